@@ -12,6 +12,7 @@
     #define CONSOLE_H
 
     #include <stdbool.h>
+    #include <stdint.h>
     #include <stdio.h>
     #include <termios.h>
 
@@ -33,12 +34,16 @@
 
     // Note: ANSI_COLOR_GRAY and ANSI_COLOR_LIGHTGRAY can sometimes be dependent on the terminal's
     // color scheme. The dark gray color (ANSI_COLOR_DARKGRAY) uses 256-color mode syntax, which
-    // might not work on all terminals.
+    // might not work on all terminals: console_color_sgr(console_color_map(242, colors), ...)
+    // from console_color.h gives the closest color the terminal has instead.
 
     // ANSI styles
     #define ANSI_ITALIC                 "\x1b[3m"
     #define ANSI_BOLD                   "\x1b[1m"
 
+    // ANSI Line codes
+    #define ANSI_ERASE_LINE             "\x1b[K" // Erase from cursor to end of line
+
     // ANSI Cursor codes
     #define ANSI_CURSOR_POS_QUERY       "\033[6n" // Query cursor position
 
@@ -71,19 +76,31 @@ enum StreamEvent {
     STREAM_EVENT_UP,
     STREAM_EVENT_DOWN,
     STREAM_EVENT_LEFT,
-    STREAM_EVENT_RIGHT
+    STREAM_EVENT_RIGHT,
+    STREAM_EVENT_ENTER,
+    STREAM_EVENT_TAB,
+    STREAM_EVENT_HOME,
+    STREAM_EVENT_END,
+    STREAM_EVENT_PAGE_UP,
+    STREAM_EVENT_PAGE_DOWN,
+    STREAM_EVENT_INSERT_KEY, // the Insert key, not an inserted character
+    STREAM_EVENT_FUNCTION    // F1..F12, number in the event's codepoint
 };
 
 enum StreamStatus {
     STREAM_STATUS_INIT,
     STREAM_STATUS_ERROR,
-    STREAM_STATUS_OK
+    STREAM_STATUS_OK,
+    STREAM_STATUS_RESTORED // the line holds restored text the next readline edits
 };
 
 // Struct to encapsulate console modes.
 struct ConsoleState {
     enum StateInput   input;   // Current input mode
     enum StateDisplay display; // Current display mode
+    bool              paste;   // Bracketed paste reporting enabled
+    bool              mouse;   // SGR mouse reporting enabled
+    size_t            preview; // Rows shown of each @path file a submitted line names
 };
 
 struct ConsoleIO {
@@ -104,8 +121,12 @@ struct ConsoleLine { // handle character stream
 };
 
 struct ConsolePage {
-    struct ConsoleLine* lines;  // all lines are buffers, not all buffers are lines
-    size_t              length; // total number of lines
+    struct ConsoleLine* lines;    // all lines are buffers, not all buffers are lines
+    size_t              size;     // number of allocated lines
+    size_t              length;   // total number of lines
+    size_t              mapped;   // the first lines point into `map`: not owned, not written
+    void*               map;      // snapshot the page was restored from, NULL for none
+    size_t              map_size;
 };
 
 struct ConsoleStream {
@@ -118,11 +139,104 @@ struct ConsoleStream {
     struct ConsolePage*   page;    // track lines as a "page" of text
 };
 
+// Kinds of edit deltas streamed to a subscriber while the user is typing.
+enum ConsoleEditKind {
+    CONSOLE_EDIT_INSERT, // `length` bytes at `data` were inserted at `offset`
+    CONSOLE_EDIT_DELETE, // `length` bytes were removed at `offset`
+    CONSOLE_EDIT_STABLE, // the first `offset` bytes have settled; may move back after edits
+    CONSOLE_EDIT_SUBMIT  // the line was submitted, the next edit starts a new line
+};
+
+struct ConsoleEdit {
+    enum ConsoleEditKind kind;
+    size_t               offset; // byte offset in the line
+    size_t               length; // bytes inserted or removed
+    const char*          data;   // inserted bytes, only valid during the callback
+};
+
+typedef void (*ConsoleEditCallback)(
+    void* context, const struct ConsoleEdit* edit, const struct ConsoleLine* line
+);
+
+// A host listening to edits of the active line, e.g. to prefill a model while typing.
+struct ConsoleSubscription {
+    ConsoleEditCallback callback; // invoked synchronously from console_readline()
+    void*               context;  // passed back to the callback
+    int                 settle;   // idle milliseconds before a prefix counts as settled
+    size_t              stable;   // length of the settled prefix announced last
+};
+
+struct Console;
+
+// A stage on the output path, e.g. the sanitizer. console_write_output() hands bytes to
+// the first stage; each passes what it makes of them on with console_sink_pass(), and
+// what the last one passes reaches the terminal.
+struct ConsoleSink {
+    void (*write)(struct Console* console, struct ConsoleSink* sink, const char* data,
+                  size_t length);
+    void (*flush)(struct Console* console, struct ConsoleSink* sink); // release held bytes
+    void*               context; // the stage's own state
+    struct ConsoleSink* next;    // following stage, NULL for the terminal
+};
+
+// Opaque output sanitizer, see console_sanitize.h
+struct ConsoleSanitizer;
+
+// Style the terminal was left with by styled output, see console_style.h
+struct ConsoleStyleTracker;
+
+// Opaque line history, see console_history.h
+struct ConsoleHistory;
+
+// Opaque frame of the input line as last drawn, see console_render.h
+struct ConsoleRenderer;
+
+// Opaque scroll region layout that pins the prompt below the output, see console_region.h
+struct ConsoleRegion;
+
+// Opaque metrics socket, see console_exporter.h
+struct ConsoleExporter;
+
+// Editing sequences the terminal understands beyond plain text and cursor moves.
+// Probed from TERM on create; a host that knows better may override any field.
+struct ConsoleCapabilities {
+    bool insert_chars;  // ICH, CSI n @
+    bool delete_chars;  // DCH, CSI n P
+    bool erase_chars;   // ECH, CSI n X
+    bool repeat_char;   // REP, CSI n b
+    bool scroll_region; // DECSTBM, CSI top ; bottom r
+    int  colors;        // 0, 16, 256 or 1 << 24, what styled output is downsampled to
+};
+
+// Input read from the terminal but not consumed yet, e.g. keys typed during output.
+struct ConsoleTypeahead {
+    unsigned char* buffer;     // ring buffer of pending input bytes
+    size_t         size;       // allocated bytes, always a power of two
+    size_t         head;       // next byte to consume
+    size_t         tail;       // next byte to fill
+    bool           eof;        // input reached end of file
+    bool           interrupt;  // interrupt key seen since the last check
+    bool           resize;     // holds the SIGWINCH handler, see console_release_events()
+    char*          paste;      // pasted text handed out by the last console_read_events()
+    size_t         paste_size; // allocated bytes for `paste`
+};
+
 struct Console {
-    struct ConsoleState*  state;    // Encapsulates console's modes
-    struct ConsoleIO*     io;       // Encapsulates console's input and output streams
-    struct ConsoleStream* stream;   //
-    struct termios*       terminal; // Terminal settings structure
+    struct ConsoleState*        state;        // Encapsulates console's modes
+    struct ConsoleIO*           io;           // Encapsulates console's input and output streams
+    struct ConsoleStream*       stream;       //
+    struct ConsoleTypeahead*    typeahead;    // Pending input captured while output streams
+    struct ConsoleHistory*      history;      // Submitted lines, source of autosuggestions
+    struct ConsoleSubscription* subscription; // Edit delta listener, NULL when unused
+    struct ConsoleRenderer*     renderer;     // Input line as it is on screen
+    struct ConsoleCapabilities* capabilities; // What the renderer may ask of the terminal
+    struct ConsoleRegion*       region;       // Pinned prompt layout, NULL when output scrolls
+    struct ConsoleSanitizer*    sanitizer;    // First output stage, keeps output from the terminal
+    struct ConsoleSink*         output;       // Output stages in order, NULL to write as is
+    struct ConsoleStyleTracker* style;        // What console_write_styled() left the terminal in
+    struct ConsoleExporter*     exporter;     // Metrics socket, NULL unless the host serves one
+    struct ConsoleExpansion*    expansion;    // @path files of the last line, NULL for none
+    struct termios*             terminal;     // Original terminal settings, restored on destroy
 };
 
 // Console memory management
@@ -136,13 +250,24 @@ ConsoleCursor* console_create_cursor(void);
 void           console_destroy_cursor(ConsoleCursor* cursor);
 
 // Line management
-ConsoleLine* console_create_line(void);
+ConsoleLine* console_create_line(size_t size); // initial buffer bytes, 0 for a default
 void         console_destroy_line(ConsoleLine* line);
 bool         console_line_append_char(ConsoleLine* line, char c);
 bool         console_line_remove_char(ConsoleLine* line, size_t index);
+bool         console_line_insert(ConsoleLine* line, size_t index, const char* data, size_t count);
+bool         console_line_remove(ConsoleLine* line, size_t index, size_t length);
+
+// UTF-8 helpers shared by the line editor and the renderer
+size_t console_utf8_length(int lead);                         // bytes in the sequence
+int    console_utf8_width(const char* text, size_t length);   // cells of one codepoint
+size_t console_utf8_columns(const char* text, size_t length); // cells of a string
+size_t console_utf8_encode(uint32_t codepoint, char* bytes);   // 1 to 4 bytes, returns count
 
+// Page management
 ConsolePage* console_create_page(void);
 void         console_destroy_page(ConsolePage* page);
+bool         console_page_append_line(ConsolePage* page, const char* text, size_t length);
+void         console_page_clear(ConsolePage* page); // drop the lines and any mapping
 
 struct termios* console_create_terminal(void);
 void            console_destroy_terminal(struct termios* terminal);
@@ -150,6 +275,12 @@ void            console_destroy_terminal(struct termios* terminal);
 ConsoleStream* console_create_stream(void);
 void           console_destroy_stream(ConsoleStream* stream);
 
+ConsoleCapabilities* console_create_capabilities(void);
+void                 console_destroy_capabilities(ConsoleCapabilities* capabilities);
+
+ConsoleTypeahead* console_create_typeahead(void);
+void              console_destroy_typeahead(ConsoleTypeahead* typeahead);
+
 Console* console_create(void);
 void     console_destroy(Console* console);
 
@@ -166,7 +297,45 @@ int   console_get_char(Console* console);
 void  console_set_line(Console* console, char* line);
 char* console_get_line(Console* console);
 
-// TODO
+// Type-ahead: drain the terminal without blocking so keys typed during output are kept
+size_t console_typeahead_drain(Console* console);
+size_t console_typeahead_pending(Console* console);
+bool   console_typeahead_interrupted(Console* console); // test and clear
+bool   console_typeahead_insert(Console* console, const char* data, size_t length); // unget
+
+// Wait up to `timeout` milliseconds (-1 blocks) for input. True if input is pending.
+bool console_poll_input(Console* console, int timeout);
+
+// Stream edit deltas of the active line to `callback`, plus a STABLE notification once
+// the line has been idle for `settle` milliseconds. The settled prefix ends at a word
+// boundary so tokenizing it stays valid as typing continues. NULL unsubscribes.
+bool console_subscribe_edits(
+    Console* console, ConsoleEditCallback callback, void* context, int settle
+);
+
+// Write model output through the output stages, sanitized by default
+void console_write_output(Console* console, const char* data, size_t length);
+
+// End of a response: stages release what they held back waiting for more
+void console_flush_output(Console* console);
+
+// Append `stage` to the output path, or take it off again. Not while output is written.
+void console_add_output_stage(Console* console, ConsoleSink* stage);
+void console_remove_output_stage(Console* console, ConsoleSink* stage);
+
+// For stages: hand bytes, or a flush, to the stage after `sink`
+void console_sink_pass(Console* console, ConsoleSink* sink, const char* data, size_t length);
+void console_sink_flush(Console* console, ConsoleSink* sink);
+
+// Write to the terminal as is, draining type-ahead between chunks so input is never
+// dropped; the end of the output path
+void console_write_terminal(Console* console, const char* data, size_t length);
+
+// Read and echo one line into `console->stream->line`, consuming type-ahead first.
+// Input is applied in batches and the line is redrawn once per batch, so key repeat and
+// pastes cost one frame rather than one write per key. The most recent history entry
+// extending the line is shown as ghost text after the cursor and accepted with Right or
+// End; Up and Down browse the history. Returns false at end of file (or Ctrl+D).
 bool console_readline(Console* console, int line_number);
 
 #endif // CONSOLE_H
@@ -0,0 +1,43 @@
+/**
+ * @file console_color.h
+ *
+ * @brief Colors as values: indexed or 24-bit, mapped to what the terminal shows through
+ * precomputed nearest-color tables, and rendered to SGR bytes once per color.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_COLOR_H
+    #define CONSOLE_COLOR_H
+
+    #include <console.h>
+
+    // Colors: the terminal's default, an indexed color 0-255 (0-15 are the ANSI colors,
+    // 8 is gray), or a 24-bit color
+    #define CONSOLE_COLOR_DEFAULT       (-1)
+    #define CONSOLE_COLOR_RGB(r, g, b) \
+        (0x1000000 | ((int) (r) & 0xFF) << 16 | ((int) (g) & 0xFF) << 8 | ((int) (b) & 0xFF))
+    #define CONSOLE_COLOR_IS_RGB(color) ((color) > 0 && 0 != ((color) & 0x1000000))
+
+    // ConsoleCapabilities::colors of a terminal that takes CONSOLE_COLOR_RGB() as it is
+    #define CONSOLE_COLORS_TRUE         0x1000000
+
+    // Longest SGR sequence for one color, ESC [ 48;2;255;255;255 m
+    #define CONSOLE_COLOR_SGR_MAX       20
+
+// Palette entry `index` (0-255) as xterm draws it, as CONSOLE_COLOR_RGB()
+int console_color_palette(int index);
+
+// The color closest to `color` that a terminal with `colors` colors (0, 16, 256 or
+// CONSOLE_COLORS_TRUE) shows: itself if it has it, CONSOLE_COLOR_DEFAULT without color.
+// 24-bit colors are looked up in tables over a 32x32x32 grid, built once on first use,
+// rather than searched for.
+int console_color_map(int color, int colors);
+
+// The SGR sequence that selects `color` as the foreground, or background, e.g.
+// "\x1b[38;5;242m". Rendered once per color: indexed colors are kept in a table, 24-bit
+// ones in a small cache per thread. Valid until the thread renders another 24-bit color.
+const char* console_color_sgr(int color, bool background, size_t* length);
+
+#endif // CONSOLE_COLOR_H
@@ -0,0 +1,71 @@
+/**
+ * @file console_event.h
+ *
+ * @brief Batch decoding of terminal input into typed events.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_EVENT_H
+    #define CONSOLE_EVENT_H
+
+    #include <console.h>
+    #include <stdint.h>
+
+    // Modifier bits, matching the xterm encoding of `1 + bits` in CSI parameters
+    #define CONSOLE_MOD_SHIFT 0x1
+    #define CONSOLE_MOD_ALT   0x2
+    #define CONSOLE_MOD_CTRL  0x4
+
+enum ConsoleEventType {
+    CONSOLE_EVENT_CODEPOINT, // a character; Ctrl/Alt chords set `modifiers`
+    CONSOLE_EVENT_KEY,       // a named key in `key`
+    CONSOLE_EVENT_PASTE,     // bracketed paste in `data`/`length`
+    CONSOLE_EVENT_MOUSE,     // SGR mouse report
+    CONSOLE_EVENT_POSITION,  // cursor position report (answer to ANSI_CURSOR_POS_QUERY)
+    CONSOLE_EVENT_RESIZE,    // terminal size changed, new size in `x` (columns) and `y` (rows)
+    CONSOLE_EVENT_SIGNAL,    // interrupt key or signal number in `signal`
+    CONSOLE_EVENT_EOF        // input reached end of file
+};
+
+struct ConsoleEvent {
+    enum ConsoleEventType type;
+    enum StreamEvent      key;       // KEY: which key
+    unsigned              modifiers; // CONSOLE_MOD_* bits
+    uint32_t              codepoint; // CODEPOINT: the character; KEY: F-key number
+    const char*           data;      // PASTE: pasted bytes, valid until the next batch read
+    size_t                length;    // PASTE: number of pasted bytes
+    int                   x;         // MOUSE, POSITION: 1-based column; RESIZE: columns
+    int                   y;         // MOUSE, POSITION: 1-based row; RESIZE: rows
+    int                   button;    // MOUSE: button number, 64+ for the wheel
+    bool                  pressed;   // MOUSE: press (true) or release (false)
+    int                   signal;    // SIGNAL: e.g. SIGINT
+    size_t                source;    // where the event starts in the type-ahead, for unread
+};
+
+// Fill up to `max` events from input that is already buffered or readable, without
+// blocking. Incomplete sequences stay buffered for the next call. A lone ESC at the end
+// of what the terminal delivered is reported as the Escape key. Returns the count.
+// Wait for more input on the descriptor, not console_poll_input(), when a call returns
+// fewer events than there are pending bytes.
+size_t console_read_events(Console* console, ConsoleEvent* events, size_t max);
+
+// Return `event` and every event after it in the last batch to the type-ahead, so the
+// next read decodes them again, e.g. keys that arrived after the line was submitted.
+// Only valid while nothing else has read input since that batch.
+void console_unread_events(Console* console, const ConsoleEvent* event);
+
+// Ask the terminal where the cursor is (1-based) and wait up to `timeout` milliseconds
+// for the answer. Keys typed in the meantime stay queued ahead of the report.
+bool console_query_position(Console* console, int timeout, int* row, int* col);
+
+// Give up what console_read_events() holds for the console. SIGWINCH is watched while any
+// console reads events; the handler that was there before is put back after the last one.
+// console_destroy() calls this.
+void console_release_events(Console* console);
+
+// Ask the terminal to bracket pastes and/or report mouse events (SGR encoding).
+void console_set_input_reporting(Console* console, bool paste, bool mouse);
+
+#endif // CONSOLE_EVENT_H
@@ -0,0 +1,65 @@
+/**
+ * @file console_expand.h
+ *
+ * @brief Expands `@path` file references in a submitted line into a scatter-gather
+ * list of inline text and memory-mapped file regions.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_EXPAND_H
+    #define CONSOLE_EXPAND_H
+
+    #include <console.h>
+    #include <stddef.h>
+
+    // Marker introducing a file reference, e.g. `@src/main.cpp` or `@"my notes.txt"`
+    #define CONSOLE_REFERENCE_MARKER '@'
+
+// A file referenced from the line, mapped read-only for the lifetime of the expansion.
+struct ConsoleMapping {
+    char*  path; // path as written after the marker (NUL-terminated copy)
+    char*  data; // read-only mapping of the file, NULL for empty files
+    size_t size; // size of the mapping in bytes
+};
+
+// A piece of the expanded line: inline text or a region of a mapped file.
+struct ConsoleSegment {
+    const char*            data;    // start of the piece, never copied
+    size_t                 length;  // number of bytes in the piece
+    struct ConsoleMapping* mapping; // owning mapping, or NULL for inline text
+};
+
+struct ConsoleExpansion {
+    struct ConsoleSegment* segments; // pieces in line order
+    size_t                 length;   // number of pieces
+    struct ConsoleMapping* mappings; // one entry per referenced file
+    size_t                 count;    // number of mapped files
+};
+
+// Split the line into segments, mapping every `@path` that names a readable regular file.
+// Inline segments point into `line->buffer`, so the line must outlive the expansion.
+// References that do not resolve to a file are kept as inline text. console_readline()
+// expands every submitted line that names a file into console->expansion, valid until
+// the next call.
+ConsoleExpansion* console_expand_line(const ConsoleLine* line);
+void              console_destroy_expansion(ConsoleExpansion* expansion);
+
+// Total number of bytes the host receives when gathering every segment in order.
+size_t console_expansion_size(const ConsoleExpansion* expansion);
+
+// Number of leading bytes of the mapping that fit in `rows` lines of `columns` bytes.
+// Only the pages holding that head are touched, so previews of huge files stay cheap.
+size_t console_mapping_preview(const ConsoleMapping* mapping, size_t rows, size_t columns);
+
+// Show each referenced file with its size and a `rows`-line preview of its head. The
+// preview goes to the terminal like output, inside the pinned region if there is one, with
+// the file's control bytes and escape sequences shown in `cat -v` notation, never obeyed.
+void console_show_expansion(Console* console, const ConsoleExpansion* expansion, size_t rows);
+
+// Have console_readline() show `rows` rows of each file a submitted line names, see
+// console_show_expansion(). 0, the default, shows nothing; the files are mapped either way.
+void console_set_expand_preview(Console* console, size_t rows);
+
+#endif // CONSOLE_EXPAND_H
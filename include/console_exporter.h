@@ -0,0 +1,39 @@
+/**
+ * @file console_exporter.h
+ *
+ * @brief Metrics endpoint: the counters and histograms of console_metrics.h served in the
+ * Prometheus text format on a local Unix socket, from the console's own input loop.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_EXPORTER_H
+    #define CONSOLE_EXPORTER_H
+
+    #include <console.h>
+    #include <poll.h>
+
+    // Scrapes served at once; further connections are closed unanswered
+    #define CONSOLE_EXPORTER_CLIENTS 4
+
+    // Bytes of a request read before answering it anyway
+    #define CONSOLE_EXPORTER_REQUEST 4096
+
+// Serve the metrics on a Unix socket at `path`, readable by the owner only, replacing a
+// socket left there before. Each connection gets one HTTP/1.0 response with the
+// snapshot as of its request, so `curl --unix-socket path http://localhost/metrics`
+// and a Prometheus behind a socket proxy both scrape it. Timers are histograms in
+// seconds; their `_count` over time is e.g. the flush rate. There is no thread: the
+// socket is served while console_readline(), console_get_char(), console_poll_input()
+// and the pager wait for input; a scrape arriving while they are busy waits its turn in
+// the socket's backlog. NULL stops serving.
+// Returns false when the socket cannot be made, or instrumentation is compiled out and
+// there is nothing to serve.
+bool console_export_metrics(Console* console, const char* path);
+
+// Used by the input loops: poll(2) on the terminal input alone, as `poll(input, 1,
+// timeout)`, serving the metrics socket in the meantime when there is one.
+int console_exporter_poll(Console* console, struct pollfd* input, int timeout);
+
+#endif // CONSOLE_EXPORTER_H
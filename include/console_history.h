@@ -0,0 +1,80 @@
+/**
+ * @file console_history.h
+ *
+ * @brief Line history with an incremental prefix index for inline autosuggestions.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_HISTORY_H
+    #define CONSOLE_HISTORY_H
+
+    #include <stdbool.h>
+    #include <stddef.h>
+
+    // Depth of the prefix trie. Prefixes up to this many bytes resolve to the most
+    // recent matching entry in O(length); longer ones verify a bucket of candidates that
+    // share more than half of the prefix, found by hash.
+    #define CONSOLE_HISTORY_INDEX_DEPTH 32
+
+    // Bytes of the most recent chunk of a history file, indexed first when it is loaded.
+    // Chunks further back double in size, up to a share of the pool's threads.
+    #define CONSOLE_HISTORY_CHUNK       (1 << 20)
+
+// What an entry that repeats an earlier one does when it is appended
+enum ConsoleHistoryDuplicates {
+    CONSOLE_HISTORY_KEEP_DUPLICATES,    // is added like any other, the default
+    CONSOLE_HISTORY_IGNORE_CONSECUTIVE, // is dropped when it repeats the newest entry
+    CONSOLE_HISTORY_IGNORE_ALL,         // is dropped when it repeats any entry
+    CONSOLE_HISTORY_MOVE_TO_FRONT       // is added, and the earlier copy removed
+};
+
+// Opaque: entries plus the prefix index built incrementally on every append.
+struct ConsoleHistory;
+
+ConsoleHistory* console_create_history(void);
+void            console_destroy_history(ConsoleHistory* history);
+
+// Read entries from `path` (one per line, `\n` and `\\` escaped) and append new entries
+// to the same file from now on. Returns false if the file exists but cannot be read.
+// The file is mapped and split into chunks that are parsed and indexed in parallel on
+// the shared pool, so this returns at once whatever the file's size. The chunks join
+// the history from the most recent back as console_history_update() finds them done.
+// Chunks the pool has no room for are submitted again by console_history_update().
+bool console_history_load(ConsoleHistory* history, const char* path);
+
+// Take in what a load or a compaction has finished since the last call. Until then the
+// history, its length and its positions stay as they were, so call this where a
+// position shifting is harmless, e.g. while not browsing. Returns true once nothing is
+// left in progress.
+bool console_history_update(ConsoleHistory* history);
+
+// Add an entry as the most recent one and index it. Returns false when it is empty or
+// dropped as a duplicate.
+bool console_history_append(ConsoleHistory* history, const char* entry, size_t length);
+
+// Duplicates are found through a 64-bit hash of every entry, in O(1) whatever the
+// history's size. The policy applies to appends from now on; console_history_compact()
+// applies it to the entries already there.
+void console_history_set_duplicates(
+    ConsoleHistory* history, enum ConsoleHistoryDuplicates duplicates
+);
+
+// Rewrite the history without its duplicates, by the current policy, and without the
+// entries removed since the last time, on the shared pool. The result is swapped in by
+// console_history_update(): the history file is replaced by a rename, so it is always
+// whole, and positions are renumbered. Returns false while a load or another compaction
+// is in progress.
+bool console_history_compact(ConsoleHistory* history);
+
+// Positions run over removed entries until a compaction; for them the entry is NULL
+size_t      console_history_length(const ConsoleHistory* history);
+const char* console_history_entry(const ConsoleHistory* history, size_t index, size_t* length);
+
+// Most recent entry starting with `prefix`. Returns false when there is none.
+bool console_history_suggest(
+    const ConsoleHistory* history, const char* prefix, size_t length, size_t* index
+);
+
+#endif // CONSOLE_HISTORY_H
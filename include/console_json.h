@@ -0,0 +1,46 @@
+/**
+ * @file console_json.h
+ *
+ * @brief Output stage that validates JSON as it streams and shows it indented and
+ * colored, reporting where the document completes or first goes wrong.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_JSON_H
+    #define CONSOLE_JSON_H
+
+    #include <console.h>
+
+    // Deeper nesting is reported as invalid rather than grown without bound
+    #define CONSOLE_JSON_DEPTH_MAX 1024
+
+enum ConsoleJsonStatus {
+    CONSOLE_JSON_PENDING,  // well-formed so far, not complete
+    CONSOLE_JSON_COMPLETE, // a whole value has been read
+    CONSOLE_JSON_INVALID   // cannot become valid any more
+};
+
+// Opaque tokenizer state: one byte per open object or array, plus the token in progress
+struct ConsoleJson;
+
+// Indent nested values by `indent` spaces, or keep the document on one line when 0
+ConsoleJson* console_create_json(size_t indent);
+void         console_destroy_json(ConsoleJson* json);
+
+// Start over with the next document, e.g. the next response
+void console_reset_json(ConsoleJson* json);
+
+// Where the document stands. For COMPLETE `offset` is set to the byte offset just past
+// its end, for INVALID to the offset of the first byte that cannot be part of it; both
+// count the bytes the stage was given since it was created or reset. A host may stop
+// generation as soon as either is reported.
+enum ConsoleJsonStatus console_json_status(const ConsoleJson* json, size_t* offset);
+
+// The printer as an output stage, see console_add_output_stage(). Whitespace between
+// tokens is replaced by its own layout; from an invalid byte on, and after the
+// document, text is passed on as it is. A flush completes a number at the top level.
+ConsoleSink* console_json_sink(ConsoleJson* json);
+
+#endif // CONSOLE_JSON_H
@@ -0,0 +1,37 @@
+/**
+ * @file console_layout.h
+ *
+ * @brief Cursor accounting for output: where the terminal leaves the cursor after a
+ * chunk, without asking it. Printable ASCII runs are found with SIMD and cost no more
+ * than their length; only other characters are decoded and looked up.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_LAYOUT_H
+    #define CONSOLE_LAYOUT_H
+
+    #include <console.h>
+
+// The cursor as output moves it on a terminal `columns` wide
+struct ConsoleLayout {
+    size_t columns; // terminal width
+    size_t col;     // 0-based, `columns` while a wrap is pending
+    size_t rows;    // rows moved down so far, by newlines and wraps
+};
+
+// Number of printable ASCII bytes at the start of `data`
+size_t console_ascii_span(const char* data, size_t length);
+
+// Length of the escape sequence that starts at `data`: CSI, OSC up to BEL or ST, or ESC
+// with intermediates and a final byte. 0 if it is cut off at `length`.
+size_t console_sequence_length(const char* data, size_t length);
+
+// Move `layout` over terminal output the way the terminal moves its cursor: printable
+// ASCII advances by its length, other characters by their width, escape sequences not
+// at all. Returns how many bytes are complete; a sequence or character cut off at the
+// end is left for the next call.
+size_t console_layout_advance(ConsoleLayout* layout, const char* data, size_t length);
+
+#endif // CONSOLE_LAYOUT_H
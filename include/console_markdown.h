@@ -0,0 +1,29 @@
+/**
+ * @file console_markdown.h
+ *
+ * @brief Output stage that renders Markdown as it streams: headings, emphasis, inline
+ * code, lists, quotes and fenced code blocks with keyword highlighting.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_MARKDOWN_H
+    #define CONSOLE_MARKDOWN_H
+
+    #include <console.h>
+
+// Opaque parser state: the open block, inline styles and fence, carried across writes.
+// Text is styled once as it passes; only a span that the next bytes decide is held back,
+// e.g. the start of a line that may turn out to be a list item, or a `**` cut off at the
+// end of a write.
+struct ConsoleMarkdown;
+
+ConsoleMarkdown* console_create_markdown(void);
+void             console_destroy_markdown(ConsoleMarkdown* markdown);
+
+// The renderer as an output stage, see console_add_output_stage(). It expects sanitized
+// text and belongs after the sanitizer; a flush ends open blocks and resets the style.
+ConsoleSink* console_markdown_sink(ConsoleMarkdown* markdown);
+
+#endif // CONSOLE_MARKDOWN_H
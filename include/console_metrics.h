@@ -0,0 +1,88 @@
+/**
+ * @file console_metrics.h
+ *
+ * @brief Hot-path instrumentation: scoped timers, counters and value histograms.
+ *
+ * Configure with -DCONSOLE_INSTRUMENT=ON to compile the macros in. Without it every
+ * macro expands to nothing and the snapshot reports no data.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_METRICS_H
+    #define CONSOLE_METRICS_H
+
+    #include <stdbool.h>
+    #include <stdint.h>
+
+    #define CONSOLE_METRIC_BUCKETS 40 // log2 buckets, bucket i holds values < 2^i
+
+// Every instrumented site records into one of these slots.
+enum ConsoleMetric {
+    CONSOLE_METRIC_DECODE,       // timer: decoding a key (UTF-8 tail, escape sequence)
+    CONSOLE_METRIC_PROCESS,      // timer: applying a key to the line
+    CONSOLE_METRIC_LAYOUT,       // timer: display width and fitting computations
+    CONSOLE_METRIC_RENDER,       // timer: producing echo and redraw bytes
+    CONSOLE_METRIC_FLUSH,        // timer: flushing buffered bytes to the terminal
+    CONSOLE_METRIC_INPUT_BYTES,  // counter: bytes drained from the terminal
+    CONSOLE_METRIC_OUTPUT_BYTES, // counter: model output bytes written
+    CONSOLE_METRIC_ECHO,         // timer: a batch of keys read until its echo is flushed
+    CONSOLE_METRIC_PROBES,       // counter: cursor position queries sent to the terminal
+    CONSOLE_METRIC_FRAME_BYTES,  // histogram: bytes drawn per input line frame
+    CONSOLE_METRIC_BACKLOG,      // histogram: bytes the terminal had not sent yet, per flush
+    CONSOLE_METRIC_COUNT
+};
+
+// Aggregated over all threads. Timers are in nanoseconds.
+struct ConsoleMetricValue {
+    uint64_t count;                           // number of samples
+    uint64_t sum;                             // sum of sampled values
+    uint64_t buckets[CONSOLE_METRIC_BUCKETS]; // histogram, empty for counters
+};
+
+const char* console_metric_name(ConsoleMetric metric);
+
+// Fill `values[CONSOLE_METRIC_COUNT]` with the totals so far. Readers never block the
+// recording threads. Returns false when instrumentation is compiled out.
+bool console_metrics_snapshot(ConsoleMetricValue* values);
+
+    #ifdef CONSOLE_INSTRUMENT
+
+uint64_t console_metrics_clock(void);     // CLOCK_MONOTONIC_RAW in nanoseconds
+uint64_t console_metrics_backlog(int fd); // bytes queued on a tty, TIOCOUTQ, 0 if unknown
+void     console_metrics_count(ConsoleMetric metric, uint64_t value);
+void     console_metrics_record(ConsoleMetric metric, uint64_t value);
+
+// Records the lifetime of the enclosing scope into a metric's histogram.
+class ConsoleScopedTimer {
+  public:
+    explicit ConsoleScopedTimer(ConsoleMetric metric)
+        : metric(metric), start(console_metrics_clock()) {}
+
+    ~ConsoleScopedTimer() {
+        console_metrics_record(metric, console_metrics_clock() - start);
+    }
+
+  private:
+    ConsoleMetric metric;
+    uint64_t      start;
+};
+
+        #define CONSOLE_METRIC_CONCAT_(a, b) a##b
+        #define CONSOLE_METRIC_CONCAT(a, b)  CONSOLE_METRIC_CONCAT_(a, b)
+
+        #define CONSOLE_TIMER(metric) \
+            ConsoleScopedTimer CONSOLE_METRIC_CONCAT(console_timer_, __LINE__)(metric)
+        #define CONSOLE_COUNT(metric, value)     console_metrics_count(metric, value)
+        #define CONSOLE_HISTOGRAM(metric, value) console_metrics_record(metric, value)
+
+    #else
+
+        #define CONSOLE_TIMER(metric)            ((void) 0)
+        #define CONSOLE_COUNT(metric, value)     ((void) 0)
+        #define CONSOLE_HISTOGRAM(metric, value) ((void) 0)
+
+    #endif // CONSOLE_INSTRUMENT
+
+#endif // CONSOLE_METRICS_H
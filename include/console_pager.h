@@ -0,0 +1,58 @@
+/**
+ * @file console_pager.h
+ *
+ * @brief A pager on the alternate screen for long output and transcripts: lines come
+ * straight from a page or a mapped file, counted in the background as it is paged.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_PAGER_H
+    #define CONSOLE_PAGER_H
+
+    #include <console.h>
+
+    // Bytes of a file counted at a time; a line number lookup scans at most one block
+    #define CONSOLE_PAGER_BLOCK   (1 << 16)
+
+    // Lines whose column index is kept between redraws, by where they are in what is paged
+    #define CONSOLE_PAGER_INDEXES 64
+
+// Opaque pager: what is paged, its line index and where the view is
+struct ConsolePager;
+
+// Page through the lines of `page`, e.g. the console's own or one filled by a capture.
+// The page must not change while the pager shows it.
+ConsolePager* console_create_page_pager(const ConsolePage* page);
+
+// Page through the file at `path`, e.g. a transcript. It is mapped, not read: opening
+// is instant whatever its size, and so are jumps to its end or to a percentage. Lines
+// are counted from the first console_run_pager() on, in the background.
+ConsolePager* console_create_file_pager(const char* path);
+
+void console_destroy_pager(ConsolePager* pager);
+
+// Lines counted so far; `complete` is cleared while the count is still running
+size_t console_pager_lines(ConsolePager* pager, bool* complete);
+
+// Show the pager until the user quits with q, then restore the screen. Lines that do
+// not fit scroll sideways rather than wrap. Keys follow less: j/k or Up/Down, Space/b or
+// Page Down/Up, d/u, g/G or Home/End, Left/Right, N g for line N and N % for a percent,
+// / for a regular expression search (see console_search.h) and n for the next match.
+// Returns false when the terminal could not be written.
+bool console_run_pager(Console* console, ConsolePager* pager);
+
+// Opaque copy of output as it passes, kept in a page
+struct ConsoleCapture;
+
+// Keep the text written through the stage in `page`, one page line per line, without
+// escape sequences or carriage returns. A flush ends the line in progress.
+ConsoleCapture* console_create_capture(ConsolePage* page);
+void            console_destroy_capture(ConsoleCapture* capture);
+
+// The capture as an output stage, see console_add_output_stage(). It passes everything
+// on unchanged.
+ConsoleSink* console_capture_sink(ConsoleCapture* capture);
+
+#endif // CONSOLE_PAGER_H
@@ -0,0 +1,88 @@
+/**
+ * @file console_pool.h
+ *
+ * @brief The worker pool background work of the console runs on: a few threads with
+ * bounded per-thread queues, which idle threads steal from, taken most urgent first.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_POOL_H
+    #define CONSOLE_POOL_H
+
+    #include <console.h>
+
+    // Threads the shared pool runs at most, unless set otherwise
+    #define CONSOLE_POOL_THREADS     4
+    #define CONSOLE_POOL_THREADS_MAX 32
+
+    // Tasks each thread's queue holds; past that, submitting fails rather than grows
+    #define CONSOLE_POOL_QUEUE       256
+
+// Most urgent first: interactive work, e.g. a search the user waits on, then the rest,
+// then what can wait for an idle moment
+enum ConsolePriority {
+    CONSOLE_PRIORITY_INTERACTIVE,
+    CONSOLE_PRIORITY_NORMAL,
+    CONSOLE_PRIORITY_IDLE,
+    CONSOLE_PRIORITIES
+};
+
+typedef void (*ConsoleTask)(void* context);
+
+// A host's own executor, e.g. its thread pool or event loop. `submit` must run every task
+// it accepts, on some thread other than the caller's, and return false for one it will
+// not run.
+struct ConsoleExecutor {
+    bool (*submit)(void* executor, ConsoleTask task, void* context, enum ConsolePriority priority);
+    void* executor;
+};
+
+// Opaque pool and its threads
+struct ConsolePool;
+
+// A pool of up to `threads` threads, started as work arrives. Destroying it runs the
+// tasks still queued, then joins the threads.
+ConsolePool* console_create_pool(size_t threads);
+void         console_destroy_pool(ConsolePool* pool);
+
+// The pool the console library submits to, created on first use with at most
+// CONSOLE_POOL_THREADS threads, fewer on machines with fewer cores. It lasts as long as
+// the process. NULL when it could not be created.
+ConsolePool* console_shared_pool(void);
+
+// Run `task(context)` on a pool thread. Returns false, and the task never runs, when the
+// queues are full, no thread could be started or `pool` is NULL; the caller may try
+// again later but must not run the task on the input thread instead.
+bool console_pool_submit(
+    ConsolePool* pool, ConsoleTask task, void* context, enum ConsolePriority priority
+);
+
+// Allow up to `threads` threads, 1 to CONSOLE_POOL_THREADS_MAX. Threads above the cap
+// leave once their task is done; their queued tasks are taken by the others.
+void console_pool_set_threads(ConsolePool* pool, size_t threads);
+
+// Send tasks to `executor` instead of the pool's threads, or to the threads again when
+// NULL. The executor is copied.
+void console_pool_set_executor(ConsolePool* pool, const ConsoleExecutor* executor);
+
+// Opaque count of submitted tasks that have not finished, to wait for them
+struct ConsoleTaskGroup;
+
+ConsoleTaskGroup* console_create_task_group(void);
+
+// Waits for the group's tasks first
+void console_destroy_task_group(ConsoleTaskGroup* group);
+
+// console_pool_submit(), counted in `group` until the task returns
+bool console_group_submit(
+    ConsoleTaskGroup* group, ConsolePool* pool, ConsoleTask task, void* context,
+    enum ConsolePriority priority
+);
+
+// Wait until every task submitted with `group` has returned. Not from a task of the same
+// pool: with every thread waiting, nothing would run the tasks.
+void console_group_wait(ConsoleTaskGroup* group);
+
+#endif // CONSOLE_POOL_H
@@ -0,0 +1,54 @@
+/**
+ * @file console_region.h
+ *
+ * @brief Pinned prompt: output scrolls inside a scroll region (DECSTBM) while the input
+ * line, and optionally a status line, stay put on the rows below it.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_REGION_H
+    #define CONSOLE_REGION_H
+
+    #include <console.h>
+
+// Keep `rows` rows for the input line, plus the last row for a status line, below a
+// scroll region that receives console_write_output(). The cursor is left on the input
+// row. Returns false, changing nothing, when the terminal has no scroll regions or is
+// too small; output then scrolls past the prompt as before.
+// While pinned, console_write_output() may run on another thread than console_readline()
+// and leaves reading input to it while it runs. Otherwise it drains keys typed during
+// output into the type-ahead, as it does unpinned, so a host that reads input on another
+// thread by other means than console_readline() must not write output meanwhile.
+bool console_pin_prompt(Console* console, size_t rows, bool status);
+
+// Give the whole screen back to output, continuing below what it already shows.
+// Not while console_readline() runs.
+void console_unpin_prompt(Console* console);
+
+// Show `text` on the status line. Ignored unless pinned with a status line.
+void console_set_status(Console* console, const char* text, size_t length);
+
+// Used by console_readline(): while it runs, writes leave the input to it
+void console_region_reading(Console* console, bool reading);
+
+// Used by console_write_output(): write into the scroll region, put the cursor back.
+// Returns false, writing nothing, when the prompt is not pinned; it may be unpinned
+// meanwhile from the input thread.
+bool console_region_write(Console* console, const char* data, size_t length);
+
+// Used by the renderer while pinned:
+// the screen row (0-based) the input starts on
+size_t console_region_input_row(Console* console);
+// make sure the input has `rows` rows, shrinking the region as needed; returns how many
+// rows the input moved up
+size_t console_region_grow(Console* console, size_t rows);
+// after a line: clear the input rows, go back to the reserved height, cursor at the start
+void console_region_reset(Console* console);
+// the terminal changed size: lay the region out again and clear the input rows
+void console_region_resize(Console* console);
+// the bytes that redraw the status line and return the cursor, empty without one
+const char* console_region_status(Console* console, size_t* length);
+
+#endif // CONSOLE_REGION_H
@@ -0,0 +1,49 @@
+/**
+ * @file console_render.h
+ *
+ * @brief Differential rendering of the input line. Each frame is laid out once and only
+ * the cells that changed since the previous frame are written, in a single write.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_RENDER_H
+    #define CONSOLE_RENDER_H
+
+    #include <console.h>
+
+ConsoleRenderer* console_create_renderer(void);
+void             console_destroy_renderer(ConsoleRenderer* renderer);
+
+// Start an empty frame at the terminal cursor. The cursor column is probed so wrapped
+// rows are laid out where the terminal puts them; a terminal that does not answer is
+// assumed to start at column 0 from then on.
+void console_render_begin(Console* console);
+
+// Bring the screen from the previous frame to `text` with the cursor before byte `point`.
+// When the cursor is at the end, `ghost` follows it dimmed, clipped to the cursor row.
+void console_render_frame(
+    Console* console, const char* text, size_t length, size_t point, const char* ghost,
+    size_t ghost_length
+);
+
+// The terminal is now `columns` wide: clear the frame so the next one is drawn in full.
+void console_render_resize(Console* console, size_t columns);
+
+// Show each row of the input as a window that scrolls sideways with the cursor, marked
+// where the row goes on past either edge, instead of wrapping it. A frame then costs the
+// rows on screen rather than the whole input, which matters for pasted single-line blobs
+// of hundreds of KB. Takes effect with the next frame.
+void console_render_nowrap(Console* console, bool nowrap);
+
+// The input changed from byte `offset` on since the last frame. No-wrap frames index the
+// input again only from the first such byte, so whoever edits it between frames must say
+// where; console_render_begin() starts a new input from 0.
+void console_render_edited(Console* console, size_t offset);
+
+// Draw the console's line in full, without ghost text and unwrapped windows, then leave
+// the cursor at the start of the row below it and forget the frame.
+void console_render_end(Console* console);
+
+#endif // CONSOLE_RENDER_H
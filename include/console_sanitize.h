@@ -0,0 +1,54 @@
+/**
+ * @file console_sanitize.h
+ *
+ * @brief Output stage that keeps untrusted text from driving the terminal: C0 and C1
+ * controls, DEL and escape sequences are dropped or shown as text, except for an
+ * allowlist such as SGR.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_SANITIZE_H
+    #define CONSOLE_SANITIZE_H
+
+    #include <console.h>
+
+    // Sequences that may reach the terminal as they are
+    #define CONSOLE_ALLOW_SGR      0x1 // colors and text attributes, CSI ... m
+
+    // Bytes console_sanitize() may write beyond twice its input, for a held sequence
+    #define CONSOLE_SANITIZE_SLACK 160
+
+enum ConsoleSanitizeMode {
+    CONSOLE_SANITIZE_PASS,  // everything goes through as is
+    CONSOLE_SANITIZE_STRIP, // what is not allowed is dropped, sequences as a whole
+    CONSOLE_SANITIZE_ESCAPE // what is not allowed is shown in `cat -v` notation, e.g. ^[[2J
+};
+
+// Opaque scanner state, carried across writes so split sequences are still recognized
+struct ConsoleSanitizer;
+
+ConsoleSanitizer* console_create_sanitizer(enum ConsoleSanitizeMode mode, unsigned allow);
+void              console_destroy_sanitizer(ConsoleSanitizer* sanitizer);
+
+// Change the policy; a sequence in progress is finished under the new one.
+void console_set_sanitizer(
+    ConsoleSanitizer* sanitizer, enum ConsoleSanitizeMode mode, unsigned allow
+);
+
+// Sanitize `data` into `out`, which holds at least 2 * length + CONSOLE_SANITIZE_SLACK
+// bytes. Newlines and tabs always pass. A sequence still open at the end is held back
+// until the next call decides it. Returns the bytes written.
+size_t console_sanitize(
+    ConsoleSanitizer* sanitizer, const char* data, size_t length, char* out
+);
+
+// End of the stream: dispose of a held sequence under the policy. `out` holds at least
+// CONSOLE_SANITIZE_SLACK bytes. Returns the bytes written.
+size_t console_sanitize_finish(ConsoleSanitizer* sanitizer, char* out);
+
+// The sanitizer as an output stage, see console_add_output_stage().
+ConsoleSink* console_sanitizer_sink(ConsoleSanitizer* sanitizer);
+
+#endif // CONSOLE_SANITIZE_H
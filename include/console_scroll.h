@@ -0,0 +1,79 @@
+/**
+ * @file console_scroll.h
+ *
+ * @brief No-wrap display of long lines: a sparse index from columns to bytes, and the
+ * window of a line that shows from a horizontal offset, marked where the line goes on.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_SCROLL_H
+    #define CONSOLE_SCROLL_H
+
+    #include <console.h>
+
+    // Columns between checkpoints; a lookup decodes at most this many
+    #define CONSOLE_SCROLL_STRIDE 128
+
+    // Drawn in the first or last column of a window where the line goes on past it
+    #define CONSOLE_SCROLL_LEFT   '<'
+    #define CONSOLE_SCROLL_RIGHT  '>'
+
+// Opaque checkpoints: where each line starts, and the byte and column of the first
+// character at or after every CONSOLE_SCROLL_STRIDE-th column of it
+struct ConsoleColumnIndex;
+
+ConsoleColumnIndex* console_create_column_index(void);
+void                console_destroy_column_index(ConsoleColumnIndex* index);
+
+// Index `text`, which is what was indexed before up to byte `from`: 0 for new text, the
+// old length after an append, the first changed byte after an edit. The text from the
+// checkpoint before `from` on is read again as lookups reach it, so the lookups below
+// must be given the same text until the next update.
+void console_column_index_update(
+    ConsoleColumnIndex* index, const char* text, size_t length, size_t from
+);
+
+// Column within its line of the character at byte `offset`
+size_t console_column_index_column(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t offset
+);
+
+// Byte offset where the line holding byte `offset` starts
+size_t console_column_index_line(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t offset
+);
+
+// Where the line after the one holding byte `offset` starts. False on the last line.
+bool console_column_index_next_line(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t offset,
+    size_t* next
+);
+
+// Byte offset of the character that covers `column` of the line starting at byte `line`,
+// with `found` set to the column it starts in. Past the end of the line that is the end,
+// a newline or `length`, and `found` is the width of the line.
+size_t console_column_index_find(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t line,
+    size_t column, size_t* found
+);
+
+// Part of a line shown by a window: `text` bytes [start, end), after `lead` bytes of
+// marker and padding
+struct ConsoleWindow {
+    size_t start;
+    size_t end;
+    size_t lead;
+};
+
+// Append to `out` what shows columns [column, column + width) of the line starting at
+// byte `line`: CONSOLE_SCROLL_LEFT in the first column when it is not the line's first,
+// CONSOLE_SCROLL_RIGHT in the last when the line goes on past it, and spaces for parts
+// of wide characters cut by either. It never takes more than `width` columns.
+bool console_column_window(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t line,
+    size_t column, size_t width, ConsoleLine* out, ConsoleWindow* window
+);
+
+#endif // CONSOLE_SCROLL_H
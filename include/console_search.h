@@ -0,0 +1,70 @@
+/**
+ * @file console_search.h
+ *
+ * @brief Regular expression search over pages and transcripts: POSIX extended syntax,
+ * matched by lazily built DFAs after a literal prefilter, in parallel across blocks.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_SEARCH_H
+    #define CONSOLE_SEARCH_H
+
+    #include <console.h>
+
+    // DFA states kept per direction before the cache starts over
+    #define CONSOLE_SEARCH_STATES  4096
+
+    // Bytes, or page lines, one thread searches at a time
+    #define CONSOLE_SEARCH_BLOCK   (1 << 20)
+    #define CONSOLE_SEARCH_LINES   4096
+
+    // Blocks one search hands the shared pool at a time, see console_pool.h
+    #define CONSOLE_SEARCH_THREADS 8
+
+    // Milliseconds a search waits for room on the shared pool before it gives up
+    #define CONSOLE_SEARCH_WAIT    1000
+
+// Opaque compiled pattern, with the DFA cache of console_regex_match()
+struct ConsoleRegex;
+
+// Compile an extended regular expression: literals and escapes, '.', bracket expressions
+// with ranges and [:classes:], \d \w \s and their negations, groups, '|', '*', '+', '?',
+// {n,m} and the anchors '^' and '$', which match at line boundaries. Backreferences are
+// not supported. On failure `error`, when given, is set to a static message.
+ConsoleRegex* console_compile_regex(
+    const char* pattern, size_t length, bool ignore_case, const char** error
+);
+void          console_destroy_regex(ConsoleRegex* regex);
+
+// The leftmost-longest match in the line `text`, as byte offsets [start, end). Not for use
+// on one regex from several threads at once; the searches below are.
+bool console_regex_match(
+    ConsoleRegex* regex, const char* text, size_t length, size_t* start, size_t* end
+);
+
+// A matching line: its index in a page or its start in a text, and the match in it
+struct ConsoleSearchMatch {
+    size_t line;
+    size_t start; // byte offsets in the line
+    size_t end;
+};
+
+// Up to `max` lines of `page` from line `first` on that match, in order. Returns the count.
+// Searches run on the shared pool only; one it has no room for within CONSOLE_SEARCH_WAIT
+// stops there and returns what was found before.
+size_t console_search_page(
+    const ConsoleRegex* regex, const ConsolePage* page, size_t first, ConsoleSearchMatch* matches,
+    size_t max
+);
+
+// The first line of `text`, which is lines separated by newlines, that starts at or after
+// byte `from` and matches. `line` is its start in `text`. False too when the shared pool
+// had no room, as above.
+bool console_search_text(
+    const ConsoleRegex* regex, const char* text, size_t length, size_t from,
+    ConsoleSearchMatch* match
+);
+
+#endif // CONSOLE_SEARCH_H
@@ -0,0 +1,29 @@
+/**
+ * @file console_snapshot.h
+ *
+ * @brief Saves a console's state to a compact binary snapshot and restores it by
+ * mapping the file, so a restarted process resumes the session without replaying it.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_SNAPSHOT_H
+    #define CONSOLE_SNAPSHOT_H
+
+    #include <console.h>
+
+    #define CONSOLE_SNAPSHOT_VERSION 1 // bumped whenever the on-disk layout changes
+
+// Write modes, cursor, the active line, the page and pending type-ahead to `path`.
+// The file is written next to `path` and renamed over it, so a crash never leaves a
+// truncated snapshot behind.
+bool console_save_snapshot(Console* console, const char* path);
+
+// Restore a snapshot written by the same build. The page's lines point into the mapped
+// file, which the page keeps until it is cleared or destroyed, so nothing of it is copied.
+// The active line is put back as it was and the next console_readline() starts editing it,
+// with the cursor at its end.
+bool console_restore_snapshot(Console* console, const char* path);
+
+#endif // CONSOLE_SNAPSHOT_H
@@ -0,0 +1,82 @@
+/**
+ * @file console_style.h
+ *
+ * @brief SGR state tracking: text attributes and colors as values, and the shortest
+ * escape sequence that takes the terminal from one to another.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_STYLE_H
+    #define CONSOLE_STYLE_H
+
+    #include <console_color.h>
+
+    // Text attributes, combined in ConsoleStyle::attributes
+    #define CONSOLE_STYLE_BOLD      0x01
+    #define CONSOLE_STYLE_DIM       0x02
+    #define CONSOLE_STYLE_ITALIC    0x04
+    #define CONSOLE_STYLE_UNDERLINE 0x08
+    #define CONSOLE_STYLE_REVERSE   0x10
+
+    // Longest transition: every attribute and two 24-bit colors
+    #define CONSOLE_STYLE_MAX       64
+
+struct ConsoleStyle {
+    unsigned attributes; // CONSOLE_STYLE_* bits
+    int      foreground; // CONSOLE_COLOR_DEFAULT, an index or CONSOLE_COLOR_RGB()
+    int      background;
+};
+
+// Apply the parameters of an SGR sequence, what is between CSI and 'm', to `style`.
+// Parameters ConsoleStyle has no room for, e.g. blink, are ignored.
+void console_style_apply(ConsoleStyle* style, const char* parameters, size_t length);
+
+// No attributes, default colors: what ANSI_COLOR_RESET leaves
+ConsoleStyle console_style_default(void);
+
+bool console_style_equal(const ConsoleStyle* a, const ConsoleStyle* b);
+
+// Write the SGR sequence that changes `from` into `to` to `out`, which has room for
+// CONSOLE_STYLE_MAX bytes, and return its length: 0 when they are equal. Attributes are
+// turned off one by one or with a reset, whichever is shorter. `from` NULL means the
+// terminal's state is unknown, e.g. after foreign escape sequences.
+size_t console_style_transition(const ConsoleStyle* from, const ConsoleStyle* to, char* out);
+
+// The terminal's style as output written through it leaves it. `exact` is cleared when
+// other escape sequences may have changed it: `current` is then only what the text is
+// assumed to look like, and the next change starts from a reset. Without `known` there
+// is not even that, and the next update writes a full sequence whatever the style.
+struct ConsoleStyleTracker {
+    ConsoleStyle current;
+    bool         exact;
+    bool         known;
+};
+
+ConsoleStyleTracker* console_create_style_tracker(void);
+void                 console_destroy_style_tracker(ConsoleStyleTracker* tracker);
+
+void console_style_track(ConsoleStyleTracker* tracker);  // default style, exact
+void console_style_forget(ConsoleStyleTracker* tracker); // e.g. after a display mode
+
+// Write what takes the terminal to `to` to `out` (CONSOLE_STYLE_MAX bytes), nothing if it
+// is there already. Returns the length.
+size_t console_style_update(ConsoleStyleTracker* tracker, const ConsoleStyle* to, char* out);
+
+// Like console_style_update() to the default style, but also when it is not exact
+size_t console_style_reset(ConsoleStyleTracker* tracker, char* out);
+
+// The closest style a terminal with `colors` colors (0, 16, 256 or CONSOLE_COLORS_TRUE)
+// can show, see console_color_map(); attributes are kept.
+ConsoleStyle console_style_downsample(const ConsoleStyle* style, int colors);
+
+// Write `text` through the output stages in `style`, downsampled to the terminal's
+// colors. A token in the same style as the one before it shares its escape sequence, so
+// runs of equal tokens cost one; console_flush_output() returns to the default style. A
+// console without capabilities or a style tracker, or a NULL style, writes the text plain.
+void console_write_styled(
+    Console* console, const char* text, size_t length, const ConsoleStyle* style
+);
+
+#endif // CONSOLE_STYLE_H
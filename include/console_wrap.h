@@ -0,0 +1,33 @@
+/**
+ * @file console_wrap.h
+ *
+ * @brief Output stage that word-wraps streamed text at line break opportunities, after
+ * the pair rules of UAX #14, instead of letting the terminal cut words in half.
+ *
+ */
+
+#pragma once
+
+#ifndef CONSOLE_WRAP_H
+    #define CONSOLE_WRAP_H
+
+    #include <console.h>
+
+// Opaque wrapping state: the row being written and the text since the last break
+// opportunity, which is all that is ever held back
+struct ConsoleWrapper;
+
+// Wrap at `columns`, or at the terminal width, measured on every write, when 0
+ConsoleWrapper* console_create_wrapper(size_t columns);
+void            console_destroy_wrapper(ConsoleWrapper* wrapper);
+
+// The cursor is at the start of a row again, e.g. after console_readline(). Text held
+// back for wrapping and not flushed yet is dropped.
+void console_reset_wrapper(ConsoleWrapper* wrapper);
+
+// The wrapper as an output stage, see console_add_output_stage(). It expects sanitized
+// text: escape sequences take no room, other controls than newline and tab are not
+// expected.
+ConsoleSink* console_wrapper_sink(ConsoleWrapper* wrapper);
+
+#endif // CONSOLE_WRAP_H
@@ -7,17 +7,32 @@
  */
 
 #include <console.h>
+#include <console_event.h>
+#include <console_expand.h>
+#include <console_exporter.h>
+#include <console_history.h>
+#include <console_layout.h>
+#include <console_metrics.h>
+#include <console_region.h>
+#include <console_render.h>
+#include <console_sanitize.h>
+#include <console_style.h>
 #include <climits>
+#include <ctype.h>
+#include <errno.h>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
 #include <locale.h>
 #include <optional>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <termios.h>
 #include <unistd.h>
 #include <wchar.h>
@@ -32,6 +47,9 @@ ConsoleState* console_create_state(void) {
 
     state->input   = STATE_INPUT_NORMAL;
     state->display = STATE_DISPLAY_INPUT;
+    state->paste   = false;
+    state->mouse   = false;
+    state->preview = 0; // the host asks for previews, see console_set_expand_preview()
     return state;
 }
 
@@ -159,10 +177,99 @@ bool console_line_remove_char(ConsoleLine* line, size_t index) {
     return true;
 }
 
-// TODO: page
-ConsolePage* console_create_page(void) {}
+bool console_line_insert(ConsoleLine* line, size_t index, const char* data, size_t count) {
+    if (index > line->length) {
+        return false;
+    }
+    if (line->length + count >= line->size) { // +1 for the null terminator
+        size_t new_size = line->size * 2;
+        while (line->length + count >= new_size) {
+            new_size *= 2;
+        }
+        char* new_buffer = (char*) realloc(line->buffer, new_size);
+        if (NULL == new_buffer) {
+            return false; // Reallocation failed
+        }
+        line->buffer = new_buffer;
+        line->size   = new_size;
+    }
+    // the tail moves right by `count`, null terminator included
+    memmove(line->buffer + index + count, line->buffer + index, line->length - index + 1);
+    memcpy(line->buffer + index, data, count);
+    line->length += count;
+    return true;
+}
+
+bool console_line_remove(ConsoleLine* line, size_t index, size_t length) {
+    if (index > line->length || length > line->length - index) {
+        return false;
+    }
+    memmove(line->buffer + index, line->buffer + index + length, line->length - index - length + 1);
+    line->length -= length;
+    return true;
+}
+
+// page
+ConsolePage* console_create_page(void) {
+    ConsolePage* page = (ConsolePage*) malloc(sizeof(ConsolePage));
+    if (NULL == page) {
+        return NULL;
+    }
+
+    page->lines    = NULL; // allocated on the first append
+    page->size     = 0;
+    page->length   = 0;
+    page->mapped   = 0;
+    page->map      = NULL;
+    page->map_size = 0;
+    return page;
+}
 
-void console_destroy_page(ConsolePage* page) {}
+void console_destroy_page(ConsolePage* page) {
+    if (NULL != page) {
+        console_page_clear(page);
+        free(page->lines);
+        free(page);
+    }
+}
+
+void console_page_clear(ConsolePage* page) {
+    for (size_t i = page->mapped; i < page->length; i++) {
+        free(page->lines[i].buffer);
+    }
+    if (NULL != page->map) {
+        munmap(page->map, page->map_size);
+    }
+    page->length   = 0;
+    page->mapped   = 0;
+    page->map      = NULL;
+    page->map_size = 0;
+}
+
+bool console_page_append_line(ConsolePage* page, const char* text, size_t length) {
+    if (page->length == page->size) {
+        size_t       new_size  = page->size ? page->size * 2 : 64; // Double the line table
+        ConsoleLine* new_lines
+            = (ConsoleLine*) realloc(page->lines, new_size * sizeof(ConsoleLine));
+        if (NULL == new_lines) {
+            return false; // Reallocation failed
+        }
+        page->lines = new_lines;
+        page->size  = new_size;
+    }
+
+    ConsoleLine* line = &page->lines[page->length];
+    line->buffer      = (char*) malloc(length + 1);
+    if (NULL == line->buffer) {
+        return false;
+    }
+    memcpy(line->buffer, text, length);
+    line->buffer[length] = '\0';
+    line->size           = length + 1;
+    line->length         = length;
+    page->length++;
+    return true;
+}
 
 // stream
 ConsoleStream* console_create_stream(void) {
@@ -177,30 +284,137 @@ ConsoleStream* console_create_stream(void) {
     stream->event   = STREAM_EVENT_POLL;       // enum StreamEvent
     stream->cursor  = console_create_cursor(); // struct ConsoleCursor
     stream->line    = console_create_line(0);  // struct ConsoleLine
-    stream->page    = NULL;                    // TODO: struct ConsolePage
+    stream->page    = console_create_page();   // struct ConsolePage
 
     return stream;
 }
 
-void console_destroy_stream(ConsoleStream* stream) {}
+void console_destroy_stream(ConsoleStream* stream) {
+    if (NULL != stream) {
+        console_destroy_cursor(stream->cursor);
+        console_destroy_line(stream->line);
+        console_destroy_page(stream->page);
+        free(stream);
+    }
+}
+
+// typeahead
+ConsoleTypeahead* console_create_typeahead(void) {
+    ConsoleTypeahead* typeahead = (ConsoleTypeahead*) malloc(sizeof(ConsoleTypeahead));
+    if (NULL == typeahead) {
+        return NULL;
+    }
+
+    typeahead->size   = 4096; // well above what a tty delivers per read, grows on demand
+    typeahead->buffer = (unsigned char*) malloc(typeahead->size);
+    if (NULL == typeahead->buffer) {
+        free(typeahead);
+        return NULL;
+    }
+
+    typeahead->head       = 0;
+    typeahead->tail       = 0;
+    typeahead->eof        = false;
+    typeahead->interrupt  = false;
+    typeahead->resize     = false; // SIGWINCH is watched from the first batch read
+    typeahead->paste      = NULL;  // allocated on the first batch read
+    typeahead->paste_size = 0;
+    return typeahead;
+}
+
+void console_destroy_typeahead(ConsoleTypeahead* typeahead) {
+    if (NULL != typeahead) {
+        free(typeahead->paste);
+        free(typeahead->buffer);
+        free(typeahead);
+    }
+}
+
+// capabilities
+// Whether `term` is `name` or one of its variants, e.g. xterm-256color for xterm
+static bool term_is(const char* term, const char* name) {
+    size_t length = strlen(name);
+    return 0 == strncmp(term, name, length) && ('\0' == term[length] || '-' == term[length]);
+}
+
+// Colors by the usual conventions: NO_COLOR turns them off, COLORTERM announces 24-bit
+// color, and TERM names 256-color terminals; anything else known gets the ANSI 16.
+static int probe_colors(const char* term, bool known) {
+    const char* none      = getenv("NO_COLOR");
+    const char* colorterm = getenv("COLORTERM");
+    if (!known || (NULL != none && '\0' != none[0])) {
+        return 0;
+    }
+    if (NULL != colorterm
+        && (0 == strcmp(colorterm, "truecolor") || 0 == strcmp(colorterm, "24bit"))) {
+        return CONSOLE_COLORS_TRUE;
+    }
+    if (NULL != strstr(term, "256color") || term_is(term, "kitty") || term_is(term, "foot")
+        || term_is(term, "wezterm")) {
+        return 256;
+    }
+    return term_is(term, "vt52") || term_is(term, "vt100") ? 0 : 16;
+}
+
+ConsoleCapabilities* console_create_capabilities(void) {
+    ConsoleCapabilities* capabilities
+        = (ConsoleCapabilities*) malloc(sizeof(ConsoleCapabilities));
+    if (NULL == capabilities) {
+        return NULL;
+    }
+
+    // ICH/DCH/ECH date back to the VT102/VT220 and everything emulating them has them;
+    // REP is newer and only trusted where it is known to work.
+    const char* term    = getenv("TERM");
+    bool        known   = NULL != term && '\0' != term[0] && !term_is(term, "dumb");
+    bool        editing = known && !term_is(term, "vt52") && !term_is(term, "vt100");
+    bool        repeat  = known
+                     && (term_is(term, "xterm") || term_is(term, "tmux") || term_is(term, "foot")
+                         || term_is(term, "kitty") || term_is(term, "wezterm"));
+
+    capabilities->insert_chars  = editing;
+    capabilities->delete_chars  = editing;
+    capabilities->erase_chars   = editing;
+    capabilities->repeat_char   = repeat;
+    capabilities->scroll_region = known && !term_is(term, "vt52"); // margins came with the VT100
+    capabilities->colors        = probe_colors(term, known);
+    return capabilities;
+}
+
+void console_destroy_capabilities(ConsoleCapabilities* capabilities) {
+    if (NULL != capabilities) {
+        free(capabilities);
+    }
+}
 
 // terminal
 struct termios* console_create_terminal(void) {
     // POSIX-specific console initialization
-    struct termios* terminal;
+    struct termios* terminal = (struct termios*) malloc(sizeof(struct termios));
+    if (NULL == terminal) {
+        return NULL;
+    }
 
+    // Keep the original settings so they can be restored on destroy
     tcgetattr(STDIN_FILENO, terminal);
-    terminal->c_lflag     &= ~(ICANON | ECHO); // Disable canonical mode and echo
-    terminal->c_cc[VMIN]   = 1; // Minimum number of characters for noncanonical read.
-    terminal->c_cc[VTIME]  = 0; // Timeout in deciseconds for noncanonical read.
-    tcsetattr(STDIN_FILENO, TCSANOW, terminal);
+    struct termios raw  = *terminal;
+    raw.c_lflag        &= ~(ICANON | ECHO); // Disable canonical mode and echo
+    // The interrupt key reaches the type-ahead as a byte instead of raising SIGINT, so
+    // it can drop the line; suspend and quit keep their signals.
+    raw.c_cc[VINTR]     = _POSIX_VDISABLE;
+    raw.c_cc[VMIN]      = 1; // Minimum number of characters for noncanonical read.
+    raw.c_cc[VTIME]     = 0; // Timeout in deciseconds for noncanonical read.
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
 
     setlocale(LC_ALL, "");
     return terminal;
 }
 
 void console_destroy_terminal(struct termios* terminal) {
-    tcsetattr(STDIN_FILENO, TCSANOW, terminal);
+    if (NULL != terminal) {
+        tcsetattr(STDIN_FILENO, TCSANOW, terminal);
+        free(terminal);
+    }
 }
 
 Console* console_create(void) {
@@ -211,28 +425,65 @@ Console* console_create(void) {
     }
 
     // Initialize console states
-    console->state    = console_create_state();
+    console->state        = console_create_state();
     // Initialize console i/o
-    console->io       = console_create_io();
+    console->io           = console_create_io();
     // initialize console stream
-    console->stream   = console_create_stream(); // TODO: struct ConsoleStream
+    console->stream       = console_create_stream(); // TODO: struct ConsoleStream
+    // capture keys typed while output is streaming
+    console->typeahead    = console_create_typeahead();
+    // in-memory until the host loads a history file
+    console->history      = console_create_history();
+    // nobody listens to edits until the host subscribes
+    console->subscription = NULL;
+    // nothing drawn yet
+    console->renderer     = console_create_renderer();
+    // what the terminal supports, judged by TERM
+    console->capabilities = console_create_capabilities();
+    // output scrolls over the whole screen until the host pins the prompt
+    console->region       = NULL;
+    // model output may color itself but not move the cursor or retitle the window
+    console->sanitizer    = console_create_sanitizer(CONSOLE_SANITIZE_STRIP, CONSOLE_ALLOW_SGR);
+    console->output       = NULL;
+    // styled output starts from the terminal's default style
+    console->style        = console_create_style_tracker();
+    // metrics stay in-process until the host asks for a socket
+    console->exporter     = NULL;
+    // no line submitted yet
+    console->expansion    = NULL;
+    if (NULL != console->sanitizer) {
+        console_add_output_stage(console, console_sanitizer_sink(console->sanitizer));
+    }
     // POSIX-specific console initialization
-    console->terminal = console_create_terminal();
+    console->terminal     = console_create_terminal();
     return console;
 }
 
 // Don't forget to restore the original terminal settings upon exit
 void console_destroy(Console* console) {
+    console_flush_output(console);
+    console_unpin_prompt(console);
     console_set_display_mode(console, STATE_DISPLAY_RESET);
-
-    if (console->io->teletype) {
-        fclose(console->io->teletype);
+    if (console->state->paste || console->state->mouse) {
+        // don't leave the shell receiving paste brackets and mouse reports
+        fputs("\x1b[?2004l\x1b[?1006l\x1b[?1000l", console->io->teletype);
+        fflush(console->io->teletype);
     }
-    tcsetattr(STDIN_FILENO, TCSANOW, &console->terminal);
 
-    if (console->state) {
-        free(console->state);
-    }
+    console_destroy_terminal(console->terminal);
+    console_release_events(console);
+    console_export_metrics(console, NULL);
+    console_destroy_expansion(console->expansion);
+    free(console->subscription);
+    console_destroy_renderer(console->renderer);
+    console_destroy_sanitizer(console->sanitizer);
+    console_destroy_style_tracker(console->style);
+    console_destroy_capabilities(console->capabilities);
+    console_destroy_history(console->history);
+    console_destroy_typeahead(console->typeahead);
+    console_destroy_stream(console->stream);
+    console_destroy_io(console->io);
+    console_destroy_state(console->state);
     free(console);
 }
 
@@ -251,12 +502,18 @@ void console_set_display_mode(Console* console, StateDisplay state) {
             case STATE_DISPLAY_INPUT:
                 fprintf(console->io->teletype, ANSI_BOLD ANSI_COLOR_GREEN);
                 break;
+            case STATE_DISPLAY_OUTPUT:
+                fprintf(console->io->teletype, ANSI_COLOR_RESET);
+                break;
             case STATE_DISPLAY_ERROR:
                 fprintf(console->io->teletype, ANSI_BOLD ANSI_COLOR_RED);
         }
 
         console->state->display = state;
         fflush(console->io->teletype);
+        if (NULL != console->style) {
+            console_style_forget(console->style); // the mode's colors replaced styled output's
+        }
     }
 }
 
@@ -264,23 +521,249 @@ void console_set_display_mode(Console* console, StateDisplay state) {
 // mostly focused on cursor movement, implementation details TBD.
 void console_set_char(Console* console, int character) {}
 
+// Move everything the terminal has already delivered into the type-ahead buffer.
+// Never blocks, so output paths can call it between writes to keep the tty drained.
+size_t console_typeahead_drain(Console* console) {
+    ConsoleTypeahead* typeahead = console->typeahead;
+    int               fd        = fileno(console->io->input);
+    size_t            total     = 0;
+
+    struct pollfd descriptor = {fd, POLLIN, 0};
+    while (!typeahead->eof && 1 == poll(&descriptor, 1, 0)) {
+        size_t pending = typeahead->tail - typeahead->head;
+        if (pending == typeahead->size) {
+            // full: double the ring and unwrap the pending bytes to the front
+            size_t         size   = typeahead->size * 2;
+            unsigned char* buffer = (unsigned char*) malloc(size);
+            if (NULL == buffer) {
+                break; // leave the rest in the kernel, it is picked up on the next drain
+            }
+            for (size_t i = 0; i < pending; i++) {
+                buffer[i] = typeahead->buffer[(typeahead->head + i) & (typeahead->size - 1)];
+            }
+            free(typeahead->buffer);
+            typeahead->buffer = buffer;
+            typeahead->size   = size;
+            typeahead->head   = 0;
+            typeahead->tail   = pending;
+        }
+
+        // read up to the end of the free region without wrapping
+        size_t  offset = typeahead->tail & (typeahead->size - 1);
+        size_t  space  = typeahead->size - (typeahead->tail - typeahead->head);
+        size_t  chunk  = space < typeahead->size - offset ? space : typeahead->size - offset;
+        ssize_t count  = read(fd, typeahead->buffer + offset, chunk);
+        if (count <= 0) {
+            typeahead->eof = 0 == count;
+            break;
+        }
+
+        // The interrupt key acts immediately and discards whatever was typed ahead of it,
+        // so of several in one read only the last one counts. The key is the terminal's
+        // own, disabled in the kernel by console_create_terminal().
+        unsigned char  interrupt = console->terminal ? console->terminal->c_cc[VINTR] : 0x03;
+        unsigned char* start     = typeahead->buffer + offset;
+        unsigned char* found     = _POSIX_VDISABLE == interrupt
+                                       ? NULL
+                                       : (unsigned char*) memrchr(start, interrupt, (size_t) count);
+        if (NULL != found) {
+            size_t after = (size_t) count - (size_t) (found - start) - 1;
+            memmove(typeahead->buffer, found + 1, after);
+            typeahead->head      = 0;
+            typeahead->tail      = after;
+            typeahead->interrupt = true;
+            total                = after;
+            continue;
+        }
+
+        typeahead->tail += (size_t) count;
+        total           += (size_t) count;
+        CONSOLE_COUNT(CONSOLE_METRIC_INPUT_BYTES, (uint64_t) count);
+    }
+
+    return total;
+}
+
+size_t console_typeahead_pending(Console* console) {
+    return console->typeahead->tail - console->typeahead->head;
+}
+
+// Queue bytes ahead of the pending input, as if they had been typed first.
+bool console_typeahead_insert(Console* console, const char* data, size_t length) {
+    ConsoleTypeahead* typeahead = console->typeahead;
+    size_t            pending   = typeahead->tail - typeahead->head;
+
+    size_t size = typeahead->size;
+    while (size < pending + length) {
+        size *= 2;
+    }
+
+    unsigned char* buffer = (unsigned char*) malloc(size);
+    if (NULL == buffer) {
+        return false;
+    }
+    memcpy(buffer, data, length);
+    for (size_t i = 0; i < pending; i++) {
+        buffer[length + i] = typeahead->buffer[(typeahead->head + i) & (typeahead->size - 1)];
+    }
+
+    free(typeahead->buffer);
+    typeahead->buffer = buffer;
+    typeahead->size   = size;
+    typeahead->head   = 0;
+    typeahead->tail   = pending + length;
+    return true;
+}
+
+bool console_typeahead_interrupted(Console* console) {
+    console_typeahead_drain(console);
+    bool interrupt                = console->typeahead->interrupt;
+    console->typeahead->interrupt = false;
+    return interrupt;
+}
+
+bool console_poll_input(Console* console, int timeout) {
+    if (console_typeahead_pending(console) > 0 || console->typeahead->eof) {
+        return true;
+    }
+
+    struct pollfd descriptor = {fileno(console->io->input), POLLIN, 0};
+    return console_exporter_poll(console, &descriptor, timeout) > 0;
+}
+
+bool console_subscribe_edits(
+    Console* console, ConsoleEditCallback callback, void* context, int settle
+) {
+    if (NULL == callback) {
+        free(console->subscription);
+        console->subscription = NULL;
+        return true;
+    }
+
+    if (NULL == console->subscription) {
+        console->subscription = (ConsoleSubscription*) malloc(sizeof(ConsoleSubscription));
+        if (NULL == console->subscription) {
+            return false;
+        }
+    }
+
+    console->subscription->callback = callback;
+    console->subscription->context  = context;
+    console->subscription->settle   = settle;
+    console->subscription->stable   = 0;
+    return true;
+}
+
+void console_write_output(Console* console, const char* data, size_t length) {
+    CONSOLE_COUNT(CONSOLE_METRIC_OUTPUT_BYTES, length);
+    if (NULL != console->output) {
+        console->output->write(console, console->output, data, length);
+    } else {
+        console_write_terminal(console, data, length);
+    }
+}
+
+void console_flush_output(Console* console) {
+    if (NULL != console->style) {
+        char   sgr[CONSOLE_STYLE_MAX];
+        size_t count = console_style_reset(console->style, sgr);
+        if (count > 0) {
+            console_write_output(console, sgr, count); // styled output ends with the response
+        }
+    }
+    if (NULL != console->output) {
+        console->output->flush(console, console->output);
+    }
+}
+
+void console_add_output_stage(Console* console, ConsoleSink* stage) {
+    ConsoleSink** link = &console->output;
+    while (NULL != *link) {
+        link = &(*link)->next;
+    }
+    stage->next = NULL;
+    *link       = stage;
+}
+
+void console_remove_output_stage(Console* console, ConsoleSink* stage) {
+    for (ConsoleSink** link = &console->output; NULL != *link; link = &(*link)->next) {
+        if (stage == *link) {
+            *link       = stage->next;
+            stage->next = NULL;
+            return;
+        }
+    }
+}
+
+void console_sink_pass(Console* console, ConsoleSink* sink, const char* data, size_t length) {
+    if (NULL != sink->next) {
+        sink->next->write(console, sink->next, data, length);
+    } else {
+        console_write_terminal(console, data, length);
+    }
+}
+
+void console_sink_flush(Console* console, ConsoleSink* sink) {
+    if (NULL != sink->next) {
+        sink->next->flush(console, sink->next);
+    }
+}
+
+// Stream output in bounded chunks and drain input in between, so a long write never
+// leaves keystrokes sitting in the kernel buffer long enough to stall or drop them.
+void console_write_terminal(Console* console, const char* data, size_t length) {
+    static const size_t chunk = 4096;
+
+    // pinned: scrolls inside the region, the prompt below stays as it is
+    size_t offset = 0;
+    for (; offset < length; offset += chunk) {
+        size_t count = length - offset < chunk ? length - offset : chunk;
+        if (!console_region_write(console, data + offset, count)) {
+            break; // not pinned, or not any more: the rest scrolls the whole screen
+        }
+    }
+    if (offset > 0 && offset >= length) {
+        return;
+    }
+    console_set_display_mode(console, STATE_DISPLAY_OUTPUT);
+    for (; offset < length; offset += chunk) {
+        size_t count = length - offset < chunk ? length - offset : chunk;
+        console_typeahead_drain(console);
+        fwrite(data + offset, 1, count, console->io->output);
+        CONSOLE_TIMER(CONSOLE_METRIC_FLUSH);
+        fflush(console->io->output);
+        CONSOLE_HISTOGRAM(CONSOLE_METRIC_BACKLOG,
+                          console_metrics_backlog(fileno(console->io->output)));
+    }
+    console_typeahead_drain(console);
+}
+
 // this is simple enough. get a character input from the user.
 // characters may be treated as a buffered stream when used in a loop.
-// this should allow for some neat things to happen.
+// pending type-ahead is consumed first, so keys typed during output are not lost.
 int console_get_char(Console* console) {
-    char control_ch;
-    if (!(std::cin >> control_ch)) {
-        console_set_display_mode(console, STATE_DISPLAY_ERROR);
-        if (std::cin.eof()) {
+    ConsoleTypeahead* typeahead = console->typeahead;
+
+    while (typeahead->head == typeahead->tail) {
+        if (typeahead->eof) {
+            console_set_display_mode(console, STATE_DISPLAY_ERROR);
             fprintf(stderr, "debug: console_get_char: reached end of file.\n");
-        } else {
+            return EOF;
+        }
+
+        struct pollfd descriptor = {fileno(console->io->input), POLLIN, 0};
+        if (-1 == console_exporter_poll(console, &descriptor, -1)
+            || (descriptor.revents & (POLLERR | POLLNVAL))) {
+            console_set_display_mode(console, STATE_DISPLAY_ERROR);
             fprintf(stderr, "debug: console_get_char: error reading input.\n");
+            return EOF;
         }
-        std::cin.clear();                                                   // Clear error flags
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Skip to the next line
-        return EOF; // Return EOF if there's an error or end of file
+        console_typeahead_drain(console);
     }
-    return static_cast<unsigned char>(control_ch); // Return the character
+
+    int character = typeahead->buffer[typeahead->head & (typeahead->size - 1)];
+    typeahead->head++;
+    return character;
 }
 
 // modify the line, similar to console_set_char, but for a line instead
@@ -318,8 +801,535 @@ void process_insert_mode(Console* console, char ch) {
     }
 }
 
-bool console_readline(std::string &line) {
-    return false; // TODO
+// Number of bytes in the UTF-8 sequence introduced by `lead`
+size_t console_utf8_length(int lead) {
+    if (lead < 0x80) {
+        return 1;
+    } else if ((lead & 0xE0) == 0xC0) {
+        return 2;
+    } else if ((lead & 0xF0) == 0xE0) {
+        return 3;
+    } else if ((lead & 0xF8) == 0xF0) {
+        return 4;
+    }
+    return 1; // stray continuation or invalid byte, treat as a single cell
+}
+
+// Display width of the UTF-8 sequence at `text`
+int console_utf8_width(const char* text, size_t length) {
+    wchar_t   wc;
+    mbstate_t state = {};
+    size_t    count = mbrtowc(&wc, text, length, &state);
+    if (count == (size_t) -1 || count == (size_t) -2) {
+        return REPLACEMENT_CHARACTER_WIDTH;
+    }
+    int width = wcwidth(wc);
+    return width < 0 ? 0 : width;
+}
+
+// Display width of a UTF-8 string; printable ASCII runs count one column per byte
+size_t console_utf8_columns(const char* text, size_t length) {
+    size_t columns = 0;
+    for (size_t i = 0; i < length;) {
+        size_t span  = console_ascii_span(text + i, length - i);
+        columns     += span;
+        i           += span;
+        if (i == length) {
+            break;
+        }
+        size_t count  = console_utf8_length((unsigned char) text[i]);
+        count         = count < length - i ? count : length - i;
+        columns      += console_utf8_width(text + i, count);
+        i            += count;
+    }
+    return columns;
+}
+
+size_t console_utf8_encode(uint32_t codepoint, char* bytes) {
+    if (codepoint < 0x80) {
+        bytes[0] = (char) codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        bytes[0] = (char) (0xC0 | (codepoint >> 6));
+        bytes[1] = (char) (0x80 | (codepoint & 0x3F));
+        return 2;
+    } else if (codepoint < 0x10000) {
+        bytes[0] = (char) (0xE0 | (codepoint >> 12));
+        bytes[1] = (char) (0x80 | ((codepoint >> 6) & 0x3F));
+        bytes[2] = (char) (0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    bytes[0] = (char) (0xF0 | (codepoint >> 18));
+    bytes[1] = (char) (0x80 | ((codepoint >> 12) & 0x3F));
+    bytes[2] = (char) (0x80 | ((codepoint >> 6) & 0x3F));
+    bytes[3] = (char) (0x80 | (codepoint & 0x3F));
+    return 4;
+}
+
+// Whether the codepoint at `index` is a mark drawn on top of the one before it
+static bool utf8_combining(const char* text, size_t length, size_t index) {
+    size_t count = console_utf8_length((unsigned char) text[index]);
+    count        = count < length - index ? count : length - index;
+    return '\n' != text[index] && 0 == console_utf8_width(text + index, count);
+}
+
+// Start of the character before `index`: a codepoint with the marks combined into it
+static size_t utf8_previous(const char* text, size_t index) {
+    size_t end = index;
+    while (index > 0) {
+        index--;
+        while (index > 0 && (text[index] & 0xC0) == 0x80) {
+            index--;
+        }
+        if (!utf8_combining(text, end, index)) {
+            break;
+        }
+    }
+    return index;
+}
+
+// End of the character at `index`, including the marks combined into it
+static size_t utf8_next(const char* text, size_t length, size_t index) {
+    if (index < length) {
+        index += console_utf8_length((unsigned char) text[index]);
+    }
+    while (index < length && utf8_combining(text, length, index)) {
+        index += console_utf8_length((unsigned char) text[index]);
+    }
+    return index < length ? index : length;
+}
+
+// Tell the subscriber about an edit of the active line. An edit inside the settled
+// prefix moves the prefix back to the edit offset so the host can drop what it prefilled.
+static void notify_edit(
+    Console* console, ConsoleEditKind kind, size_t offset, size_t length, const char* data
+) {
+    ConsoleSubscription* subscription = console->subscription;
+    if (NULL == subscription) {
+        return;
+    }
+
+    ConsoleEdit edit = {kind, offset, length, data};
+    subscription->callback(subscription->context, &edit, console->stream->line);
+
+    if (CONSOLE_EDIT_SUBMIT == kind) {
+        subscription->stable = 0;
+    } else if (offset < subscription->stable) {
+        subscription->stable = offset;
+        ConsoleEdit retract  = {CONSOLE_EDIT_STABLE, offset, 0, NULL};
+        subscription->callback(subscription->context, &retract, console->stream->line);
+    }
+}
+
+// The line ended without a submit: nothing of the next one is settled yet
+static void forget_settled(Console* console) {
+    if (NULL != console->subscription) {
+        console->subscription->stable = 0;
+    }
+}
+
+// Called once input has been idle for the settle time: announce the prefix up to the
+// last word boundary, the part a tokenizer will not re-split as typing continues.
+static void notify_settled(Console* console) {
+    ConsoleSubscription* subscription = console->subscription;
+    ConsoleLine*         line         = console->stream->line;
+
+    size_t boundary = line->length;
+    while (boundary > 0 && !isspace((unsigned char) line->buffer[boundary - 1])) {
+        boundary--;
+    }
+    if (boundary > subscription->stable) {
+        subscription->stable = boundary;
+        ConsoleEdit edit     = {CONSOLE_EDIT_STABLE, boundary, 0, NULL};
+        subscription->callback(subscription->context, &edit, line);
+    }
+}
+
+// Editing state of one console_readline() call
+struct LineEditor {
+    size_t      point;  // byte offset of the cursor in the line
+    size_t      browse; // history entry on display, the history length while typing
+    std::string draft;  // the line being typed, kept while browsing the history
+};
+
+enum EditorAction {
+    EDITOR_CONTINUE,  // keep reading
+    EDITOR_SUBMIT,    // the line is complete
+    EDITOR_INTERRUPT, // drop the line and start over
+    EDITOR_EOF        // end of input, or Ctrl+D on an empty line
+};
+
+static void editor_insert(Console* console, LineEditor* editor, const char* data, size_t length) {
+    ConsoleLine* line = console->stream->line;
+    if (0 == length || !console_line_insert(line, editor->point, data, length)) {
+        return;
+    }
+    notify_edit(console, CONSOLE_EDIT_INSERT, editor->point, length, line->buffer + editor->point);
+    console_render_edited(console, editor->point);
+    editor->point += length;
+}
+
+static void editor_delete(Console* console, LineEditor* editor, size_t offset, size_t length) {
+    if (0 == length || !console_line_remove(console->stream->line, offset, length)) {
+        return;
+    }
+    if (editor->point > offset) {
+        editor->point = editor->point - offset > length ? editor->point - length : offset;
+    }
+    notify_edit(console, CONSOLE_EDIT_DELETE, offset, length, NULL);
+    console_render_edited(console, offset);
+}
+
+static void editor_replace(Console* console, LineEditor* editor, const char* text, size_t length) {
+    editor_delete(console, editor, 0, console->stream->line->length);
+    editor->point = 0;
+    editor_insert(console, editor, text, length);
+}
+
+// Insert pasted text as if typed, without control characters. CR and CRLF become
+// newlines and tabs become spaces so what is stored is exactly what is drawn.
+static void editor_paste(Console* console, LineEditor* editor, const char* data, size_t length) {
+    std::string text;
+    text.reserve(length);
+    for (size_t i = 0; i < length; i++) {
+        unsigned char byte = (unsigned char) data[i];
+        if ('\r' == byte) {
+            text.push_back('\n');
+            i += i + 1 < length && '\n' == data[i + 1];
+        } else if ('\t' == byte) {
+            text.push_back(' ');
+        } else if ('\n' == byte || (byte >= 0x20 && 0x7F != byte)) {
+            text.push_back((char) byte);
+        }
+    }
+    editor_insert(console, editor, text.data(), text.size());
+}
+
+// Append the full suggestion to the line.
+static void editor_accept(Console* console, LineEditor* editor) {
+    ConsoleLine* line = console->stream->line;
+
+    size_t index;
+    if (editor->point == line->length
+        && console_history_suggest(console->history, line->buffer, line->length, &index)) {
+        size_t      length;
+        const char* entry = console_history_entry(console->history, index, &length);
+        editor_insert(console, editor, entry + line->length, length - line->length);
+    }
+}
+
+// Step through the history, over removed entries. Coming back past the newest entry
+// restores the draft.
+static void editor_browse(Console* console, LineEditor* editor, bool older) {
+    ConsoleLine* line  = console->stream->line;
+    size_t       count = console_history_length(console->history);
+    size_t       next  = editor->browse;
+    const char*  entry = NULL;
+    size_t       length;
+    while (NULL == entry && (older ? 0 != next : next < count)) {
+        next  = older ? next - 1 : next + 1;
+        entry = next < count ? console_history_entry(console->history, next, &length) : NULL;
+        if (next == count) {
+            break;
+        }
+    }
+    if (next == editor->browse || (NULL == entry && next < count)) {
+        return;
+    }
+
+    if (editor->browse == count) {
+        editor->draft.assign(line->buffer, line->length);
+    }
+    editor->browse = next;
+    if (editor->browse == count) {
+        editor_replace(console, editor, editor->draft.data(), editor->draft.size());
+    } else {
+        editor_replace(console, editor, entry, length);
+    }
+}
+
+static EditorAction apply_key(Console* console, LineEditor* editor, StreamEvent key) {
+    ConsoleLine* line = console->stream->line;
+
+    switch (key) {
+        case STREAM_EVENT_LEFT:
+            editor->point = utf8_previous(line->buffer, editor->point);
+            break;
+        case STREAM_EVENT_RIGHT:
+        case STREAM_EVENT_END:
+            if (editor->point == line->length) {
+                editor_accept(console, editor);
+            } else if (STREAM_EVENT_RIGHT == key) {
+                editor->point = utf8_next(line->buffer, line->length, editor->point);
+            } else {
+                editor->point = line->length;
+            }
+            break;
+        case STREAM_EVENT_HOME:
+            editor->point = 0;
+            break;
+        case STREAM_EVENT_BACKSPACE:
+            {
+                size_t start = utf8_previous(line->buffer, editor->point);
+                editor_delete(console, editor, start, editor->point - start);
+                break;
+            }
+        case STREAM_EVENT_DEL:
+            {
+                size_t end = utf8_next(line->buffer, line->length, editor->point);
+                editor_delete(console, editor, editor->point, end - editor->point);
+                break;
+            }
+        case STREAM_EVENT_UP:
+            editor_browse(console, editor, true);
+            break;
+        case STREAM_EVENT_DOWN:
+            editor_browse(console, editor, false);
+            break;
+        case STREAM_EVENT_ENTER:
+            if (line->length > 0 && '\\' == line->buffer[line->length - 1]) {
+                // a trailing backslash continues the input on the next row
+                editor->point = line->length;
+                editor_delete(console, editor, line->length - 1, 1);
+                editor_insert(console, editor, "\n", 1);
+                break;
+            }
+            return EDITOR_SUBMIT;
+        default:
+            break;
+    }
+    return EDITOR_CONTINUE;
+}
+
+// Emacs-style control chords, mapped onto the keys they stand for
+static EditorAction apply_control(Console* console, LineEditor* editor, uint32_t letter) {
+    ConsoleLine* line = console->stream->line;
+
+    switch (letter) {
+        case 'a':
+            return apply_key(console, editor, STREAM_EVENT_HOME);
+        case 'b':
+            return apply_key(console, editor, STREAM_EVENT_LEFT);
+        case 'd':
+            if (0 == line->length) {
+                return EDITOR_EOF;
+            }
+            return apply_key(console, editor, STREAM_EVENT_DEL);
+        case 'e':
+            return apply_key(console, editor, STREAM_EVENT_END);
+        case 'f':
+            return apply_key(console, editor, STREAM_EVENT_RIGHT);
+        case 'k':
+            editor_delete(console, editor, editor->point, line->length - editor->point);
+            break;
+        case 'n':
+            return apply_key(console, editor, STREAM_EVENT_DOWN);
+        case 'p':
+            return apply_key(console, editor, STREAM_EVENT_UP);
+        case 'u':
+            editor_delete(console, editor, 0, editor->point);
+            break;
+    }
+    return EDITOR_CONTINUE;
+}
+
+static EditorAction apply_event(Console* console, LineEditor* editor, const ConsoleEvent* event) {
+    switch (event->type) {
+        case CONSOLE_EVENT_CODEPOINT:
+            if (event->modifiers & CONSOLE_MOD_CTRL) {
+                return apply_control(console, editor, event->codepoint);
+            }
+            if (0 == (event->modifiers & CONSOLE_MOD_ALT)) {
+                char bytes[4];
+                editor_insert(console, editor, bytes, console_utf8_encode(event->codepoint, bytes));
+            }
+            return EDITOR_CONTINUE;
+        case CONSOLE_EVENT_KEY:
+            return apply_key(console, editor, event->key);
+        case CONSOLE_EVENT_PASTE:
+            editor_paste(console, editor, event->data, event->length);
+            return EDITOR_CONTINUE;
+        case CONSOLE_EVENT_RESIZE:
+            console_render_resize(console, (size_t) event->x);
+            return EDITOR_CONTINUE;
+        case CONSOLE_EVENT_SIGNAL:
+            return EDITOR_INTERRUPT;
+        case CONSOLE_EVENT_EOF:
+            return EDITOR_EOF;
+        default:
+            return EDITOR_CONTINUE; // mouse and stray position reports
+    }
+}
+
+// Keep the logical cursor in step with the point: the row counts continuation lines,
+// the column is the width of what precedes the point on its row.
+static void update_cursor(Console* console, int line_number, size_t point) {
+    ConsoleLine* line  = console->stream->line;
+    const char*  start = line->buffer;
+    size_t       row   = (size_t) line_number;
+    for (size_t i = 0; i < point; i++) {
+        if ('\n' == line->buffer[i]) {
+            row++;
+            start = line->buffer + i + 1;
+        }
+    }
+    console->stream->cursor->row = row;
+    console->stream->cursor->col = console_utf8_columns(start, line->buffer + point - start);
+}
+
+// Draw the line with the ghost text: the rest of the most recent history entry that
+// extends it, offered while the cursor is at the end.
+static void editor_render(Console* console, const LineEditor* editor) {
+    ConsoleLine* line   = console->stream->line;
+    const char*  ghost  = NULL;
+    size_t       length = 0;
+
+    size_t index;
+    if (editor->point == line->length
+        && console_history_suggest(console->history, line->buffer, line->length, &index)) {
+        const char* entry = console_history_entry(console->history, index, &length);
+        ghost             = entry + line->length;
+        length           -= line->length;
+    }
+    console_render_frame(console, line->buffer, line->length, editor->point, ghost, length);
+}
+
+// Block until the terminal has more input. False once it can no longer be read.
+static bool wait_input(Console* console) {
+    struct pollfd descriptor = {fileno(console->io->input), POLLIN, 0};
+    if (-1 == console_exporter_poll(console, &descriptor, -1)) {
+        return EINTR == errno; // e.g. SIGWINCH, picked up by the next batch
+    }
+    if (descriptor.revents & (POLLERR | POLLNVAL)) {
+        console_set_display_mode(console, STATE_DISPLAY_ERROR);
+        fprintf(stderr, "debug: console_readline: error reading input.\n");
+        return false;
+    }
+    return true;
+}
+
+bool console_readline(Console* console, int line_number) {
+    ConsoleLine* line = console->stream->line;
+    FILE*        echo = console->io->teletype;
+    ConsoleEvent events[64];
+
+    fflush(console->io->output);
+    console_set_display_mode(console, STATE_DISPLAY_INPUT);
+    console_region_reading(console, true);
+
+    // the last line's expansion points into the line, which is about to change
+    console_destroy_expansion(console->expansion);
+    console->expansion = NULL;
+
+    // a restored line is edited as it was left, anything else starts empty
+    bool restored = STREAM_STATUS_RESTORED == console->stream->status;
+    if (!restored) {
+        line->length    = 0;
+        line->buffer[0] = '\0';
+    }
+
+    LineEditor editor;
+    console_history_update(console->history);
+    editor.point  = line->length;
+    editor.browse = console_history_length(console->history);
+    update_cursor(console, line_number, editor.point);
+    console_render_begin(console);
+    if (restored) {
+        console->stream->status = STREAM_STATUS_OK;
+        notify_edit(console, CONSOLE_EDIT_INSERT, 0, line->length, line->buffer);
+        editor_render(console, &editor);
+    }
+
+    {
+        CONSOLE_TIMER(CONSOLE_METRIC_FLUSH);
+        fflush(echo);
+    }
+
+    EditorAction action = EDITOR_CONTINUE;
+    while (EDITOR_CONTINUE == action) {
+        // idle long enough: let the subscriber start on the settled prefix
+        if (NULL != console->subscription && console->subscription->settle >= 0
+            && !console_poll_input(console, console->subscription->settle)) {
+            notify_settled(console);
+        }
+
+        size_t count = console_read_events(console, events, sizeof(events) / sizeof(*events));
+        if (0 == count) {
+            if (!wait_input(console)) {
+                action = EDITOR_EOF;
+            }
+            continue;
+        }
+        CONSOLE_TIMER(CONSOLE_METRIC_ECHO); // until the batch is flushed, below
+
+        // entries still loading join between batches, unless they would move the one shown
+        if (editor.browse == console_history_length(console->history)) {
+            console_history_update(console->history);
+            editor.browse = console_history_length(console->history);
+        }
+
+        // Apply the whole batch to the line first, then lay it out and draw it once
+        {
+            CONSOLE_TIMER(CONSOLE_METRIC_PROCESS);
+            for (size_t i = 0; i < count && EDITOR_CONTINUE == action; i++) {
+                action = apply_event(console, &editor, &events[i]);
+                if (EDITOR_CONTINUE != action && i + 1 < count) {
+                    console_unread_events(console, &events[i + 1]); // input for the next line
+                }
+            }
+        }
+
+        if (EDITOR_INTERRUPT == action) {
+            // drop the line and start over on a fresh row
+            console_render_end(console);
+            editor_delete(console, &editor, 0, line->length);
+            forget_settled(console);
+            editor.browse = console_history_length(console->history);
+            console_render_begin(console);
+            action = EDITOR_CONTINUE;
+        }
+        update_cursor(console, line_number, editor.point);
+        if (EDITOR_CONTINUE == action) {
+            editor_render(console, &editor);
+        }
+
+        // Ensure all output is displayed before waiting for input
+        {
+            CONSOLE_TIMER(CONSOLE_METRIC_FLUSH);
+            fflush(echo);
+        }
+        CONSOLE_HISTOGRAM(CONSOLE_METRIC_BACKLOG, console_metrics_backlog(fileno(echo)));
+    }
+
+    // final frame: no ghost, cursor after the input
+    console_render_end(console);
+    console_region_reading(console, false);
+    if (EDITOR_EOF == action) {
+        forget_settled(console);
+        console->stream->status = STREAM_STATUS_ERROR;
+        fflush(echo);
+        return false;
+    }
+
+    notify_edit(console, CONSOLE_EDIT_SUBMIT, 0, line->length, line->buffer);
+    console_history_append(console->history, line->buffer, line->length);
+    console_page_append_line(console->stream->page, line->buffer, line->length);
+
+    // files the line references are mapped now and shown, for the host to send along
+    if (NULL != memchr(line->buffer, CONSOLE_REFERENCE_MARKER, line->length)) {
+        console->expansion = console_expand_line(line);
+        if (NULL != console->expansion && 0 == console->expansion->count) {
+            console_destroy_expansion(console->expansion); // no reference named a file
+            console->expansion = NULL;
+        }
+        if (NULL != console->expansion && console->state->preview > 0) {
+            console_show_expansion(console, console->expansion, console->state->preview);
+        }
+    }
+
+    console->stream->status = STREAM_STATUS_OK;
+    fflush(echo);
+    return true;
 }
 
 int main() {
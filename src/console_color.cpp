@@ -0,0 +1,213 @@
+/**
+ * @file console_color.cpp
+ *
+ * @brief Colors as values: indexed or 24-bit, mapped to what the terminal shows through
+ * precomputed nearest-color tables, and rendered to SGR bytes once per color.
+ *
+ */
+
+#include <console_color.h>
+
+#include <string.h>
+
+// The 16 ANSI colors as xterm sets them up; 16-231 are a 6x6x6 cube, 232-255 grays
+static const unsigned char ansi_palette[16][3] = {
+    {0, 0, 0},       {205, 0, 0},   {0, 205, 0},   {205, 205, 0},
+    {0, 0, 238},     {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0},   {0, 255, 0},   {255, 255, 0},
+    {92, 92, 255},   {255, 0, 255}, {0, 255, 255}, {255, 255, 255}
+};
+
+static const int cube_levels[6] = {0, 95, 135, 175, 215, 255};
+
+static void palette_rgb(int index, int* rgb) {
+    if (index < 16) {
+        for (size_t i = 0; i < 3; i++) {
+            rgb[i] = ansi_palette[index][i];
+        }
+    } else if (index < 232) {
+        rgb[0] = cube_levels[(index - 16) / 36];
+        rgb[1] = cube_levels[(index - 16) / 6 % 6];
+        rgb[2] = cube_levels[(index - 16) % 6];
+    } else {
+        rgb[0] = rgb[1] = rgb[2] = 8 + 10 * (index - 232);
+    }
+}
+
+int console_color_palette(int index) {
+    int rgb[3];
+    palette_rgb(index & 0xFF, rgb);
+    return CONSOLE_COLOR_RGB(rgb[0], rgb[1], rgb[2]);
+}
+
+// Squared distance weighted by how sensitive the eye is to each channel ("redmean")
+static int distance(const int* a, const int* b) {
+    int mean  = (a[0] + b[0]) / 2;
+    int red   = a[0] - b[0];
+    int green = a[1] - b[1];
+    int blue  = a[2] - b[2];
+    return ((512 + mean) * red * red >> 8) + 4 * green * green
+           + ((767 - mean) * blue * blue >> 8);
+}
+
+// Closer of `index` and `best` to `rgb`
+static int closer(const int* rgb, int index, int best) {
+    int entry[3];
+    int other[3];
+    palette_rgb(index, entry);
+    palette_rgb(best, other);
+    return distance(rgb, entry) < distance(rgb, other) ? index : best;
+}
+
+// Nearest of the cube and the grays. Both are regular, so the candidates are found by
+// arithmetic: the cube level nearest each channel, and the grays around the average.
+static int nearest_indexed(const int* rgb) {
+    int cube = 16;
+    for (size_t channel = 0; channel < 3; channel++) {
+        int level = 0;
+        while (level < 5 && rgb[channel] > (cube_levels[level] + cube_levels[level + 1]) / 2) {
+            level++;
+        }
+        cube += level * (channel == 0 ? 36 : channel == 1 ? 6 : 1);
+    }
+    int gray = ((rgb[0] + rgb[1] + rgb[2]) / 3 - 3) / 10;
+    gray     = gray < 0 ? 0 : gray > 23 ? 23 : gray;
+    int best = closer(rgb, 232 + gray, cube);
+    if (gray > 0) {
+        best = closer(rgb, 231 + gray, best);
+    }
+    if (gray < 23) {
+        best = closer(rgb, 233 + gray, best);
+    }
+    return best;
+}
+
+static int nearest_ansi(const int* rgb) {
+    int best = 0;
+    for (int index = 1; index < 16; index++) {
+        best = closer(rgb, index, best);
+    }
+    return best;
+}
+
+// Nearest palette entries for each cell of a 32x32x32 grid over RGB, at the cell's
+// center. The 256-color table only uses the cube and the grays, which unlike the ANSI
+// colors do not change with the terminal's theme. ANSI indices take a nibble each.
+struct ColorTables {
+    unsigned char indexed[32 * 32 * 32];
+    unsigned char ansi[32 * 32 * 32 / 2];
+};
+
+static const ColorTables* build_tables(void) {
+    static ColorTables tables;
+    for (int cell = 0; cell < 32 * 32 * 32; cell++) {
+        int rgb[3] = {(cell >> 10) * 8 + 4, (cell >> 5 & 31) * 8 + 4, (cell & 31) * 8 + 4};
+        tables.indexed[cell]    = (unsigned char) nearest_indexed(rgb);
+        tables.ansi[cell / 2] |= (unsigned char) (nearest_ansi(rgb) << (cell % 2 * 4));
+    }
+    return &tables;
+}
+
+int console_color_map(int color, int colors) {
+    if (CONSOLE_COLOR_DEFAULT == color || colors >= CONSOLE_COLORS_TRUE) {
+        return color;
+    }
+    if (colors < 16) {
+        return CONSOLE_COLOR_DEFAULT;
+    }
+    if (!CONSOLE_COLOR_IS_RGB(color)) {
+        if (color < colors) {
+            return color;
+        }
+        color = console_color_palette(color);
+    }
+
+    static const ColorTables* tables = build_tables(); // once, thread-safe
+    int cell = (color >> 19 & 31) << 10 | (color >> 11 & 31) << 5 | (color >> 3 & 31);
+    if (colors >= 256) {
+        return tables->indexed[cell];
+    }
+    return tables->ansi[cell / 2] >> (cell % 2 * 4) & 0xF;
+}
+
+struct ColorSgr {
+    int           color;
+    unsigned char length;
+    char          bytes[CONSOLE_COLOR_SGR_MAX];
+};
+
+static size_t append_number(char* out, size_t length, int number) {
+    char   digits[4];
+    size_t count = 0;
+    do {
+        digits[count++] = (char) ('0' + number % 10);
+        number         /= 10;
+    } while (number > 0);
+    while (count > 0) {
+        out[length++] = digits[--count];
+    }
+    return length;
+}
+
+static void render(ColorSgr* entry, int color, bool background) {
+    int    base   = background ? 40 : 30;
+    char*  out    = entry->bytes;
+    size_t length = 2;
+    out[0]        = '\x1b';
+    out[1]        = '[';
+    if (CONSOLE_COLOR_DEFAULT == color) {
+        length = append_number(out, length, base + 9);
+    } else if (CONSOLE_COLOR_IS_RGB(color)) {
+        length        = append_number(out, length, base + 8);
+        memcpy(out + length, ";2;", 3);
+        length        = append_number(out, length + 3, color >> 16 & 0xFF);
+        out[length++] = ';';
+        length        = append_number(out, length, color >> 8 & 0xFF);
+        out[length++] = ';';
+        length        = append_number(out, length, color & 0xFF);
+    } else if (color < 16) {
+        length = append_number(out, length, color < 8 ? base + color : base + 52 + color);
+    } else {
+        length        = append_number(out, length, base + 8);
+        memcpy(out + length, ";5;", 3);
+        length        = append_number(out, length + 3, color & 0xFF);
+    }
+    out[length++] = 'm';
+    entry->color  = color;
+    entry->length = (unsigned char) length;
+}
+
+// Sequences of the default and indexed colors, foreground then background
+struct IndexedSgr {
+    ColorSgr entries[2][257]; // the default color last
+};
+
+static const IndexedSgr* build_indexed(void) {
+    static IndexedSgr table;
+    for (int layer = 0; layer < 2; layer++) {
+        for (int index = 0; index < 256; index++) {
+            render(&table.entries[layer][index], index, 1 == layer);
+        }
+        render(&table.entries[layer][256], CONSOLE_COLOR_DEFAULT, 1 == layer);
+    }
+    return &table;
+}
+
+const char* console_color_sgr(int color, bool background, size_t* length) {
+    const ColorSgr* entry;
+    if (!CONSOLE_COLOR_IS_RGB(color)) {
+        static const IndexedSgr* table = build_indexed(); // once, thread-safe
+        entry = &table->entries[background][CONSOLE_COLOR_DEFAULT == color ? 256 : color & 0xFF];
+    } else {
+        // direct-mapped: heatmaps and highlighting reuse a handful of colors
+        static thread_local ColorSgr cache[2][64];
+        unsigned  hash = (unsigned) color * 0x9E3779B1u >> 26;
+        ColorSgr* slot = &cache[background][hash];
+        if (slot->color != color) {
+            render(slot, color, background);
+        }
+        entry = slot;
+    }
+    *length = entry->length;
+    return entry->bytes;
+}
@@ -0,0 +1,488 @@
+/**
+ * @file console_event.cpp
+ *
+ * @brief Batch decoding of terminal input into typed events.
+ *
+ */
+
+#include <console_event.h>
+#include <console_metrics.h>
+#include <ctype.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+// SIGWINCH only raises a flag, the next batch read turns it into a RESIZE event.
+static volatile sig_atomic_t resized  = 0;
+static size_t                watchers = 0; // consoles holding the handler
+static struct sigaction      previous_winch;
+
+static void on_winch(int signal) {
+    resized = 1;
+    if (previous_winch.sa_handler != SIG_IGN && previous_winch.sa_handler != SIG_DFL
+        && !(previous_winch.sa_flags & SA_SIGINFO)) {
+        previous_winch.sa_handler(signal); // keep the host's handler working
+    }
+}
+
+static void watch_resize(ConsoleTypeahead* typeahead) {
+    if (typeahead->resize) {
+        return;
+    }
+    if (0 == watchers) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = on_winch;
+        action.sa_flags   = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGWINCH, &action, &previous_winch);
+    }
+    watchers++;
+    typeahead->resize = true;
+}
+
+void console_release_events(Console* console) {
+    ConsoleTypeahead* typeahead = console->typeahead;
+    if (NULL == typeahead || !typeahead->resize) {
+        return;
+    }
+    typeahead->resize = false;
+    if (0 == --watchers) {
+        sigaction(SIGWINCH, &previous_winch, NULL);
+        resized = 0;
+    }
+}
+
+// Move the pending bytes to the front of the ring so they can be parsed in place.
+static bool linearize(ConsoleTypeahead* typeahead) {
+    size_t mask    = typeahead->size - 1;
+    size_t pending = typeahead->tail - typeahead->head;
+    size_t start   = typeahead->head & mask;
+    if (0 == start) {
+        typeahead->head = 0;
+        typeahead->tail = pending;
+        return true;
+    }
+
+    if (start + pending <= typeahead->size) {
+        memmove(typeahead->buffer, typeahead->buffer + start, pending);
+    } else {
+        // wrapped: rotate via a scratch copy of the front part
+        size_t         front   = (start + pending) & mask;
+        unsigned char* scratch = (unsigned char*) malloc(front);
+        if (NULL == scratch) {
+            return false;
+        }
+        memcpy(scratch, typeahead->buffer, front);
+        memmove(typeahead->buffer, typeahead->buffer + start, pending - front);
+        memcpy(typeahead->buffer + pending - front, scratch, front);
+        free(scratch);
+    }
+    typeahead->head = 0;
+    typeahead->tail = pending;
+    return true;
+}
+
+static void clear_event(ConsoleEvent* event, ConsoleEventType type) {
+    memset(event, 0, sizeof(*event));
+    event->type = type;
+}
+
+static void key_event(ConsoleEvent* event, StreamEvent key, unsigned modifiers) {
+    clear_event(event, CONSOLE_EVENT_KEY);
+    event->key       = key;
+    event->modifiers = modifiers;
+}
+
+// Map a `CSI number ~` sequence to its key.
+static bool tilde_key(ConsoleEvent* event, int number, unsigned modifiers) {
+    // F5..F12 are 15, 17-21, 23, 24; the gaps are historical
+    static const int function_keys[] = {15, 17, 18, 19, 20, 21, 23, 24};
+
+    switch (number) {
+        case 1:
+        case 7:
+            key_event(event, STREAM_EVENT_HOME, modifiers);
+            return true;
+        case 4:
+        case 8:
+            key_event(event, STREAM_EVENT_END, modifiers);
+            return true;
+        case 2:
+            key_event(event, STREAM_EVENT_INSERT_KEY, modifiers);
+            return true;
+        case 3:
+            key_event(event, STREAM_EVENT_DEL, modifiers);
+            return true;
+        case 5:
+            key_event(event, STREAM_EVENT_PAGE_UP, modifiers);
+            return true;
+        case 6:
+            key_event(event, STREAM_EVENT_PAGE_DOWN, modifiers);
+            return true;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (function_keys[i] == number) {
+            key_event(event, STREAM_EVENT_FUNCTION, modifiers);
+            event->codepoint = (uint32_t) (5 + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Keys sharing a final byte between CSI and SS3 forms: arrows, Home/End, F1-F4.
+static bool final_key(ConsoleEvent* event, unsigned char final, unsigned modifiers) {
+    switch (final) {
+        case 'A':
+            key_event(event, STREAM_EVENT_UP, modifiers);
+            return true;
+        case 'B':
+            key_event(event, STREAM_EVENT_DOWN, modifiers);
+            return true;
+        case 'C':
+            key_event(event, STREAM_EVENT_RIGHT, modifiers);
+            return true;
+        case 'D':
+            key_event(event, STREAM_EVENT_LEFT, modifiers);
+            return true;
+        case 'H':
+            key_event(event, STREAM_EVENT_HOME, modifiers);
+            return true;
+        case 'F':
+            key_event(event, STREAM_EVENT_END, modifiers);
+            return true;
+        case 'P':
+        case 'Q':
+        case 'R':
+        case 'S':
+            key_event(event, STREAM_EVENT_FUNCTION, modifiers);
+            event->codepoint = (uint32_t) (1 + final - 'P');
+            return true;
+    }
+    return false;
+}
+
+// Decode a CSI sequence starting after `ESC [`. Returns bytes used (0 if incomplete).
+// `*emitted` is false for well-formed sequences this decoder has no event for, and for
+// malformed ones, which use the bytes before the one that broke them, possibly none.
+// Pasted text is copied to just below `*spare`, which then moves down past it.
+static size_t decode_csi(
+    const unsigned char* data, size_t length, ConsoleEvent* event, bool* emitted, char** spare
+) {
+    static const char paste_end[] = "\x1b[201~";
+
+    size_t i         = 0;
+    bool   mouse     = i < length && '<' == data[i];
+    int    values[4] = {0, 0, 0, 0};
+    int    count     = 0;
+    if (mouse) {
+        i++;
+    }
+    for (; i < length; i++) {
+        unsigned char byte = data[i];
+        if (byte >= '0' && byte <= '9') {
+            if (count < 4) {
+                values[count] = values[count] * 10 + (byte - '0');
+            }
+        } else if (';' == byte) {
+            count++;
+        } else if (byte >= 0x40 && byte <= 0x7E) {
+            break;
+        } else if (byte < 0x20 || byte > 0x3F) {
+            *emitted = false; // malformed, drop what was read so far
+            return i;
+        }
+    }
+    if (i >= length) {
+        return 0;
+    }
+    count++;
+
+    unsigned char final     = data[i];
+    size_t        used      = i + 1;
+    unsigned      modifiers = count > 1 && values[1] > 0 ? (unsigned) values[1] - 1 : 0;
+    *emitted                = true;
+
+    if (mouse && ('M' == final || 'm' == final) && count >= 3) {
+        clear_event(event, CONSOLE_EVENT_MOUSE);
+        event->button    = values[0] & ~(4 | 8 | 16);
+        event->modifiers = (values[0] & 4 ? CONSOLE_MOD_SHIFT : 0)
+                           | (values[0] & 8 ? CONSOLE_MOD_ALT : 0)
+                           | (values[0] & 16 ? CONSOLE_MOD_CTRL : 0);
+        event->x         = values[1];
+        event->y         = values[2];
+        event->pressed   = 'M' == final;
+        return used;
+    }
+
+    if ('~' == final && 200 == values[0]) {
+        // bracketed paste: wait until the closing marker has arrived
+        const unsigned char* end
+            = (const unsigned char*) memmem(data + used, length - used, paste_end, 6);
+        if (NULL == end) {
+            return 0;
+        }
+        // the paste buffer is as large as the pending input, so earlier spans stay valid
+        size_t size  = (size_t) (end - (data + used));
+        *spare      -= size;
+        memcpy(*spare, data + used, size);
+        clear_event(event, CONSOLE_EVENT_PASTE);
+        event->data   = *spare;
+        event->length = size;
+        return (size_t) (end - data) + 6;
+    }
+
+    if ('~' == final && tilde_key(event, values[0], modifiers)) {
+        return used;
+    }
+    if ('R' == final && count == 2 && values[1] > 0) {
+        clear_event(event, CONSOLE_EVENT_POSITION);
+        event->y = values[0];
+        event->x = values[1];
+        return used;
+    }
+    if ('Z' == final) { // Shift+Tab
+        key_event(event, STREAM_EVENT_TAB, CONSOLE_MOD_SHIFT);
+        return used;
+    }
+    *emitted = final_key(event, final, modifiers);
+    return used;
+}
+
+// Decode one event at `data`. Returns bytes used, 0 if the input ends mid-sequence.
+static size_t decode_event(
+    const unsigned char* data, size_t length, ConsoleEvent* event, bool* emitted, char** spare
+) {
+    unsigned char byte = data[0];
+    *emitted           = true;
+
+    if (0x1B == byte) {
+        if (1 == length) {
+            // nothing followed in the same delivery: the Escape key itself
+            key_event(event, STREAM_EVENT_ESC, 0);
+            return 1;
+        }
+        if ('[' == data[1]) {
+            // malformed, e.g. Alt+[ then Enter: drop `ESC [`, the Enter decodes on its own
+            size_t used = decode_csi(data + 2, length - 2, event, emitted, spare);
+            return 0 == used && *emitted ? 0 : used + 2;
+        }
+        // SS3 key, e.g. ESC O A; without a final byte after it, Alt+O like any other chord
+        if ('O' == data[1] && length > 2 && final_key(event, data[2], 0)) {
+            return 3;
+        }
+        // ESC + key is the Alt chord of that key
+        size_t used = decode_event(data + 1, length - 1, event, emitted, spare);
+        if (0 == used) {
+            return 0;
+        }
+        event->modifiers |= CONSOLE_MOD_ALT;
+        return used + 1;
+    }
+
+    if ('\r' == byte || '\n' == byte) {
+        key_event(event, STREAM_EVENT_ENTER, 0);
+        return 1;
+    }
+    if ('\t' == byte) {
+        key_event(event, STREAM_EVENT_TAB, 0);
+        return 1;
+    }
+    if (0x7F == byte || '\b' == byte) {
+        key_event(event, STREAM_EVENT_BACKSPACE, 0);
+        return 1;
+    }
+    if (byte < 0x20) {
+        // Ctrl+letter arrives as the letter's position in the alphabet
+        clear_event(event, CONSOLE_EVENT_CODEPOINT);
+        event->codepoint = 0 == byte ? ' ' : (uint32_t) (byte + 'a' - 1);
+        event->modifiers = CONSOLE_MOD_CTRL;
+        return 1;
+    }
+
+    // UTF-8: a lead byte and its continuation bytes
+    size_t   count     = 1;
+    uint32_t codepoint = byte;
+    if ((byte & 0xE0) == 0xC0) {
+        count     = 2;
+        codepoint = byte & 0x1F;
+    } else if ((byte & 0xF0) == 0xE0) {
+        count     = 3;
+        codepoint = byte & 0x0F;
+    } else if ((byte & 0xF8) == 0xF0) {
+        count     = 4;
+        codepoint = byte & 0x07;
+    } else if (byte >= 0x80) {
+        count     = 0; // stray continuation or invalid lead byte
+    }
+
+    clear_event(event, CONSOLE_EVENT_CODEPOINT);
+    if (0 == count) {
+        event->codepoint = 0xFFFD;
+        return 1;
+    }
+    if (count > length) {
+        return 0;
+    }
+    for (size_t i = 1; i < count; i++) {
+        if ((data[i] & 0xC0) != 0x80) {
+            event->codepoint = 0xFFFD; // truncated sequence, resynchronize at this byte
+            return i;
+        }
+        codepoint = (codepoint << 6) | (data[i] & 0x3F);
+    }
+    event->codepoint = codepoint;
+    return count;
+}
+
+size_t console_read_events(Console* console, ConsoleEvent* events, size_t max) {
+    CONSOLE_TIMER(CONSOLE_METRIC_DECODE);
+
+    ConsoleTypeahead* typeahead = console->typeahead;
+    size_t            count     = 0;
+
+    watch_resize(typeahead);
+    console_typeahead_drain(console);
+
+    if (count < max && resized) {
+        resized = 0;
+        struct winsize window_size;
+        clear_event(&events[count], CONSOLE_EVENT_RESIZE);
+        if (0 == ioctl(fileno(console->io->teletype), TIOCGWINSZ, &window_size)) {
+            events[count].x = window_size.ws_col;
+            events[count].y = window_size.ws_row;
+        }
+        count++;
+    }
+    if (count < max && typeahead->interrupt) {
+        typeahead->interrupt = false;
+        clear_event(&events[count], CONSOLE_EVENT_SIGNAL);
+        events[count].signal = SIGINT;
+        count++;
+    }
+
+    // Pastes are copied into a buffer as large as the pending input, filled from the back,
+    // so all spans handed out in this batch stay valid together.
+    size_t pending = typeahead->tail - typeahead->head;
+    if (pending > typeahead->paste_size || NULL == typeahead->paste) {
+        char* paste = (char*) realloc(typeahead->paste, pending + 1);
+        if (NULL == paste) {
+            return count;
+        }
+        typeahead->paste      = paste;
+        typeahead->paste_size = pending;
+    }
+    if (!linearize(typeahead)) {
+        return count;
+    }
+
+    const unsigned char* data   = typeahead->buffer;
+    char*                spare  = typeahead->paste + pending;
+    size_t               offset = 0;
+    while (count < max && offset < pending) {
+        bool   emitted;
+        size_t used
+            = decode_event(data + offset, pending - offset, &events[count], &emitted, &spare);
+        if (0 == used) {
+            break; // incomplete, wait for the rest
+        }
+        events[count].source  = offset;
+        offset               += used;
+        if (emitted) {
+            count++;
+        }
+    }
+    typeahead->head += offset;
+
+    if (count < max && typeahead->eof) {
+        typeahead->head = typeahead->tail; // the rest of a sequence is never coming
+        clear_event(&events[count], CONSOLE_EVENT_EOF);
+        events[count++].source = typeahead->tail;
+    }
+    return count;
+}
+
+void console_unread_events(Console* console, const ConsoleEvent* event) {
+    // the batch was decoded from the front of the linearized ring and is still there
+    if (event->source < console->typeahead->head) {
+        console->typeahead->head = event->source;
+    }
+}
+
+// Find the last `ESC [ row ; col R` in the pending input and cut it out.
+static bool take_position(ConsoleTypeahead* typeahead, int* row, int* col) {
+    unsigned char* data    = typeahead->buffer;
+    size_t         pending = typeahead->tail - typeahead->head;
+
+    for (size_t end = pending; end-- > 0;) {
+        if ('R' != data[end]) {
+            continue;
+        }
+        size_t start  = end;
+        int    values = 0;
+        while (start > 0 && (isdigit(data[start - 1]) || ';' == data[start - 1])) {
+            values += ';' == data[--start];
+        }
+        if (1 != values || start < 2 || '[' != data[start - 1] || 0x1B != data[start - 2]) {
+            continue;
+        }
+        if (2 != sscanf((const char*) data + start, "%d;%d", row, col)) {
+            continue;
+        }
+        memmove(data + start - 2, data + end + 1, pending - end - 1);
+        typeahead->tail -= end + 3 - start;
+        return true;
+    }
+    return false;
+}
+
+bool console_query_position(Console* console, int timeout, int* row, int* col) {
+    ConsoleTypeahead* typeahead = console->typeahead;
+    FILE*             teletype  = console->io->teletype;
+
+    CONSOLE_COUNT(CONSOLE_METRIC_PROBES, 1);
+    fputs(ANSI_CURSOR_POS_QUERY, teletype);
+    fflush(teletype);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (true) {
+        console_typeahead_drain(console);
+        if (linearize(typeahead) && take_position(typeahead, row, col)) {
+            return true;
+        }
+        if (typeahead->eof) {
+            return false;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000
+                       + (now.tv_nsec - start.tv_nsec) / 1000000;
+
+        struct pollfd descriptor = {fileno(console->io->input), POLLIN, 0};
+        if (elapsed >= timeout || poll(&descriptor, 1, (int) (timeout - elapsed)) <= 0) {
+            return false;
+        }
+    }
+}
+
+void console_set_input_reporting(Console* console, bool paste, bool mouse) {
+    FILE* teletype = console->io->teletype;
+    if (paste != console->state->paste) {
+        fputs(paste ? "\x1b[?2004h" : "\x1b[?2004l", teletype);
+        console->state->paste = paste;
+    }
+    if (mouse != console->state->mouse) {
+        // 1000: press/release, 1006: SGR coordinates without the 223 column limit
+        fputs(mouse ? "\x1b[?1000h\x1b[?1006h" : "\x1b[?1006l\x1b[?1000l", teletype);
+        console->state->mouse = mouse;
+    }
+    fflush(teletype);
+}
@@ -0,0 +1,272 @@
+/**
+ * @file console_expand.cpp
+ *
+ * @brief Expands `@path` file references in a submitted line into a scatter-gather
+ * list of inline text and memory-mapped file regions.
+ *
+ */
+
+#include <console_expand.h>
+#include <console_sanitize.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Map a regular file read-only. Returns false if the path does not name one.
+static bool map_file(ConsoleMapping* mapping, const char* path, size_t length) {
+    mapping->path = strndup(path, length);
+    mapping->data = NULL;
+    mapping->size = 0;
+    if (NULL == mapping->path) {
+        return false;
+    }
+
+    int fd = open(mapping->path, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+        free(mapping->path);
+        return false;
+    }
+
+    struct stat info;
+    if (-1 == fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+        close(fd);
+        free(mapping->path);
+        return false;
+    }
+
+    if (info.st_size > 0) {
+        void* data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == data) {
+            close(fd);
+            free(mapping->path);
+            return false;
+        }
+        mapping->data = (char*) data;
+        mapping->size = (size_t) info.st_size;
+    }
+
+    close(fd); // the mapping keeps its own reference to the file
+    return true;
+}
+
+static void unmap_file(ConsoleMapping* mapping) {
+    if (NULL != mapping->data) {
+        munmap(mapping->data, mapping->size);
+    }
+    free(mapping->path);
+}
+
+// Find the extent of a reference starting at `start` (which points at the marker).
+// Sets `path`/`length` to the path and returns the index just past the token.
+static size_t scan_reference(
+    const char* buffer, size_t start, size_t end, const char** path, size_t* length
+) {
+    size_t i = start + 1;
+    if (i < end && '"' == buffer[i]) { // quoted form allows spaces: @"my notes.txt"
+        size_t close = i + 1;
+        while (close < end && '"' != buffer[close]) {
+            close++;
+        }
+        if (close >= end) {
+            *length = 0; // unterminated quote, leave as text
+            return i;
+        }
+        *path   = buffer + i + 1;
+        *length = close - i - 1;
+        return close + 1;
+    }
+
+    while (i < end && !isspace((unsigned char) buffer[i])) {
+        i++;
+    }
+    *path   = buffer + start + 1;
+    *length = i - start - 1;
+    return i;
+}
+
+ConsoleExpansion* console_expand_line(const ConsoleLine* line) {
+    if (NULL == line) {
+        return NULL;
+    }
+
+    ConsoleExpansion* expansion = (ConsoleExpansion*) malloc(sizeof(ConsoleExpansion));
+    if (NULL == expansion) {
+        return NULL;
+    }
+
+    // Every reference splits the line into at most two more segments, so count markers
+    // first and allocate once instead of growing the arrays while scanning.
+    size_t markers = 0;
+    for (size_t i = 0; i < line->length; i++) {
+        if (CONSOLE_REFERENCE_MARKER == line->buffer[i]) {
+            markers++;
+        }
+    }
+
+    expansion->segments = (ConsoleSegment*) malloc((2 * markers + 1) * sizeof(ConsoleSegment));
+    expansion->mappings = (ConsoleMapping*) malloc((markers + 1) * sizeof(ConsoleMapping));
+    expansion->length   = 0;
+    expansion->count    = 0;
+    if (NULL == expansion->segments || NULL == expansion->mappings) {
+        console_destroy_expansion(expansion);
+        return NULL;
+    }
+
+    const char* buffer       = line->buffer;
+    size_t      inline_start = 0;
+    size_t      i            = 0;
+    while (i < line->length) {
+        bool at_token = CONSOLE_REFERENCE_MARKER == buffer[i]
+                        && (0 == i || isspace((unsigned char) buffer[i - 1]));
+        if (!at_token) {
+            i++;
+            continue;
+        }
+
+        const char* path   = NULL;
+        size_t      length = 0;
+        size_t      next   = scan_reference(buffer, i, line->length, &path, &length);
+
+        ConsoleMapping* mapping = &expansion->mappings[expansion->count];
+        if (0 == length || !map_file(mapping, path, length)) {
+            i = next; // not a file, the token stays part of the inline text
+            continue;
+        }
+        expansion->count++;
+
+        if (i > inline_start) {
+            ConsoleSegment* text = &expansion->segments[expansion->length++];
+            text->data           = buffer + inline_start;
+            text->length         = i - inline_start;
+            text->mapping        = NULL;
+        }
+
+        ConsoleSegment* file = &expansion->segments[expansion->length++];
+        file->data           = mapping->data;
+        file->length         = mapping->size;
+        file->mapping        = mapping;
+
+        inline_start = i = next;
+    }
+
+    if (line->length > inline_start) {
+        ConsoleSegment* text = &expansion->segments[expansion->length++];
+        text->data           = buffer + inline_start;
+        text->length         = line->length - inline_start;
+        text->mapping        = NULL;
+    }
+
+    return expansion;
+}
+
+void console_destroy_expansion(ConsoleExpansion* expansion) {
+    if (NULL != expansion) {
+        if (NULL != expansion->mappings) {
+            for (size_t i = 0; i < expansion->count; i++) {
+                unmap_file(&expansion->mappings[i]);
+            }
+            free(expansion->mappings);
+        }
+        if (NULL != expansion->segments) {
+            free(expansion->segments);
+        }
+        free(expansion);
+    }
+}
+
+size_t console_expansion_size(const ConsoleExpansion* expansion) {
+    size_t size = 0;
+    for (size_t i = 0; i < expansion->length; i++) {
+        size += expansion->segments[i].length;
+    }
+    return size;
+}
+
+size_t console_mapping_preview(const ConsoleMapping* mapping, size_t rows, size_t columns) {
+    if (NULL == mapping || NULL == mapping->data || 0 == rows) {
+        return 0;
+    }
+
+    // Never look further than the visible area could show, whatever the file size is.
+    size_t limit = rows * columns;
+    if (0 == columns || limit > mapping->size) {
+        limit = mapping->size;
+    }
+    // only the head is read ahead; how the rest is gathered is up to the host
+    madvise(mapping->data, limit, MADV_WILLNEED);
+
+    size_t offset = 0;
+    for (size_t row = 0; row < rows && offset < limit; row++) {
+        const char* newline
+            = (const char*) memchr(mapping->data + offset, '\n', limit - offset);
+        if (NULL == newline) {
+            return limit;
+        }
+        offset = (size_t) (newline - mapping->data) + 1;
+    }
+    return offset;
+}
+
+// Append file bytes to `text` as they may be shown: nothing in them reaches the terminal
+// as a control, and a sequence cut off at the end is shown too.
+static void append_shown(
+    std::string &text, ConsoleSanitizer* sanitizer, const char* data, size_t length
+) {
+    size_t used = text.size();
+    text.resize(used + 2 * length + 2 * CONSOLE_SANITIZE_SLACK);
+    used += console_sanitize(sanitizer, data, length, &text[used]);
+    used += console_sanitize_finish(sanitizer, &text[used]);
+    text.resize(used);
+}
+
+void console_show_expansion(Console* console, const ConsoleExpansion* expansion, size_t rows) {
+    struct winsize window_size;
+    size_t         columns = 80;
+    if (0 == ioctl(fileno(console->io->teletype), TIOCGWINSZ, &window_size)
+        && window_size.ws_col > 0) {
+        columns = window_size.ws_col;
+    }
+
+    ConsoleSanitizer* sanitizer = console_create_sanitizer(CONSOLE_SANITIZE_ESCAPE, 0);
+    if (NULL == sanitizer) {
+        fprintf(stderr, "debug: console_show_expansion: failed to allocate sanitizer\n");
+        return;
+    }
+
+    std::string text;
+    for (size_t i = 0; i < expansion->count; i++) {
+        const ConsoleMapping* mapping = &expansion->mappings[i];
+        char                  size[32];
+        snprintf(size, sizeof(size), " (%zu bytes)\n", mapping->size);
+        text += ANSI_BOLD "@";
+        append_shown(text, sanitizer, mapping->path, strlen(mapping->path));
+        text += ANSI_COLOR_RESET;
+        text += size;
+
+        size_t head  = console_mapping_preview(mapping, rows, columns);
+        text        += ANSI_COLOR_GRAY;
+        append_shown(text, sanitizer, mapping->data, head);
+        if (head > 0 && '\n' != mapping->data[head - 1]) {
+            text += '\n';
+        }
+        if (head < mapping->size) {
+            text += "...\n";
+        }
+        text += ANSI_COLOR_RESET;
+    }
+    console_destroy_sanitizer(sanitizer);
+
+    console_write_terminal(console, text.data(), text.size());
+    console->state->display = STATE_DISPLAY_RESET; // the previews reset any active style
+}
+
+void console_set_expand_preview(Console* console, size_t rows) {
+    console->state->preview = rows;
+}
@@ -0,0 +1,345 @@
+/**
+ * @file console_exporter.cpp
+ *
+ * @brief Metrics endpoint: the counters and histograms of console_metrics.h served in the
+ * Prometheus text format on a local Unix socket, from the console's own input loop.
+ *
+ */
+
+#include <console_exporter.h>
+#include <console_metrics.h>
+#include <errno.h>
+#include <new>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+enum MetricKind {
+    METRIC_TIMER,     // histogram in seconds
+    METRIC_COUNTER,   // the sum of what was counted
+    METRIC_HISTOGRAM, // histogram of plain values
+};
+
+struct MetricExport {
+    enum MetricKind kind;
+    const char*     help;
+};
+
+// In the order of enum ConsoleMetric
+static const MetricExport exports[] = {
+    {METRIC_TIMER, "Decoding a key, UTF-8 tail or escape sequence"},
+    {METRIC_TIMER, "Applying a batch of keys to the line"},
+    {METRIC_TIMER, "Display width and fitting computations"},
+    {METRIC_TIMER, "Producing echo and redraw bytes"},
+    {METRIC_TIMER, "Flushing buffered bytes to the terminal"},
+    {METRIC_COUNTER, "Bytes read from the terminal"},
+    {METRIC_COUNTER, "Model output bytes written"},
+    {METRIC_TIMER, "From a batch of keys read until its echo is flushed"},
+    {METRIC_COUNTER, "Cursor position queries sent to the terminal"},
+    {METRIC_HISTOGRAM, "Bytes drawn per input line frame"},
+    {METRIC_HISTOGRAM, "Bytes queued for the terminal and not yet sent, after a flush"},
+};
+static_assert(sizeof(exports) / sizeof(*exports) == CONSOLE_METRIC_COUNT, "one per metric");
+
+// A scrape: the request is read, then the response written as the socket takes it
+struct ExporterClient {
+    int         fd;       // -1 for a free slot
+    std::string request;
+    std::string response; // empty while the request is read
+    size_t      sent;
+};
+
+struct ConsoleExporter {
+    int            listener;
+    std::string    path;
+    ExporterClient clients[CONSOLE_EXPORTER_CLIENTS];
+};
+
+static void append(std::string &out, const char* format, ...) {
+    char    line[256];
+    va_list arguments;
+    va_start(arguments, format);
+    int count = vsnprintf(line, sizeof(line), format, arguments);
+    va_end(arguments);
+    if (count > 0) {
+        out.append(line, (size_t) count < sizeof(line) ? (size_t) count : sizeof(line) - 1);
+    }
+}
+
+// Bucket i of console_metrics.h holds values below 2^i, so its bound is 2^i - 1. The
+// last one also holds everything above and only shows in +Inf.
+static void format_histogram(
+    std::string &out, const char* name, const ConsoleMetricValue* value, bool seconds
+) {
+    uint64_t total = 0;
+    for (int bucket = 0; bucket + 1 < CONSOLE_METRIC_BUCKETS; bucket++) {
+        uint64_t bound  = (1ull << bucket) - 1;
+        total          += value->buckets[bucket];
+        if (seconds) {
+            append(out, "%s_bucket{le=\"%.9g\"} %llu\n", name, (double) bound / 1e9,
+                   (unsigned long long) total);
+        } else {
+            append(out, "%s_bucket{le=\"%llu\"} %llu\n", name, (unsigned long long) bound,
+                   (unsigned long long) total);
+        }
+    }
+    append(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) value->count);
+    if (seconds) {
+        append(out, "%s_sum %.9f\n", name, (double) value->sum / 1e9);
+    } else {
+        append(out, "%s_sum %llu\n", name, (unsigned long long) value->sum);
+    }
+    append(out, "%s_count %llu\n", name, (unsigned long long) value->count);
+}
+
+static void format_metrics(std::string &out) {
+    ConsoleMetricValue values[CONSOLE_METRIC_COUNT];
+    console_metrics_snapshot(values);
+
+    for (int metric = 0; metric < CONSOLE_METRIC_COUNT; metric++) {
+        const MetricExport* entry = &exports[metric];
+        const char*         name  = console_metric_name((ConsoleMetric) metric);
+        char                full[64];
+        switch (entry->kind) {
+            case METRIC_TIMER:
+                snprintf(full, sizeof(full), "console_%s_seconds", name);
+                break;
+            case METRIC_COUNTER:
+                snprintf(full, sizeof(full), "console_%s_total", name);
+                break;
+            default:
+                snprintf(full, sizeof(full), "console_%s", name);
+                break;
+        }
+        append(out, "# HELP %s %s\n", full, entry->help);
+        append(out, "# TYPE %s %s\n", full,
+               METRIC_COUNTER == entry->kind ? "counter" : "histogram");
+        if (METRIC_COUNTER == entry->kind) {
+            append(out, "%s %llu\n", full, (unsigned long long) values[metric].sum);
+        } else {
+            format_histogram(out, full, &values[metric], METRIC_TIMER == entry->kind);
+        }
+    }
+}
+
+static void respond(ExporterClient* client) {
+    std::string body;
+    format_metrics(body);
+    bool found = 0 == client->request.compare(0, 4, "GET ")
+                 || 0 == client->request.compare(0, 5, "HEAD ") || client->request.empty();
+    append(client->response,
+           "HTTP/1.0 %s\r\n"
+           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+           "Content-Length: %zu\r\n"
+           "Connection: close\r\n\r\n",
+           found ? "200 OK" : "405 Method Not Allowed", found ? body.size() : (size_t) 0);
+    if (found && 0 != client->request.compare(0, 5, "HEAD ")) {
+        client->response += body;
+    }
+    client->sent = 0;
+}
+
+static void close_client(ExporterClient* client) {
+    close(client->fd);
+    client->fd = -1;
+    client->request.clear();
+    client->response.clear();
+}
+
+static void accept_clients(ConsoleExporter* exporter) {
+    for (;;) {
+        int fd = accept4(exporter->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (-1 == fd) {
+            return; // EAGAIN once the backlog is empty
+        }
+        ExporterClient* free_slot = NULL;
+        for (ExporterClient &client : exporter->clients) {
+            if (-1 == client.fd) {
+                free_slot = &client;
+                break;
+            }
+        }
+        if (NULL == free_slot) {
+            close(fd); // busy: the scraper tries again next interval
+            continue;
+        }
+        free_slot->fd = fd;
+    }
+}
+
+// Read what there is of the request; answer once its headers end or the peer stops
+static void read_request(ExporterClient* client) {
+    char    buffer[1024];
+    ssize_t count = read(client->fd, buffer, sizeof(buffer));
+    if (-1 == count && (EAGAIN == errno || EINTR == errno)) {
+        return;
+    }
+    if (count > 0) {
+        client->request.append(buffer, (size_t) count);
+        if (std::string::npos == client->request.find("\r\n\r\n")
+            && std::string::npos == client->request.find("\n\n")
+            && client->request.size() < CONSOLE_EXPORTER_REQUEST) {
+            return;
+        }
+    } else if (-1 == count) {
+        close_client(client);
+        return;
+    }
+    respond(client);
+}
+
+static void write_response(ExporterClient* client) {
+    const std::string &response = client->response;
+    ssize_t            count    = send(client->fd, response.data() + client->sent,
+                                       response.size() - client->sent, MSG_NOSIGNAL);
+    if (-1 == count && (EAGAIN == errno || EINTR == errno)) {
+        return;
+    }
+    if (-1 == count || (client->sent += (size_t) count) == response.size()) {
+        close_client(client);
+    }
+}
+
+static void destroy_exporter(ConsoleExporter* exporter) {
+    for (ExporterClient &client : exporter->clients) {
+        if (-1 != client.fd) {
+            close(client.fd);
+        }
+    }
+    close(exporter->listener);
+    unlink(exporter->path.c_str());
+    delete exporter;
+}
+
+static int open_listener(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "debug: console_export_metrics: socket path too long\n");
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    // a socket left by an earlier run is replaced, anything else is not touched
+    struct stat info;
+    if (0 == lstat(path, &info) && S_ISSOCK(info.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (-1 == fd) {
+        fprintf(stderr, "debug: console_export_metrics: cannot create a socket\n");
+        return -1;
+    }
+    mode_t mask  = umask(077); // owner only from the start, not after a chmod
+    int    bound = bind(fd, (struct sockaddr*) &address, sizeof(address));
+    umask(mask);
+    if (-1 == bound || -1 == listen(fd, CONSOLE_EXPORTER_CLIENTS)) {
+        fprintf(stderr, "debug: console_export_metrics: cannot listen on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool console_export_metrics(Console* console, const char* path) {
+    if (NULL != console->exporter) {
+        destroy_exporter(console->exporter);
+        console->exporter = NULL;
+    }
+    if (NULL == path) {
+        return true;
+    }
+
+    ConsoleMetricValue values[CONSOLE_METRIC_COUNT];
+    if (!console_metrics_snapshot(values)) {
+        fprintf(stderr, "debug: console_export_metrics: built without CONSOLE_INSTRUMENT\n");
+        return false;
+    }
+
+    ConsoleExporter* exporter = new (std::nothrow) ConsoleExporter();
+    if (NULL == exporter) {
+        fprintf(stderr, "debug: console_export_metrics: failed to allocate exporter\n");
+        return false;
+    }
+    exporter->listener = open_listener(path);
+    if (-1 == exporter->listener) {
+        delete exporter;
+        return false;
+    }
+    exporter->path = path;
+    for (ExporterClient &client : exporter->clients) {
+        client.fd = -1;
+    }
+    console->exporter = exporter;
+    return true;
+}
+
+static long elapsed_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+int console_exporter_poll(Console* console, struct pollfd* input, int timeout) {
+    ConsoleExporter* exporter = console->exporter;
+    if (NULL == exporter) {
+        return poll(input, 1, timeout);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        // the input first, then the listener, then the clients in slot order
+        struct pollfd   descriptors[2 + CONSOLE_EXPORTER_CLIENTS];
+        ExporterClient* polled[CONSOLE_EXPORTER_CLIENTS];
+        nfds_t          count = 2;
+        descriptors[0]        = *input;
+        descriptors[1]        = {exporter->listener, POLLIN, 0};
+        for (ExporterClient &client : exporter->clients) {
+            if (-1 != client.fd) {
+                short events         = client.response.empty() ? POLLIN : POLLOUT;
+                polled[count - 2]    = &client;
+                descriptors[count++] = {client.fd, events, 0};
+            }
+        }
+
+        long remaining = timeout < 0 ? -1 : timeout - elapsed_since(&start);
+        int  result    = poll(descriptors, count, remaining > 0 ? (int) remaining
+                                                  : timeout < 0  ? -1
+                                                                 : 0);
+        if (result <= 0) {
+            input->revents = 0;
+            return result;
+        }
+
+        if (descriptors[1].revents & POLLIN) {
+            accept_clients(exporter);
+        }
+        for (nfds_t i = 2; i < count; i++) {
+            if (0 == descriptors[i].revents) {
+                continue;
+            }
+            if (polled[i - 2]->response.empty()) {
+                read_request(polled[i - 2]);
+            } else {
+                write_response(polled[i - 2]);
+            }
+        }
+
+        input->revents = descriptors[0].revents;
+        if (0 != input->revents) {
+            return 1;
+        }
+        if (timeout >= 0 && elapsed_since(&start) >= timeout) {
+            return 0;
+        }
+    }
+}
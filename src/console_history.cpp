@@ -0,0 +1,912 @@
+/**
+ * @file console_history.cpp
+ *
+ * @brief Line history with an incremental prefix index for inline autosuggestions.
+ *
+ */
+
+#include <console_history.h>
+#include <console_pool.h>
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Trie over the first CONSOLE_HISTORY_INDEX_DEPTH bytes of every entry. Each node
+// remembers the most recent entry passing through it, so an append updates at most
+// `depth` nodes and a suggestion is a walk down the prefix. Nodes live in one array and
+// list their children, newest first; the root, with the most, has a table instead.
+// Longer entries are also kept by the hash of their first `level` bytes, for each level
+// of the depth times a power of two they go past.
+struct HistoryNode {
+    uint32_t      latest;
+    uint32_t      child;   // first child, 0 for none: the root is nobody's child
+    uint32_t      sibling; // next child of the same parent
+    unsigned char byte;
+};
+
+struct HistoryIndex {
+    std::vector<HistoryNode>                            nodes; // [0] is the root
+    uint32_t                                            roots[256];
+    std::unordered_map<uint64_t, std::vector<uint32_t>> deep;  // by prefix hash, oldest first
+};
+
+// A run of consecutive entries and their trie, positions counted from the run's start.
+// The history is a list of them: those loaded from the file, then the live one appends
+// go to. Once a load is done its runs share one trie, a base.
+struct HistorySegment {
+    std::vector<std::string>               entries;
+    HistoryIndex                           index;
+    std::unordered_map<uint64_t, uint32_t> hashes;  // newest entry with each content hash
+    std::vector<bool>                      removed; // duplicates, sized on the first
+    size_t                                 first;   // position of the first entry
+    bool                                   indexed; // queries use `index`, not a base
+};
+
+// The merged trie of segments [from, to), positions counted from the first of them
+struct HistoryBase {
+    HistoryIndex* index;
+    size_t        from;
+    size_t        to;
+};
+
+// A file being loaded: chunks of it parsed and indexed in parallel on the shared pool,
+// the most recent first, then their tries merged into one
+struct HistoryChunk {
+    struct HistoryLoad* load;
+    const char*         data;
+    size_t              length;
+    HistorySegment*     segment; // built by the task, owned by the history once adopted
+    std::atomic<bool>   done;
+};
+
+struct HistoryLoad {
+    void*                      map;
+    size_t                     size;
+    std::vector<HistoryChunk*> chunks;    // oldest first
+    size_t                     adopted;   // from the newest, now segments of the history
+    size_t                     submitted; // from the newest, handed to the pool
+    std::atomic<size_t>        remaining; // chunks not parsed yet
+    std::atomic<bool>          unmerged;  // all parsed, but the pool had no room to merge
+    std::atomic<bool>          stop;
+    HistoryIndex*              merged;    // every chunk's trie in one, from the oldest
+    std::atomic<bool>          complete;  // `merged` is ready
+    ConsoleTaskGroup*          group;
+};
+
+// A rewrite of the history without its duplicates, built on the pool from the runs
+// sealed when it started, then swapped in by console_history_update()
+struct HistoryCompaction {
+    std::vector<const HistorySegment*> segments;  // sealed: nothing is added to them
+    std::vector<std::vector<bool>>     removed;   // their removed entries when sealed
+    enum ConsoleHistoryDuplicates      policy;
+    std::string                        path;      // the file to rewrite, empty for none
+    std::string                        temporary; // written next to it
+    HistorySegment*                    result;
+    bool                               written;   // `temporary` holds the result
+    std::atomic<bool>                  done;
+    ConsoleTaskGroup*                  group;
+};
+
+struct ConsoleHistory {
+    std::vector<HistorySegment*>  segments;   // oldest first, the last takes appends
+    std::vector<HistoryBase>      bases;      // one per completed load
+    size_t                        length;
+    enum ConsoleHistoryDuplicates duplicates;
+    HistoryLoad*                  load;       // in progress, its chunks go before `load_at`
+    size_t                        load_at;
+    HistoryCompaction*            compaction; // in progress
+    std::string                   path;
+    FILE*                         file;       // new entries are appended here once loaded
+};
+
+// 64-bit hash of an entry's bytes, eight at a time (MurmurHash64A)
+static uint64_t hash_entry(const char* data, size_t length) {
+    const uint64_t multiplier = 0xC6A4A7935BD1E995ULL;
+    uint64_t       hash       = 0x9E3779B97F4A7C15ULL ^ (length * multiplier);
+    size_t         i          = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        word *= multiplier;
+        word ^= word >> 47;
+        word *= multiplier;
+        hash ^= word;
+        hash *= multiplier;
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, length - i);
+        hash ^= word;
+        hash *= multiplier;
+    }
+    hash ^= hash >> 47;
+    hash *= multiplier;
+    hash ^= hash >> 47;
+    return hash;
+}
+
+static void init_index(HistoryIndex &index) {
+    index.nodes.assign(1, HistoryNode{0, 0, 0, 0});
+    memset(index.roots, 0, sizeof(index.roots));
+}
+
+static uint32_t find_child(const HistoryIndex &index, uint32_t node, unsigned char byte) {
+    if (0 == node) {
+        return index.roots[byte];
+    }
+    uint32_t child = index.nodes[node].child;
+    while (0 != child && index.nodes[child].byte != byte) {
+        child = index.nodes[child].sibling;
+    }
+    return child;
+}
+
+static uint32_t add_child(HistoryIndex &index, uint32_t node, unsigned char byte) {
+    uint32_t child = (uint32_t) index.nodes.size();
+    index.nodes.push_back(HistoryNode{0, 0, index.nodes[node].child, byte});
+    index.nodes[node].child = child;
+    if (0 == node) {
+        index.roots[byte] = child;
+    }
+    return child;
+}
+
+static void index_insert(HistoryIndex &index, const std::string &entry, uint32_t position) {
+    size_t   depth = entry.size() < CONSOLE_HISTORY_INDEX_DEPTH ? entry.size()
+                                                                : CONSOLE_HISTORY_INDEX_DEPTH;
+    uint32_t node  = 0;
+
+    index.nodes[node].latest = position;
+    for (size_t i = 0; i < depth; i++) {
+        unsigned char byte  = (unsigned char) entry[i];
+        uint32_t      child = find_child(index, node, byte);
+        node                = 0 != child ? child : add_child(index, node, byte);
+        index.nodes[node].latest = position;
+    }
+
+    for (size_t level = CONSOLE_HISTORY_INDEX_DEPTH; level < entry.size(); level *= 2) {
+        index.deep[hash_entry(entry.data(), level)].push_back(position);
+    }
+}
+
+// The level whose bucket holds the candidates for a prefix of `length` bytes past the
+// trie: the longest shorter than it, so they share more than half of it
+static size_t deep_level(size_t length) {
+    size_t level = CONSOLE_HISTORY_INDEX_DEPTH;
+    while (level * 2 < length) {
+        level *= 2;
+    }
+    return level;
+}
+
+// Fold the subtree of `from` at `node` into `into` at `target`, positions shifted by
+// `offset` and newer than all of `into`'s
+static void merge_node(
+    HistoryIndex &into, uint32_t target, const HistoryIndex &from, uint32_t node, uint32_t offset
+) {
+    into.nodes[target].latest = from.nodes[node].latest + offset;
+    for (uint32_t child = from.nodes[node].child; 0 != child; child = from.nodes[child].sibling) {
+        unsigned char byte  = from.nodes[child].byte;
+        uint32_t      found = find_child(into, target, byte);
+        found               = 0 != found ? found : add_child(into, target, byte);
+        merge_node(into, found, from, child, offset);
+    }
+}
+
+// Fold all of `from` into `into`, positions shifted by `offset` and newer than all of
+// `into`'s
+static void merge_index(HistoryIndex &into, const HistoryIndex &from, uint32_t offset) {
+    merge_node(into, 0, from, 0, offset);
+    for (const auto &bucket : from.deep) {
+        std::vector<uint32_t> &deep = into.deep[bucket.first];
+        for (uint32_t position : bucket.second) {
+            deep.push_back(position + offset);
+        }
+    }
+}
+
+// One entry per line; escape the bytes that would break that framing. The caller flushes.
+static void write_entry(FILE* file, const char* entry, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if ('\n' == entry[i]) {
+            fputs("\\n", file);
+        } else if ('\\' == entry[i]) {
+            fputs("\\\\", file);
+        } else {
+            fputc(entry[i], file);
+        }
+    }
+    fputc('\n', file);
+}
+
+static std::string read_entry(const char* line, size_t length) {
+    std::string entry;
+    entry.reserve(length);
+    for (size_t i = 0; i < length; i++) {
+        if ('\\' == line[i] && i + 1 < length) {
+            i++;
+            entry.push_back('n' == line[i] ? '\n' : line[i]);
+        } else {
+            entry.push_back(line[i]);
+        }
+    }
+    return entry;
+}
+
+static HistorySegment* create_segment(void) {
+    HistorySegment* segment = new (std::nothrow) HistorySegment();
+    if (NULL == segment) {
+        fprintf(stderr, "debug: console_history: failed to allocate segment\n");
+        return NULL;
+    }
+    init_index(segment->index);
+    segment->indexed = true;
+    return segment;
+}
+
+// Add an entry to the end of a run, to its trie and its hashes
+static void segment_add(HistorySegment* segment, std::string &&entry, uint64_t hash) {
+    uint32_t position = (uint32_t) segment->entries.size();
+    segment->entries.push_back(std::move(entry));
+    index_insert(segment->index, segment->entries.back(), position);
+    segment->hashes[hash] = position;
+}
+
+static bool is_removed(const HistorySegment* segment, size_t position) {
+    return position < segment->removed.size() && segment->removed[position];
+}
+
+static void remove_entry(HistorySegment* segment, size_t position) {
+    if (segment->removed.size() <= position) {
+        segment->removed.resize(segment->entries.size());
+    }
+    segment->removed[position] = true;
+}
+
+// Local position in `segment` of an entry equal to `entry`, or -1
+static long find_in_segment(
+    const HistorySegment* segment, const char* entry, size_t length, uint64_t hash
+) {
+    auto found = segment->hashes.find(hash);
+    if (found == segment->hashes.end() || is_removed(segment, found->second)) {
+        return -1;
+    }
+    const std::string &candidate = segment->entries[found->second];
+    return candidate.size() == length && 0 == memcmp(candidate.data(), entry, length)
+               ? (long) found->second
+               : -1;
+}
+
+static void merge_chunks(void* context) {
+    HistoryLoad*  load   = (HistoryLoad*) context;
+    HistoryIndex* merged = new (std::nothrow) HistoryIndex();
+    if (NULL != merged) {
+        init_index(*merged);
+        uint32_t offset = 0;
+        for (size_t i = 0; i < load->chunks.size() && !load->stop.load(); i++) {
+            const HistorySegment* segment = load->chunks[i]->segment;
+            merge_index(*merged, segment->index, offset);
+            offset += (uint32_t) segment->entries.size();
+        }
+    }
+    load->merged = merged; // NULL leaves the chunks' own tries in use
+    load->complete.store(true, std::memory_order_release);
+}
+
+// Parse and index one chunk; the last one to finish merges them all
+static void parse_chunk(void* context) {
+    HistoryChunk*   chunk   = (HistoryChunk*) context;
+    HistoryLoad*    load    = chunk->load;
+    HistorySegment* segment = chunk->segment;
+    const char*     line    = chunk->data;
+    const char*     end     = chunk->data + chunk->length;
+    while (line < end && !load->stop.load(std::memory_order_relaxed)) {
+        const char* newline = (const char*) memchr(line, '\n', (size_t) (end - line));
+        const char* stop    = NULL != newline ? newline : end;
+        std::string entry = read_entry(line, (size_t) (stop - line));
+        uint64_t    hash  = hash_entry(entry.data(), entry.size());
+        segment_add(segment, std::move(entry), hash);
+        line = stop + 1;
+    }
+    chunk->done.store(true, std::memory_order_release);
+
+    if (1 == load->remaining.fetch_sub(1, std::memory_order_acq_rel)
+        && !console_group_submit(load->group, console_shared_pool(), merge_chunks, load,
+                                 CONSOLE_PRIORITY_NORMAL)) {
+        load->unmerged.store(true, std::memory_order_release); // for the next update
+    }
+}
+
+// Hand the pool the chunks it has not taken yet, the newest first and ahead of the rest,
+// and the merge if it was refused. What is refused again waits for the next update: a
+// load never runs on the caller, which is the input thread.
+static void submit_load(HistoryLoad* load) {
+    size_t count = load->chunks.size();
+    while (load->submitted < count) {
+        enum ConsolePriority priority = 0 == load->submitted ? CONSOLE_PRIORITY_INTERACTIVE
+                                                             : CONSOLE_PRIORITY_NORMAL;
+        if (!console_group_submit(load->group, console_shared_pool(), parse_chunk,
+                                  load->chunks[count - 1 - load->submitted], priority)) {
+            break;
+        }
+        load->submitted++;
+    }
+    if (load->unmerged.exchange(false, std::memory_order_acquire)
+        && !console_group_submit(load->group, console_shared_pool(), merge_chunks, load,
+                                 CONSOLE_PRIORITY_NORMAL)) {
+        load->unmerged.store(true, std::memory_order_relaxed);
+    }
+}
+
+// Stop a load and free what the history has not adopted
+static void destroy_load(HistoryLoad* load) {
+    load->stop.store(true, std::memory_order_relaxed);
+    console_destroy_task_group(load->group);
+    for (size_t i = 0; i < load->chunks.size(); i++) {
+        if (i + load->adopted < load->chunks.size()) {
+            delete load->chunks[i]->segment;
+        }
+        delete load->chunks[i];
+    }
+    delete load->merged;
+    if (NULL != load->map) {
+        munmap(load->map, load->size);
+    }
+    delete load;
+}
+
+static void number_segments(ConsoleHistory* history) {
+    size_t first = 0;
+    for (HistorySegment* segment : history->segments) {
+        segment->first  = first;
+        first          += segment->entries.size();
+    }
+    history->length = first;
+}
+
+// Take in the chunks a load has finished; true once it is complete
+static bool update_load(ConsoleHistory* history) {
+    HistoryLoad* load = history->load;
+    if (NULL == load) {
+        return true;
+    }
+
+    submit_load(load);
+
+    // chunks join from the newest back, so positions only shift here
+    size_t count = load->chunks.size();
+    while (load->adopted < count
+           && load->chunks[count - 1 - load->adopted]->done.load(std::memory_order_acquire)) {
+        HistorySegment* segment = load->chunks[count - 1 - load->adopted]->segment;
+        history->segments.insert(history->segments.begin() + (long) history->load_at, segment);
+        load->adopted++;
+    }
+    number_segments(history);
+    if (!load->complete.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    // the chunks' tries give way to the merged one; later loads only add after them
+    if (NULL != load->merged) {
+        HistoryBase base = {load->merged, history->load_at, history->load_at + count};
+        history->bases.push_back(base);
+        load->merged = NULL;
+        for (size_t i = base.from; i < base.to; i++) {
+            history->segments[i]->indexed = false;
+            history->segments[i]->index   = HistoryIndex();
+        }
+    }
+    history->load = NULL;
+    destroy_load(load);
+    return true;
+}
+
+// Which entries a compaction keeps, in order, by its policy
+static void select_entries(
+    const HistoryCompaction* compaction, std::vector<const std::string*> &kept
+) {
+    std::vector<const std::string*> entries;
+    for (size_t k = 0; k < compaction->segments.size(); k++) {
+        const HistorySegment*    segment = compaction->segments[k];
+        const std::vector<bool> &removed = compaction->removed[k];
+        for (size_t i = 0; i < segment->entries.size(); i++) {
+            if (i >= removed.size() || !removed[i]) {
+                entries.push_back(&segment->entries[i]);
+            }
+        }
+    }
+
+    // ignoring all keeps the oldest copy of each entry, moving to the front the newest
+    bool                                   newest = CONSOLE_HISTORY_MOVE_TO_FRONT
+                                                    == compaction->policy;
+    std::vector<bool>                      keep(entries.size(), true);
+    std::unordered_map<uint64_t, uint32_t> seen;
+    for (size_t k = 0; k < entries.size(); k++) {
+        size_t             i     = newest ? entries.size() - 1 - k : k;
+        const std::string &entry = *entries[i];
+        switch (compaction->policy) {
+            case CONSOLE_HISTORY_IGNORE_CONSECUTIVE:
+                keep[i] = 0 == i || entry != *entries[i - 1];
+                break;
+            case CONSOLE_HISTORY_IGNORE_ALL:
+            case CONSOLE_HISTORY_MOVE_TO_FRONT: {
+                auto found = seen.emplace(hash_entry(entry.data(), entry.size()), (uint32_t) i);
+                keep[i]    = found.second || *entries[found.first->second] != entry;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (keep[i]) {
+            kept.push_back(entries[i]);
+        }
+    }
+}
+
+// Write the kept entries to a file next to the history file, with its permissions
+static bool write_compacted(HistoryCompaction* compaction) {
+    struct stat info;
+    compaction->temporary = compaction->path + ".XXXXXX";
+    int fd                = mkstemp(&compaction->temporary[0]);
+    if (-1 == fd) {
+        fprintf(stderr, "debug: console_history_compact: cannot create %s\n",
+                compaction->temporary.c_str());
+        return false;
+    }
+    if (0 == stat(compaction->path.c_str(), &info)) {
+        fchmod(fd, info.st_mode & 07777);
+    }
+    FILE* file = fdopen(fd, "w");
+    if (NULL == file) {
+        close(fd);
+        unlink(compaction->temporary.c_str());
+        return false;
+    }
+    for (const std::string &entry : compaction->result->entries) {
+        write_entry(file, entry.data(), entry.size());
+    }
+    bool written = 0 == fflush(file) && 0 == fsync(fd);
+    written      = 0 == fclose(file) && written;
+    if (!written) {
+        unlink(compaction->temporary.c_str());
+    }
+    return written;
+}
+
+static void compact_entries(void* context) {
+    HistoryCompaction*              compaction = (HistoryCompaction*) context;
+    std::vector<const std::string*> kept;
+    select_entries(compaction, kept);
+
+    compaction->result = create_segment();
+    if (NULL != compaction->result) {
+        for (const std::string* entry : kept) {
+            segment_add(compaction->result, std::string(*entry),
+                        hash_entry(entry->data(), entry->size()));
+        }
+        compaction->written = !compaction->path.empty() && write_compacted(compaction);
+    }
+    compaction->done.store(true, std::memory_order_release);
+}
+
+static void destroy_compaction(HistoryCompaction* compaction) {
+    console_destroy_task_group(compaction->group);
+    if (compaction->written) {
+        unlink(compaction->temporary.c_str()); // never swapped in
+    }
+    delete compaction->result;
+    delete compaction;
+}
+
+// Swap a finished compaction in; true when none is left in progress
+static bool update_compaction(ConsoleHistory* history) {
+    HistoryCompaction* compaction = history->compaction;
+    if (NULL == compaction) {
+        return true;
+    }
+    if (!compaction->done.load(std::memory_order_acquire)) {
+        return false;
+    }
+    history->compaction = NULL;
+    if (NULL == compaction->result) {
+        destroy_compaction(compaction);
+        return true;
+    }
+
+    // entries added since it started go after it, in the file too, and may repeat some
+    // of it
+    HistorySegment* result = compaction->result;
+    size_t          sealed = compaction->segments.size();
+    FILE*           file   = compaction->written ? fopen(compaction->temporary.c_str(), "a")
+                                                 : NULL;
+    for (size_t k = sealed; k < history->segments.size(); k++) {
+        const HistorySegment* segment = history->segments[k];
+        for (size_t i = 0; i < segment->entries.size(); i++) {
+            const std::string &entry = segment->entries[i];
+            if (is_removed(segment, i)) {
+                continue;
+            }
+            if (NULL != file) {
+                write_entry(file, entry.data(), entry.size());
+            }
+            long found = find_in_segment(result, entry.data(), entry.size(),
+                                         hash_entry(entry.data(), entry.size()));
+            if (found >= 0 && CONSOLE_HISTORY_MOVE_TO_FRONT == history->duplicates) {
+                remove_entry(result, (size_t) found);
+            }
+        }
+    }
+    if (NULL != file) {
+        bool written = 0 == fflush(file) && 0 == fsync(fileno(file));
+        written      = 0 == fclose(file) && written;
+        if (written && 0 == rename(compaction->temporary.c_str(), history->path.c_str())) {
+            compaction->written = false;
+            FILE* swapped       = fopen(history->path.c_str(), "a+");
+            if (NULL != swapped) {
+                fclose(history->file);
+                history->file = swapped;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < sealed; k++) {
+        delete history->segments[k];
+    }
+    for (const HistoryBase &base : history->bases) {
+        delete base.index;
+    }
+    history->bases.clear();
+    std::vector<HistorySegment*> &segments = history->segments;
+    segments.erase(segments.begin() + 1, segments.begin() + (long) sealed);
+    segments[0] = result;
+    compaction->result   = NULL;
+    number_segments(history);
+    destroy_compaction(compaction);
+    return true;
+}
+
+bool console_history_update(ConsoleHistory* history) {
+    bool loaded    = update_load(history);
+    bool compacted = update_compaction(history);
+    return loaded && compacted;
+}
+
+ConsoleHistory* console_create_history(void) {
+    ConsoleHistory* history = new (std::nothrow) ConsoleHistory();
+    if (NULL == history) {
+        return NULL;
+    }
+
+    HistorySegment* live = create_segment();
+    if (NULL == live) {
+        delete history;
+        return NULL;
+    }
+    history->segments.push_back(live);
+    history->file = NULL;
+    return history;
+}
+
+void console_destroy_history(ConsoleHistory* history) {
+    if (NULL != history) {
+        if (NULL != history->load) {
+            destroy_load(history->load);
+        }
+        if (NULL != history->compaction) {
+            destroy_compaction(history->compaction);
+        }
+        for (HistorySegment* segment : history->segments) {
+            delete segment;
+        }
+        for (const HistoryBase &base : history->bases) {
+            delete base.index;
+        }
+        if (NULL != history->file) {
+            fclose(history->file);
+        }
+        delete history;
+    }
+}
+
+// Split the mapped file into chunks at line ends: small ones at the end, so the most
+// recent entries are indexed first, doubling to a share of the pool's threads
+static bool split_file(HistoryLoad* load) {
+    const char* data    = (const char*) load->map;
+    size_t      threads = std::thread::hardware_concurrency();
+    size_t      largest = load->size / (2 * (threads > 0 ? threads : 1));
+    size_t      size    = CONSOLE_HISTORY_CHUNK;
+    size_t      end     = load->size;
+    largest             = largest > CONSOLE_HISTORY_CHUNK ? largest : CONSOLE_HISTORY_CHUNK;
+    while (end > 0) {
+        size_t start = end > size ? end - size : 0;
+        if (start > 0) {
+            const char* newline = (const char*) memrchr(data, '\n', start);
+            start               = NULL != newline ? (size_t) (newline - data) + 1 : 0;
+        }
+        HistoryChunk* chunk = new (std::nothrow) HistoryChunk();
+        if (NULL == chunk || NULL == (chunk->segment = create_segment())) {
+            delete chunk;
+            return false;
+        }
+        chunk->load   = load;
+        chunk->data   = data + start;
+        chunk->length = end - start;
+        load->chunks.push_back(chunk);
+        end  = start;
+        size = size < largest / 2 ? size * 2 : largest;
+    }
+    std::reverse(load->chunks.begin(), load->chunks.end());
+    return true;
+}
+
+bool console_history_load(ConsoleHistory* history, const char* path) {
+    FILE* file = fopen(path, "a+");
+    if (NULL == file) {
+        fprintf(stderr, "debug: console_history_load: cannot open %s\n", path);
+        return false;
+    }
+    struct stat info;
+    if (-1 == fstat(fileno(file), &info)) {
+        fclose(file);
+        return false;
+    }
+
+    // one load or compaction at a time: those in progress are waited for first
+    if (NULL != history->load) {
+        console_group_wait(history->load->group);
+    }
+    if (NULL != history->compaction) {
+        console_group_wait(history->compaction->group);
+    }
+    console_history_update(history);
+    if (NULL != history->file) {
+        fclose(history->file);
+    }
+    history->file = file; // "a+" writes always go to the end
+    history->path = path;
+    if (0 == info.st_size) {
+        return true;
+    }
+
+    HistoryLoad* load = new (std::nothrow) HistoryLoad();
+    if (NULL == load) {
+        fprintf(stderr, "debug: console_history_load: failed to allocate load\n");
+        return false;
+    }
+    load->size  = (size_t) info.st_size;
+    load->map   = mmap(NULL, load->size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    load->group = console_create_task_group();
+    HistorySegment* live = create_segment();
+    if (MAP_FAILED == load->map || NULL == load->group || NULL == live || !split_file(load)) {
+        load->map = MAP_FAILED == load->map ? NULL : load->map;
+        delete live;
+        destroy_load(load);
+        return false;
+    }
+
+    // the file's entries come after those already here; appends go after them
+    history->load_at = history->segments.size();
+    history->segments.push_back(live);
+    history->load = load;
+    load->remaining.store(load->chunks.size());
+    console_history_update(history); // submits the chunks
+    return true;
+}
+
+// The newest entry equal to `entry` that is not removed, newest run first
+static bool find_duplicate(
+    const ConsoleHistory* history, const char* entry, size_t length, uint64_t hash,
+    HistorySegment** segment, size_t* position
+) {
+    for (size_t k = history->segments.size(); k > 0; k--) {
+        long found = find_in_segment(history->segments[k - 1], entry, length, hash);
+        if (found >= 0) {
+            *segment  = history->segments[k - 1];
+            *position = (size_t) found;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool console_history_append(ConsoleHistory* history, const char* entry, size_t length) {
+    if (0 == length) {
+        return false;
+    }
+
+    uint64_t        hash = hash_entry(entry, length);
+    HistorySegment* segment;
+    size_t          position;
+    switch (history->duplicates) {
+        case CONSOLE_HISTORY_IGNORE_CONSECUTIVE:
+            for (size_t i = history->length; i > 0; i--) {
+                size_t      newest_length;
+                const char* newest = console_history_entry(history, i - 1, &newest_length);
+                if (NULL != newest) {
+                    if (newest_length == length && 0 == memcmp(newest, entry, length)) {
+                        return false;
+                    }
+                    break;
+                }
+            }
+            break;
+        case CONSOLE_HISTORY_IGNORE_ALL:
+            if (find_duplicate(history, entry, length, hash, &segment, &position)) {
+                return false;
+            }
+            break;
+        case CONSOLE_HISTORY_MOVE_TO_FRONT:
+            if (find_duplicate(history, entry, length, hash, &segment, &position)) {
+                remove_entry(segment, position);
+            }
+            break;
+        default:
+            break;
+    }
+
+    segment_add(history->segments.back(), std::string(entry, length), hash);
+    history->length++;
+
+    if (NULL != history->file) {
+        write_entry(history->file, entry, length);
+        fflush(history->file);
+    }
+    return true;
+}
+
+void console_history_set_duplicates(
+    ConsoleHistory* history, enum ConsoleHistoryDuplicates duplicates
+) {
+    history->duplicates = duplicates;
+}
+
+bool console_history_compact(ConsoleHistory* history) {
+    if (NULL != history->load || NULL != history->compaction) {
+        return false;
+    }
+    HistoryCompaction* compaction = new (std::nothrow) HistoryCompaction();
+    HistorySegment*    live       = create_segment();
+    if (NULL == compaction || NULL == live
+        || NULL == (compaction->group = console_create_task_group())) {
+        fprintf(stderr, "debug: console_history_compact: failed to allocate compaction\n");
+        delete compaction;
+        delete live;
+        return false;
+    }
+
+    // seal the runs so far: appends go to a new one while the pool reads them
+    for (const HistorySegment* segment : history->segments) {
+        compaction->segments.push_back(segment);
+        compaction->removed.push_back(segment->removed);
+    }
+    live->first        = history->length;
+    compaction->policy = history->duplicates;
+    compaction->path   = NULL != history->file ? history->path : std::string();
+    history->segments.push_back(live);
+    history->compaction = compaction;
+    if (!console_group_submit(compaction->group, console_shared_pool(), compact_entries,
+                              compaction, CONSOLE_PRIORITY_IDLE)) {
+        history->compaction = NULL; // the live run stays, empty
+        destroy_compaction(compaction);
+        return false;
+    }
+    return true;
+}
+
+size_t console_history_length(const ConsoleHistory* history) {
+    return history->length;
+}
+
+const char* console_history_entry(const ConsoleHistory* history, size_t index, size_t* length) {
+    if (index >= history->length) {
+        return NULL;
+    }
+    // the last segment that starts at or before `index`
+    const std::vector<HistorySegment*> &segments = history->segments;
+    size_t                              low      = 0;
+    size_t                              high     = segments.size();
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (segments[middle]->first <= index) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    while (index - segments[low]->first >= segments[low]->entries.size()) {
+        low++; // past empty segments
+    }
+    if (is_removed(segments[low], index - segments[low]->first)) {
+        return NULL;
+    }
+    const std::string &entry = segments[low]->entries[index - segments[low]->first];
+    if (NULL != length) {
+        *length = entry.size();
+    }
+    return entry.c_str();
+}
+
+// Most recent entry of one trie starting with `prefix`, `first` its first position
+static bool index_suggest(
+    const ConsoleHistory* history, const HistoryIndex &trie, size_t first, const char* prefix,
+    size_t length, size_t* index
+) {
+    size_t   depth = length < CONSOLE_HISTORY_INDEX_DEPTH ? length : CONSOLE_HISTORY_INDEX_DEPTH;
+    uint32_t node  = 0;
+    for (size_t i = 0; i < depth; i++) {
+        node = find_child(trie, node, (unsigned char) prefix[i]);
+        if (0 == node) {
+            return false;
+        }
+    }
+
+    if (length <= CONSOLE_HISTORY_INDEX_DEPTH) {
+        // a removed entry was moved to the front, where its newer copy is found first;
+        // should it not be, the older ones are checked
+        for (size_t i = first + trie.nodes[node].latest + 1; i > first; i--) {
+            size_t      entry_length;
+            const char* entry = console_history_entry(history, i - 1, &entry_length);
+            if (NULL != entry && entry_length >= length && 0 == memcmp(entry, prefix, length)) {
+                *index = i - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Past the indexed depth, check the candidates sharing most of the prefix, newest first.
+    auto bucket = trie.deep.find(hash_entry(prefix, deep_level(length)));
+    if (bucket == trie.deep.end()) {
+        return false;
+    }
+    for (auto it = bucket->second.rbegin(); it != bucket->second.rend(); ++it) {
+        size_t      entry_length;
+        const char* entry = console_history_entry(history, first + *it, &entry_length);
+        if (NULL != entry && entry_length >= length && 0 == memcmp(entry, prefix, length)) {
+            *index = first + *it;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool console_history_suggest(
+    const ConsoleHistory* history, const char* prefix, size_t length, size_t* index
+) {
+    if (0 == length || 0 == history->length) {
+        return false;
+    }
+
+    // newest first: each run's own trie, or a base once for the runs it covers
+    for (size_t i = history->segments.size(); i > 0; i--) {
+        const HistorySegment* segment = history->segments[i - 1];
+        if (segment->indexed) {
+            if (!segment->entries.empty()
+                && index_suggest(history, segment->index, segment->first, prefix, length, index)) {
+                return true;
+            }
+            continue;
+        }
+        for (const HistoryBase &base : history->bases) {
+            size_t first = history->segments[base.from]->first;
+            if (i == base.to && index_suggest(history, *base.index, first, prefix, length, index)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,411 @@
+/**
+ * @file console_json.cpp
+ *
+ * @brief Output stage that validates JSON as it streams and shows it indented and
+ * colored, reporting where the document completes or first goes wrong.
+ *
+ */
+
+#include <console_json.h>
+#include <console_style.h>
+
+#include <new>
+#include <string.h>
+#include <string>
+
+enum JsonState {
+    JSON_VALUE,          // top level, after ':', after ',' in an array
+    JSON_VALUE_OR_CLOSE, // after '['
+    JSON_KEY,            // after ',' in an object
+    JSON_KEY_OR_CLOSE,   // after '{'
+    JSON_COLON,
+    JSON_COMMA_OR_CLOSE, // after a value in an object or array
+    JSON_STRING,
+    JSON_ESCAPE,
+    JSON_UNICODE,
+    JSON_LITERAL,        // true, false or null
+    JSON_MINUS,          // numbers, by what they may continue with
+    JSON_ZERO,
+    JSON_INTEGER,
+    JSON_POINT,
+    JSON_FRACTION,
+    JSON_EXPONENT,
+    JSON_EXPONENT_SIGN,
+    JSON_EXPONENT_DIGITS,
+    JSON_AFTER           // the document is over or invalid, text passes as it is
+};
+
+// Colors of the tokens, ANSI indices
+static const int color_key     = 4; // blue
+static const int color_string  = 2; // green
+static const int color_number  = 3; // yellow
+static const int color_literal = 5; // magenta
+
+struct ConsoleJson {
+    ConsoleSink            sink;    // the printer as an output stage
+    size_t                 indent;  // spaces per level, 0 for one line
+    enum JsonState         state;
+    std::string            stack;   // '{' or '[' for each open container
+    bool                   opened;  // the innermost container has no elements yet
+    bool                   key;     // the string is an object key
+    const char*            literal; // being matched, with `matched` bytes seen
+    size_t                 matched;
+    size_t                 hex;     // digits left in a \u escape
+    enum ConsoleJsonStatus status;
+    size_t                 offset;  // bytes given since create or reset
+    size_t                 end;     // offset reported with the status
+    ConsoleStyleTracker    style;   // what the terminal has
+    std::string            out;     // output of the write in progress
+};
+
+static void emit(ConsoleJson* json, int color, const char* data, size_t length) {
+    ConsoleStyle style = console_style_default();
+    style.foreground   = color;
+
+    char sgr[CONSOLE_STYLE_MAX];
+    json->out.append(sgr, console_style_update(&json->style, &style, sgr));
+    json->out.append(data, length);
+}
+
+static void reset_style(ConsoleJson* json) {
+    char sgr[CONSOLE_STYLE_MAX];
+    json->out.append(sgr, console_style_reset(&json->style, sgr));
+}
+
+static void newline(ConsoleJson* json, size_t depth) {
+    if (json->indent > 0) {
+        emit(json, CONSOLE_COLOR_DEFAULT, "\n", 1);
+        json->out.append(depth * json->indent, ' ');
+    }
+}
+
+// The first element of a container goes on its own line, once it is known there is one
+static void begin_value(ConsoleJson* json) {
+    if (json->opened) {
+        json->opened = false;
+        newline(json, json->stack.size());
+    }
+}
+
+static void end_value(ConsoleJson* json, size_t end) {
+    if (!json->stack.empty()) {
+        json->state = JSON_COMMA_OR_CLOSE;
+        return;
+    }
+    reset_style(json);
+    json->status = CONSOLE_JSON_COMPLETE;
+    json->end    = end;
+    json->state  = JSON_AFTER;
+}
+
+// Returns false, so the byte is passed on as it is
+static bool fail(ConsoleJson* json) {
+    reset_style(json);
+    json->status = CONSOLE_JSON_INVALID;
+    json->end    = json->offset;
+    json->state  = JSON_AFTER;
+    return false;
+}
+
+static bool open_container(ConsoleJson* json, char c) {
+    if (json->stack.size() >= CONSOLE_JSON_DEPTH_MAX) {
+        return fail(json);
+    }
+    begin_value(json);
+    emit(json, CONSOLE_COLOR_DEFAULT, &c, 1);
+    json->stack.push_back(c);
+    json->opened = true;
+    json->state  = '{' == c ? JSON_KEY_OR_CLOSE : JSON_VALUE_OR_CLOSE;
+    return true;
+}
+
+static bool close_container(ConsoleJson* json, char c) {
+    if (json->stack.empty() || c != json->stack.back() + 2) { // '[' + 2 is ']', likewise {}
+        return fail(json);
+    }
+    json->stack.pop_back();
+    if (json->opened) {
+        json->opened = false; // empty, closed on the same line
+    } else {
+        newline(json, json->stack.size());
+    }
+    emit(json, CONSOLE_COLOR_DEFAULT, &c, 1);
+    end_value(json, json->offset + 1);
+    return true;
+}
+
+static bool start_value(ConsoleJson* json, char c) {
+    if ('{' == c || '[' == c) {
+        return open_container(json, c);
+    }
+
+    int color = color_number;
+    if ('"' == c) {
+        color       = color_string;
+        json->key   = false;
+        json->state = JSON_STRING;
+    } else if ('-' == c) {
+        json->state = JSON_MINUS;
+    } else if ('0' == c) {
+        json->state = JSON_ZERO;
+    } else if (c >= '1' && c <= '9') {
+        json->state = JSON_INTEGER;
+    } else if ('t' == c || 'f' == c || 'n' == c) {
+        color         = color_literal;
+        json->literal = 't' == c ? "true" : 'f' == c ? "false" : "null";
+        json->matched = 1;
+        json->state   = JSON_LITERAL;
+    } else {
+        return fail(json);
+    }
+    begin_value(json);
+    emit(json, color, &c, 1);
+    return true;
+}
+
+// The next state of a number after `c`: JSON_VALUE if `c` ends it, JSON_AFTER if it
+// makes it invalid
+static enum JsonState number(enum JsonState state, char c) {
+    bool digit    = c >= '0' && c <= '9';
+    bool exponent = 'e' == c || 'E' == c;
+    switch (state) {
+        case JSON_MINUS:
+            if ('0' == c) {
+                return JSON_ZERO;
+            }
+            return digit ? JSON_INTEGER : JSON_AFTER;
+        case JSON_ZERO:
+        case JSON_INTEGER:
+            if (digit) {
+                return JSON_ZERO == state ? JSON_AFTER : JSON_INTEGER; // no leading zeros
+            }
+            if ('.' == c) {
+                return JSON_POINT;
+            }
+            return exponent ? JSON_EXPONENT : JSON_VALUE;
+        case JSON_POINT:
+            return digit ? JSON_FRACTION : JSON_AFTER;
+        case JSON_FRACTION:
+            if (digit) {
+                return JSON_FRACTION;
+            }
+            return exponent ? JSON_EXPONENT : JSON_VALUE;
+        case JSON_EXPONENT:
+            if ('+' == c || '-' == c) {
+                return JSON_EXPONENT_SIGN;
+            }
+            return digit ? JSON_EXPONENT_DIGITS : JSON_AFTER;
+        case JSON_EXPONENT_SIGN:
+            return digit ? JSON_EXPONENT_DIGITS : JSON_AFTER;
+        case JSON_EXPONENT_DIGITS:
+            return digit ? JSON_EXPONENT_DIGITS : JSON_VALUE;
+        default:
+            return JSON_AFTER;
+    }
+}
+
+// Consume one byte, or return false to have it looked at again in the new state
+static bool step(ConsoleJson* json, char c) {
+    switch (json->state) {
+        case JSON_AFTER:
+            json->out.push_back(c);
+            return true;
+        case JSON_STRING:
+            if ((unsigned char) c < 0x20) {
+                return fail(json);
+            }
+            emit(json, json->key ? color_key : color_string, &c, 1);
+            if ('\\' == c) {
+                json->state = JSON_ESCAPE;
+            } else if ('"' == c) {
+                if (json->key) {
+                    json->state = JSON_COLON;
+                } else {
+                    end_value(json, json->offset + 1);
+                }
+            }
+            return true;
+        case JSON_ESCAPE:
+            if ('\0' == c || NULL == strchr("\"\\/bfnrtu", c)) {
+                return fail(json);
+            }
+            emit(json, json->key ? color_key : color_string, &c, 1);
+            json->hex   = 4;
+            json->state = 'u' == c ? JSON_UNICODE : JSON_STRING;
+            return true;
+        case JSON_UNICODE:
+            if (!((c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'))) {
+                return fail(json);
+            }
+            emit(json, json->key ? color_key : color_string, &c, 1);
+            json->state = 0 == --json->hex ? JSON_STRING : JSON_UNICODE;
+            return true;
+        case JSON_LITERAL:
+            if (c != json->literal[json->matched]) {
+                return fail(json);
+            }
+            emit(json, color_literal, &c, 1);
+            if ('\0' == json->literal[++json->matched]) {
+                end_value(json, json->offset + 1);
+            }
+            return true;
+        case JSON_MINUS:
+        case JSON_ZERO:
+        case JSON_INTEGER:
+        case JSON_POINT:
+        case JSON_FRACTION:
+        case JSON_EXPONENT:
+        case JSON_EXPONENT_SIGN:
+        case JSON_EXPONENT_DIGITS: {
+            enum JsonState next = number(json->state, c);
+            if (JSON_AFTER == next) {
+                return fail(json);
+            }
+            if (JSON_VALUE == next) {
+                end_value(json, json->offset);
+                return false;
+            }
+            emit(json, color_number, &c, 1);
+            json->state = next;
+            return true;
+        }
+        default:
+            break;
+    }
+
+    if (' ' == c || '\t' == c || '\n' == c || '\r' == c) {
+        return true; // the printer lays out its own whitespace
+    }
+    switch (json->state) {
+        case JSON_VALUE_OR_CLOSE:
+            return ']' == c ? close_container(json, c) : start_value(json, c);
+        case JSON_KEY_OR_CLOSE:
+            if ('}' == c) {
+                return close_container(json, c);
+            }
+            // fall through
+        case JSON_KEY:
+            if ('"' != c) {
+                return fail(json);
+            }
+            begin_value(json);
+            emit(json, color_key, &c, 1);
+            json->key   = true;
+            json->state = JSON_STRING;
+            return true;
+        case JSON_COLON:
+            if (':' != c) {
+                return fail(json);
+            }
+            emit(json, CONSOLE_COLOR_DEFAULT, ": ", 2);
+            json->state = JSON_VALUE;
+            return true;
+        case JSON_COMMA_OR_CLOSE:
+            if (',' != c) {
+                return close_container(json, c);
+            }
+            emit(json, CONSOLE_COLOR_DEFAULT, ",", 1);
+            if (0 == json->indent) {
+                json->out.push_back(' ');
+            }
+            newline(json, json->stack.size());
+            json->state = '{' == json->stack.back() ? JSON_KEY : JSON_VALUE;
+            return true;
+        default:
+            return start_value(json, c);
+    }
+}
+
+static void feed(ConsoleJson* json, const char* data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        if (JSON_AFTER == json->state) {
+            json->out.append(data + i, length - i);
+            json->offset += length - i;
+            return;
+        }
+        if (JSON_STRING == json->state) {
+            // string contents up to a quote, backslash or control at once
+            size_t count = 0;
+            while (i + count < length && '"' != data[i + count] && '\\' != data[i + count]
+                   && (unsigned char) data[i + count] >= 0x20) {
+                count++;
+            }
+            if (count > 0) {
+                emit(json, json->key ? color_key : color_string, data + i, count);
+                json->offset += count;
+                i            += count;
+                continue;
+            }
+        }
+        if (step(json, data[i])) {
+            json->offset++;
+            i++;
+        }
+    }
+}
+
+static void json_write(Console* console, ConsoleSink* sink, const char* data, size_t length) {
+    ConsoleJson* json = (ConsoleJson*) sink->context;
+
+    json->out.clear();
+    feed(json, data, length);
+    if (!json->out.empty()) {
+        console_sink_pass(console, sink, json->out.data(), json->out.size());
+    }
+}
+
+static void json_flush(Console* console, ConsoleSink* sink) {
+    ConsoleJson* json = (ConsoleJson*) sink->context;
+
+    json->out.clear();
+    if (json->stack.empty() && JSON_VALUE == number(json->state, '\0')) {
+        end_value(json, json->offset); // a number only ends with what follows it
+    }
+    reset_style(json);
+    if (!json->out.empty()) {
+        console_sink_pass(console, sink, json->out.data(), json->out.size());
+    }
+    console_sink_flush(console, sink);
+}
+
+ConsoleJson* console_create_json(size_t indent) {
+    ConsoleJson* json = new (std::nothrow) ConsoleJson();
+    if (NULL == json) {
+        fprintf(stderr, "debug: console_create_json: failed to allocate printer\n");
+        return NULL;
+    }
+
+    json->indent       = indent;
+    json->sink.write   = json_write;
+    json->sink.flush   = json_flush;
+    json->sink.context = json;
+    json->sink.next    = NULL;
+    console_reset_json(json);
+    return json;
+}
+
+void console_destroy_json(ConsoleJson* json) {
+    delete json;
+}
+
+void console_reset_json(ConsoleJson* json) {
+    json->state  = JSON_VALUE;
+    json->opened = false;
+    json->status = CONSOLE_JSON_PENDING;
+    json->offset = 0;
+    json->end    = 0;
+    json->stack.clear();
+    console_style_track(&json->style);
+}
+
+enum ConsoleJsonStatus console_json_status(const ConsoleJson* json, size_t* offset) {
+    if (NULL != offset) {
+        *offset = json->end;
+    }
+    return json->status;
+}
+
+ConsoleSink* console_json_sink(ConsoleJson* json) {
+    return &json->sink;
+}
@@ -0,0 +1,155 @@
+/**
+ * @file console_layout.cpp
+ *
+ * @brief Cursor accounting for output: where the terminal leaves the cursor after a
+ * chunk, without asking it. Printable ASCII runs are found with SIMD and cost no more
+ * than their length; only other characters are decoded and looked up.
+ *
+ */
+
+#include <console_layout.h>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+size_t console_ascii_span(const char* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t               i     = 0;
+#if defined(__SSE2__)
+    // as signed bytes, printable ASCII is everything above 0x1F except 0x7F
+    const __m128i controls = _mm_set1_epi8(0x1F);
+    const __m128i del      = _mm_set1_epi8(0x7F);
+    for (; i + 32 <= length; i += 32) {
+        __m128i  low  = _mm_loadu_si128((const __m128i*) (bytes + i));
+        __m128i  high = _mm_loadu_si128((const __m128i*) (bytes + i + 16));
+        __m128i  good_low
+            = _mm_andnot_si128(_mm_cmpeq_epi8(low, del), _mm_cmpgt_epi8(low, controls));
+        __m128i  good_high
+            = _mm_andnot_si128(_mm_cmpeq_epi8(high, del), _mm_cmpgt_epi8(high, controls));
+        unsigned mask = (unsigned) _mm_movemask_epi8(good_low)
+                        | (unsigned) _mm_movemask_epi8(good_high) << 16;
+        if (0xFFFFFFFFu != mask) {
+            return i + (size_t) __builtin_ctz(~mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t del   = vdupq_n_u8(0x7F);
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t bytes16 = vld1q_u8(bytes + i);
+        uint8x16_t bad     = vorrq_u8(vcltq_u8(bytes16, space), vcgeq_u8(bytes16, del));
+        // narrow each byte of the mask to 4 bits to get a scalar to count zeros in
+        uint64_t   mask    = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(bad), 4)), 0
+        );
+        if (0 != mask) {
+            return i + (size_t) (__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+    while (i < length && bytes[i] >= 0x20 && bytes[i] < 0x7F) {
+        i++;
+    }
+    return i;
+}
+
+// `count` cells of width one: whole rows at a time instead of a cell at a time.
+static void advance_cells(ConsoleLayout* layout, size_t count) {
+    size_t columns = layout->columns;
+    if (0 == count) {
+        return;
+    }
+    if (layout->col >= columns) {
+        layout->rows++; // the pending wrap is taken by the first cell
+        layout->col = 0;
+    }
+    size_t room = columns - layout->col;
+    if (count <= room) {
+        layout->col += count;
+        return;
+    }
+    // the rest fills whole rows, the last of which keeps its pending wrap
+    count        -= room;
+    layout->rows += (count + columns - 1) / columns;
+    layout->col   = count - (count - 1) / columns * columns;
+}
+
+size_t console_sequence_length(const char* data, size_t length) {
+    size_t next = 1;
+    if (next >= length) {
+        return 0;
+    }
+    if ('[' == data[next]) {
+        next++;
+        while (next < length && ((unsigned char) data[next] < 0x40
+                                 || (unsigned char) data[next] > 0x7E)) {
+            next++;
+        }
+    } else if (']' == data[next]) {
+        next++;
+        while (next < length && '\a' != data[next]
+               && !('\x1b' == data[next - 1] && '\\' == data[next])) {
+            next++;
+        }
+    } else {
+        while (next < length && (unsigned char) data[next] >= 0x20
+               && (unsigned char) data[next] <= 0x2F) {
+            next++; // intermediates, e.g. ESC ( B
+        }
+    }
+    return next < length ? next + 1 : 0;
+}
+
+size_t console_layout_advance(ConsoleLayout* layout, const char* data, size_t length) {
+    size_t columns = layout->columns;
+    size_t i       = 0;
+
+    while (i < length) {
+        size_t span = console_ascii_span(data + i, length - i);
+        advance_cells(layout, span);
+        i += span;
+        if (i == length) {
+            break;
+        }
+
+        unsigned char byte = (unsigned char) data[i];
+        size_t        next = i + 1;
+        if (0x1b == byte) {
+            size_t count = console_sequence_length(data + i, length - i);
+            if (0 == count) {
+                return i;
+            }
+            next = i + count;
+        } else if ('\n' == byte) {
+            layout->rows++;
+            layout->col = 0;
+        } else if ('\r' == byte) {
+            layout->col = 0;
+        } else if ('\b' == byte) {
+            layout->col = layout->col < columns ? layout->col : columns - 1;
+            layout->col = layout->col > 0 ? layout->col - 1 : 0;
+        } else if ('\t' == byte) {
+            size_t stop = (layout->col / 8 + 1) * 8;
+            layout->col = stop < columns ? stop : columns - 1;
+        } else if (byte >= 0x80) {
+            size_t count = console_utf8_length(byte);
+            if (i + count > length) {
+                return i;
+            }
+            int cells = console_utf8_width(data + i, count);
+            if (cells > 0) {
+                if (layout->col + (size_t) cells > columns) {
+                    layout->rows++; // a wide character that does not fit wraps first
+                    layout->col = 0;
+                }
+                layout->col += (size_t) cells;
+            }
+            next = i + count;
+        }
+        i = next;
+    }
+    return i;
+}
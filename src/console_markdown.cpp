@@ -0,0 +1,903 @@
+/**
+ * @file console_markdown.cpp
+ *
+ * @brief Output stage that renders Markdown as it streams: headings, emphasis, inline
+ * code, lists, quotes and fenced code blocks with keyword highlighting.
+ *
+ */
+
+#include <console_layout.h>
+#include <console_markdown.h>
+#include <console_style.h>
+
+#include <new>
+#include <string.h>
+#include <string>
+
+// Held line starts that are still undecided past this length are plain text
+#define MARKDOWN_PREFIX_MAX 128
+
+enum MarkdownMode {
+    MARKDOWN_START,       // start of a line, deciding its block
+    MARKDOWN_INLINE,      // text of a paragraph, heading or list item
+    MARKDOWN_INFO,        // rest of an opening fence line, the language
+    MARKDOWN_FENCE_START, // start of a line in a fence, which may close it
+    MARKDOWN_CODE         // a line in a fence
+};
+
+enum MarkdownBlock {
+    MARKDOWN_PARAGRAPH,
+    MARKDOWN_HEADING,
+    MARKDOWN_ITEM
+};
+
+// What a line start turned out to be
+enum LineKind {
+    LINE_PENDING, // not yet known
+    LINE_BLANK,
+    LINE_PARAGRAPH,
+    LINE_HEADING,
+    LINE_QUOTE,
+    LINE_BULLET,
+    LINE_ORDERED,
+    LINE_FENCE,
+    LINE_RULE
+};
+
+// Where the code lexer is within a line
+enum CodeToken {
+    CODE_PLAIN,
+    CODE_WORD,          // identifier, held until it ends
+    CODE_NUMBER,
+    CODE_STRING,
+    CODE_SLASH,         // a held '/' that may start a comment
+    CODE_LINE_COMMENT,
+    CODE_BLOCK_COMMENT
+};
+
+struct Language {
+    const char*        names;    // info strings that select it, space separated
+    const char* const* keywords; // sorted
+    size_t             count;
+    const char*        quotes;   // characters that delimit strings
+    bool               slash;    // // and /* */ comments
+    bool               hash;     // # comments
+};
+
+static const char* const c_keywords[] = {
+    "alignas",     "alignof",     "auto",        "bool",        "break",       "case",
+    "catch",       "char",        "class",       "const",       "constexpr",   "continue",
+    "default",     "define",      "delete",      "do",          "double",      "else",
+    "endif",       "enum",        "explicit",    "extern",      "false",       "float",
+    "for",         "friend",      "goto",        "if",          "ifdef",       "ifndef",
+    "include",     "inline",      "int",         "long",        "namespace",   "new",
+    "noexcept",    "nullptr",     "operator",    "override",    "pragma",      "private",
+    "protected",   "public",      "return",      "short",       "signed",      "sizeof",
+    "static",      "static_cast", "struct",      "switch",      "template",    "this",
+    "throw",       "true",        "try",         "typedef",     "typename",    "union",
+    "unsigned",    "using",       "virtual",     "void",        "volatile",    "while"
+};
+
+static const char* const python_keywords[] = {
+    "False",    "None",     "True",     "and",      "as",       "assert",   "async",    "await",
+    "break",    "class",    "continue", "def",      "del",      "elif",     "else",     "except",
+    "finally",  "for",      "from",     "global",   "if",       "import",   "in",       "is",
+    "lambda",   "nonlocal", "not",      "or",       "pass",     "raise",    "return",   "self",
+    "try",      "while",    "with",     "yield"
+};
+
+static const char* const script_keywords[] = {
+    "as",         "async",      "await",      "break",      "case",       "catch",      "class",
+    "const",      "continue",   "default",    "delete",     "do",         "else",       "export",
+    "extends",    "false",      "finally",    "for",        "from",       "function",   "if",
+    "import",     "in",         "instanceof", "interface",  "let",        "new",        "null",
+    "of",         "return",     "static",     "super",      "switch",     "this",       "throw",
+    "true",       "try",        "type",       "typeof",     "undefined",  "var",        "void",
+    "while",      "yield"
+};
+
+static const char* const rust_keywords[] = {
+    "Self",     "as",       "async",    "await",    "break",    "const",    "continue", "crate",
+    "else",     "enum",     "false",    "fn",       "for",      "if",       "impl",     "in",
+    "let",      "loop",     "match",    "mod",      "move",     "mut",      "pub",      "ref",
+    "return",   "self",     "static",   "struct",   "super",    "trait",    "true",     "type",
+    "unsafe",   "use",      "where",    "while"
+};
+
+static const char* const go_keywords[] = {
+    "break",       "case",        "chan",        "const",       "continue",    "default",
+    "defer",       "else",        "fallthrough", "false",       "for",         "func",
+    "go",          "goto",        "if",          "import",      "interface",   "map",
+    "nil",         "package",     "range",       "return",      "select",      "struct",
+    "switch",      "true",        "type",        "var"
+};
+
+static const char* const shell_keywords[] = {
+    "case",     "do",       "done",     "elif",     "else",     "esac",     "export",   "fi",
+    "for",      "function", "if",       "in",       "local",    "return",   "then",     "until",
+    "while"
+};
+
+static const char* const json_keywords[] = {"false", "null", "true"};
+
+#define KEYWORDS(list) list, sizeof(list) / sizeof(list[0])
+
+static const Language languages[] = {
+    {"c h cpp c++ cc cxx hpp", KEYWORDS(c_keywords), "\"'", true, false},
+    {"python py python3", KEYWORDS(python_keywords), "\"'", false, true},
+    {"javascript js jsx typescript ts tsx", KEYWORDS(script_keywords), "\"'`", true, false},
+    {"rust rs", KEYWORDS(rust_keywords), "\"", true, false},
+    {"go golang", KEYWORDS(go_keywords), "\"'`", true, false},
+    {"sh bash shell zsh console", KEYWORDS(shell_keywords), "\"'", false, true},
+    {"json", KEYWORDS(json_keywords), "\"", false, false}
+};
+
+#undef KEYWORDS
+
+// Colors of the rendering, ANSI indices
+static const int color_code    = 6; // cyan: inline code
+static const int color_marker  = 3; // yellow: list bullets and numbers
+static const int color_faint   = 8; // gray: quote bars, fences, rules, comments
+static const int color_keyword = 5; // magenta
+static const int color_string  = 2; // green
+static const int color_number  = 3; // yellow
+
+struct ConsoleMarkdown {
+    ConsoleSink         sink;         // the renderer as an output stage
+    enum MarkdownMode   mode;
+    enum MarkdownBlock  block;        // block of the current line
+    size_t              level;        // heading level
+    size_t              quotes;       // quote depth of the current line
+    std::string         line;         // held start of the line while its block is undecided
+    unsigned            emphasis;     // CONSOLE_STYLE_BOLD and/or CONSOLE_STYLE_ITALIC
+    size_t              ticks;        // backticks that opened the code span, 0 outside one
+    char                run;          // delimiter held until the next byte, 0 for none
+    size_t              run_length;
+    bool                escape;       // a backslash is held
+    char                previous;     // last text byte of the line, ' ' at its start
+    char                fence;        // '`' or '~' of the open fence, 0 outside one
+    size_t              fence_length;
+    const Language*     language;     // of the open fence, NULL for plain code
+    enum CodeToken      token;
+    char                quote;        // that opened the string
+    bool                escaped;      // in a string, after a backslash
+    bool                star;         // in a block comment, after a '*'
+    std::string         word;         // held identifier
+    ConsoleStyleTracker style;        // what the terminal has
+    std::string         sequence;     // an escape sequence cut off by the last write
+    std::string         deferred;     // sequences that came while the line start was held
+    std::string         out;          // output of the write in progress
+};
+
+static ConsoleStyle make_style(unsigned attributes, int foreground) {
+    ConsoleStyle style = console_style_default();
+    style.attributes   = attributes;
+    style.foreground   = foreground;
+    return style;
+}
+
+static void emit(ConsoleMarkdown* markdown, ConsoleStyle style, const char* data, size_t length) {
+    char sgr[CONSOLE_STYLE_MAX];
+    markdown->out.append(sgr, console_style_update(&markdown->style, &style, sgr));
+    markdown->out.append(data, length);
+}
+
+static void reset_style(ConsoleMarkdown* markdown) {
+    char sgr[CONSOLE_STYLE_MAX];
+    markdown->out.append(sgr, console_style_reset(&markdown->style, sgr));
+}
+
+// Style of inline text where the parser is now
+static ConsoleStyle text_style(ConsoleMarkdown* markdown) {
+    ConsoleStyle style = make_style(markdown->emphasis, CONSOLE_COLOR_DEFAULT);
+    if (MARKDOWN_HEADING == markdown->block) {
+        style.attributes |= CONSOLE_STYLE_BOLD;
+        style.attributes |= 1 == markdown->level ? CONSOLE_STYLE_UNDERLINE : 0;
+    }
+    if (markdown->quotes > 0) {
+        style.attributes |= CONSOLE_STYLE_ITALIC;
+    }
+    if (markdown->ticks > 0) {
+        style.foreground = color_code;
+    }
+    return style;
+}
+
+// A sequence in the text set the terminal's style: it stands for the style the text
+// would have until the renderer changes that
+static void adopt(ConsoleMarkdown* markdown) {
+    bool code               = MARKDOWN_CODE == markdown->mode;
+    markdown->style.current = code ? console_style_default() : text_style(markdown);
+    markdown->style.exact   = false;
+}
+
+// Sequences held with the line start follow its marker, so they apply to the text
+static void release(ConsoleMarkdown* markdown) {
+    if (!markdown->deferred.empty()) {
+        markdown->out.append(markdown->deferred);
+        markdown->deferred.clear();
+        adopt(markdown);
+    }
+}
+
+static void emit_text(ConsoleMarkdown* markdown, const char* data, size_t length) {
+    emit(markdown, text_style(markdown), data, length);
+    markdown->previous = data[length - 1];
+}
+
+// The line is over: styles end with it, so a stray delimiter never bleeds further
+static void newline(ConsoleMarkdown* markdown) {
+    release(markdown);
+    reset_style(markdown);
+    markdown->out.push_back('\n');
+    markdown->mode     = 0 != markdown->fence ? MARKDOWN_FENCE_START : MARKDOWN_START;
+    markdown->block    = MARKDOWN_PARAGRAPH;
+    markdown->quotes   = 0;
+    markdown->emphasis = 0;
+    markdown->ticks    = 0;
+    markdown->previous = ' ';
+    markdown->line.clear();
+}
+
+static bool is_space(char c) {
+    return ' ' == c || '\t' == c || '\n' == c;
+}
+
+// Letters, digits and anything not ASCII, for '_' which does not emphasize within words
+static bool is_word(char c) {
+    unsigned char byte  = (unsigned char) c;
+    unsigned char lower = byte | 0x20;
+    return byte >= 0x80 || (byte >= '0' && byte <= '9') || (lower >= 'a' && lower <= 'z');
+}
+
+// Decide the held delimiter run now that `next` follows it: emphasis opens where text
+// follows the run and closes where text precedes it, roughly CommonMark's flanking rules.
+static void resolve_run(ConsoleMarkdown* markdown, char next) {
+    char   run    = markdown->run;
+    size_t length = markdown->run_length;
+    markdown->run        = 0;
+    markdown->run_length = 0;
+
+    if ('`' == run) {
+        if (0 == markdown->ticks) {
+            markdown->ticks = length;
+            return;
+        }
+        if (length == markdown->ticks) {
+            markdown->ticks = 0;
+            return;
+        }
+    } else if (length <= 3) {
+        char previous = markdown->previous;
+        bool opening  = !is_space(next);
+        bool closing  = !is_space(previous);
+        if ('_' == run) {
+            opening = opening && !is_word(previous);
+            closing = closing && !is_word(next);
+        }
+        unsigned flags = 1 == length   ? CONSOLE_STYLE_ITALIC
+                         : 2 == length ? CONSOLE_STYLE_BOLD
+                                       : CONSOLE_STYLE_BOLD | CONSOLE_STYLE_ITALIC;
+        if (closing && (markdown->emphasis & flags)) {
+            markdown->emphasis &= ~flags;
+            return;
+        }
+        if (opening) {
+            markdown->emphasis |= flags;
+            return;
+        }
+    }
+    std::string literal(length, run);
+    emit_text(markdown, literal.data(), literal.size());
+}
+
+static void inline_byte(ConsoleMarkdown* markdown, char c) {
+    if (markdown->escape) {
+        markdown->escape = false;
+        if ((c >= '!' && c <= '/') || (c >= ':' && c <= '@') || (c >= '[' && c <= '`')
+            || (c >= '{' && c <= '~')) {
+            emit_text(markdown, &c, 1);
+            return;
+        }
+        emit_text(markdown, "\\", 1);
+    }
+    if (0 != markdown->run) {
+        if (c == markdown->run) {
+            markdown->run_length++;
+            return;
+        }
+        resolve_run(markdown, c);
+    }
+    if (markdown->ticks > 0 && '`' != c) {
+        emit_text(markdown, &c, 1); // only backticks mean something in a code span
+        return;
+    }
+    if ('*' == c || '_' == c || '`' == c) {
+        markdown->run        = c;
+        markdown->run_length = 1;
+        return;
+    }
+    if ('\\' == c && 0 == markdown->ticks) {
+        markdown->escape = true;
+        return;
+    }
+    emit_text(markdown, &c, 1);
+}
+
+static void end_line(ConsoleMarkdown* markdown) {
+    if (markdown->escape) {
+        markdown->escape = false;
+        emit_text(markdown, "\\", 1);
+    }
+    if (0 != markdown->run) {
+        resolve_run(markdown, '\n');
+    }
+    newline(markdown);
+}
+
+// Inline text up to the next byte that may mean something, all at once
+static size_t inline_span(ConsoleMarkdown* markdown, const char* data, size_t length) {
+    if (0 == markdown->run && !markdown->escape) {
+        size_t count = 0;
+        if (0 == markdown->ticks) {
+            while (count < length && NULL == memchr("*_`\\\n\x1b", data[count], 6)) {
+                count++;
+            }
+        } else {
+            while (count < length && '`' != data[count] && '\n' != data[count]
+                   && '\x1b' != data[count]) {
+                count++;
+            }
+        }
+        if (count > 0) {
+            emit_text(markdown, data, count);
+            return count;
+        }
+    }
+    if ('\n' == data[0]) {
+        end_line(markdown);
+    } else {
+        inline_byte(markdown, data[0]);
+    }
+    return 1;
+}
+
+// What the held start of a line is, given that the line `ended` there or goes on.
+// `marker` is set to the bytes the block marker takes, `level` to a heading's level.
+static enum LineKind classify(const std::string& text, bool ended, size_t* marker, size_t* level) {
+    size_t length = text.size();
+    size_t i      = 0;
+    while (i < length && ' ' == text[i]) {
+        i++;
+    }
+    if (i == length) {
+        return ended ? LINE_BLANK : LINE_PENDING;
+    }
+
+    char   c = text[i];
+    size_t j = i;
+    if ('#' == c) {
+        while (j < length && '#' == text[j]) {
+            j++;
+        }
+        *level = j - i;
+        if (*level > 6) {
+            return LINE_PARAGRAPH;
+        }
+        if (j == length) {
+            *marker = j;
+            return ended ? LINE_HEADING : LINE_PENDING;
+        }
+        *marker = j + 1;
+        return ' ' == text[j] ? LINE_HEADING : LINE_PARAGRAPH;
+    }
+    if ('>' == c) {
+        if (i + 1 == length && !ended) {
+            return LINE_PENDING;
+        }
+        *marker = i + 1 < length && ' ' == text[i + 1] ? i + 2 : i + 1;
+        return LINE_QUOTE;
+    }
+    if ('`' == c || '~' == c) {
+        while (j < length && c == text[j]) {
+            j++;
+        }
+        if (j == length && !ended) {
+            return LINE_PENDING;
+        }
+        return j - i >= 3 ? LINE_FENCE : LINE_PARAGRAPH;
+    }
+    if ('-' == c || '*' == c || '_' == c || '+' == c) {
+        // a rule is three or more of the same, spaces between allowed, and nothing else
+        size_t count = 0;
+        while (j < length && (c == text[j] || ' ' == text[j])) {
+            count += c == text[j];
+            j++;
+        }
+        if (j == length) {
+            if (!ended) {
+                return LINE_PENDING;
+            }
+            if (count >= 3 && '+' != c) {
+                return LINE_RULE;
+            }
+        }
+        if ('_' != c && i + 1 < length && ' ' == text[i + 1]) {
+            *marker = i + 2;
+            return LINE_BULLET;
+        }
+        return LINE_PARAGRAPH;
+    }
+    if (c >= '0' && c <= '9') {
+        while (j < length && j - i < 9 && text[j] >= '0' && text[j] <= '9') {
+            j++;
+        }
+        if (j < length && ('.' == text[j] || ')' == text[j])) {
+            if (j + 1 == length) {
+                return ended ? LINE_PARAGRAPH : LINE_PENDING;
+            }
+            if (' ' == text[j + 1]) {
+                *marker = j + 2;
+                return LINE_ORDERED;
+            }
+        } else if (j == length && !ended) {
+            return LINE_PENDING;
+        }
+    }
+    return LINE_PARAGRAPH;
+}
+
+static const Language* find_language(const std::string& info) {
+    size_t start = info.find_first_not_of(" `~");
+    if (std::string::npos == start) {
+        return NULL;
+    }
+    size_t      end  = info.find_first_of(" {,", start);
+    std::string name = info.substr(start, std::string::npos == end ? end : end - start);
+    for (size_t i = 0; i < name.size(); i++) {
+        name[i] = (char) (name[i] >= 'A' && name[i] <= 'Z' ? name[i] + 32 : name[i]);
+    }
+    for (size_t i = 0; i < sizeof(languages) / sizeof(languages[0]); i++) {
+        const char* names = languages[i].names;
+        while ('\0' != *names) {
+            size_t count = strcspn(names, " ");
+            if (count == name.size() && 0 == memcmp(names, name.data(), count)) {
+                return &languages[i];
+            }
+            names += count;
+            names += ' ' == *names;
+        }
+    }
+    return NULL;
+}
+
+// The opening fence line, held until its end so the language is known
+static void info_byte(ConsoleMarkdown* markdown, char c) {
+    if ('\n' != c) {
+        if (markdown->line.size() < MARKDOWN_PREFIX_MAX) {
+            markdown->line.push_back(c);
+        }
+        return;
+    }
+    markdown->language = find_language(markdown->line);
+    markdown->token    = CODE_PLAIN;
+    emit(markdown, make_style(0, color_faint), markdown->line.data(), markdown->line.size());
+    newline(markdown);
+}
+
+static void rule(ConsoleMarkdown* markdown) {
+    static const char line[] = "────────"
+                               "────────"
+                               "────────";
+    emit(markdown, make_style(0, color_faint), line, sizeof(line) - 1);
+}
+
+// A byte at the start of a line, or the newline that ends it: hold it until the block
+// is known, then style the marker and hand the rest to the inline parser.
+static void start_byte(ConsoleMarkdown* markdown, char c) {
+    bool ended = '\n' == c;
+    if (!ended) {
+        markdown->line.push_back(c);
+    }
+
+    for (;;) {
+        std::string&  line   = markdown->line;
+        size_t        marker = 0;
+        size_t        level  = 0;
+        enum LineKind kind   = classify(line, ended, &marker, &level);
+        if (LINE_PENDING == kind) {
+            if (line.size() < MARKDOWN_PREFIX_MAX) {
+                return;
+            }
+            kind = LINE_PARAGRAPH;
+        }
+
+        size_t indent = line.find_first_not_of(' ');
+        switch (kind) {
+            case LINE_QUOTE:
+                // quotes nest, and may hold any other block: decide the rest again
+                emit(markdown, make_style(0, color_faint), "│ ", sizeof("│ ") - 1);
+                markdown->quotes++;
+                line.erase(0, marker);
+                if (line.empty()) {
+                    if (ended) {
+                        newline(markdown);
+                    }
+                    return;
+                }
+                continue;
+            case LINE_FENCE: {
+                size_t end             = line.find_first_not_of(line[indent], indent);
+                markdown->fence        = line[indent];
+                markdown->fence_length = (std::string::npos == end ? line.size() : end) - indent;
+                markdown->mode         = MARKDOWN_INFO;
+                if (ended) {
+                    info_byte(markdown, '\n');
+                }
+                return;
+            }
+            case LINE_RULE:
+                rule(markdown);
+                newline(markdown);
+                return;
+            case LINE_BLANK:
+                newline(markdown);
+                return;
+            case LINE_HEADING:
+                markdown->block = MARKDOWN_HEADING;
+                markdown->level = level;
+                break;
+            case LINE_BULLET:
+                markdown->block = MARKDOWN_ITEM;
+                if (indent > 0) {
+                    emit(markdown, make_style(0, CONSOLE_COLOR_DEFAULT), line.data(), indent);
+                }
+                emit(markdown, make_style(0, color_marker), "• ", sizeof("• ") - 1);
+                break;
+            case LINE_ORDERED:
+                markdown->block = MARKDOWN_ITEM;
+                if (indent > 0) {
+                    emit(markdown, make_style(0, CONSOLE_COLOR_DEFAULT), line.data(), indent);
+                }
+                emit(markdown, make_style(0, color_marker), line.data() + indent,
+                     marker - indent);
+                break;
+            default:
+                marker = 0;
+                break;
+        }
+
+        std::string text = line.substr(marker);
+        line.clear();
+        markdown->mode     = MARKDOWN_INLINE;
+        markdown->previous = ' ';
+        release(markdown);
+        for (size_t i = 0; i < text.size(); i++) {
+            inline_byte(markdown, text[i]);
+        }
+        if (ended) {
+            end_line(markdown);
+        }
+        return;
+    }
+}
+
+static bool is_keyword(const Language* language, const std::string& word) {
+    size_t low  = 0;
+    size_t high = language->count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        int    order  = strcmp(language->keywords[middle], word.c_str());
+        if (0 == order) {
+            return true;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+// Release what the code lexer holds: an identifier or a '/'
+static void code_settle(ConsoleMarkdown* markdown) {
+    if (CODE_WORD == markdown->token) {
+        bool keyword = is_keyword(markdown->language, markdown->word);
+        emit(markdown, make_style(0, keyword ? color_keyword : CONSOLE_COLOR_DEFAULT),
+             markdown->word.data(), markdown->word.size());
+        markdown->word.clear();
+        markdown->token = CODE_PLAIN;
+    } else if (CODE_SLASH == markdown->token) {
+        emit(markdown, make_style(0, CONSOLE_COLOR_DEFAULT), "/", 1);
+        markdown->token = CODE_PLAIN;
+    }
+}
+
+static void code_byte(ConsoleMarkdown* markdown, char c) {
+    const Language* language = markdown->language;
+    if (NULL == language) {
+        emit(markdown, make_style(0, CONSOLE_COLOR_DEFAULT), &c, 1);
+        return;
+    }
+
+    bool word = '_' == c || is_word(c);
+    switch (markdown->token) {
+        case CODE_STRING:
+            emit(markdown, make_style(0, color_string), &c, 1);
+            if (markdown->escaped) {
+                markdown->escaped = false;
+            } else if ('\\' == c) {
+                markdown->escaped = true;
+            } else if (markdown->quote == c) {
+                markdown->token = CODE_PLAIN;
+            }
+            return;
+        case CODE_LINE_COMMENT:
+            emit(markdown, make_style(0, color_faint), &c, 1);
+            return;
+        case CODE_BLOCK_COMMENT:
+            emit(markdown, make_style(0, color_faint), &c, 1);
+            if (markdown->star && '/' == c) {
+                markdown->token = CODE_PLAIN;
+            }
+            markdown->star = '*' == c;
+            return;
+        case CODE_WORD:
+            if (word) {
+                markdown->word.push_back(c);
+                return;
+            }
+            code_settle(markdown);
+            break;
+        case CODE_NUMBER:
+            if (word || '.' == c) {
+                emit(markdown, make_style(0, color_number), &c, 1);
+                return;
+            }
+            markdown->token = CODE_PLAIN;
+            break;
+        case CODE_SLASH:
+            if ('/' == c || '*' == c) {
+                emit(markdown, make_style(0, color_faint), "/", 1);
+                emit(markdown, make_style(0, color_faint), &c, 1);
+                markdown->token = '/' == c ? CODE_LINE_COMMENT : CODE_BLOCK_COMMENT;
+                markdown->star  = false;
+                return;
+            }
+            code_settle(markdown);
+            break;
+        case CODE_PLAIN:
+            break;
+    }
+
+    if (c >= '0' && c <= '9') {
+        markdown->token = CODE_NUMBER;
+        emit(markdown, make_style(0, color_number), &c, 1);
+    } else if (word) {
+        markdown->token = CODE_WORD;
+        markdown->word.push_back(c);
+    } else if ('\0' != c && NULL != strchr(language->quotes, c)) {
+        markdown->token   = CODE_STRING;
+        markdown->quote   = c;
+        markdown->escaped = false;
+        emit(markdown, make_style(0, color_string), &c, 1);
+    } else if ('/' == c && language->slash) {
+        markdown->token = CODE_SLASH;
+    } else if ('#' == c && language->hash) {
+        markdown->token = CODE_LINE_COMMENT;
+        emit(markdown, make_style(0, color_faint), &c, 1);
+    } else {
+        emit(markdown, make_style(0, CONSOLE_COLOR_DEFAULT), &c, 1);
+    }
+}
+
+static void code_newline(ConsoleMarkdown* markdown) {
+    code_settle(markdown);
+    if (CODE_BLOCK_COMMENT != markdown->token) {
+        markdown->token = CODE_PLAIN; // strings and line comments end with the line
+    }
+    newline(markdown);
+}
+
+// A byte at the start of a line in a fence: held while the line may be the closing
+// fence, up to three spaces, at least as many fence characters and trailing spaces.
+static void fence_start_byte(ConsoleMarkdown* markdown, char c) {
+    bool ended = '\n' == c;
+    if (!ended) {
+        markdown->line.push_back(c);
+    }
+
+    const std::string& line   = markdown->line;
+    size_t             length = line.size();
+    size_t             i      = 0;
+    while (i < length && i < 3 && ' ' == line[i]) {
+        i++;
+    }
+    size_t j = i;
+    while (j < length && markdown->fence == line[j]) {
+        j++;
+    }
+    size_t k = j;
+    while (k < length && ' ' == line[k]) {
+        k++;
+    }
+    bool closing = k == length && (j - i >= markdown->fence_length || (k == j && !ended));
+    if (closing && !ended) {
+        return;
+    }
+    if (closing) {
+        code_settle(markdown);
+        emit(markdown, make_style(0, color_faint), line.data(), length);
+        markdown->fence    = 0;
+        markdown->language = NULL;
+        newline(markdown);
+        return;
+    }
+
+    std::string text = std::move(markdown->line);
+    markdown->line.clear();
+    markdown->mode = MARKDOWN_CODE;
+    release(markdown);
+    for (size_t n = 0; n < text.size(); n++) {
+        code_byte(markdown, text[n]);
+    }
+    if (ended) {
+        code_newline(markdown);
+    }
+}
+
+// Escape sequences in the text pass through as they are; whatever style they set lasts
+// until the renderer next changes it.
+static size_t sequence(ConsoleMarkdown* markdown, const char* data, size_t length) {
+    size_t held  = markdown->sequence.size();
+    size_t count = 0;
+    if (0 == held) {
+        count = console_sequence_length(data, length);
+    }
+    if (0 == count) {
+        markdown->sequence.append(data, length);
+        count = console_sequence_length(markdown->sequence.data(), markdown->sequence.size());
+        if (0 == count) {
+            return length;
+        }
+        data = markdown->sequence.data();
+    }
+
+    if (MARKDOWN_CODE == markdown->mode) {
+        code_settle(markdown); // a held word goes first, as plain text
+    }
+    if (!markdown->line.empty() && MARKDOWN_INLINE != markdown->mode
+        && MARKDOWN_CODE != markdown->mode) {
+        markdown->deferred.append(data, count);
+    } else {
+        markdown->out.append(data, count);
+        adopt(markdown);
+    }
+    markdown->sequence.clear();
+    return count - held;
+}
+
+static void render(ConsoleMarkdown* markdown, const char* data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        char c = data[i];
+        if ('\x1b' == c || !markdown->sequence.empty()) {
+            i += sequence(markdown, data + i, length - i);
+            continue;
+        }
+        switch (markdown->mode) {
+            case MARKDOWN_START:
+                start_byte(markdown, c);
+                break;
+            case MARKDOWN_INLINE:
+                i += inline_span(markdown, data + i, length - i);
+                continue;
+            case MARKDOWN_INFO:
+                info_byte(markdown, c);
+                break;
+            case MARKDOWN_FENCE_START:
+                fence_start_byte(markdown, c);
+                break;
+            case MARKDOWN_CODE:
+                if ('\n' == c) {
+                    code_newline(markdown);
+                } else {
+                    code_byte(markdown, c);
+                }
+                break;
+        }
+        i++;
+    }
+}
+
+// End of a response: what is held is written as it stands, open blocks end
+static void finish(ConsoleMarkdown* markdown) {
+    bool fresh = markdown->line.empty()
+                 && (MARKDOWN_START == markdown->mode
+                     || MARKDOWN_FENCE_START == markdown->mode);
+    switch (markdown->mode) {
+        case MARKDOWN_START:
+        case MARKDOWN_FENCE_START:
+        case MARKDOWN_INFO:
+            if (!markdown->line.empty()) {
+                emit(markdown, make_style(0, CONSOLE_COLOR_DEFAULT), markdown->line.data(),
+                     markdown->line.size());
+            }
+            break;
+        case MARKDOWN_INLINE:
+            if (markdown->escape) {
+                markdown->escape = false;
+                emit_text(markdown, "\\", 1);
+            }
+            if (0 != markdown->run) {
+                resolve_run(markdown, '\n');
+            }
+            break;
+        case MARKDOWN_CODE:
+            code_settle(markdown);
+            break;
+    }
+    release(markdown);
+    markdown->out.append(markdown->sequence);
+    markdown->sequence.clear();
+    reset_style(markdown);
+
+    markdown->mode     = fresh ? MARKDOWN_START : MARKDOWN_INLINE;
+    markdown->block    = MARKDOWN_PARAGRAPH;
+    markdown->quotes   = 0;
+    markdown->emphasis = 0;
+    markdown->ticks    = 0;
+    markdown->fence    = 0;
+    markdown->language = NULL;
+    markdown->token    = CODE_PLAIN;
+    markdown->line.clear();
+}
+
+static void markdown_write(Console* console, ConsoleSink* sink, const char* data, size_t length) {
+    ConsoleMarkdown* markdown = (ConsoleMarkdown*) sink->context;
+
+    markdown->out.clear();
+    render(markdown, data, length);
+    if (!markdown->out.empty()) {
+        console_sink_pass(console, sink, markdown->out.data(), markdown->out.size());
+    }
+}
+
+static void markdown_flush(Console* console, ConsoleSink* sink) {
+    ConsoleMarkdown* markdown = (ConsoleMarkdown*) sink->context;
+
+    markdown->out.clear();
+    finish(markdown);
+    if (!markdown->out.empty()) {
+        console_sink_pass(console, sink, markdown->out.data(), markdown->out.size());
+    }
+    console_sink_flush(console, sink);
+}
+
+ConsoleMarkdown* console_create_markdown(void) {
+    ConsoleMarkdown* markdown = new (std::nothrow) ConsoleMarkdown();
+    if (NULL == markdown) {
+        fprintf(stderr, "debug: console_create_markdown: failed to allocate renderer\n");
+        return NULL;
+    }
+
+    markdown->mode         = MARKDOWN_START;
+    markdown->block        = MARKDOWN_PARAGRAPH;
+    markdown->previous     = ' ';
+    markdown->token        = CODE_PLAIN;
+    console_style_track(&markdown->style);
+    markdown->sink.write   = markdown_write;
+    markdown->sink.flush   = markdown_flush;
+    markdown->sink.context = markdown;
+    markdown->sink.next    = NULL;
+    return markdown;
+}
+
+void console_destroy_markdown(ConsoleMarkdown* markdown) {
+    delete markdown;
+}
+
+ConsoleSink* console_markdown_sink(ConsoleMarkdown* markdown) {
+    return &markdown->sink;
+}
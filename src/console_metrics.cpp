@@ -0,0 +1,123 @@
+/**
+ * @file console_metrics.cpp
+ *
+ * @brief Hot-path instrumentation: scoped timers, counters and value histograms.
+ *
+ */
+
+#include <console_metrics.h>
+#include <string.h>
+
+#ifdef CONSOLE_INSTRUMENT
+    #include <atomic>
+    #include <sys/ioctl.h>
+    #include <time.h>
+
+// One shard per recording thread. Only the owner writes, so plain load/store pairs are
+// enough; readers sum the shards with relaxed loads and never take a lock.
+struct MetricShard {
+    std::atomic<uint64_t> counts[CONSOLE_METRIC_COUNT];
+    std::atomic<uint64_t> sums[CONSOLE_METRIC_COUNT];
+    std::atomic<uint64_t> buckets[CONSOLE_METRIC_COUNT][CONSOLE_METRIC_BUCKETS];
+    MetricShard*          next; // shards are never freed, totals survive thread exit
+};
+
+static std::atomic<MetricShard*> shards{nullptr};
+
+static MetricShard* local_shard(void) {
+    static thread_local MetricShard* shard = nullptr;
+    if (nullptr == shard) {
+        shard = new MetricShard(); // value-initialized, all zero
+        shard->next = shards.load(std::memory_order_relaxed);
+        while (!shards.compare_exchange_weak(shard->next, shard, std::memory_order_release)) {
+        }
+    }
+    return shard;
+}
+
+static void bump(std::atomic<uint64_t> &slot, uint64_t value) {
+    slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+uint64_t console_metrics_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+uint64_t console_metrics_backlog(int fd) {
+    int queued = 0;
+    if (-1 == ioctl(fd, TIOCOUTQ, &queued) || queued < 0) {
+        return 0;
+    }
+    return (uint64_t) queued;
+}
+
+void console_metrics_count(ConsoleMetric metric, uint64_t value) {
+    MetricShard* shard = local_shard();
+    bump(shard->counts[metric], 1);
+    bump(shard->sums[metric], value);
+}
+
+void console_metrics_record(ConsoleMetric metric, uint64_t value) {
+    MetricShard* shard  = local_shard();
+    int          bucket = 0 == value ? 0 : 64 - __builtin_clzll(value);
+    if (bucket >= CONSOLE_METRIC_BUCKETS) {
+        bucket = CONSOLE_METRIC_BUCKETS - 1;
+    }
+    bump(shard->counts[metric], 1);
+    bump(shard->sums[metric], value);
+    bump(shard->buckets[metric][bucket], 1);
+}
+#endif // CONSOLE_INSTRUMENT
+
+const char* console_metric_name(ConsoleMetric metric) {
+    switch (metric) {
+        case CONSOLE_METRIC_DECODE:
+            return "decode";
+        case CONSOLE_METRIC_PROCESS:
+            return "process";
+        case CONSOLE_METRIC_LAYOUT:
+            return "layout";
+        case CONSOLE_METRIC_RENDER:
+            return "render";
+        case CONSOLE_METRIC_FLUSH:
+            return "flush";
+        case CONSOLE_METRIC_INPUT_BYTES:
+            return "input_bytes";
+        case CONSOLE_METRIC_OUTPUT_BYTES:
+            return "output_bytes";
+        case CONSOLE_METRIC_ECHO:
+            return "echo";
+        case CONSOLE_METRIC_PROBES:
+            return "probes";
+        case CONSOLE_METRIC_FRAME_BYTES:
+            return "frame_bytes";
+        case CONSOLE_METRIC_BACKLOG:
+            return "output_backlog_bytes";
+        default:
+            return "unknown";
+    }
+}
+
+bool console_metrics_snapshot(ConsoleMetricValue* values) {
+    memset(values, 0, CONSOLE_METRIC_COUNT * sizeof(ConsoleMetricValue));
+
+#ifdef CONSOLE_INSTRUMENT
+    for (MetricShard* shard = shards.load(std::memory_order_acquire); nullptr != shard;
+         shard              = shard->next) {
+        for (int metric = 0; metric < CONSOLE_METRIC_COUNT; metric++) {
+            ConsoleMetricValue* value  = &values[metric];
+            value->count              += shard->counts[metric].load(std::memory_order_relaxed);
+            value->sum                += shard->sums[metric].load(std::memory_order_relaxed);
+            for (int bucket = 0; bucket < CONSOLE_METRIC_BUCKETS; bucket++) {
+                value->buckets[bucket]
+                    += shard->buckets[metric][bucket].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,828 @@
+/**
+ * @file console_pager.cpp
+ *
+ * @brief A pager on the alternate screen for long output and transcripts: lines come
+ * straight from a page or a mapped file, counted in the background as it is paged.
+ *
+ */
+
+#include <console_event.h>
+#include <console_exporter.h>
+#include <console_layout.h>
+#include <console_pager.h>
+#include <console_pool.h>
+#include <console_scroll.h>
+#include <console_search.h>
+#include <console_style.h>
+#include <atomic>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+// The column index of a line drawn at `position`, kept for the next redraw
+struct PagerIndex {
+    size_t              position;
+    const char*         text;
+    size_t              length;
+    ConsoleColumnIndex* columns; // NULL until a line is drawn with it
+};
+
+// A file's lines are found with memchr and memrchr from wherever the view is, so paging
+// never waits for the count. The count only numbers lines: `counts[i]` is the number of
+// newlines before the end of block i, valid for the first `indexed` blocks.
+struct ConsolePager {
+    const ConsolePage*  page;    // paged lines, NULL for a file
+    const char*         data;    // the mapped file
+    size_t              size;
+    char*               name;    // shown in the status line, NULL for a page
+    uint64_t*           counts;  // newlines up to the end of each block
+    size_t              blocks;
+    std::atomic<size_t> indexed; // blocks counted, published after their count
+    std::atomic<bool>   stop;    // the count should give up
+    ConsoleTaskGroup*   counter; // the count, a task on the shared pool
+    bool                queued;  // the count was submitted, by the first run
+    size_t              top;     // first line shown: byte offset in a file, index in a page
+    size_t              scroll;  // first column shown
+    ConsoleLine*        window;  // the window of the line being drawn
+    PagerIndex          indexes[CONSOLE_PAGER_INDEXES]; // by position, wrapping around
+    std::string         frame;   // bytes of the screen being drawn
+    ConsoleRegex*       regex;   // the last search, repeated by n
+    std::string         pattern; // being typed after '/'
+    bool                typing;
+    const char*         message; // shown in the status line until the next key
+};
+
+// Newlines in `data`. Bytes are compared 16 at a time into per-lane counters, which are
+// summed before any of them can overflow.
+static size_t count_newlines(const char* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t               count = 0;
+    size_t               i     = 0;
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero    = _mm_setzero_si128();
+    while (i + 16 <= length) {
+        __m128i lanes = zero;
+        for (size_t round = 0; round < 255 && i + 16 <= length; round++, i += 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*) (bytes + i));
+            lanes         = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(chunk, newline)); // -1 a match
+        }
+        __m128i sums  = _mm_sad_epu8(lanes, zero);
+        count        += (size_t) _mm_cvtsi128_si32(sums)
+                        + (size_t) _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    while (i + 16 <= length) {
+        uint8x16_t lanes = vdupq_n_u8(0);
+        for (size_t round = 0; round < 255 && i + 16 <= length; round++, i += 16) {
+            uint8x16_t match = vceqq_u8(vld1q_u8(bytes + i), newline);
+            lanes            = vsubq_u8(lanes, vreinterpretq_u8_s8(vreinterpretq_s8_u8(match)));
+        }
+        uint64x2_t sums  = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(lanes)));
+        count           += (size_t) (vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+    }
+#endif
+    for (; i < length; i++) {
+        count += '\n' == bytes[i];
+    }
+    return count;
+}
+
+static void count_lines(void* context) {
+    ConsolePager* pager = (ConsolePager*) context;
+    uint64_t      total = 0;
+    for (size_t block = 0; block < pager->blocks; block++) {
+        if (pager->stop.load(std::memory_order_relaxed)) {
+            return;
+        }
+        size_t start          = block * CONSOLE_PAGER_BLOCK;
+        size_t length         = pager->size - start;
+        length                = length < CONSOLE_PAGER_BLOCK ? length : CONSOLE_PAGER_BLOCK;
+        total                += count_newlines(pager->data + start, length);
+        pager->counts[block]  = total;
+        pager->indexed.store(block + 1, std::memory_order_release);
+    }
+}
+
+// Count on the shared pool. A full pool is tried again on the next call, from the
+// pager's redraw.
+static void start_counting(ConsolePager* pager) {
+    if (NULL == pager->page && pager->blocks > 0 && !pager->queued) {
+        pager->queued = console_group_submit(pager->counter, console_shared_pool(), count_lines,
+                                             pager, CONSOLE_PRIORITY_NORMAL);
+    }
+}
+
+static ConsolePager* create_pager(void) {
+    ConsolePager* pager = new (std::nothrow) ConsolePager();
+    if (NULL == pager) {
+        fprintf(stderr, "debug: console_create_pager: failed to allocate pager\n");
+        return NULL;
+    }
+    pager->window  = console_create_line(0);
+    pager->counter = console_create_task_group();
+    if (NULL == pager->window || NULL == pager->counter) {
+        console_destroy_pager(pager);
+        return NULL;
+    }
+    return pager;
+}
+
+ConsolePager* console_create_page_pager(const ConsolePage* page) {
+    ConsolePager* pager = create_pager();
+    if (NULL != pager) {
+        pager->page = page;
+    }
+    return pager;
+}
+
+ConsolePager* console_create_file_pager(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+        return NULL;
+    }
+    struct stat info;
+    if (-1 == fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    ConsolePager* pager = create_pager();
+    if (NULL == pager) {
+        close(fd);
+        return NULL;
+    }
+    pager->size   = (size_t) info.st_size;
+    pager->blocks = (pager->size + CONSOLE_PAGER_BLOCK - 1) / CONSOLE_PAGER_BLOCK;
+    pager->name   = strdup(path);
+    pager->counts = (uint64_t*) calloc(pager->blocks > 0 ? pager->blocks : 1, sizeof(uint64_t));
+    if (NULL == pager->name || NULL == pager->counts) {
+        close(fd);
+        console_destroy_pager(pager);
+        return NULL;
+    }
+    if (pager->size > 0) {
+        void* data = mmap(NULL, pager->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == data) {
+            close(fd);
+            console_destroy_pager(pager);
+            return NULL;
+        }
+        pager->data = (const char*) data;
+    }
+    close(fd); // the mapping keeps its own reference to the file
+    return pager;
+}
+
+void console_destroy_pager(ConsolePager* pager) {
+    if (NULL == pager) {
+        return;
+    }
+    pager->stop.store(true, std::memory_order_relaxed);
+    console_destroy_task_group(pager->counter); // waits for the count to give up
+    if (NULL != pager->data) {
+        munmap((void*) pager->data, pager->size);
+    }
+    console_destroy_regex(pager->regex);
+    for (PagerIndex &index : pager->indexes) {
+        console_destroy_column_index(index.columns);
+    }
+    console_destroy_line(pager->window);
+    free(pager->counts);
+    free(pager->name);
+    delete pager;
+}
+
+size_t console_pager_lines(ConsolePager* pager, bool* complete) {
+    if (NULL != pager->page) {
+        *complete = true;
+        return pager->page->length;
+    }
+    start_counting(pager);
+    size_t indexed = pager->indexed.load(std::memory_order_acquire);
+    *complete      = indexed == pager->blocks;
+    if (0 == indexed) {
+        return 0;
+    }
+    size_t lines = (size_t) pager->counts[indexed - 1];
+    if (*complete && pager->size > 0 && '\n' != pager->data[pager->size - 1]) {
+        lines++; // the last line has no newline
+    }
+    return lines;
+}
+
+// Lines are positions below end_of(): a byte offset that starts a line in a file, an
+// index in a page
+static size_t end_of(const ConsolePager* pager) {
+    return NULL != pager->page ? pager->page->length : pager->size;
+}
+
+static const char* line_text(const ConsolePager* pager, size_t position, size_t* length) {
+    if (NULL != pager->page) {
+        *length = pager->page->lines[position].length;
+        return pager->page->lines[position].buffer;
+    }
+    const char* start   = pager->data + position;
+    const char* newline = (const char*) memchr(start, '\n', pager->size - position);
+    *length             = NULL != newline ? (size_t) (newline - start) : pager->size - position;
+    return start;
+}
+
+static size_t next_line(const ConsolePager* pager, size_t position) {
+    if (NULL != pager->page) {
+        return position + 1;
+    }
+    size_t length;
+    line_text(pager, position, &length);
+    return position + length + 1 < pager->size ? position + length + 1 : pager->size;
+}
+
+static size_t previous_line(const ConsolePager* pager, size_t position) {
+    if (0 == position) {
+        return 0;
+    }
+    if (NULL != pager->page) {
+        return position - 1;
+    }
+    const char* newline = (const char*) memrchr(pager->data, '\n', position - 1);
+    return NULL != newline ? (size_t) (newline - pager->data) + 1 : 0;
+}
+
+// Start of the line at byte `offset` of a file
+static size_t line_start(const ConsolePager* pager, size_t offset) {
+    return offset > 0 ? previous_line(pager, offset + 1) : 0;
+}
+
+// The top that shows the last line on the last row of `rows`
+static size_t last_top(const ConsolePager* pager, size_t rows) {
+    size_t top = end_of(pager);
+    for (size_t i = 0; i < rows && top > 0; i++) {
+        top = previous_line(pager, top);
+    }
+    return top;
+}
+
+// 1-based number of the line at `position`, 0 while the count has not got there
+static size_t line_number(const ConsolePager* pager, size_t position) {
+    if (NULL != pager->page) {
+        return position + 1;
+    }
+    size_t block = position / CONSOLE_PAGER_BLOCK;
+    if (pager->indexed.load(std::memory_order_acquire) < block) {
+        return 0;
+    }
+    size_t start = block * CONSOLE_PAGER_BLOCK;
+    size_t count = block > 0 ? (size_t) pager->counts[block - 1] : 0;
+    return count + count_newlines(pager->data + start, position - start) + 1;
+}
+
+// Position of line `number` (1-based), or the end when there are fewer. Counted blocks
+// are skipped by a binary search; past them the file is scanned up to the line.
+static size_t find_line(const ConsolePager* pager, size_t number) {
+    if (NULL != pager->page) {
+        return number > 0 ? number - 1 : 0;
+    }
+    size_t newlines = number > 0 ? number - 1 : 0;
+    size_t indexed  = pager->indexed.load(std::memory_order_acquire);
+    size_t low      = 0;
+    size_t high     = indexed;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (pager->counts[middle] < newlines) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    size_t position = low * CONSOLE_PAGER_BLOCK;
+    newlines       -= low > 0 ? (size_t) pager->counts[low - 1] : 0;
+    for (; newlines > 0 && position < pager->size; newlines--) {
+        const char* newline = (const char*) memchr(pager->data + position, '\n',
+                                                   pager->size - position);
+        position = NULL != newline ? (size_t) (newline - pager->data) + 1 : pager->size;
+    }
+    return position;
+}
+
+static void measure(Console* console, size_t* rows, size_t* columns) {
+    struct winsize window_size;
+    if (0 == ioctl(fileno(console->io->teletype), TIOCGWINSZ, &window_size)
+        && window_size.ws_col > 0 && window_size.ws_row > 1) {
+        *rows    = window_size.ws_row;
+        *columns = window_size.ws_col;
+    } else {
+        *rows    = 24;
+        *columns = 80;
+    }
+}
+
+// Add the window of the line at `position` to the frame. Control characters take no
+// columns in the window and are left out, so the text can never move the cursor.
+static void draw_line(
+    ConsolePager* pager, size_t position, const char* text, size_t length, size_t columns
+) {
+    PagerIndex* index = &pager->indexes[position % CONSOLE_PAGER_INDEXES];
+    if (NULL == index->columns) {
+        index->columns = console_create_column_index();
+        if (NULL == index->columns) {
+            return;
+        }
+    }
+    // what is paged does not change, so a line drawn before is still indexed
+    bool drawn = index->position == position && index->text == text && index->length == length;
+    console_column_index_update(index->columns, text, length, drawn ? length : 0);
+    index->position = position;
+    index->text     = text;
+    index->length   = length;
+
+    ConsoleLine*  out = pager->window;
+    ConsoleWindow window;
+    out->length = 0;
+    if (!console_column_window(index->columns, text, length, 0, pager->scroll, columns, out,
+                               &window)) {
+        return;
+    }
+    for (size_t i = 0; i < out->length; i++) {
+        unsigned char byte = (unsigned char) out->buffer[i];
+        if (byte >= 0x20 && 0x7F != byte) {
+            pager->frame += (char) byte;
+        }
+    }
+}
+
+static void draw_status(
+    ConsolePager* pager, size_t rows, size_t columns, size_t bottom, const char* count
+) {
+    char position[32];
+    snprintf(position, sizeof(position), "\x1b[%zuH\x1b[K", rows);
+    pager->frame += position;
+    if (pager->typing) {
+        size_t room  = columns > 1 ? columns - 1 - 1 : 0; // after the '/', off the last column
+        size_t shown = pager->pattern.size() < room ? pager->pattern.size() : room;
+        pager->frame += "/";
+        pager->frame.append(pager->pattern, pager->pattern.size() - shown, shown);
+        return;
+    }
+
+    char   status[256];
+    size_t end   = end_of(pager);
+    size_t first = line_number(pager, pager->top);
+    size_t last  = NULL != pager->page ? bottom : line_number(pager, bottom > 0 ? bottom - 1 : 0);
+    bool   complete;
+    size_t lines = console_pager_lines(pager, &complete);
+    int    percent = end > 0 ? (int) (100.0 * (double) bottom / (double) end) : 100;
+
+    int length;
+    if (first > 0 && last > 0) {
+        length = snprintf(status, sizeof(status), " %s  lines %zu-%zu of %zu%s  %d%%",
+                          NULL != pager->name ? pager->name : "page", first,
+                          last >= first ? last : first, lines, complete ? "" : "+", percent);
+    } else {
+        length = snprintf(status, sizeof(status), " %s  byte %zu of %zu  %d%%",
+                          NULL != pager->name ? pager->name : "page", pager->top, end, percent);
+    }
+    if (NULL != pager->message) {
+        length += snprintf(status + length, sizeof(status) - (size_t) length, "  (%s)",
+                           pager->message);
+    }
+    if (NULL != count && '\0' != *count && (size_t) length < sizeof(status)) {
+        length += snprintf(status + length, sizeof(status) - (size_t) length, "  :%s", count);
+    }
+    size_t shown = (size_t) length < sizeof(status) ? (size_t) length : sizeof(status) - 1;
+    shown        = shown < columns - 1 ? shown : columns - 1; // the status has no controls
+
+    pager->frame += "\x1b[7m";
+    pager->frame.append(status, shown);
+    pager->frame += ANSI_COLOR_RESET;
+}
+
+// Redraw the whole screen: the lines from the top, '~' past the end, the status below
+static bool draw(Console* console, ConsolePager* pager, const char* count) {
+    size_t rows;
+    size_t columns;
+    measure(console, &rows, &columns);
+
+    size_t top = last_top(pager, rows - 1);
+    if (pager->top > top) {
+        pager->top = top; // the last line stays on the last row
+    }
+
+    size_t end      = end_of(pager);
+    size_t position = pager->top;
+    pager->frame    = "\x1b[H";
+    for (size_t row = 0; row + 1 < rows; row++) {
+        pager->frame += ANSI_ERASE_LINE; // first, a full row leaves a pending wrap
+        if (position < end) {
+            size_t      length;
+            const char* text = line_text(pager, position, &length);
+            draw_line(pager, position, text, length, columns);
+            position = next_line(pager, position);
+        } else {
+            pager->frame += "~";
+        }
+        pager->frame += "\r\n";
+    }
+    draw_status(pager, rows, columns, position, count);
+
+    FILE* teletype = console->io->teletype;
+    return pager->frame.size() == fwrite(pager->frame.data(), 1, pager->frame.size(), teletype)
+           && 0 == fflush(teletype);
+}
+
+static void move_lines(ConsolePager* pager, long count) {
+    for (; count > 0 && pager->top < end_of(pager); count--) {
+        pager->top = next_line(pager, pager->top);
+    }
+    for (; count < 0 && pager->top > 0; count++) {
+        pager->top = previous_line(pager, pager->top);
+    }
+}
+
+// Move the top to the next line below it that matches the last search, and scroll
+// sideways when the match is out of view
+static void search_next(Console* console, ConsolePager* pager) {
+    if (NULL == pager->regex) {
+        pager->message = "no previous search";
+        return;
+    }
+    ConsoleSearchMatch match;
+    size_t             from  = next_line(pager, pager->top);
+    bool               found = false;
+    if (from < end_of(pager) && NULL != pager->page) {
+        found = 1 == console_search_page(pager->regex, pager->page, from, &match, 1);
+    } else if (from < end_of(pager)) {
+        found = console_search_text(pager->regex, pager->data, pager->size, from, &match);
+    }
+    if (!found) {
+        pager->message = "pattern not found";
+        return;
+    }
+    pager->top = match.line;
+
+    size_t      rows;
+    size_t      columns;
+    size_t      length;
+    const char* text   = line_text(pager, match.line, &length);
+    size_t      column = console_utf8_columns(text, match.start);
+    measure(console, &rows, &columns);
+    if (column < pager->scroll || column >= pager->scroll + columns) {
+        pager->scroll = column > columns / 4 ? column - columns / 4 : 0;
+    }
+}
+
+// Search for the typed pattern. Case is ignored unless the pattern has capitals, as in
+// less -i.
+static void search(Console* console, ConsolePager* pager) {
+    bool ignore_case = true;
+    for (size_t i = 0; i < pager->pattern.size(); i++) {
+        if ('\\' == pager->pattern[i]) {
+            i++; // \D, \W and \S are classes
+        } else if (isupper((unsigned char) pager->pattern[i])) {
+            ignore_case = false;
+        }
+    }
+    const char*   error = NULL;
+    ConsoleRegex* regex = console_compile_regex(pager->pattern.data(), pager->pattern.size(),
+                                                ignore_case, &error);
+    if (NULL == regex) {
+        pager->message = NULL != error ? error : "invalid pattern";
+        return;
+    }
+    console_destroy_regex(pager->regex);
+    pager->regex = regex;
+    search_next(console, pager);
+}
+
+// A key while a pattern is typed: Enter searches, Escape or erasing it all cancels
+static void edit_pattern(Console* console, ConsolePager* pager, const ConsoleEvent* event) {
+    std::string &pattern = pager->pattern;
+    if (CONSOLE_EVENT_CODEPOINT == event->type && event->codepoint >= 0x20
+        && 0 == (event->modifiers & (CONSOLE_MOD_ALT | CONSOLE_MOD_CTRL))) {
+        char bytes[4];
+        pattern.append(bytes, console_utf8_encode(event->codepoint, bytes));
+    } else if (CONSOLE_EVENT_PASTE == event->type) {
+        for (size_t i = 0; i < event->length; i++) {
+            if ((unsigned char) event->data[i] >= 0x20) {
+                pattern += event->data[i];
+            }
+        }
+    } else if (CONSOLE_EVENT_KEY == event->type) {
+        switch (event->key) {
+            case STREAM_EVENT_BACKSPACE:
+                if (pattern.empty()) {
+                    pager->typing = false;
+                }
+                while (!pattern.empty() && 0x80 == (pattern.back() & 0xC0)) {
+                    pattern.pop_back();
+                }
+                if (!pattern.empty()) {
+                    pattern.pop_back();
+                }
+                break;
+            case STREAM_EVENT_ESC:
+                pager->typing = false;
+                break;
+            case STREAM_EVENT_ENTER:
+                pager->typing = false;
+                search(console, pager);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Apply a key; returns false to quit. `count` is the number typed before it, if any.
+static bool apply_key(
+    Console* console, ConsolePager* pager, const ConsoleEvent* event, size_t count, bool counted
+) {
+    size_t rows;
+    size_t columns;
+    measure(console, &rows, &columns);
+    long page = (long) rows - 1;
+
+    if (CONSOLE_EVENT_KEY == event->type) {
+        switch (event->key) {
+            case STREAM_EVENT_ESC:
+                return false;
+            case STREAM_EVENT_DOWN:
+            case STREAM_EVENT_ENTER:
+                move_lines(pager, counted ? (long) count : 1);
+                break;
+            case STREAM_EVENT_UP:
+                move_lines(pager, counted ? -(long) count : -1);
+                break;
+            case STREAM_EVENT_PAGE_DOWN:
+                move_lines(pager, page);
+                break;
+            case STREAM_EVENT_PAGE_UP:
+                move_lines(pager, -page);
+                break;
+            case STREAM_EVENT_HOME:
+                pager->top = 0;
+                break;
+            case STREAM_EVENT_END:
+                pager->top = end_of(pager);
+                break;
+            case STREAM_EVENT_RIGHT:
+                pager->scroll += columns / 2;
+                break;
+            case STREAM_EVENT_LEFT:
+                pager->scroll -= pager->scroll < columns / 2 ? pager->scroll : columns / 2;
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
+
+    switch (event->codepoint) {
+        case 'q':
+        case 'Q':
+            return false;
+        case 'j':
+        case 'e':
+            move_lines(pager, counted ? (long) count : 1);
+            break;
+        case 'k':
+        case 'y':
+        case 'p':
+            move_lines(pager, counted ? -(long) count : -1);
+            break;
+        case ' ':
+        case 'f':
+            move_lines(pager, page);
+            break;
+        case 'b':
+            move_lines(pager, -page);
+            break;
+        case 'd':
+            move_lines(pager, page / 2);
+            break;
+        case 'u':
+            move_lines(pager, -page / 2);
+            break;
+        case 'g':
+        case '<':
+            pager->top = counted ? find_line(pager, count) : 0;
+            break;
+        case 'G':
+        case '>':
+            pager->top = counted ? find_line(pager, count) : end_of(pager);
+            break;
+        case '/':
+            pager->typing = true;
+            pager->pattern.clear();
+            break;
+        case 'n':
+            search_next(console, pager);
+            break;
+        case '%':
+            if (NULL != pager->page) {
+                pager->top = (size_t) ((double) end_of(pager) * (double) count / 100.0);
+            } else {
+                size_t offset = (size_t) ((double) pager->size * (double) count / 100.0);
+                offset        = offset < pager->size ? offset : pager->size;
+                pager->top    = offset < pager->size ? line_start(pager, offset) : offset;
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+static bool wait_input(Console* console, int timeout, bool* ready) {
+    struct pollfd descriptor = {fileno(console->io->input), POLLIN, 0};
+    int           result     = console_exporter_poll(console, &descriptor, timeout);
+    *ready                   = result > 0;
+    if (-1 == result) {
+        return EINTR == errno; // e.g. SIGWINCH, picked up by the next batch
+    }
+    return 0 == (descriptor.revents & (POLLERR | POLLNVAL));
+}
+
+bool console_run_pager(Console* console, ConsolePager* pager) {
+    FILE*        teletype = console->io->teletype;
+    ConsoleEvent events[64];
+    char         count[24] = "";
+    size_t       digits    = 0;
+
+    start_counting(pager);
+    fputs("\x1b[?1049h\x1b[?25l", teletype); // alternate screen, no cursor
+    bool ok      = draw(console, pager, count);
+    bool running = ok;
+    while (running) {
+        size_t batch = console_read_events(console, events, sizeof(events) / sizeof(*events));
+        if (0 == batch) {
+            // while lines are still being counted, the status line follows the count
+            bool complete;
+            console_pager_lines(pager, &complete);
+            bool ready;
+            if (!wait_input(console, complete ? -1 : 200, &ready)) {
+                break;
+            }
+            if (!ready) {
+                ok = draw(console, pager, count);
+            }
+            continue;
+        }
+
+        for (size_t i = 0; i < batch && running; i++) {
+            const ConsoleEvent* event = &events[i];
+            if (CONSOLE_EVENT_EOF == event->type || CONSOLE_EVENT_SIGNAL == event->type) {
+                running = false;
+            } else if (pager->typing) {
+                edit_pattern(console, pager, event);
+            } else if (CONSOLE_EVENT_CODEPOINT == event->type && event->codepoint >= '0'
+                       && event->codepoint <= '9' && 0 == event->modifiers) {
+                if (digits + 1 < sizeof(count)) {
+                    count[digits++] = (char) event->codepoint;
+                    count[digits]   = '\0';
+                }
+            } else if (CONSOLE_EVENT_KEY == event->type || CONSOLE_EVENT_CODEPOINT == event->type) {
+                size_t number  = (size_t) strtoull(count, NULL, 10);
+                pager->message = NULL;
+                running        = apply_key(console, pager, event, number, digits > 0);
+                digits        = 0;
+                count[0]      = '\0';
+            }
+        }
+        if (running) {
+            ok = draw(console, pager, count);
+        }
+    }
+
+    fputs("\x1b[?25h\x1b[?1049l", teletype);
+    fflush(teletype);
+    console_style_forget(console->style); // the screen switch restores what it saved
+    return ok;
+}
+
+enum CaptureState {
+    CAPTURE_TEXT,
+    CAPTURE_ESCAPE,       // after ESC
+    CAPTURE_CSI,          // up to a final byte
+    CAPTURE_STRING,       // OSC and the like, up to BEL or ST
+    CAPTURE_STRING_ESCAPE // ESC inside a string, maybe the start of ST
+};
+
+struct ConsoleCapture {
+    ConsoleSink       sink;  // the capture as an output stage
+    ConsolePage*      page;  // where finished lines go
+    ConsoleLine*      line;  // the line in progress
+    enum CaptureState state; // escape sequences are skipped across writes
+};
+
+static void capture_text(ConsoleCapture* capture, const char* data, size_t length) {
+    ConsoleLine* line = capture->line;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char byte = (unsigned char) data[i];
+        switch (capture->state) {
+            case CAPTURE_TEXT:
+                if (0x1b == byte) {
+                    capture->state = CAPTURE_ESCAPE;
+                } else if ('\n' == byte) {
+                    console_page_append_line(capture->page, line->buffer, line->length);
+                    line->length    = 0;
+                    line->buffer[0] = '\0';
+                } else if (byte >= 0x20 || '\t' == byte) {
+                    size_t span = console_ascii_span(data + i, length - i);
+                    span        = span > 0 ? span : 1;
+                    console_line_insert(line, line->length, data + i, span);
+                    i += span - 1;
+                }
+                break;
+            case CAPTURE_ESCAPE:
+                if ('[' == byte) {
+                    capture->state = CAPTURE_CSI;
+                } else if (']' == byte || 'P' == byte) {
+                    capture->state = CAPTURE_STRING;
+                } else if (byte < 0x20 || byte > 0x2F) {
+                    capture->state = CAPTURE_TEXT; // not an intermediate, the final byte
+                }
+                break;
+            case CAPTURE_CSI:
+                if (byte >= 0x40 && byte <= 0x7E) {
+                    capture->state = CAPTURE_TEXT;
+                }
+                break;
+            case CAPTURE_STRING:
+                if ('\a' == byte) {
+                    capture->state = CAPTURE_TEXT;
+                } else if (0x1b == byte) {
+                    capture->state = CAPTURE_STRING_ESCAPE;
+                }
+                break;
+            case CAPTURE_STRING_ESCAPE:
+                capture->state = '\\' == byte ? CAPTURE_TEXT : CAPTURE_STRING;
+                break;
+        }
+    }
+}
+
+static void capture_write(Console* console, ConsoleSink* sink, const char* data, size_t length) {
+    ConsoleCapture* capture = (ConsoleCapture*) sink->context;
+    capture_text(capture, data, length);
+    console_sink_pass(console, sink, data, length);
+}
+
+static void capture_flush(Console* console, ConsoleSink* sink) {
+    ConsoleCapture* capture = (ConsoleCapture*) sink->context;
+    ConsoleLine*    line    = capture->line;
+    if (line->length > 0) {
+        console_page_append_line(capture->page, line->buffer, line->length);
+        line->length    = 0;
+        line->buffer[0] = '\0';
+    }
+    console_sink_flush(console, sink);
+}
+
+ConsoleCapture* console_create_capture(ConsolePage* page) {
+    ConsoleCapture* capture = (ConsoleCapture*) malloc(sizeof(ConsoleCapture));
+    if (NULL == capture) {
+        fprintf(stderr, "debug: console_create_capture: failed to allocate capture\n");
+        return NULL;
+    }
+    capture->line = console_create_line(0);
+    if (NULL == capture->line) {
+        free(capture);
+        return NULL;
+    }
+    capture->page         = page;
+    capture->state        = CAPTURE_TEXT;
+    capture->sink.write   = capture_write;
+    capture->sink.flush   = capture_flush;
+    capture->sink.context = capture;
+    capture->sink.next    = NULL;
+    return capture;
+}
+
+void console_destroy_capture(ConsoleCapture* capture) {
+    if (NULL != capture) {
+        console_destroy_line(capture->line);
+        free(capture);
+    }
+}
+
+ConsoleSink* console_capture_sink(ConsoleCapture* capture) {
+    return &capture->sink;
+}
@@ -0,0 +1,300 @@
+/**
+ * @file console_pool.cpp
+ *
+ * @brief The worker pool background work of the console runs on: a few threads with
+ * bounded per-thread queues, which idle threads steal from, taken most urgent first.
+ *
+ */
+
+#include <console_pool.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+#include <system_error>
+#include <thread>
+
+struct PoolJob {
+    ConsoleTask       task;
+    void*             context;
+    ConsoleTaskGroup* group; // counts the task until it returns, or NULL
+};
+
+struct ConsoleTaskGroup {
+    std::mutex              lock;
+    std::condition_variable done;
+    size_t                  pending;
+};
+
+// One thread's queues, one per priority. A thread takes from its own first, then from
+// the others', so a burst submitted to one thread spreads over the idle ones.
+struct PoolSlot {
+    std::mutex          lock;
+    std::deque<PoolJob> queues[CONSOLE_PRIORITIES];
+    std::atomic<size_t> count;   // queued over all priorities, read without the lock
+    std::thread         thread;
+    bool                running; // under the pool's lock
+};
+
+struct ConsolePool {
+    PoolSlot                slots[CONSOLE_POOL_THREADS_MAX];
+    std::mutex              lock;     // the threads, the cap and sleeping
+    std::condition_variable wake;
+    size_t                  cap;
+    size_t                  idle;     // threads asleep for want of work
+    std::atomic<size_t>     pending;  // tasks queued and not yet taken
+    bool                    stop;
+    size_t                  next;     // queue for the next task from outside the pool
+    ConsoleExecutor         executor; // `submit` NULL for the pool's threads
+};
+
+// The pool and slot of a pool thread, so the tasks it submits go to its own queue
+static thread_local ConsolePool* current_pool  = NULL;
+static thread_local size_t       current_index = 0;
+
+static void finish(ConsoleTaskGroup* group) {
+    std::lock_guard<std::mutex> guard(group->lock);
+    if (0 == --group->pending) {
+        group->done.notify_all();
+    }
+}
+
+static void run_job(const PoolJob* job) {
+    job->task(job->context);
+    if (NULL != job->group) {
+        finish(job->group);
+    }
+}
+
+// The most urgent task queued anywhere, looking at the thread's own queue first
+static bool take_job(ConsolePool* pool, size_t index, PoolJob* job) {
+    for (size_t priority = 0; priority < CONSOLE_PRIORITIES; priority++) {
+        for (size_t k = 0; k < CONSOLE_POOL_THREADS_MAX; k++) {
+            PoolSlot* slot = &pool->slots[(index + k) % CONSOLE_POOL_THREADS_MAX];
+            if (0 == slot->count.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(slot->lock);
+            std::deque<PoolJob>        &queue = slot->queues[priority];
+            if (!queue.empty()) {
+                *job = queue.front();
+                queue.pop_front();
+                slot->count.fetch_sub(1, std::memory_order_relaxed);
+                pool->pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void work(ConsolePool* pool, size_t index) {
+    current_pool  = pool;
+    current_index = index;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> guard(pool->lock);
+            if (index >= pool->cap) {
+                pool->slots[index].running = false;
+                return;
+            }
+        }
+        PoolJob job;
+        if (take_job(pool, index, &job)) {
+            run_job(&job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(pool->lock);
+        if (0 != pool->pending.load(std::memory_order_relaxed)) {
+            continue; // queued after the search passed its queue
+        }
+        if (index >= pool->cap || pool->stop) {
+            pool->slots[index].running = false;
+            return;
+        }
+        pool->idle++;
+        pool->wake.wait(lock);
+        pool->idle--;
+    }
+}
+
+// Start a thread in the lowest free slot under the cap, with the pool locked
+static bool start_thread(ConsolePool* pool) {
+    for (size_t index = 0; index < pool->cap; index++) {
+        PoolSlot* slot = &pool->slots[index];
+        if (slot->running) {
+            continue;
+        }
+        if (slot->thread.joinable()) {
+            slot->thread.join(); // left when the cap was lower, and is gone by now
+        }
+        try {
+            slot->thread = std::thread(work, pool, index);
+        } catch (const std::system_error &) {
+            fprintf(stderr, "debug: console_pool_submit: failed to start a thread\n");
+            return false;
+        }
+        slot->running = true;
+        return true;
+    }
+    return false;
+}
+
+static size_t default_threads(void) {
+    size_t cores = std::thread::hardware_concurrency();
+    return cores > 0 && cores < CONSOLE_POOL_THREADS ? cores : CONSOLE_POOL_THREADS;
+}
+
+ConsolePool* console_create_pool(size_t threads) {
+    ConsolePool* pool = new (std::nothrow) ConsolePool();
+    if (NULL == pool) {
+        fprintf(stderr, "debug: console_create_pool: failed to allocate pool\n");
+        return NULL;
+    }
+    console_pool_set_threads(pool, threads);
+    return pool;
+}
+
+void console_destroy_pool(ConsolePool* pool) {
+    if (NULL == pool) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->stop = true;
+        pool->wake.notify_all();
+    }
+    for (size_t index = 0; index < CONSOLE_POOL_THREADS_MAX; index++) {
+        if (pool->slots[index].thread.joinable()) {
+            pool->slots[index].thread.join();
+        }
+    }
+    delete pool;
+}
+
+ConsolePool* console_shared_pool(void) {
+    static ConsolePool* pool = console_create_pool(default_threads()); // once, thread-safe
+    return pool;
+}
+
+// A task of a group sent to a host's executor, which knows nothing of groups
+struct GroupCall {
+    ConsoleTask       task;
+    void*             context;
+    ConsoleTaskGroup* group;
+};
+
+static void run_group_call(void* context) {
+    GroupCall* call = (GroupCall*) context;
+    PoolJob    job  = {call->task, call->context, call->group};
+    delete call;
+    run_job(&job);
+}
+
+static bool submit_job(ConsolePool* pool, const PoolJob* job, enum ConsolePriority priority) {
+    if (NULL == pool) {
+        return false; // the shared pool could not be created
+    }
+    std::unique_lock<std::mutex> lock(pool->lock);
+    if (pool->stop) {
+        return false;
+    }
+    if (NULL != pool->executor.submit) {
+        ConsoleExecutor executor = pool->executor;
+        lock.unlock();
+        if (NULL == job->group) {
+            return executor.submit(executor.executor, job->task, job->context, priority);
+        }
+        GroupCall* call = new (std::nothrow) GroupCall{job->task, job->context, job->group};
+        if (NULL == call) {
+            return false;
+        }
+        if (!executor.submit(executor.executor, run_group_call, call, priority)) {
+            delete call;
+            return false;
+        }
+        return true;
+    }
+
+    // a thread is started when none is idle, until the cap
+    if (0 == pool->idle && !start_thread(pool) && !pool->slots[0].running) {
+        return false;
+    }
+    size_t first = current_pool == pool ? current_index : pool->next++ % pool->cap;
+    for (size_t k = 0; k < pool->cap; k++) {
+        PoolSlot*                   slot = &pool->slots[(first + k) % pool->cap];
+        std::lock_guard<std::mutex> guard(slot->lock);
+        if (slot->count.load(std::memory_order_relaxed) < CONSOLE_POOL_QUEUE) {
+            slot->queues[priority].push_back(*job);
+            slot->count.fetch_add(1, std::memory_order_relaxed);
+            pool->pending.fetch_add(1, std::memory_order_relaxed);
+            pool->wake.notify_one();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool console_pool_submit(
+    ConsolePool* pool, ConsoleTask task, void* context, enum ConsolePriority priority
+) {
+    PoolJob job = {task, context, NULL};
+    return submit_job(pool, &job, priority);
+}
+
+void console_pool_set_threads(ConsolePool* pool, size_t threads) {
+    threads = threads > 0 ? threads : 1;
+    threads = threads < CONSOLE_POOL_THREADS_MAX ? threads : CONSOLE_POOL_THREADS_MAX;
+    std::lock_guard<std::mutex> guard(pool->lock);
+    pool->cap = threads;
+    pool->wake.notify_all(); // threads above the cap leave, the rest take their tasks
+}
+
+void console_pool_set_executor(ConsolePool* pool, const ConsoleExecutor* executor) {
+    std::lock_guard<std::mutex> guard(pool->lock);
+    if (NULL != executor) {
+        pool->executor = *executor;
+    } else {
+        pool->executor = ConsoleExecutor{NULL, NULL};
+    }
+}
+
+ConsoleTaskGroup* console_create_task_group(void) {
+    ConsoleTaskGroup* group = new (std::nothrow) ConsoleTaskGroup();
+    if (NULL == group) {
+        fprintf(stderr, "debug: console_create_task_group: failed to allocate group\n");
+    }
+    return group;
+}
+
+void console_destroy_task_group(ConsoleTaskGroup* group) {
+    if (NULL != group) {
+        console_group_wait(group);
+        delete group;
+    }
+}
+
+bool console_group_submit(
+    ConsoleTaskGroup* group, ConsolePool* pool, ConsoleTask task, void* context,
+    enum ConsolePriority priority
+) {
+    {
+        std::lock_guard<std::mutex> guard(group->lock);
+        group->pending++;
+    }
+    PoolJob job = {task, context, group};
+    if (!submit_job(pool, &job, priority)) {
+        finish(group);
+        return false;
+    }
+    return true;
+}
+
+void console_group_wait(ConsoleTaskGroup* group) {
+    std::unique_lock<std::mutex> lock(group->lock);
+    while (0 != group->pending) {
+        group->done.wait(lock);
+    }
+}
@@ -0,0 +1,366 @@
+/**
+ * @file console_region.cpp
+ *
+ * @brief Pinned prompt: output scrolls inside a scroll region (DECSTBM) while the input
+ * line, and optionally a status line, stay put on the rows below it.
+ *
+ */
+
+#include <console_event.h>
+#include <console_layout.h>
+#include <console_metrics.h>
+#include <console_region.h>
+#include <console_style.h>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// Guards `console->region` itself: pinning and unpinning set it under this lock, and the
+// output thread holds it for as long as it writes through the region
+static std::mutex pinning;
+
+// Rows are 1-based screen rows, as the terminal counts them. Output is written at
+// (`row`, `col`) between DECSC and DECRC, so the input cursor never notices it.
+struct ConsoleRegion {
+    std::mutex   lock;      // output may come from another thread than input
+    size_t       lines;     // terminal height
+    size_t       columns;   // terminal width
+    size_t       reserve;   // input rows asked for
+    size_t       input;     // input rows now, more while a long line is edited
+    bool         status;    // the last row is a status line
+    size_t       bottom;    // last row of the scroll region
+    size_t       row;       // where output continues
+    size_t       col;       // 0-based, `columns` while a wrap is pending
+    ConsoleStyle rendition; // style output left, DECRC takes it away between writes
+    std::string  partial;   // incomplete sequence or character held back from the last write
+    std::string  text;      // status line
+    std::string  redraw;    // bytes that redraw the status line
+    bool         reading;   // console_readline() runs and drains the input, under `pinning`
+};
+
+static void measure(Console* console, size_t* lines, size_t* columns) {
+    struct winsize window_size;
+    if (0 == ioctl(fileno(console->io->teletype), TIOCGWINSZ, &window_size)
+        && window_size.ws_col > 0 && window_size.ws_row > 0) {
+        *lines   = window_size.ws_row;
+        *columns = window_size.ws_col;
+    } else {
+        *lines   = 24;
+        *columns = 80;
+    }
+}
+
+static void append_position(std::string &out, size_t row, size_t col) {
+    char sequence[48];
+    snprintf(sequence, sizeof(sequence), "\x1b[%zu;%zuH", row, col);
+    out += sequence;
+}
+
+static void append_margins(std::string &out, size_t bottom) {
+    char sequence[32];
+    snprintf(sequence, sizeof(sequence), "\x1b[1;%zur", bottom); // homes the cursor
+    out += sequence;
+}
+
+static void emit(Console* console, const std::string &out) {
+    fwrite(out.data(), 1, out.size(), console->io->teletype);
+    fflush(console->io->teletype);
+}
+
+// Place the region above the input rows, keeping at least one row of output.
+static void arrange(ConsoleRegion* region) {
+    size_t below = region->input + (region->status ? 1 : 0);
+    if (region->lines < below + 1) {
+        region->input = region->lines > (region->status ? 2 : 1)
+                            ? region->lines - (region->status ? 2 : 1)
+                            : 1;
+        below         = region->input + (region->status ? 1 : 0);
+    }
+    region->bottom = region->lines > below ? region->lines - below : 1;
+    if (region->row > region->bottom) {
+        region->row = region->bottom;
+    }
+    if (region->col > region->columns) {
+        region->col = region->columns;
+    }
+}
+
+// Status text clipped to the row, drawn without disturbing the cursor or its style.
+static void build_status(ConsoleRegion* region) {
+    region->redraw.clear();
+    if (!region->status) {
+        return;
+    }
+
+    std::string &out   = region->redraw;
+    size_t       width = 0;
+    out                = "\x1b" "7";
+    append_position(out, region->lines, 1);
+    out += ANSI_COLOR_RESET ANSI_ERASE_LINE;
+    for (size_t i = 0; i < region->text.size();) {
+        size_t count = console_utf8_length((unsigned char) region->text[i]);
+        count        = count < region->text.size() - i ? count : region->text.size() - i;
+        int    cells = console_utf8_width(region->text.data() + i, count);
+        if ((unsigned char) region->text[i] < 0x20 || cells < 0) {
+            i += count; // no controls on a line that must stay one row
+            continue;
+        }
+        if (width + (size_t) cells >= region->columns) {
+            break; // the last column would leave a pending wrap
+        }
+        out.append(region->text, i, count);
+        width += (size_t) cells;
+        i     += count;
+    }
+    out += "\x1b" "8";
+}
+
+// Move the output position over `data`. Returns how many bytes are complete; the rest
+// is an unfinished sequence or character to hold back until more arrives.
+static size_t advance(ConsoleRegion* region, const char* data, size_t length) {
+    ConsoleLayout layout = {region->columns, region->col, 0};
+    size_t        count  = console_layout_advance(&layout, data, length);
+    size_t        room   = region->bottom - region->row; // the region scrolls after that
+    region->col          = layout.col;
+    region->row         += layout.rows < room ? layout.rows : room;
+    return count;
+}
+
+bool console_pin_prompt(Console* console, size_t rows, bool status) {
+    if (NULL != console->region) {
+        return true;
+    }
+    if (NULL == console->capabilities || !console->capabilities->scroll_region
+        || !isatty(fileno(console->io->teletype))) {
+        return false;
+    }
+
+    size_t lines;
+    size_t columns;
+    measure(console, &lines, &columns);
+    rows = rows > 0 ? rows : 1;
+    if (lines < rows + (status ? 1 : 0) + 2) {
+        return false;
+    }
+
+    ConsoleRegion* region = new (std::nothrow) ConsoleRegion();
+    if (NULL == region) {
+        fprintf(stderr, "debug: console_pin_prompt: failed to allocate region\n");
+        return false;
+    }
+    region->lines     = lines;
+    region->columns   = columns;
+    region->reserve   = rows;
+    region->input     = rows;
+    region->status    = status;
+    region->rendition = console_style_default();
+    arrange(region);
+    build_status(region);
+
+    // output continues where the cursor is; a terminal that does not say is assumed to
+    // be at the bottom, as it is after any amount of output
+    int         row = (int) lines;
+    int         col = 1;
+    std::string out;
+    console_query_position(console, 100, &row, &col);
+    row = row >= 1 && (size_t) row <= lines ? row : (int) lines;
+    if ((size_t) row > region->bottom) {
+        // scroll what is on screen up, out of the way of the input rows
+        append_position(out, lines, 1);
+        out.append((size_t) row - region->bottom, '\n');
+        row = (int) region->bottom;
+    }
+    region->row = (size_t) row;
+    region->col = col >= 1 && (size_t) col <= columns ? (size_t) col - 1 : 0;
+
+    append_margins(out, region->bottom);
+    append_position(out, region->bottom + 1, 1);
+    out += "\x1b[J";
+    out += region->redraw;
+    {
+        std::lock_guard<std::mutex> guard(pinning);
+        console->region = region;
+    }
+    emit(console, out);
+    return true;
+}
+
+void console_unpin_prompt(Console* console) {
+    std::lock_guard<std::mutex> pinned(pinning); // until no write can see the region
+    ConsoleRegion*              region = console->region;
+    if (NULL == region) {
+        return;
+    }
+
+    std::string out;
+    {
+        std::lock_guard<std::mutex> guard(region->lock);
+        append_position(out, region->bottom + 1, 1);
+        out += ANSI_COLOR_RESET "\x1b[J\x1b[r";
+        if (region->col < region->columns) {
+            append_position(out, region->row, region->col + 1);
+        } else {
+            append_position(out, region->row, region->columns);
+            out += "\r\n";
+        }
+        out += region->partial; // whatever was held back, the terminal sorts it out now
+    }
+    console->region          = NULL;
+    console->state->display = STATE_DISPLAY_RESET;
+    emit(console, out);
+    delete region;
+}
+
+void console_set_status(Console* console, const char* text, size_t length) {
+    std::lock_guard<std::mutex> pinned(pinning);
+    ConsoleRegion*              region = console->region;
+    if (NULL == region || !region->status) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(region->lock);
+    region->text.assign(text, length);
+    build_status(region);
+    emit(console, region->redraw);
+}
+
+// Follow the SGR sequences in output, so the next write starts in the style this one
+// left instead of the prompt's
+static void track_rendition(ConsoleRegion* region, const char* data, size_t length) {
+    const char* end = data + length;
+    const char* escape;
+    while (NULL != (escape = (const char*) memchr(data, '\x1b', (size_t) (end - data)))) {
+        size_t count = console_sequence_length(escape, (size_t) (end - escape));
+        if (0 == count) {
+            return;
+        }
+        if ('[' == escape[1] && 'm' == escape[count - 1]) {
+            console_style_apply(&region->rendition, escape + 2, count - 3);
+        }
+        data = escape + count;
+    }
+}
+
+bool console_region_write(Console* console, const char* data, size_t length) {
+    std::lock_guard<std::mutex> pinned(pinning);
+    ConsoleRegion*              region = console->region;
+    if (NULL == region) {
+        return false;
+    }
+    if (!region->reading) {
+        console_typeahead_drain(console); // keys typed during output are kept, as unpinned
+    }
+    std::lock_guard<std::mutex> guard(region->lock);
+    CONSOLE_TIMER(CONSOLE_METRIC_FLUSH);
+
+    std::string text = std::move(region->partial);
+    text.append(data, length);
+    if (text.empty()) {
+        return true;
+    }
+
+    std::string out = "\x1b" "7";
+    if (region->col < region->columns) {
+        append_position(out, region->row, region->col + 1);
+    } else {
+        // a pending wrap can't be restored by a move, so take it now if it would be
+        append_position(out, region->row, region->columns);
+        if ('\n' != text[0] && '\r' != text[0]) {
+            out         += "\r\n";
+            region->row += region->row < region->bottom ? 1 : 0;
+            region->col  = 0;
+        }
+    }
+    char sgr[CONSOLE_STYLE_MAX];
+    out.append(sgr, console_style_transition(NULL, &region->rendition, sgr));
+
+    size_t complete = advance(region, text.data(), text.size());
+    out.append(text, 0, complete);
+    track_rendition(region, text.data(), complete);
+    region->partial.assign(text, complete, std::string::npos);
+    out += "\x1b" "8";
+    emit(console, out);
+    return true;
+}
+
+void console_region_reading(Console* console, bool reading) {
+    std::lock_guard<std::mutex> pinned(pinning); // not while a write drains the input
+    if (NULL != console->region) {
+        console->region->reading = reading;
+    }
+}
+
+size_t console_region_input_row(Console* console) {
+    return console->region->bottom; // 0-based, the row below the region
+}
+
+size_t console_region_grow(Console* console, size_t rows) {
+    ConsoleRegion*              region = console->region;
+    std::lock_guard<std::mutex> guard(region->lock);
+
+    size_t most = region->lines - (region->status ? 2 : 1); // keep a row of output
+    rows        = rows < most ? rows : most;
+    if (rows <= region->input) {
+        return 0;
+    }
+
+    // scroll output and input up together inside a region that spans both
+    size_t      moved = rows - region->input;
+    size_t      last  = region->lines - (region->status ? 1 : 0);
+    std::string out;
+    append_margins(out, last);
+    append_position(out, last, 1);
+    out.append(moved, '\n');
+
+    region->input = rows;
+    region->row   = region->row > moved ? region->row - moved : 1;
+    arrange(region);
+    append_margins(out, region->bottom);
+    emit(console, out);
+    return moved;
+}
+
+void console_region_reset(Console* console) {
+    ConsoleRegion*              region = console->region;
+    std::lock_guard<std::mutex> guard(region->lock);
+
+    std::string out;
+    append_position(out, region->bottom + 1, 1);
+    out += "\x1b[J";
+    if (region->input != region->reserve) {
+        // the rows the line grew into go back to output, blank
+        region->input = region->reserve;
+        arrange(region);
+        append_margins(out, region->bottom);
+    }
+    out += region->redraw;
+    append_position(out, region->bottom + 1, 1);
+    emit(console, out);
+}
+
+void console_region_resize(Console* console) {
+    ConsoleRegion*              region = console->region;
+    std::lock_guard<std::mutex> guard(region->lock);
+
+    measure(console, &region->lines, &region->columns);
+    region->input = region->reserve;
+    arrange(region);
+    build_status(region);
+
+    std::string out;
+    append_margins(out, region->bottom);
+    append_position(out, region->bottom + 1, 1);
+    out += "\x1b[J";
+    out += region->redraw;
+    append_position(out, region->bottom + 1, 1);
+    emit(console, out);
+}
+
+const char* console_region_status(Console* console, size_t* length) {
+    *length = console->region->redraw.size();
+    return console->region->redraw.data();
+}
@@ -0,0 +1,797 @@
+/**
+ * @file console_render.cpp
+ *
+ * @brief Differential rendering of the input line. Each frame is laid out once and only
+ * the cells that changed since the previous frame are written, in a single write.
+ *
+ */
+
+#include <console_event.h>
+#include <console_metrics.h>
+#include <console_region.h>
+#include <console_render.h>
+#include <console_scroll.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <vector>
+
+// One screen cell: a codepoint with the zero-width marks combined into it, or a newline.
+struct RenderCell {
+    size_t offset; // first byte in the frame text
+    size_t length; // bytes
+    size_t row;    // relative to the first row of the frame
+    size_t col;
+    size_t width;  // 0 for a newline
+    bool   ghost;  // drawn in the suggestion style
+};
+
+// Positions are relative to the first row of the frame. A column equal to `columns`
+// means the terminal holds a pending wrap: the cursor sits on the last column and the
+// next character goes to the start of the following row.
+struct ConsoleRenderer {
+    std::string             text;     // last frame: input bytes, then ghost bytes
+    std::vector<RenderCell> cells;    // layout of `text` as it is on screen
+    size_t                  input;    // bytes of `text` that are input
+    size_t                  end_row;  // position after the last cell
+    size_t                  end_col;
+    size_t                  columns;  // terminal width
+    size_t                  lines;    // terminal height
+    size_t                  origin;   // column the frame starts in
+    size_t                  row;      // terminal cursor
+    size_t                  col;
+    size_t                  rows;     // rows the frame has reached, lower ones need a newline
+    long                    top;      // screen row of the frame's first row, if anchored
+    bool                    anchored; // `top` is known, absolute moves are possible
+    bool                    probe;    // false once the terminal ignored a position query
+    bool                    dimmed;   // the ghost style is active
+    bool                    nowrap;   // rows are windows that scroll with the cursor
+    size_t                  scroll;   // first column of each row the windows show
+    size_t                  indexed;  // bytes of the input the column index still holds
+    ConsoleColumnIndex*     index;    // columns of the input, created by the first window
+    ConsoleLine*            window;   // windows of the frame being built
+    std::string             out;      // bytes of the frame being drawn
+    // What each column of each frame row shows as far as cursor motion cares: the ASCII
+    // byte of an input cell, or 0 when it is unknown, wide or in another style.
+    std::vector<std::string> screen;
+};
+
+static void measure(Console* console, ConsoleRenderer* renderer) {
+    struct winsize window_size;
+    if (0 == ioctl(fileno(console->io->teletype), TIOCGWINSZ, &window_size)
+        && window_size.ws_col > 0) {
+        renderer->columns = window_size.ws_col;
+        renderer->lines   = window_size.ws_row > 0 ? window_size.ws_row : 24;
+    } else {
+        renderer->columns = 80;
+        renderer->lines   = 24;
+    }
+}
+
+ConsoleRenderer* console_create_renderer(void) {
+    ConsoleRenderer* renderer = new (std::nothrow) ConsoleRenderer();
+    if (NULL == renderer) {
+        return NULL;
+    }
+
+    renderer->columns = 80; // measured again by every console_render_begin()
+    renderer->probe   = true;
+    return renderer;
+}
+
+void console_destroy_renderer(ConsoleRenderer* renderer) {
+    if (NULL != renderer->index) {
+        console_destroy_column_index(renderer->index);
+    }
+    if (NULL != renderer->window) {
+        console_destroy_line(renderer->window);
+    }
+    delete renderer;
+}
+
+static void reset_frame(ConsoleRenderer* renderer) {
+    renderer->text.clear();
+    renderer->cells.clear();
+    renderer->input   = 0;
+    renderer->end_row = 0;
+    renderer->end_col = renderer->origin;
+    renderer->row     = 0;
+    renderer->col     = renderer->origin;
+    renderer->rows    = 1;
+    renderer->screen.clear();
+}
+
+// Place `text` from the origin the way the terminal will: a cell that does not fit on
+// the row wraps first. Ghost text ends before the last column of the cursor row so the
+// cursor can always return from it; whatever does not fit is cut from `text`.
+static void layout(ConsoleRenderer* renderer, std::string &text, size_t input) {
+    CONSOLE_TIMER(CONSOLE_METRIC_LAYOUT);
+
+    std::vector<RenderCell> &cells   = renderer->cells;
+    size_t                   columns = renderer->columns;
+    size_t                   row     = 0;
+    size_t                   col     = renderer->origin;
+
+    cells.clear();
+    for (size_t i = 0; i < text.size();) {
+        bool ghost = i >= input;
+        if ('\n' == text[i]) {
+            if (ghost) {
+                text.resize(i);
+                break;
+            }
+            cells.push_back({i, 1, row, col, 0, false});
+            row++;
+            col  = 0;
+            i   += 1;
+            continue;
+        }
+
+        size_t limit = ghost ? text.size() : input;
+        size_t count = console_utf8_length((unsigned char) text[i]);
+        count        = count < limit - i ? count : limit - i;
+        size_t width = (size_t) console_utf8_width(text.data() + i, count);
+        size_t next  = i + count;
+        while (next < limit && '\n' != text[next]) {
+            size_t mark = console_utf8_length((unsigned char) text[next]);
+            mark        = mark < limit - next ? mark : limit - next;
+            if (0 != console_utf8_width(text.data() + next, mark)) {
+                break;
+            }
+            next += mark; // combining mark, drawn together with its base
+        }
+
+        size_t before = col;
+        if (col + width > columns) {
+            row++;
+            col = 0;
+        }
+        // the ghost may only start a row when the input filled the one before
+        bool wrapped = 0 == col && before > 0;
+        if (ghost && ((wrapped && (i > input || before < columns)) || col + width >= columns)) {
+            text.resize(i);
+            break;
+        }
+        cells.push_back({i, next - i, row, col, width, ghost});
+        col += width;
+        i    = next;
+    }
+    renderer->end_row = row;
+    renderer->end_col = col;
+}
+
+static void append_sequence(std::string &out, size_t count, char final) {
+    char sequence[32];
+    if (1 == count) {
+        snprintf(sequence, sizeof(sequence), "\x1b[%c", final); // a count of 1 is implied
+    } else {
+        snprintf(sequence, sizeof(sequence), "\x1b[%zu%c", count, final);
+    }
+    out += sequence;
+}
+
+// The bytes that redraw columns [from, to) of `row` as they are, if every one is known.
+static bool screen_text(
+    const ConsoleRenderer* renderer, size_t row, size_t from, size_t to, std::string &text
+) {
+    if (renderer->dimmed || row >= renderer->screen.size()
+        || renderer->screen[row].size() < to) {
+        return false;
+    }
+    text.assign(renderer->screen[row], from, to - from);
+    return NULL == memchr(text.data(), '\0', text.size());
+}
+
+// Cheapest way along the current row from column `from` to `to`: relative steps,
+// carriage return plus steps, an absolute column, backspaces, or rewriting the cells
+// in between with what they already show.
+static void horizontal(
+    const ConsoleRenderer* renderer, size_t row, size_t from, size_t to, bool pending,
+    std::string &best
+) {
+    std::string candidate;
+    std::string text;
+
+    best.clear();
+    if (from == to && !pending) {
+        return;
+    }
+
+    if (to < from) {
+        append_sequence(best, from - to, 'D');
+    } else if (to > from) {
+        append_sequence(best, to - from, 'C');
+    } else {
+        best = "\r"; // placeholder, replaced below when anything is cheaper
+        append_sequence(best, to, 'C');
+    }
+
+    candidate = "\r";
+    if (to > 0 && screen_text(renderer, row, 0, to, text)) {
+        candidate += text;
+    } else if (to > 0) {
+        append_sequence(candidate, to, 'C');
+    }
+    if (candidate.size() < best.size()) {
+        best = candidate;
+    }
+
+    candidate.clear();
+    append_sequence(candidate, to + 1, 'G');
+    if (candidate.size() < best.size()) {
+        best = candidate;
+    }
+
+    // a backspace from a pending wrap lands in different places on different terminals
+    if (to < from && !pending && from - to < best.size()) {
+        best.assign(from - to, '\b');
+    }
+    if (to > from && to - from < best.size() && screen_text(renderer, row, from, to, text)) {
+        best = text;
+    }
+}
+
+// The cursor entered `row`. Entering a row below the frame from the bottom line of the
+// screen scrolls it, which moves the frame up.
+static void reach_row(ConsoleRenderer* renderer, size_t row) {
+    while (renderer->rows <= row) {
+        if (renderer->anchored && renderer->top + (long) renderer->rows >= (long) renderer->lines) {
+            renderer->top--;
+        }
+        renderer->rows++;
+    }
+}
+
+// Move the terminal cursor along the cheapest byte sequence. Rows the frame has not
+// reached yet may not exist on screen, so they are entered with newlines.
+static void move_to(ConsoleRenderer* renderer, size_t row, size_t col) {
+    std::string &out     = renderer->out;
+    bool         pending = renderer->col >= renderer->columns;
+    size_t       current = pending ? renderer->columns - 1 : renderer->col;
+    std::string  best;
+
+    if (row >= renderer->rows) {
+        if (renderer->row + 1 < renderer->rows) {
+            append_sequence(out, renderer->rows - 1 - renderer->row, 'B');
+        }
+        for (size_t i = renderer->rows - 1; i < row; i++) {
+            out += "\r\n";
+        }
+        reach_row(renderer, row);
+        horizontal(renderer, row, 0, col, false, best);
+    } else {
+        // vertical steps keep the column and end a pending wrap
+        if (row > renderer->row) {
+            append_sequence(best, row - renderer->row, 'B');
+        } else if (row < renderer->row) {
+            append_sequence(best, renderer->row - row, 'A');
+        }
+        std::string steps;
+        horizontal(renderer, row, current, col, pending && row == renderer->row, steps);
+        best += steps;
+
+        long screen_row = renderer->top + (long) row;
+        if (renderer->anchored && screen_row >= 0 && !best.empty()) {
+            char sequence[48];
+            snprintf(sequence, sizeof(sequence), "\x1b[%ld;%zuH", screen_row + 1, col + 1);
+            if (strlen(sequence) < best.size()) {
+                best = sequence;
+            }
+        }
+    }
+    out           += best;
+    renderer->row  = row;
+    renderer->col  = col;
+}
+
+// A pending wrap is resolved to the start of the next row when the cursor rests there.
+static void move_after(ConsoleRenderer* renderer, size_t row, size_t col) {
+    if (col >= renderer->columns) {
+        move_to(renderer, row + 1, 0);
+    } else {
+        move_to(renderer, row, col);
+    }
+}
+
+// Clear from the cursor to the end of its row, on screen and in the screen model.
+static void erase_line(ConsoleRenderer* renderer) {
+    renderer->out += ANSI_ERASE_LINE;
+    if (renderer->row < renderer->screen.size()
+        && renderer->screen[renderer->row].size() > renderer->col) {
+        renderer->screen[renderer->row].resize(renderer->col);
+    }
+}
+
+// Clear from the cursor to the end of the screen, then bring back a pinned status line.
+static void erase_below(Console* console) {
+    ConsoleRenderer* renderer = console->renderer;
+    renderer->out += "\x1b[J";
+    if (NULL != console->region) {
+        size_t      length;
+        const char* status = console_region_status(console, &length);
+        renderer->out.append(status, length);
+    }
+    if (renderer->screen.size() > renderer->row + 1) {
+        renderer->screen.resize(renderer->row + 1);
+    }
+    if (renderer->row < renderer->screen.size()
+        && renderer->screen[renderer->row].size() > renderer->col) {
+        renderer->screen[renderer->row].resize(renderer->col);
+    }
+}
+
+// Account for a cell the terminal just drew: the screen model and the cursor after it.
+static void place_cell(ConsoleRenderer* renderer, const std::string &text, const RenderCell &cell) {
+    if (renderer->screen.size() <= cell.row) {
+        renderer->screen.resize(cell.row + 1);
+    }
+    std::string &row = renderer->screen[cell.row];
+    if (row.size() < cell.col + cell.width) {
+        row.resize(cell.col + cell.width, '\0');
+    }
+    unsigned char byte  = (unsigned char) text[cell.offset];
+    bool          plain = !cell.ghost && 1 == cell.length && byte >= 0x20 && byte < 0x7F;
+    for (size_t i = 0; i < cell.width; i++) {
+        row[cell.col + i] = plain ? (char) byte : '\0';
+    }
+    renderer->row = cell.row;
+    renderer->col = cell.col + cell.width;
+    reach_row(renderer, cell.row);
+}
+
+static void write_cell(ConsoleRenderer* renderer, const std::string &text, const RenderCell &cell) {
+    renderer->out.append(text, cell.offset, cell.length);
+    place_cell(renderer, text, cell);
+}
+
+// Cells from `index` on that REP can draw: the same single-width byte on the same row in
+// the same style. Returns 1 when repeating is unsupported or not cheaper.
+static size_t repeat_run(
+    const ConsoleRenderer* renderer, const ConsoleCapabilities* capabilities,
+    const std::string &text, size_t index
+) {
+    const std::vector<RenderCell> &cells = renderer->cells;
+    const RenderCell              &cell  = cells[index];
+    if (NULL == capabilities || !capabilities->repeat_char || 1 != cell.length
+        || 1 != cell.width) {
+        return 1;
+    }
+
+    size_t run = 1;
+    while (index + run < cells.size()) {
+        const RenderCell &next = cells[index + run];
+        if (1 != next.length || next.row != cell.row || next.ghost != cell.ghost
+            || text[next.offset] != text[cell.offset]) {
+            break;
+        }
+        run++;
+    }
+    std::string sequence;
+    append_sequence(sequence, run - 1, 'b');
+    return run > 1 && sequence.size() < run - 1 ? run : 1;
+}
+
+// Keep the screen model in step with ICH (`count` > 0) or DCH (`count` < 0) at a cell.
+static void shift_screen(ConsoleRenderer* renderer, size_t row, size_t col, long count) {
+    if (row >= renderer->screen.size() || col >= renderer->screen[row].size()) {
+        return;
+    }
+    std::string &text = renderer->screen[row];
+    if (count > 0) {
+        text.insert(col, (size_t) count, '\0');
+        if (text.size() > renderer->columns) {
+            text.resize(renderer->columns);
+        }
+    } else {
+        text.erase(col, (size_t) -count);
+    }
+}
+
+// A mid-line edit of plain text: let the terminal shift the unchanged tail with ICH or
+// DCH and only draw the changed cells, plus the cells that cross a row boundary in each
+// wrapped row below. Only frames whose cells from `first` on are single-width input
+// qualify, since then every row shifts by the same number of columns. Returns false,
+// with nothing emitted, when this is not possible or not cheaper than a rewrite.
+static bool shift_tail(
+    Console* console, const std::string &old_text, const std::vector<RenderCell> &old_cells,
+    const std::string &text, size_t first
+) {
+    ConsoleRenderer*               renderer     = console->renderer;
+    const ConsoleCapabilities*     capabilities = console->capabilities;
+    const std::vector<RenderCell> &cells        = renderer->cells;
+    size_t                         columns      = renderer->columns;
+
+    if (NULL == capabilities || first >= cells.size() || first >= old_cells.size()) {
+        return false; // appending or truncating, a rewrite is already minimal
+    }
+    for (size_t i = first; i < old_cells.size(); i++) {
+        const RenderCell &cell = old_cells[i];
+        if (cell.ghost || 1 != cell.width || '\n' == old_text[cell.offset]) {
+            return false;
+        }
+    }
+    for (size_t i = first; i < cells.size(); i++) {
+        const RenderCell &cell = cells[i];
+        if (cell.ghost || 1 != cell.width || '\n' == text[cell.offset]) {
+            return false;
+        }
+    }
+
+    // unchanged tail, compared by content since its position moved
+    size_t suffix = 0;
+    while (first + suffix < old_cells.size() && first + suffix < cells.size()) {
+        const RenderCell &old_cell = old_cells[old_cells.size() - 1 - suffix];
+        const RenderCell &cell     = cells[cells.size() - 1 - suffix];
+        if (old_cell.length != cell.length
+            || 0 != memcmp(old_text.data() + old_cell.offset, text.data() + cell.offset,
+                           cell.length)) {
+            break;
+        }
+        suffix++;
+    }
+    size_t old_middle = old_cells.size() - suffix - first;
+    size_t middle     = cells.size() - suffix - first;
+    long   shift      = (long) middle - (long) old_middle;
+    size_t count      = (size_t) (shift < 0 ? -shift : shift);
+    size_t row        = cells[first].row;
+    size_t col        = cells[first].col;
+    size_t old_last   = old_cells.back().row;
+    size_t last_row   = old_last > cells.back().row ? old_last : cells.back().row;
+
+    size_t widest     = middle > old_middle ? middle : old_middle;
+    if (0 == suffix || count >= columns || col + widest > columns
+        || (shift > 0 && !capabilities->insert_chars)
+        || (shift < 0 && !capabilities->delete_chars)) {
+        return false;
+    }
+    // draft the shift, then keep it only if it beats rewriting the tail
+    std::string &out   = renderer->out;
+    size_t       start = out.size();
+    size_t       index = first;
+
+    size_t                   saved_row    = renderer->row;
+    size_t                   saved_col    = renderer->col;
+    size_t                   saved_rows   = renderer->rows;
+    long                     saved_top    = renderer->top;
+    std::vector<std::string> saved_screen = renderer->screen;
+
+    move_to(renderer, row, col);
+    size_t rewrite = out.size() - start + (shift < 0 ? 3 : 0); // ED after a shorter tail
+    for (size_t i = first; i < cells.size(); i++) {
+        rewrite += cells[i].length;
+    }
+    if (shift > 0) {
+        append_sequence(out, count, '@');
+        shift_screen(renderer, row, col, shift);
+    }
+    for (; index < first + middle; index++) {
+        write_cell(renderer, text, cells[index]);
+    }
+    if (shift < 0) {
+        append_sequence(out, count, 'P');
+        shift_screen(renderer, row, renderer->col, shift);
+    }
+
+    // each row below gains or loses `count` cells at the boundary with the row above
+    for (size_t r = row; r <= last_row; r++) {
+        if (r > row && r <= old_last) {
+            move_to(renderer, r, 0);
+            append_sequence(out, count, shift > 0 ? '@' : 'P');
+            shift_screen(renderer, r, 0, shift);
+        }
+        for (; index < cells.size() && cells[index].row == r; index++) {
+            const RenderCell &cell = cells[index];
+            if (r > old_last || (shift > 0 && r > row && cell.col < count)
+                || (shift < 0 && cell.col >= columns - count)) {
+                move_to(renderer, cell.row, cell.col);
+                write_cell(renderer, text, cell);
+            }
+        }
+    }
+
+    if (out.size() - start >= rewrite) {
+        out.resize(start);
+        renderer->row    = saved_row;
+        renderer->col    = saved_col;
+        renderer->rows   = saved_rows;
+        renderer->top    = saved_top;
+        renderer->screen = std::move(saved_screen);
+        return false;
+    }
+    return true;
+}
+
+static bool same_cell(
+    const std::string &old_text, const RenderCell &old_cell, const std::string &new_text,
+    const RenderCell &new_cell
+) {
+    return old_cell.row == new_cell.row && old_cell.col == new_cell.col
+           && old_cell.ghost == new_cell.ghost && old_cell.length == new_cell.length
+           && 0 == memcmp(old_text.data() + old_cell.offset, new_text.data() + new_cell.offset,
+                          new_cell.length);
+}
+
+// The frame of no-wrap mode: a window of each row, all scrolled to the same column, with
+// the cursor's row scrolled so the cursor is in view. `point` and `length` are moved to
+// the frame. Returns false, with nothing changed, when the windows cannot be built.
+static bool window_frame(
+    ConsoleRenderer* renderer, const char* text, size_t* length, size_t* point,
+    const char* ghost, size_t ghost_length, std::string &frame
+) {
+    if (NULL == renderer->index) {
+        renderer->index   = console_create_column_index();
+        renderer->window  = console_create_line(0);
+        renderer->indexed = 0;
+        if (NULL == renderer->index || NULL == renderer->window) {
+            // both or neither, the next frame tries again
+            console_destroy_column_index(renderer->index);
+            console_destroy_line(renderer->window);
+            renderer->index  = NULL;
+            renderer->window = NULL;
+            return false;
+        }
+    }
+
+    // only what follows the first byte edited since the last frame is indexed again
+    console_column_index_update(renderer->index, text, *length,
+                                renderer->indexed < *length ? renderer->indexed : *length);
+    renderer->indexed = *length;
+
+    size_t cursor = console_column_index_line(renderer->index, text, *length, *point);
+    size_t width  = 0 == cursor ? renderer->columns - renderer->origin : renderer->columns;
+    size_t      column = console_column_index_column(renderer->index, text, *length, *point);
+    size_t      lowest = renderer->scroll + (renderer->scroll > 0 ? 1 : 0);
+    if (column < lowest || column + 2 > renderer->scroll + width) {
+        renderer->scroll = column + 2 <= width ? 0 : column - width / 2;
+    }
+
+    ConsoleLine*  out         = renderer->window;
+    size_t        line        = 0;
+    size_t        frame_point = 0;
+    ConsoleWindow window;
+    out->length = 0;
+    for (;;) {
+        size_t base = out->length;
+        size_t room = 0 == line ? renderer->columns - renderer->origin : renderer->columns;
+        if (!console_column_window(renderer->index, text, *length, line, renderer->scroll, room,
+                                   out, &window)) {
+            return false;
+        }
+        if (line == cursor) {
+            size_t at   = *point < window.start ? window.start
+                          : *point > window.end ? window.end : *point;
+            frame_point = base + window.lead + at - window.start;
+        }
+        if (!console_column_index_next_line(renderer->index, text, *length, line, &line)) {
+            break;
+        }
+        if (!console_line_append_char(out, '\n')) {
+            return false;
+        }
+    }
+
+    frame.assign(out->buffer, out->length);
+    if (*point == *length && window.end == *length && NULL != ghost) {
+        frame.append(ghost, ghost_length); // the end of the input is in view
+    }
+    *point  = frame_point;
+    *length = out->length;
+    return true;
+}
+
+void console_render_frame(
+    Console* console, const char* text, size_t length, size_t point, const char* ghost,
+    size_t ghost_length
+) {
+    CONSOLE_TIMER(CONSOLE_METRIC_RENDER);
+
+    ConsoleRenderer* renderer = console->renderer;
+    std::string      frame;
+    if (!renderer->nowrap
+        || !window_frame(renderer, text, &length, &point, ghost, ghost_length, frame)) {
+        frame.assign(text, length);
+        if (point == length && NULL != ghost) {
+            frame.append(ghost, ghost_length);
+        }
+    }
+
+    // lay out the new frame, keeping the old one for comparison
+    std::string             old_text  = std::move(renderer->text);
+    std::vector<RenderCell> old_cells = std::move(renderer->cells);
+    size_t                  old_row   = renderer->end_row;
+    size_t                  old_col   = renderer->end_col;
+    layout(renderer, frame, length);
+
+    std::vector<RenderCell> &cells = renderer->cells;
+    size_t                   first = 0;
+    while (first < cells.size() && first < old_cells.size()
+           && same_cell(old_text, old_cells[first], frame, cells[first])) {
+        first++;
+    }
+
+    // rewrite everything from the first changed cell
+    std::string &out = renderer->out;
+    out.clear();
+    renderer->dimmed = false;
+    if (NULL != console->region) {
+        // pinned rows below the screen's scroll region don't scroll, so make room first
+        size_t rows  = renderer->end_row + (renderer->end_col >= renderer->columns ? 2 : 1);
+        size_t moved = console_region_grow(console, rows);
+        if (moved > 0) {
+            char sequence[48];
+            renderer->top -= (long) moved;
+            renderer->col  = renderer->col < renderer->columns ? renderer->col
+                                                                : renderer->columns - 1;
+            snprintf(sequence, sizeof(sequence), "\x1b[%ld;%zuH",
+                     renderer->top + (long) renderer->row + 1, renderer->col + 1);
+            out += sequence;
+        }
+    }
+    bool shifted = shift_tail(console, old_text, old_cells, frame, first);
+    if (!shifted && first < cells.size()) {
+        move_to(renderer, cells[first].row, cells[first].col);
+    }
+    for (size_t i = shifted ? cells.size() : first; i < cells.size(); i++) {
+        const RenderCell &cell = cells[i];
+        if (cell.ghost && !renderer->dimmed) {
+            out              += ANSI_COLOR_RESET ANSI_COLOR_GRAY;
+            renderer->dimmed  = true;
+        }
+        if (cell.row != renderer->row && renderer->col < renderer->columns) {
+            erase_line(renderer); // the wrap left the last columns, clear what was there
+        }
+        if ('\n' == frame[cell.offset]) {
+            if (renderer->col < renderer->columns) {
+                erase_line(renderer);
+            }
+            out           += "\r\n";
+            renderer->row  = cell.row + 1;
+            renderer->col  = 0;
+            reach_row(renderer, renderer->row);
+        } else {
+            size_t run = repeat_run(renderer, console->capabilities, frame, i);
+            write_cell(renderer, frame, cell);
+            if (run > 1) {
+                append_sequence(out, run - 1, 'b');
+                for (size_t j = 1; j < run; j++) {
+                    place_cell(renderer, frame, cells[i + j]);
+                }
+                i += run - 1;
+            }
+        }
+    }
+
+    // the old frame reached further: clear everything after the new one
+    if (!shifted
+        && (old_row > renderer->end_row
+            || (old_row == renderer->end_row && old_col > renderer->end_col))) {
+        move_after(renderer, renderer->end_row, renderer->end_col);
+        erase_below(console);
+    }
+
+    size_t index = 0;
+    while (index < cells.size() && cells[index].offset < point) {
+        index++;
+    }
+    if (index < cells.size()) {
+        move_to(renderer, cells[index].row, cells[index].col); // a ghost starts at the cursor
+    } else {
+        move_after(renderer, renderer->end_row, renderer->end_col);
+    }
+
+    renderer->text  = std::move(frame);
+    renderer->input = length;
+    if (!out.empty()) {
+        CONSOLE_HISTOGRAM(CONSOLE_METRIC_FRAME_BYTES, out.size());
+        fwrite(out.data(), 1, out.size(), console->io->teletype);
+    }
+    if (renderer->dimmed) {
+        // the ghost style replaced the input style, re-emit it
+        console->state->display = STATE_DISPLAY_RESET;
+        console_set_display_mode(console, STATE_DISPLAY_INPUT);
+    }
+}
+
+void console_render_begin(Console* console) {
+    ConsoleRenderer* renderer = console->renderer;
+
+    measure(console, renderer);
+    renderer->origin   = 0;
+    renderer->anchored = false;
+    renderer->scroll   = 0;
+    renderer->indexed  = 0; // a new input
+
+    int row;
+    int col;
+    if (renderer->probe) {
+        if (console_query_position(console, 100, &row, &col)) {
+            renderer->origin   = (size_t) col - 1 < renderer->columns ? (size_t) col - 1 : 0;
+            renderer->top      = row - 1;
+            renderer->anchored = row >= 1 && (size_t) row <= renderer->lines;
+        } else {
+            renderer->probe = false; // no answer, don't stall every line on it
+        }
+    }
+    if (NULL != console->region) {
+        renderer->top      = (long) console_region_input_row(console);
+        renderer->anchored = true;
+    }
+    reset_frame(renderer);
+}
+
+void console_render_resize(Console* console, size_t columns) {
+    ConsoleRenderer* renderer = console->renderer;
+
+    if (NULL != console->region) {
+        // the input rows are cleared along with the prompt and the frame starts over
+        console_region_resize(console);
+        measure(console, renderer);
+        renderer->origin   = 0;
+        renderer->top      = (long) console_region_input_row(console);
+        renderer->anchored = true;
+        reset_frame(renderer);
+        return;
+    }
+
+    // back to the start of the frame as laid out for the old width, then clear it;
+    // rows may have been reflowed, so only relative moves are trusted from here on
+    renderer->anchored = false;
+    renderer->out.clear();
+    move_to(renderer, 0, renderer->origin);
+    erase_below(console);
+    fwrite(renderer->out.data(), 1, renderer->out.size(), console->io->teletype);
+
+    measure(console, renderer);
+    if (columns > 0) {
+        renderer->columns = columns;
+    }
+    if (renderer->origin >= renderer->columns) {
+        renderer->origin = 0;
+    }
+    reset_frame(renderer);
+}
+
+void console_render_end(Console* console) {
+    ConsoleRenderer* renderer = console->renderer;
+    ConsoleLine*     line     = console->stream->line;
+
+    // the line stays behind in the scrollback whole, not as the windows that showed it
+    bool nowrap      = renderer->nowrap;
+    renderer->nowrap = false;
+    console_render_frame(console, line->buffer, line->length, line->length, NULL, 0);
+    renderer->nowrap = nowrap;
+
+    renderer->out.clear();
+    move_after(renderer, renderer->end_row, renderer->end_col);
+    if (NULL != console->region) {
+        // the line joins the output above and the input rows are cleared for the next
+        fwrite(renderer->out.data(), 1, renderer->out.size(), console->io->teletype);
+        console_region_write(console, line->buffer, line->length);
+        console_region_write(console, "\n", 1);
+        console_region_reset(console);
+        renderer->origin = 0;
+        reset_frame(renderer);
+        return;
+    }
+    if (renderer->end_col < renderer->columns) {
+        // a full last row already put the cursor at the start of the next one
+        renderer->out += "\r\n";
+    }
+    fwrite(renderer->out.data(), 1, renderer->out.size(), console->io->teletype);
+
+    renderer->origin = 0;
+    reset_frame(renderer);
+}
+
+void console_render_nowrap(Console* console, bool nowrap) {
+    console->renderer->nowrap  = nowrap;
+    console->renderer->scroll  = 0;
+    console->renderer->indexed = 0;
+}
+
+void console_render_edited(Console* console, size_t offset) {
+    ConsoleRenderer* renderer = console->renderer;
+    renderer->indexed         = offset < renderer->indexed ? offset : renderer->indexed;
+}
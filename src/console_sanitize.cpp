@@ -0,0 +1,413 @@
+/**
+ * @file console_sanitize.cpp
+ *
+ * @brief Output stage that keeps untrusted text from driving the terminal: C0 and C1
+ * controls, DEL and escape sequences are dropped or shown as text, except for an
+ * allowlist such as SGR.
+ *
+ */
+
+#include <console_sanitize.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+// Where the scanner is. Sequences are recognized the way a terminal parses them, so
+// whatever would have been swallowed by one is dropped as a whole.
+enum SanitizeState {
+    SANITIZE_GROUND,     // text
+    SANITIZE_LEAD,       // after 0xC2, the lead byte of every C1 control in UTF-8
+    SANITIZE_ESCAPE,     // after ESC and any intermediates
+    SANITIZE_CSI,        // control sequence parameters
+    SANITIZE_STRING,     // OSC, DCS, SOS, PM or APC payload, up to BEL or ST
+    SANITIZE_STRING_ESC, // ESC inside a string, ST if a backslash follows
+    SANITIZE_STRING_LEAD // 0xC2 inside a string, ST if 0x9C follows
+};
+
+struct ConsoleSanitizer {
+    ConsoleSink              sink;     // the sanitizer as an output stage
+    enum ConsoleSanitizeMode mode;
+    unsigned                 allow;    // CONSOLE_ALLOW_* bits
+    enum SanitizeState       state;
+    char                     held[64]; // the sequence so far, while it may still be allowed
+    size_t                   count;    // bytes in `held`
+    bool                     discard;  // too long to be allowed, disposed of as it arrives
+    size_t                   string;   // payload bytes of the current string
+    std::string              buffer;   // output of the stage
+};
+
+// Longest string payload dropped before the rest shows up as text again; a terminal
+// would swallow everything after an unterminated OSC, but nothing here should.
+static const size_t string_limit = 4096;
+
+// Index of the first byte that needs a look: C0, DEL, or 0xC2. Everything else is
+// copied in bulk.
+static size_t scan(const unsigned char* data, size_t length) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i controls = _mm_set1_epi8(0x1F);
+    const __m128i del      = _mm_set1_epi8(0x7F);
+    const __m128i lead     = _mm_set1_epi8((char) 0xC2);
+    for (; i + 32 <= length; i += 32) {
+        __m128i low  = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i high = _mm_loadu_si128((const __m128i*) (data + i + 16));
+        // unsigned byte <= 0x1F is min(byte, 0x1F) == byte
+        __m128i hits_low = _mm_or_si128(
+            _mm_cmpeq_epi8(_mm_min_epu8(low, controls), low),
+            _mm_or_si128(_mm_cmpeq_epi8(low, del), _mm_cmpeq_epi8(low, lead))
+        );
+        __m128i hits_high = _mm_or_si128(
+            _mm_cmpeq_epi8(_mm_min_epu8(high, controls), high),
+            _mm_or_si128(_mm_cmpeq_epi8(high, del), _mm_cmpeq_epi8(high, lead))
+        );
+        unsigned mask = (unsigned) _mm_movemask_epi8(hits_low)
+                        | (unsigned) _mm_movemask_epi8(hits_high) << 16;
+        if (0 != mask) {
+            return i + (size_t) __builtin_ctz(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t controls = vdupq_n_u8(0x20);
+    const uint8x16_t del      = vdupq_n_u8(0x7F);
+    const uint8x16_t lead     = vdupq_n_u8(0xC2);
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t bytes = vld1q_u8(data + i);
+        uint8x16_t hits  = vorrq_u8(
+            vcltq_u8(bytes, controls), vorrq_u8(vceqq_u8(bytes, del), vceqq_u8(bytes, lead))
+        );
+        // narrow each byte of the mask to 4 bits to get a scalar to count zeros in
+        uint64_t mask = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0
+        );
+        if (0 != mask) {
+            return i + (size_t) (__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        if (data[i] < 0x20 || 0x7F == data[i] || 0xC2 == data[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
+// A byte that is not allowed: dropped, or shown as ^X, ^? or M-^X for a C1 control.
+// Passed as it is when the policy changed to PASS in the middle of a sequence.
+static char* dispose(const ConsoleSanitizer* sanitizer, unsigned char byte, bool c1, char* out) {
+    if (CONSOLE_SANITIZE_PASS == sanitizer->mode) {
+        if (c1) {
+            *out++ = (char) 0xC2;
+        }
+        *out++ = (char) byte;
+        return out;
+    }
+    if (CONSOLE_SANITIZE_STRIP == sanitizer->mode) {
+        return out;
+    }
+    if (c1) {
+        *out++ = 'M';
+        *out++ = '-';
+        byte  -= 0x80;
+    }
+    if (byte < 0x20 || 0x7F == byte) {
+        *out++ = '^';
+        *out++ = 0x7F == byte ? '?' : (char) (byte + 0x40);
+    } else {
+        *out++ = (char) byte;
+    }
+    return out;
+}
+
+static char* dispose_held(ConsoleSanitizer* sanitizer, char* out) {
+    for (size_t i = 0; i < sanitizer->count; i++) {
+        unsigned char byte = (unsigned char) sanitizer->held[i];
+        if (0xC2 == byte && i + 1 < sanitizer->count) {
+            out = dispose(sanitizer, (unsigned char) sanitizer->held[++i], true, out);
+        } else {
+            out = dispose(sanitizer, byte, false, out);
+        }
+    }
+    sanitizer->count = 0;
+    return out;
+}
+
+// Keep a byte of the current sequence, unless it has outgrown every allowed one.
+static char* hold(ConsoleSanitizer* sanitizer, unsigned char byte, char* out) {
+    if (!sanitizer->discard && sanitizer->count == sizeof(sanitizer->held)) {
+        out                = dispose_held(sanitizer, out);
+        sanitizer->discard = true;
+    }
+    if (sanitizer->discard) {
+        return dispose(sanitizer, byte, false, out);
+    }
+    sanitizer->held[sanitizer->count++] = (char) byte;
+    return out;
+}
+
+static void begin(ConsoleSanitizer* sanitizer, enum SanitizeState state) {
+    sanitizer->state   = state;
+    sanitizer->count   = 0;
+    sanitizer->discard = false;
+    sanitizer->string  = 0;
+}
+
+// A complete control sequence in `held`: pass it if it is an allowed SGR.
+static char* finish_csi(ConsoleSanitizer* sanitizer, char* out) {
+    size_t start = 2; // after ESC [ or 0xC2 0x9B
+    bool   sgr   = !sanitizer->discard && (sanitizer->allow & CONSOLE_ALLOW_SGR)
+                 && 'm' == sanitizer->held[sanitizer->count - 1];
+    for (size_t i = start; sgr && i + 1 < sanitizer->count; i++) {
+        char byte = sanitizer->held[i];
+        sgr       = (byte >= '0' && byte <= '9') || ';' == byte || ':' == byte;
+    }
+    if (sgr) {
+        // the 7-bit form, which every terminal reads the same way
+        *out++ = '\x1b';
+        *out++ = '[';
+        memcpy(out, sanitizer->held + start, sanitizer->count - start);
+        out              += sanitizer->count - start;
+        sanitizer->count  = 0;
+        return out;
+    }
+    return dispose_held(sanitizer, out);
+}
+
+// The C1 control `byte` (0x80 to 0x9F) in the ground state.
+static char* control_c1(ConsoleSanitizer* sanitizer, unsigned char byte, char* out) {
+    switch (byte) {
+        case 0x9B: // CSI
+            begin(sanitizer, SANITIZE_CSI);
+            sanitizer->held[0] = (char) 0xC2;
+            sanitizer->held[1] = (char) byte;
+            sanitizer->count   = 2;
+            return out;
+        case 0x90: // DCS
+        case 0x98: // SOS
+        case 0x9D: // OSC
+        case 0x9E: // PM
+        case 0x9F: // APC
+            begin(sanitizer, SANITIZE_STRING);
+            return dispose(sanitizer, byte, true, out);
+        default:
+            sanitizer->state = SANITIZE_GROUND;
+            return dispose(sanitizer, byte, true, out);
+    }
+}
+
+// One byte outside of a bulk span. Returns false if it must be looked at again in the
+// state it left behind.
+static bool step(ConsoleSanitizer* sanitizer, unsigned char byte, char** cursor) {
+    char* out = *cursor;
+    bool  used = true;
+
+    switch (sanitizer->state) {
+        case SANITIZE_GROUND:
+            if ('\n' == byte || '\t' == byte) {
+                *out++ = (char) byte;
+            } else if (0xC2 == byte) {
+                sanitizer->state = SANITIZE_LEAD;
+            } else if (0x1B == byte) {
+                begin(sanitizer, SANITIZE_ESCAPE);
+                out = hold(sanitizer, byte, out);
+            } else {
+                out = dispose(sanitizer, byte, false, out);
+            }
+            break;
+
+        case SANITIZE_LEAD:
+            if (byte >= 0x80 && byte <= 0x9F) {
+                out = control_c1(sanitizer, byte, out);
+            } else {
+                *out++           = (char) 0xC2; // an ordinary character, e.g. U+00A9
+                sanitizer->state = SANITIZE_GROUND;
+                used             = false;
+            }
+            break;
+
+        case SANITIZE_ESCAPE:
+            if (1 == sanitizer->count && '[' == byte) {
+                out              = hold(sanitizer, byte, out);
+                sanitizer->state = SANITIZE_CSI;
+            } else if (1 == sanitizer->count && 0 != byte && NULL != strchr("]PX^_", byte)) {
+                out = hold(sanitizer, byte, out);
+                out = dispose_held(sanitizer, out);
+                begin(sanitizer, SANITIZE_STRING);
+            } else if (byte >= 0x20 && byte <= 0x2F) {
+                out = hold(sanitizer, byte, out); // intermediate, e.g. ESC ( B
+            } else if (byte >= 0x30 && byte <= 0x7E) {
+                out              = hold(sanitizer, byte, out);
+                out              = dispose_held(sanitizer, out);
+                sanitizer->state = SANITIZE_GROUND;
+            } else {
+                out              = dispose_held(sanitizer, out); // cut short
+                sanitizer->state = SANITIZE_GROUND;
+                used             = 0x18 == byte || 0x1A == byte; // CAN and SUB cancel
+            }
+            break;
+
+        case SANITIZE_CSI:
+            if (byte >= 0x20 && byte <= 0x3F) {
+                out = hold(sanitizer, byte, out);
+            } else if (byte >= 0x40 && byte <= 0x7E) {
+                out              = hold(sanitizer, byte, out);
+                out              = finish_csi(sanitizer, out);
+                sanitizer->state = SANITIZE_GROUND;
+            } else {
+                out              = dispose_held(sanitizer, out);
+                sanitizer->state = SANITIZE_GROUND;
+                used             = 0x18 == byte || 0x1A == byte;
+            }
+            break;
+
+        case SANITIZE_STRING:
+            if (0x07 == byte || 0x18 == byte || 0x1A == byte) {
+                out              = dispose(sanitizer, byte, false, out);
+                sanitizer->state = SANITIZE_GROUND;
+            } else if (0x1B == byte) {
+                sanitizer->state = SANITIZE_STRING_ESC;
+            } else if (0xC2 == byte) {
+                sanitizer->state = SANITIZE_STRING_LEAD;
+            } else if (++sanitizer->string > string_limit) {
+                sanitizer->state = SANITIZE_GROUND;
+                used             = false;
+            } else {
+                out = dispose(sanitizer, byte, false, out);
+            }
+            break;
+
+        case SANITIZE_STRING_ESC:
+            if ('\\' == byte) {
+                out              = dispose(sanitizer, 0x1B, false, out);
+                out              = dispose(sanitizer, byte, false, out);
+                sanitizer->state = SANITIZE_GROUND;
+            } else {
+                begin(sanitizer, SANITIZE_ESCAPE); // a new sequence cuts the string short
+                out  = hold(sanitizer, 0x1B, out);
+                used = false;
+            }
+            break;
+
+        case SANITIZE_STRING_LEAD:
+            if (0x9C == byte) {
+                out              = dispose(sanitizer, byte, true, out);
+                sanitizer->state = SANITIZE_GROUND;
+            } else {
+                out              = dispose(sanitizer, 0xC2, false, out);
+                sanitizer->state = SANITIZE_STRING;
+                used             = false;
+            }
+            break;
+    }
+    *cursor = out;
+    return used;
+}
+
+static void sanitizer_write(Console* console, ConsoleSink* sink, const char* data, size_t length) {
+    ConsoleSanitizer* sanitizer = (ConsoleSanitizer*) sink->context;
+    sanitizer->buffer.resize(2 * length + CONSOLE_SANITIZE_SLACK);
+    size_t count = console_sanitize(sanitizer, data, length, &sanitizer->buffer[0]);
+    if (count > 0) {
+        console_sink_pass(console, sink, sanitizer->buffer.data(), count);
+    }
+}
+
+static void sanitizer_flush(Console* console, ConsoleSink* sink) {
+    ConsoleSanitizer* sanitizer = (ConsoleSanitizer*) sink->context;
+    sanitizer->buffer.resize(CONSOLE_SANITIZE_SLACK);
+    size_t count = console_sanitize_finish(sanitizer, &sanitizer->buffer[0]);
+    if (count > 0) {
+        console_sink_pass(console, sink, sanitizer->buffer.data(), count);
+    }
+    console_sink_flush(console, sink);
+}
+
+ConsoleSanitizer* console_create_sanitizer(enum ConsoleSanitizeMode mode, unsigned allow) {
+    ConsoleSanitizer* sanitizer = new (std::nothrow) ConsoleSanitizer();
+    if (NULL == sanitizer) {
+        fprintf(stderr, "debug: console_create_sanitizer: failed to allocate sanitizer\n");
+        return NULL;
+    }
+
+    sanitizer->mode  = mode;
+    sanitizer->allow = allow;
+    sanitizer->state = SANITIZE_GROUND;
+
+    sanitizer->sink.write   = sanitizer_write;
+    sanitizer->sink.flush   = sanitizer_flush;
+    sanitizer->sink.context = sanitizer;
+    sanitizer->sink.next    = NULL;
+    return sanitizer;
+}
+
+void console_destroy_sanitizer(ConsoleSanitizer* sanitizer) {
+    delete sanitizer;
+}
+
+void console_set_sanitizer(
+    ConsoleSanitizer* sanitizer, enum ConsoleSanitizeMode mode, unsigned allow
+) {
+    sanitizer->mode  = mode;
+    sanitizer->allow = allow;
+}
+
+size_t console_sanitize(ConsoleSanitizer* sanitizer, const char* data, size_t length, char* out) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    char*                start = out;
+
+    if (CONSOLE_SANITIZE_PASS == sanitizer->mode && SANITIZE_GROUND == sanitizer->state) {
+        memcpy(out, data, length);
+        return length;
+    }
+
+    size_t i = 0;
+    while (i < length) {
+        if (SANITIZE_GROUND == sanitizer->state) {
+            size_t span = scan(bytes + i, length - i);
+            memcpy(out, data + i, span);
+            out += span;
+            i   += span;
+            if (i == length) {
+                break;
+            }
+        }
+        if (step(sanitizer, bytes[i], &out)) {
+            i++;
+        }
+    }
+    return (size_t) (out - start);
+}
+
+size_t console_sanitize_finish(ConsoleSanitizer* sanitizer, char* out) {
+    char* start = out;
+    switch (sanitizer->state) {
+        case SANITIZE_LEAD:
+            *out++ = (char) 0xC2; // a character that never got its second byte
+            break;
+        case SANITIZE_ESCAPE:
+        case SANITIZE_CSI:
+            out = dispose_held(sanitizer, out);
+            break;
+        case SANITIZE_STRING_ESC:
+            out = dispose(sanitizer, 0x1B, false, out);
+            break;
+        case SANITIZE_STRING_LEAD:
+            out = dispose(sanitizer, 0xC2, false, out);
+            break;
+        default:
+            break;
+    }
+    begin(sanitizer, SANITIZE_GROUND);
+    return (size_t) (out - start);
+}
+
+ConsoleSink* console_sanitizer_sink(ConsoleSanitizer* sanitizer) {
+    return &sanitizer->sink;
+}
@@ -0,0 +1,324 @@
+/**
+ * @file console_scroll.cpp
+ *
+ * @brief No-wrap display of long lines: a sparse index from columns to bytes, and the
+ * window of a line that shows from a horizontal offset, marked where the line goes on.
+ *
+ */
+
+#include <console_layout.h>
+#include <console_scroll.h>
+#include <new>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// A character starts at `offset`, in column `column` of line `line` (0-based)
+struct ColumnCheckpoint {
+    size_t offset;
+    size_t line;
+    size_t column;
+};
+
+// Checkpoints in text order; the first is always the start of the text. They are made
+// as lookups reach them, so an edit costs what is looked at after it, not the rest of
+// the text.
+struct ConsoleColumnIndex {
+    mutable std::vector<ColumnCheckpoint> checkpoints;
+    mutable ColumnCheckpoint              walked; // how far indexing has got
+    mutable size_t                        target; // column of the next checkpoint
+};
+
+ConsoleColumnIndex* console_create_column_index(void) {
+    ConsoleColumnIndex* index = new (std::nothrow) ConsoleColumnIndex();
+    if (NULL == index) {
+        fprintf(stderr, "debug: console_create_column_index: failed to allocate index\n");
+        return NULL;
+    }
+    index->checkpoints.push_back({0, 0, 0});
+    index->walked = {0, 0, 0};
+    index->target = CONSOLE_SCROLL_STRIDE;
+    return index;
+}
+
+void console_destroy_column_index(ConsoleColumnIndex* index) {
+    delete index;
+}
+
+// End of the character at `i`, with the zero-width marks combined into it the way the
+// renderer draws them, and its width. Only a newline ends a character short.
+static size_t step(const char* text, size_t length, size_t i, size_t* width) {
+    unsigned char byte  = (unsigned char) text[i];
+    size_t        count = console_utf8_length(byte);
+    count               = count < length - i ? count : length - i;
+    *width = byte >= 0x20 && byte < 0x7F ? 1 : (size_t) console_utf8_width(text + i, count);
+
+    size_t next = i + count;
+    while (next < length && '\n' != text[next]) {
+        byte = (unsigned char) text[next];
+        if (byte >= 0x20 && byte < 0x7F) {
+            break; // printable ASCII always takes a column
+        }
+        size_t mark = console_utf8_length(byte);
+        mark        = mark < length - next ? mark : length - next;
+        if (0 != console_utf8_width(text + next, mark)) {
+            break;
+        }
+        next += mark;
+    }
+    return next;
+}
+
+// Move over whole characters while the next one ends no further than column `limit`.
+// Stops at a newline. Runs of printable ASCII are crossed without decoding, all but
+// their last byte, which may carry marks.
+static void walk(const char* text, size_t length, size_t* offset, size_t* column, size_t limit) {
+    size_t i   = *offset;
+    size_t col = *column;
+    while (i < length && col <= limit && '\n' != text[i]) {
+        size_t room = limit - col + 1 < length - i ? limit - col + 1 : length - i;
+        size_t span = console_ascii_span(text + i, room);
+        if (span > 1) {
+            size_t count  = span - 1;
+            i            += count;
+            col          += count;
+        }
+        size_t width;
+        size_t next = step(text, length, i, &width);
+        if (col + width > limit) {
+            break;
+        }
+        i    = next;
+        col += width;
+    }
+    *offset = i;
+    *column = col;
+}
+
+// Last checkpoint at or before byte `offset`
+static const ColumnCheckpoint* before_offset(const ConsoleColumnIndex* index, size_t offset) {
+    const std::vector<ColumnCheckpoint> &checkpoints = index->checkpoints;
+    size_t                               low         = 0;
+    size_t                               high        = checkpoints.size();
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (checkpoints[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return &checkpoints[low];
+}
+
+// Last checkpoint at or before `column` of line `line`
+static const ColumnCheckpoint* before_column(
+    const ConsoleColumnIndex* index, size_t line, size_t column
+) {
+    const std::vector<ColumnCheckpoint> &checkpoints = index->checkpoints;
+    size_t                               low         = 0;
+    size_t                               high        = checkpoints.size();
+    while (high - low > 1) {
+        size_t                  middle     = low + (high - low) / 2;
+        const ColumnCheckpoint &checkpoint = checkpoints[middle];
+        if (checkpoint.line < line || (checkpoint.line == line && checkpoint.column <= column)) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return &checkpoints[low];
+}
+
+// Index on until byte `offset`, or column `column` of line `line`, whichever comes first.
+// Every checkpoint up to there is then made.
+static void extend(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t offset,
+    size_t line, size_t column
+) {
+    std::vector<ColumnCheckpoint> &checkpoints = index->checkpoints;
+    ColumnCheckpoint              &at          = index->walked;
+    while (at.offset < length && at.offset < offset
+           && (at.line < line || (at.line == line && at.column < column))) {
+        if ('\n' == text[at.offset]) {
+            at            = {at.offset + 1, at.line + 1, 0};
+            index->target = CONSOLE_SCROLL_STRIDE;
+            checkpoints.push_back(at);
+            continue;
+        }
+        walk(text, length, &at.offset, &at.column, index->target);
+        if (at.offset == length || '\n' == text[at.offset]) {
+            continue;
+        }
+        if (at.column < index->target) {
+            size_t width; // a wide character crosses the checkpoint column
+            at.offset  = step(text, length, at.offset, &width);
+            at.column += width;
+            if (at.offset == length || '\n' == text[at.offset]) {
+                continue;
+            }
+        }
+        checkpoints.push_back(at);
+        index->target = (at.column / CONSOLE_SCROLL_STRIDE + 1) * CONSOLE_SCROLL_STRIDE;
+    }
+}
+
+static void extend_to_offset(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t offset
+) {
+    extend(index, text, length, offset, SIZE_MAX, SIZE_MAX);
+}
+
+void console_column_index_update(
+    ConsoleColumnIndex* index, const char* text, size_t length, size_t from
+) {
+    (void) text;
+    std::vector<ColumnCheckpoint> &checkpoints = index->checkpoints;
+
+    // a checkpoint before `from` still holds: nothing before it changed
+    from        = from < length ? from : length;
+    size_t keep = (size_t) (before_offset(index, from > 0 ? from - 1 : 0) - &checkpoints[0]);
+    if (keep + 1 < checkpoints.size() || index->walked.offset >= from) {
+        checkpoints.resize(keep + 1);
+        ColumnCheckpoint &at = index->walked;
+        at                   = checkpoints.back();
+        index->target        = (at.column / CONSOLE_SCROLL_STRIDE + 1) * CONSOLE_SCROLL_STRIDE;
+    }
+}
+
+size_t console_column_index_column(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t offset
+) {
+    extend_to_offset(index, text, length, offset);
+    const ColumnCheckpoint* checkpoint = before_offset(index, offset);
+    size_t                  i          = checkpoint->offset;
+    size_t                  column     = checkpoint->column;
+    offset                             = offset < length ? offset : length;
+    while (i < offset && '\n' != text[i]) {
+        size_t span = console_ascii_span(text + i, offset - i);
+        if (span > 1) {
+            i      += span - 1;
+            column += span - 1;
+        }
+        size_t width;
+        size_t next = step(text, length, i, &width);
+        if (next > offset) {
+            break; // `offset` is inside this character
+        }
+        i       = next;
+        column += width;
+    }
+    return column;
+}
+
+size_t console_column_index_line(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t offset
+) {
+    extend_to_offset(index, text, length, offset);
+    return before_column(index, before_offset(index, offset)->line, 0)->offset;
+}
+
+bool console_column_index_next_line(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t offset,
+    size_t* next
+) {
+    (void) index; // the rest of the line is only looked for a newline, not indexed
+    offset              = offset < length ? offset : length;
+    const char* newline = (const char*) memchr(text + offset, '\n', length - offset);
+    if (NULL == newline) {
+        return false;
+    }
+    *next = (size_t) (newline - text) + 1;
+    return true;
+}
+
+size_t console_column_index_find(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t line,
+    size_t column, size_t* found
+) {
+    extend_to_offset(index, text, length, line);
+    size_t number = before_offset(index, line)->line; // extending moves the checkpoints
+    extend(index, text, length, SIZE_MAX, number, column);
+    const ColumnCheckpoint* point = before_column(index, number, column);
+    size_t                  i     = point->offset;
+    size_t                  col   = point->column;
+    walk(text, length, &i, &col, column);
+    *found = col;
+    return i;
+}
+
+static bool append_spaces(ConsoleLine* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!console_line_append_char(out, ' ')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool console_column_window(
+    const ConsoleColumnIndex* index, const char* text, size_t length, size_t line,
+    size_t column, size_t width, ConsoleLine* out, ConsoleWindow* window
+) {
+    size_t before = out->length;
+    size_t first  = column > 0 ? column + 1 : column; // after the left marker
+    size_t limit  = column + width;
+
+    window->start = line;
+    window->end   = line;
+    window->lead  = 0;
+    if (0 == width) {
+        return true;
+    }
+    if (column > 0 && !console_line_append_char(out, CONSOLE_SCROLL_LEFT)) {
+        return false;
+    }
+    if (first >= limit) {
+        window->lead = out->length - before; // room for the marker only
+        return true;
+    }
+
+    size_t col;
+    size_t start = console_column_index_find(index, text, length, line, first, &col);
+    if (col < first && start < length && '\n' != text[start]) {
+        size_t cut; // a wide character the left edge goes through
+        start  = step(text, length, start, &cut);
+        col   += cut;
+    }
+    size_t pad = col > first ? col - first : 0;
+
+    // as much as fits, and as much as fits next to a right marker
+    size_t end      = start;
+    size_t end_col  = col;
+    walk(text, length, &end, &end_col, limit - 1);
+    size_t short_end = end;
+    size_t short_col = end_col;
+    walk(text, length, &end, &end_col, limit);
+    bool   more      = end < length && '\n' != text[end];
+
+    if (!more) {
+        if (!append_spaces(out, pad) || !console_line_insert(out, out->length, text + start,
+                                                            end - start)) {
+            return false;
+        }
+        window->start = start;
+        window->end   = end;
+        window->lead  = out->length - before - (end - start);
+        return true;
+    }
+
+    pad          = pad < limit - 1 - first ? pad : limit - 1 - first;
+    size_t shown = short_end > start ? short_col : first + pad;
+    if (!append_spaces(out, pad)) {
+        return false;
+    }
+    window->lead = out->length - before;
+    if (!console_line_insert(out, out->length, text + start, short_end - start)
+        || !append_spaces(out, limit - 1 - shown)
+        || !console_line_append_char(out, CONSOLE_SCROLL_RIGHT)) {
+        return false;
+    }
+    window->start = start;
+    window->end   = short_end;
+    return true;
+}
@@ -0,0 +1,1142 @@
+/**
+ * @file console_search.cpp
+ *
+ * @brief Regular expression search over pages and transcripts: POSIX extended syntax,
+ * matched by lazily built DFAs after a literal prefilter, in parallel across blocks.
+ *
+ */
+
+#include <console_pool.h>
+#include <console_search.h>
+#include <algorithm>
+#include <ctype.h>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+// Limits that keep a pattern from growing without bound, e.g. (a{255}){255}
+#define REPEAT_MAX 255
+#define NFA_MAX    (1 << 16)
+
+struct ByteSet {
+    uint64_t bits[4];
+};
+
+static void set_add(ByteSet* set, unsigned char byte) {
+    set->bits[byte >> 6] |= (uint64_t) 1 << (byte & 63);
+}
+
+static bool set_has(const ByteSet* set, unsigned char byte) {
+    return 0 != (set->bits[byte >> 6] >> (byte & 63) & 1);
+}
+
+static void set_add_range(ByteSet* set, unsigned char low, unsigned char high) {
+    for (unsigned byte = low; byte <= high; byte++) {
+        set_add(set, (unsigned char) byte);
+    }
+}
+
+static size_t set_count(const ByteSet* set) {
+    size_t count = 0;
+    for (size_t i = 0; i < 4; i++) {
+        count += (size_t) __builtin_popcountll(set->bits[i]);
+    }
+    return count;
+}
+
+// Syntax tree: a set matches one byte, characters of more are concatenations of sets
+enum NodeKind {
+    NODE_EMPTY,
+    NODE_SET,
+    NODE_CONCAT,
+    NODE_ALTERNATE,
+    NODE_REPEAT, // `min` to `max` times, `max` -1 without bound
+    NODE_BEGIN,  // ^
+    NODE_END     // $
+};
+
+struct RegexNode {
+    NodeKind         kind;
+    ByteSet          set;
+    int              min;
+    int              max;
+    std::vector<int> children;
+};
+
+struct Parser {
+    const char*            pattern;
+    size_t                 length;
+    size_t                 position;
+    bool                   ignore_case;
+    const char*            error;
+    std::vector<RegexNode> nodes;
+};
+
+static int add_node(Parser* parser, NodeKind kind) {
+    RegexNode node;
+    node.kind = kind;
+    memset(&node.set, 0, sizeof(node.set));
+    node.min = 0;
+    node.max = 0;
+    parser->nodes.push_back(node);
+    return (int) parser->nodes.size() - 1;
+}
+
+static void add_byte(const Parser* parser, ByteSet* set, unsigned char byte) {
+    set_add(set, byte);
+    if (parser->ignore_case && byte < 0x80 && isalpha(byte)) {
+        set_add(set, (unsigned char) (isupper(byte) ? tolower(byte) : toupper(byte)));
+    }
+}
+
+static int add_set(Parser* parser, const ByteSet* set) {
+    int node                  = add_node(parser, NODE_SET);
+    parser->nodes[node].set = *set;
+    return node;
+}
+
+static int add_pair(Parser* parser, NodeKind kind, int first, int second) {
+    int node = add_node(parser, kind);
+    parser->nodes[node].children.push_back(first);
+    parser->nodes[node].children.push_back(second);
+    return node;
+}
+
+// One whole character: a byte of `ascii`, or any multibyte UTF-8 sequence when `other`
+static int add_class(Parser* parser, const ByteSet* ascii, bool other) {
+    int node = add_set(parser, ascii);
+    if (!other) {
+        return node;
+    }
+    static const unsigned char leads[3][2] = {{0xC2, 0xDF}, {0xE0, 0xEF}, {0xF0, 0xF4}};
+    ByteSet                    tail        = {};
+    set_add_range(&tail, 0x80, 0xBF);
+    for (size_t i = 0; i < 3; i++) {
+        ByteSet lead = {};
+        set_add_range(&lead, leads[i][0], leads[i][1]);
+        int sequence = add_set(parser, &lead);
+        for (size_t k = 0; k <= i; k++) {
+            sequence = add_pair(parser, NODE_CONCAT, sequence, add_set(parser, &tail));
+        }
+        node = add_pair(parser, NODE_ALTERNATE, node, sequence);
+    }
+    return node;
+}
+
+// The literal character at the parser's position, all of its bytes
+static int add_literal(Parser* parser) {
+    const unsigned char* bytes = (const unsigned char*) parser->pattern + parser->position;
+    size_t               count = console_utf8_length(bytes[0]);
+    count = count < parser->length - parser->position ? count : parser->length - parser->position;
+
+    int node = -1;
+    for (size_t i = 0; i < count; i++) {
+        ByteSet set = {};
+        add_byte(parser, &set, bytes[i]);
+        int byte = add_set(parser, &set);
+        node     = node < 0 ? byte : add_pair(parser, NODE_CONCAT, node, byte);
+    }
+    parser->position += count;
+    return node;
+}
+
+// Shorthand classes: \d \w \s, the negated \D \W \S. False for other letters.
+static bool shorthand(char letter, ByteSet* set, bool* negated) {
+    *negated = isupper((unsigned char) letter);
+    switch (tolower((unsigned char) letter)) {
+        case 'd':
+            set_add_range(set, '0', '9');
+            return true;
+        case 'w':
+            set_add_range(set, '0', '9');
+            set_add_range(set, 'A', 'Z');
+            set_add_range(set, 'a', 'z');
+            set_add(set, '_');
+            return true;
+        case 's':
+            set_add(set, ' ');
+            set_add_range(set, '\t', '\r');
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool named_class(const char* name, size_t length, ByteSet* set) {
+    static const char* const names[] = {"alnum", "alpha", "blank", "cntrl", "digit", "graph",
+                                        "lower", "print", "punct", "space", "upper", "xdigit"};
+    static int (*const tests[])(int) = {isalnum, isalpha, isblank, iscntrl, isdigit, isgraph,
+                                        islower, isprint, ispunct, isspace, isupper, isxdigit};
+    for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+        if (strlen(names[i]) == length && 0 == memcmp(names[i], name, length)) {
+            for (int byte = 0; byte < 0x80; byte++) {
+                if (tests[i](byte)) {
+                    set_add(set, (unsigned char) byte);
+                }
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// [...] after the '['. Multibyte members become alternatives; they may not be negated or
+// used in ranges.
+static int parse_bracket(Parser* parser) {
+    const char* pattern  = parser->pattern;
+    size_t      length   = parser->length;
+    bool        negated  = parser->position < length && '^' == pattern[parser->position];
+    ByteSet     set      = {};
+    int         multi    = -1;
+    bool        first    = true;
+    parser->position    += negated ? 1 : 0;
+
+    while (parser->position < length && (first || ']' != pattern[parser->position])) {
+        first              = false;
+        unsigned char byte = (unsigned char) pattern[parser->position];
+        if ('[' == byte && parser->position + 1 < length && ':' == pattern[parser->position + 1]) {
+            size_t name  = parser->position + 2;
+            size_t close = name;
+            while (close + 1 < length && !(':' == pattern[close] && ']' == pattern[close + 1])) {
+                close++;
+            }
+            if (close + 1 >= length || !named_class(pattern + name, close - name, &set)) {
+                parser->error = "unknown character class";
+                return -1;
+            }
+            parser->position = close + 2;
+            continue;
+        }
+        if ('\\' == byte && parser->position + 1 < length) {
+            bool    negative;
+            ByteSet shorthand_set = {};
+            if (shorthand(pattern[parser->position + 1], &shorthand_set, &negative)) {
+                if (negative) {
+                    parser->error = "negated classes are not supported in brackets";
+                    return -1;
+                }
+                for (size_t i = 0; i < 4; i++) {
+                    set.bits[i] |= shorthand_set.bits[i];
+                }
+                parser->position += 2;
+                continue;
+            }
+            parser->position++; // any other escaped byte stands for itself
+            byte = (unsigned char) pattern[parser->position];
+        }
+        if (byte >= 0x80) {
+            if (negated) {
+                parser->error = "non-ASCII characters are not supported in negated brackets";
+                return -1;
+            }
+            int literal = add_literal(parser);
+            multi       = multi < 0 ? literal : add_pair(parser, NODE_ALTERNATE, multi, literal);
+            continue;
+        }
+        parser->position++;
+        if (parser->position + 1 < length && '-' == pattern[parser->position]
+            && ']' != pattern[parser->position + 1]) {
+            unsigned char high = (unsigned char) pattern[parser->position + 1];
+            if (high >= 0x80 || high < byte) {
+                parser->error = "invalid range";
+                return -1;
+            }
+            for (unsigned value = byte; value <= high; value++) {
+                add_byte(parser, &set, (unsigned char) value);
+            }
+            parser->position += 2;
+        } else {
+            add_byte(parser, &set, byte);
+        }
+    }
+    if (parser->position >= length) {
+        parser->error = "unterminated bracket expression";
+        return -1;
+    }
+    parser->position++; // ]
+
+    if (negated) {
+        ByteSet ascii = {};
+        for (int byte = 0; byte < 0x80; byte++) {
+            if (!set_has(&set, (unsigned char) byte) && '\n' != byte) {
+                set_add(&ascii, (unsigned char) byte);
+            }
+        }
+        return add_class(parser, &ascii, true);
+    }
+    int node = add_set(parser, &set);
+    return multi < 0 ? node : add_pair(parser, NODE_ALTERNATE, node, multi);
+}
+
+static int parse_alternation(Parser* parser);
+
+static int parse_atom(Parser* parser) {
+    const char* pattern = parser->pattern;
+    char        c       = pattern[parser->position];
+    switch (c) {
+        case '(': {
+            parser->position++;
+            int node = parse_alternation(parser);
+            if (node < 0) {
+                return -1;
+            }
+            if (parser->position >= parser->length || ')' != pattern[parser->position]) {
+                parser->error = "unbalanced parenthesis";
+                return -1;
+            }
+            parser->position++;
+            return node;
+        }
+        case '[':
+            parser->position++;
+            return parse_bracket(parser);
+        case '.': {
+            parser->position++;
+            ByteSet ascii = {};
+            set_add_range(&ascii, 0x00, 0x7F);
+            ascii.bits[0] &= ~((uint64_t) 1 << '\n');
+            return add_class(parser, &ascii, true);
+        }
+        case '^':
+            parser->position++;
+            return add_node(parser, NODE_BEGIN);
+        case '$':
+            parser->position++;
+            return add_node(parser, NODE_END);
+        case '*':
+        case '+':
+        case '?':
+            parser->error = "nothing to repeat";
+            return -1;
+        case '\\': {
+            if (parser->position + 1 >= parser->length) {
+                parser->error = "trailing backslash";
+                return -1;
+            }
+            char    letter = pattern[parser->position + 1];
+            bool    negated;
+            ByteSet set    = {};
+            if (shorthand(letter, &set, &negated)) {
+                parser->position += 2;
+                set.bits[0]      &= ~((uint64_t) 1 << '\n');
+                if (!negated) {
+                    return add_set(parser, &set);
+                }
+                ByteSet ascii = {};
+                for (int byte = 0; byte < 0x80; byte++) {
+                    if (!set_has(&set, (unsigned char) byte) && '\n' != byte) {
+                        set_add(&ascii, (unsigned char) byte);
+                    }
+                }
+                return add_class(parser, &ascii, true);
+            }
+            if (isalnum((unsigned char) letter)) {
+                if ('t' != letter && 'n' != letter) {
+                    parser->error = "unsupported escape";
+                    return -1;
+                }
+                parser->position += 2;
+                ByteSet tab       = {};
+                set_add(&tab, 't' == letter ? '\t' : '\n'); // \n never matches in a line
+                return add_set(parser, &tab);
+            }
+            parser->position++;
+            return add_literal(parser);
+        }
+        default:
+            return add_literal(parser);
+    }
+}
+
+// {n}, {n,} or {n,m}; false, with the position unchanged, when it is not one
+static bool parse_bounds(Parser* parser, int* min, int* max) {
+    const char* pattern  = parser->pattern;
+    size_t      position = parser->position + 1;
+    int         values[2] = {0, -1};
+    bool        comma     = false;
+    for (int k = 0; k < 2; k++) {
+        size_t digits = 0;
+        int    value  = 0;
+        while (position < parser->length && isdigit((unsigned char) pattern[position])) {
+            value = value * 10 + (pattern[position] - '0');
+            value = value < REPEAT_MAX + 1 ? value : REPEAT_MAX + 1;
+            position++;
+            digits++;
+        }
+        if (digits > 0) {
+            values[k] = value;
+        } else if (0 == k) {
+            return false;
+        }
+        if (0 == k && position < parser->length && ',' == pattern[position]) {
+            comma = true;
+            position++;
+            continue;
+        }
+        break;
+    }
+    if (position >= parser->length || '}' != pattern[position]) {
+        return false;
+    }
+    *min             = values[0];
+    *max             = comma ? values[1] : values[0];
+    parser->position = position + 1;
+    return true;
+}
+
+static int parse_repeat(Parser* parser) {
+    int node = parse_atom(parser);
+    while (node >= 0 && parser->position < parser->length) {
+        char c   = parser->pattern[parser->position];
+        int  min = 0;
+        int  max = -1;
+        if ('*' == c || '+' == c || '?' == c) {
+            min = '+' == c ? 1 : 0;
+            max = '?' == c ? 1 : -1;
+            parser->position++;
+        } else if ('{' != c || !parse_bounds(parser, &min, &max)) {
+            break;
+        }
+        if (min > REPEAT_MAX || max > REPEAT_MAX || (max >= 0 && max < min)) {
+            parser->error = "invalid repetition count";
+            return -1;
+        }
+        int repeat                = add_node(parser, NODE_REPEAT);
+        parser->nodes[repeat].min = min;
+        parser->nodes[repeat].max = max;
+        parser->nodes[repeat].children.push_back(node);
+        node = repeat;
+    }
+    return node;
+}
+
+static int parse_concat(Parser* parser) {
+    int node = add_node(parser, NODE_EMPTY);
+    while (parser->position < parser->length && '|' != parser->pattern[parser->position]
+           && ')' != parser->pattern[parser->position]) {
+        int next = parse_repeat(parser);
+        if (next < 0) {
+            return -1;
+        }
+        node = add_pair(parser, NODE_CONCAT, node, next);
+    }
+    return node;
+}
+
+static int parse_alternation(Parser* parser) {
+    int node = parse_concat(parser);
+    while (node >= 0 && parser->position < parser->length
+           && '|' == parser->pattern[parser->position]) {
+        parser->position++;
+        int next = parse_concat(parser);
+        node     = next < 0 ? -1 : add_pair(parser, NODE_ALTERNATE, node, next);
+    }
+    return node;
+}
+
+// Thompson automaton over bytes. BEGIN and END only pass at the start and end of a line.
+enum NfaKind {
+    NFA_SET,
+    NFA_SPLIT,
+    NFA_EMPTY,
+    NFA_BEGIN,
+    NFA_END,
+    NFA_MATCH
+};
+
+struct NfaState {
+    NfaKind kind;
+    int     set; // index into Nfa::sets
+    int     out;
+    int     out1; // second branch of a split
+};
+
+struct Nfa {
+    std::vector<NfaState> states;
+    std::vector<ByteSet>  sets;
+    int                   start;
+};
+
+// A piece under construction: its entry, and the exits still to be connected
+struct Fragment {
+    int                              start;
+    std::vector<std::pair<int, int>> holes; // state, and 0 for `out` or 1 for `out1`
+};
+
+static int add_state(Nfa* nfa, NfaKind kind, int set) {
+    nfa->states.push_back({kind, set, -1, -1});
+    return (int) nfa->states.size() - 1;
+}
+
+static void patch(Nfa* nfa, const Fragment &fragment, int target) {
+    for (const std::pair<int, int> &hole : fragment.holes) {
+        if (0 == hole.second) {
+            nfa->states[(size_t) hole.first].out = target;
+        } else {
+            nfa->states[(size_t) hole.first].out1 = target;
+        }
+    }
+}
+
+// Automaton of the tree at `index`, read backwards when `reverse`: concatenations are
+// turned around and the anchors swap places.
+static bool build(
+    Nfa* nfa, const std::vector<RegexNode> &nodes, int index, bool reverse, Fragment* out
+) {
+    if (nfa->states.size() > NFA_MAX) {
+        return false;
+    }
+    const RegexNode &node = nodes[(size_t) index];
+    switch (node.kind) {
+        case NODE_EMPTY:
+        case NODE_BEGIN:
+        case NODE_END: {
+            NfaKind kind = NFA_EMPTY;
+            if (NODE_EMPTY != node.kind) {
+                kind = (NODE_BEGIN == node.kind) != reverse ? NFA_BEGIN : NFA_END;
+            }
+            int state  = add_state(nfa, kind, -1);
+            out->start = state;
+            out->holes = {{state, 0}};
+            return true;
+        }
+        case NODE_SET: {
+            nfa->sets.push_back(node.set);
+            int state  = add_state(nfa, NFA_SET, (int) nfa->sets.size() - 1);
+            out->start = state;
+            out->holes = {{state, 0}};
+            return true;
+        }
+        case NODE_CONCAT: {
+            Fragment first;
+            Fragment second;
+            int      a = node.children[reverse ? 1 : 0];
+            int      b = node.children[reverse ? 0 : 1];
+            if (!build(nfa, nodes, a, reverse, &first) || !build(nfa, nodes, b, reverse, &second)) {
+                return false;
+            }
+            patch(nfa, first, second.start);
+            out->start = first.start;
+            out->holes = std::move(second.holes);
+            return true;
+        }
+        case NODE_ALTERNATE: {
+            Fragment first;
+            Fragment second;
+            if (!build(nfa, nodes, node.children[0], reverse, &first)
+                || !build(nfa, nodes, node.children[1], reverse, &second)) {
+                return false;
+            }
+            int split                            = add_state(nfa, NFA_SPLIT, -1);
+            nfa->states[(size_t) split].out  = first.start;
+            nfa->states[(size_t) split].out1 = second.start;
+            out->start                           = split;
+            out->holes                           = std::move(first.holes);
+            out->holes.insert(out->holes.end(), second.holes.begin(), second.holes.end());
+            return true;
+        }
+        case NODE_REPEAT: {
+            // the required copies, then optional ones or a loop
+            int entry = add_state(nfa, NFA_EMPTY, -1);
+            out->start = entry;
+            out->holes = {{entry, 0}};
+            for (int i = 0; i < node.min; i++) {
+                Fragment copy;
+                if (!build(nfa, nodes, node.children[0], reverse, &copy)) {
+                    return false;
+                }
+                patch(nfa, *out, copy.start);
+                out->holes = std::move(copy.holes);
+            }
+            if (node.max < 0) {
+                Fragment copy;
+                if (!build(nfa, nodes, node.children[0], reverse, &copy)) {
+                    return false;
+                }
+                int loop                           = add_state(nfa, NFA_SPLIT, -1);
+                nfa->states[(size_t) loop].out = copy.start;
+                patch(nfa, copy, loop);
+                patch(nfa, *out, loop);
+                out->holes = {{loop, 1}};
+                return true;
+            }
+            for (int i = node.min; i < node.max; i++) {
+                Fragment copy;
+                if (!build(nfa, nodes, node.children[0], reverse, &copy)) {
+                    return false;
+                }
+                int skip                           = add_state(nfa, NFA_SPLIT, -1);
+                nfa->states[(size_t) skip].out = copy.start;
+                patch(nfa, *out, skip);
+                out->holes = std::move(copy.holes);
+                out->holes.push_back({skip, 1});
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool build_nfa(Nfa* nfa, const std::vector<RegexNode> &nodes, int root, bool reverse) {
+    Fragment fragment;
+    if (!build(nfa, nodes, root, reverse, &fragment)) {
+        return false;
+    }
+    int match = add_state(nfa, NFA_MATCH, -1);
+    patch(nfa, fragment, match);
+    nfa->start = fragment.start;
+    return true;
+}
+
+// DFA states are sets of the NFA states that consume a byte or wait for the line's end
+// (SET, END, MATCH), built the first time a byte class leads to them. Transitions are
+// stored per byte class, the bytes no set of the pattern tells apart.
+#define DFA_UNKNOWN  (-1)
+#define DFA_MATCH    0x1 // a match ends here
+#define DFA_MATCH_AT 0x2 // a match ends here if the line does
+#define DFA_DEAD     0x4 // no match can follow
+
+struct Dfa {
+    const Nfa*                           nfa;
+    size_t                               classes;
+    const unsigned char*                 representatives; // a byte of each class
+    bool                                 unanchored;      // a match may start anywhere
+    std::vector<std::vector<int>>        sets;            // NFA states of each state
+    std::vector<int32_t>                 next;            // state * classes + class
+    std::vector<unsigned char>           flags;
+    std::unordered_map<std::string, int> ids;             // by their sorted NFA states
+    int                                  start;           // at the start of a line
+    int                                  inside;          // anywhere else
+    std::vector<int>                     stack;           // scratch for closures
+    std::vector<int>                     visited;
+    std::vector<char>                    seen;
+};
+
+// Add what `state` leads to without consuming a byte to `list`
+static void closure(Dfa* dfa, int state, bool begin, bool end, std::vector<int> &list) {
+    const std::vector<NfaState> &states = dfa->nfa->states;
+    std::vector<int>            &stack  = dfa->stack;
+    stack.push_back(state);
+    while (!stack.empty()) {
+        int current = stack.back();
+        stack.pop_back();
+        if (current < 0 || dfa->seen[(size_t) current]) {
+            continue;
+        }
+        dfa->seen[(size_t) current] = 1;
+        dfa->visited.push_back(current);
+        const NfaState &nfa_state = states[(size_t) current];
+        switch (nfa_state.kind) {
+            case NFA_SPLIT:
+                stack.push_back(nfa_state.out1);
+                stack.push_back(nfa_state.out);
+                break;
+            case NFA_EMPTY:
+                stack.push_back(nfa_state.out);
+                break;
+            case NFA_BEGIN:
+                if (begin) {
+                    stack.push_back(nfa_state.out);
+                }
+                break;
+            case NFA_END:
+                if (end) {
+                    stack.push_back(nfa_state.out);
+                } else {
+                    list.push_back(current);
+                }
+                break;
+            default:
+                list.push_back(current);
+                break;
+        }
+    }
+}
+
+// Closures share `seen` until this, so a state reached twice is listed once
+static void clear_seen(Dfa* dfa) {
+    for (int state : dfa->visited) {
+        dfa->seen[(size_t) state] = 0;
+    }
+    dfa->visited.clear();
+}
+
+static int intern(Dfa* dfa, std::vector<int> &list) {
+    std::sort(list.begin(), list.end());
+    std::string key((const char*) list.data(), list.size() * sizeof(int));
+    auto        found = dfa->ids.find(key);
+    if (found != dfa->ids.end()) {
+        return found->second;
+    }
+
+    const std::vector<NfaState> &states = dfa->nfa->states;
+    unsigned char                flags  = list.empty() ? DFA_DEAD : 0;
+    std::vector<int>             ending;
+    for (int state : list) {
+        if (NFA_MATCH == states[(size_t) state].kind) {
+            flags |= DFA_MATCH | DFA_MATCH_AT;
+        } else if (NFA_END == states[(size_t) state].kind) {
+            closure(dfa, states[(size_t) state].out, false, true, ending);
+        }
+    }
+    clear_seen(dfa);
+    for (int state : ending) {
+        if (NFA_MATCH == states[(size_t) state].kind) {
+            flags |= DFA_MATCH_AT;
+        }
+    }
+    if (dfa->unanchored) {
+        flags &= (unsigned char) ~DFA_DEAD; // the next byte may start a match
+    }
+
+    int id = (int) dfa->sets.size();
+    dfa->sets.push_back(list);
+    dfa->flags.push_back(flags);
+    dfa->next.resize(dfa->next.size() + dfa->classes, DFA_UNKNOWN);
+    dfa->ids.emplace(std::move(key), id);
+    return id;
+}
+
+static int start_state(Dfa* dfa, bool begin) {
+    std::vector<int> list;
+    closure(dfa, dfa->nfa->start, begin, false, list);
+    clear_seen(dfa);
+    return intern(dfa, list);
+}
+
+// Forget every state, e.g. when the cache is full
+static void reset_dfa(Dfa* dfa) {
+    dfa->sets.clear();
+    dfa->next.clear();
+    dfa->flags.clear();
+    dfa->ids.clear();
+    dfa->start  = start_state(dfa, true);
+    dfa->inside = start_state(dfa, false);
+}
+
+static void init_dfa(
+    Dfa* dfa, const Nfa* nfa, size_t classes, const unsigned char* representatives,
+    bool unanchored
+) {
+    dfa->nfa             = nfa;
+    dfa->classes         = classes;
+    dfa->representatives = representatives;
+    dfa->unanchored      = unanchored;
+    dfa->seen.assign(nfa->states.size(), 0);
+    reset_dfa(dfa);
+}
+
+// The state after `state` reads a byte of class `cls`, built if it is new
+static int step_slow(Dfa* dfa, int state, size_t cls) {
+    const std::vector<NfaState> &states = dfa->nfa->states;
+    const std::vector<ByteSet>  &sets   = dfa->nfa->sets;
+    unsigned char                byte   = dfa->representatives[cls];
+    std::vector<int>             list;
+    for (int nfa_state : dfa->sets[(size_t) state]) {
+        const NfaState &current = states[(size_t) nfa_state];
+        if (NFA_SET == current.kind && set_has(&sets[(size_t) current.set], byte)) {
+            closure(dfa, current.out, false, false, list);
+        }
+    }
+    if (dfa->unanchored) {
+        closure(dfa, dfa->nfa->start, false, false, list);
+    }
+    clear_seen(dfa);
+
+    if (dfa->sets.size() >= CONSOLE_SEARCH_STATES) {
+        reset_dfa(dfa); // `state` is gone, but the new one is all the caller needs
+        return intern(dfa, list);
+    }
+    int next                                       = intern(dfa, list);
+    dfa->next[(size_t) state * dfa->classes + cls] = next;
+    return next;
+}
+
+static inline int step(Dfa* dfa, int state, size_t cls) {
+    int next = dfa->next[(size_t) state * dfa->classes + cls];
+    return DFA_UNKNOWN != next ? next : step_slow(dfa, state, cls);
+}
+
+struct ConsoleRegex {
+    Nfa                  forward;
+    Nfa                  backward;
+    unsigned char        class_of[256];
+    unsigned char        representatives[256];
+    size_t               classes;
+    std::string          prefix;  // bytes every match starts with, found with memmem
+    struct RegexMatcher* matcher; // for console_regex_match(), built on first use
+};
+
+// The three automata one thread matches with: whether a line matches at all, then where
+// the leftmost match starts (backwards from the end) and where the longest one from there
+// ends
+struct RegexMatcher {
+    Dfa filter;
+    Dfa reverse;
+    Dfa anchored;
+};
+
+static void init_matcher(RegexMatcher* matcher, const ConsoleRegex* regex) {
+    init_dfa(&matcher->filter, &regex->forward, regex->classes, regex->representatives, true);
+    init_dfa(&matcher->reverse, &regex->backward, regex->classes, regex->representatives, true);
+    init_dfa(&matcher->anchored, &regex->forward, regex->classes, regex->representatives,
+             false);
+}
+
+static bool line_matches(
+    const ConsoleRegex* regex, Dfa* dfa, const unsigned char* text, size_t length
+) {
+    int state = dfa->start;
+    for (size_t i = 0; i < length && 0 == (dfa->flags[(size_t) state] & DFA_MATCH); i++) {
+        state = step(dfa, state, regex->class_of[text[i]]);
+    }
+    return 0 != (dfa->flags[(size_t) state] & DFA_MATCH_AT);
+}
+
+// Leftmost-longest match of a line known to match
+static void locate(
+    const ConsoleRegex* regex, RegexMatcher* matcher, const unsigned char* text, size_t length,
+    size_t* start, size_t* end
+) {
+    Dfa*   dfa   = &matcher->reverse;
+    int    state = dfa->start;
+    size_t first = length;
+    for (size_t i = length; i > 0; i--) {
+        state = step(dfa, state, regex->class_of[text[i - 1]]);
+        if (dfa->flags[(size_t) state] & DFA_MATCH) {
+            first = i - 1;
+        }
+    }
+    if (dfa->flags[(size_t) state] & DFA_MATCH_AT) {
+        first = 0;
+    }
+
+    dfa          = &matcher->anchored;
+    state        = 0 == first ? dfa->start : dfa->inside;
+    size_t last  = first;
+    size_t i     = first;
+    for (; i < length && 0 == (dfa->flags[(size_t) state] & DFA_DEAD); i++) {
+        state = step(dfa, state, regex->class_of[text[i]]);
+        if (dfa->flags[(size_t) state] & DFA_MATCH) {
+            last = i + 1;
+        }
+    }
+    if (i == length && (dfa->flags[(size_t) state] & DFA_MATCH_AT)) {
+        last = length;
+    }
+    *start = first;
+    *end   = last;
+}
+
+// Whether the prefix occurs in `text` at all
+static bool has_prefix(const std::string &prefix, const char* text, size_t length) {
+    return prefix.empty() || NULL != memmem(text, length, prefix.data(), prefix.size());
+}
+
+static bool match_line(
+    const ConsoleRegex* regex, RegexMatcher* matcher, const char* text, size_t length,
+    size_t* start, size_t* end
+) {
+    const unsigned char* bytes = (const unsigned char*) text;
+    if (!has_prefix(regex->prefix, text, length)
+        || !line_matches(regex, &matcher->filter, bytes, length)) {
+        return false;
+    }
+    locate(regex, matcher, bytes, length, start, end);
+    return true;
+}
+
+// The bytes every match starts with: the single-byte sets at the front of the pattern
+static void find_prefix(
+    const std::vector<RegexNode> &nodes, int index, std::string* prefix, bool* open
+) {
+    const RegexNode &node = nodes[(size_t) index];
+    switch (node.kind) {
+        case NODE_EMPTY:
+        case NODE_BEGIN:
+            return;
+        case NODE_CONCAT:
+            find_prefix(nodes, node.children[0], prefix, open);
+            if (*open) {
+                find_prefix(nodes, node.children[1], prefix, open);
+            }
+            return;
+        case NODE_SET:
+            if (1 == set_count(&node.set)) {
+                for (int byte = 0; byte < 256; byte++) {
+                    if (set_has(&node.set, (unsigned char) byte)) {
+                        *prefix += (char) byte;
+                    }
+                }
+                return;
+            }
+            *open = false;
+            return;
+        default:
+            *open = false;
+            return;
+    }
+}
+
+// Bytes that every set of the pattern treats alike share a class
+static void find_classes(ConsoleRegex* regex) {
+    std::unordered_map<std::string, unsigned char> classes;
+    for (int byte = 0; byte < 256; byte++) {
+        std::string signature;
+        for (const ByteSet &set : regex->forward.sets) {
+            signature += set_has(&set, (unsigned char) byte) ? '1' : '0';
+        }
+        auto found = classes.find(signature);
+        if (found == classes.end()) {
+            unsigned char cls                   = (unsigned char) classes.size();
+            regex->representatives[cls]         = (unsigned char) byte;
+            found                               = classes.emplace(signature, cls).first;
+        }
+        regex->class_of[byte] = found->second;
+    }
+    regex->classes = classes.size();
+}
+
+ConsoleRegex* console_compile_regex(
+    const char* pattern, size_t length, bool ignore_case, const char** error
+) {
+    Parser parser;
+    parser.pattern     = pattern;
+    parser.length      = length;
+    parser.position    = 0;
+    parser.ignore_case = ignore_case;
+    parser.error       = NULL;
+
+    int root = parse_alternation(&parser);
+    if (root >= 0 && parser.position < length) {
+        parser.error = "unbalanced parenthesis";
+        root         = -1;
+    }
+    if (root < 0) {
+        if (NULL != error) {
+            *error = parser.error;
+        }
+        return NULL;
+    }
+
+    ConsoleRegex* regex = new (std::nothrow) ConsoleRegex();
+    if (NULL == regex) {
+        fprintf(stderr, "debug: console_compile_regex: failed to allocate regex\n");
+        return NULL;
+    }
+    if (!build_nfa(&regex->forward, parser.nodes, root, false)
+        || !build_nfa(&regex->backward, parser.nodes, root, true)) {
+        if (NULL != error) {
+            *error = "pattern too large";
+        }
+        delete regex;
+        return NULL;
+    }
+    find_classes(regex);
+    regex->matcher = NULL;
+    bool open      = true;
+    find_prefix(parser.nodes, root, &regex->prefix, &open);
+    return regex;
+}
+
+void console_destroy_regex(ConsoleRegex* regex) {
+    if (NULL != regex) {
+        delete regex->matcher;
+        delete regex;
+    }
+}
+
+bool console_regex_match(
+    ConsoleRegex* regex, const char* text, size_t length, size_t* start, size_t* end
+) {
+    if (NULL == regex->matcher) {
+        regex->matcher = new (std::nothrow) RegexMatcher();
+        if (NULL == regex->matcher) {
+            return false;
+        }
+        init_matcher(regex->matcher, regex);
+    }
+    const char* newline = (const char*) memchr(text, '\n', length);
+    length              = NULL != newline ? (size_t) (newline - text) : length;
+    return match_line(regex, regex->matcher, text, length, start, end);
+}
+
+// A block of lines one thread searches: bytes of a text or lines of a page
+struct SearchTask {
+    const ConsoleRegex*             regex;
+    const char*                     text;
+    const ConsolePage*              page;
+    size_t                          begin;
+    size_t                          end;
+    size_t                          max;     // matches wanted; a text wants the first
+    std::vector<ConsoleSearchMatch> matches; // in order
+};
+
+static void run_task(SearchTask* task) {
+    RegexMatcher matcher;
+    init_matcher(&matcher, task->regex);
+
+    ConsoleSearchMatch match;
+    if (NULL != task->page) {
+        for (size_t line = task->begin; line < task->end && task->matches.size() < task->max;
+             line++) {
+            const ConsoleLine* page_line = &task->page->lines[line];
+            if (match_line(task->regex, &matcher, page_line->buffer, page_line->length,
+                           &match.start, &match.end)) {
+                match.line = line;
+                task->matches.push_back(match);
+            }
+        }
+        return;
+    }
+
+    // a prefix leads straight to the lines that can match
+    const std::string &prefix   = task->regex->prefix;
+    const char*        text     = task->text;
+    size_t             position = task->begin;
+    while (position < task->end) {
+        size_t line = position;
+        if (!prefix.empty()) {
+            const char* found = (const char*) memmem(text + position, task->end - position,
+                                                     prefix.data(), prefix.size());
+            if (NULL == found) {
+                return;
+            }
+            const char* newline = (const char*) memrchr(text + position, '\n',
+                                                        (size_t) (found - text) - position);
+            line = NULL != newline ? (size_t) (newline - text) + 1 : position;
+        }
+        const char* newline = (const char*) memchr(text + line, '\n', task->end - line);
+        size_t      end     = NULL != newline ? (size_t) (newline - text) : task->end;
+        if (match_line(task->regex, &matcher, text + line, end - line, &match.start,
+                       &match.end)) {
+            match.line = line;
+            task->matches.push_back(match);
+            return;
+        }
+        position = end + 1;
+    }
+}
+
+static void run_search_task(void* context) {
+    run_task((SearchTask*) context);
+}
+
+// Run the tasks side by side on the shared pool, ahead of its background work. The caller
+// is the input thread, so a task the pool has no room for waits for the tasks already
+// submitted, then for the pool's other work, and is tried again; it never runs here.
+// Returns false, once the submitted tasks are done, when one could not be submitted.
+static bool run_tasks(std::vector<SearchTask> &tasks) {
+    ConsoleTaskGroup* group = console_create_task_group();
+    if (NULL == group) {
+        return false;
+    }
+    ConsolePool*    pool = console_shared_pool();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t i = 0;
+    while (i < tasks.size()) {
+        if (console_group_submit(group, pool, run_search_task, &tasks[i],
+                                 CONSOLE_PRIORITY_INTERACTIVE)) {
+            i++;
+            continue;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long waited = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (NULL == pool || waited >= CONSOLE_SEARCH_WAIT) {
+            break;
+        }
+        if (i > 0) {
+            console_group_wait(group); // our own tasks free room first
+        } else {
+            struct timespec pause = {0, 1000000};
+            nanosleep(&pause, NULL);
+        }
+    }
+    console_destroy_task_group(group);
+    return i == tasks.size();
+}
+
+// Blocks in flight at once: enough to keep the pool busy, few enough that a match near
+// the start is not paid for with the whole text
+static size_t thread_count(void) {
+    size_t count = std::thread::hardware_concurrency();
+    count        = count > 0 ? count : 1;
+    return count < CONSOLE_SEARCH_THREADS ? count : CONSOLE_SEARCH_THREADS;
+}
+
+size_t console_search_page(
+    const ConsoleRegex* regex, const ConsolePage* page, size_t first, ConsoleSearchMatch* matches,
+    size_t max
+) {
+    size_t count    = 0;
+    size_t threads  = thread_count();
+    size_t position = first;
+    while (position < page->length && count < max) {
+        std::vector<SearchTask> tasks;
+        for (size_t i = 0; i < threads && position < page->length; i++) {
+            size_t end = page->length - position > CONSOLE_SEARCH_LINES
+                             ? position + CONSOLE_SEARCH_LINES
+                             : page->length;
+            tasks.push_back({regex, NULL, page, position, end, max - count, {}});
+            position = end;
+        }
+        if (!run_tasks(tasks)) {
+            break; // a block was not searched, so nothing after it can be counted
+        }
+        for (const SearchTask &task : tasks) {
+            for (size_t i = 0; i < task.matches.size() && count < max; i++) {
+                matches[count++] = task.matches[i];
+            }
+        }
+    }
+    return count;
+}
+
+bool console_search_text(
+    const ConsoleRegex* regex, const char* text, size_t length, size_t from,
+    ConsoleSearchMatch* match
+) {
+    if (from >= length) {
+        return false;
+    }
+    if (from > 0 && '\n' != text[from - 1]) {
+        const char* newline = (const char*) memchr(text + from, '\n', length - from);
+        from                = NULL != newline ? (size_t) (newline - text) + 1 : length;
+    }
+
+    size_t threads  = thread_count();
+    size_t position = from;
+    while (position < length) {
+        std::vector<SearchTask> tasks;
+        for (size_t i = 0; i < threads && position < length; i++) {
+            // blocks end after a newline, so no line is split between two
+            size_t end = length - position > CONSOLE_SEARCH_BLOCK
+                             ? position + CONSOLE_SEARCH_BLOCK
+                             : length;
+            if (end < length) {
+                const char* newline = (const char*) memchr(text + end, '\n', length - end);
+                end                 = NULL != newline ? (size_t) (newline - text) + 1 : length;
+            }
+            tasks.push_back({regex, text, NULL, position, end, 1, {}});
+            position = end;
+        }
+        if (!run_tasks(tasks)) {
+            return false;
+        }
+        for (const SearchTask &task : tasks) {
+            if (!task.matches.empty()) {
+                *match = task.matches[0];
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,286 @@
+/**
+ * @file console_snapshot.cpp
+ *
+ * @brief Saves a console's state to a compact binary snapshot and restores it by
+ * mapping the file, so a restarted process resumes the session without replaying it.
+ *
+ */
+
+#include <console_snapshot.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Layout: header, section table, then 8-byte aligned sections in table order.
+// Values are stored in host byte order; snapshots do not move between machines.
+static const char SNAPSHOT_MAGIC[8] = {'C', 'O', 'N', 'S', 'N', 'A', 'P', '\0'};
+
+enum SnapshotSection {
+    SNAPSHOT_SECTION_STATE,     // modes and cursor
+    SNAPSHOT_SECTION_LINE,      // active line bytes
+    SNAPSHOT_SECTION_PAGE,      // end offset per line, then the line bytes back to back
+    SNAPSHOT_SECTION_TYPEAHEAD, // input that was read but not consumed yet
+    SNAPSHOT_SECTION_COUNT
+};
+
+struct SnapshotHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t count; // number of table entries
+};
+
+struct SnapshotEntry {
+    uint32_t kind;   // enum SnapshotSection
+    uint32_t unused; // padding, keeps the table 8-byte aligned
+    uint64_t offset; // from the start of the file
+    uint64_t length; // in bytes
+    uint64_t count;  // number of items, e.g. lines in the page
+};
+
+struct SnapshotState {
+    uint32_t input;   // enum StateInput
+    uint32_t display; // enum StateDisplay
+    uint64_t row;
+    uint64_t col;
+};
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+// Pad a section that was `length` bytes long up to the next 8-byte boundary
+static bool write_padding(FILE* file, uint64_t length) {
+    static const char zero[8] = {0};
+    size_t            padding = (size_t) (align8(length) - length);
+    return 0 == padding || 1 == fwrite(zero, padding, 1, file);
+}
+
+static bool write_padded(FILE* file, const void* data, size_t length) {
+    if (length > 0 && 1 != fwrite(data, length, 1, file)) {
+        return false;
+    }
+    return write_padding(file, length);
+}
+
+bool console_save_snapshot(Console* console, const char* path) {
+    ConsoleStream*    stream    = console->stream;
+    ConsoleTypeahead* typeahead = console->typeahead;
+    ConsolePage*      page      = stream->page;
+
+    // pending type-ahead may wrap around the ring, flatten it first
+    size_t      pending = typeahead->tail - typeahead->head;
+    std::string input(pending, '\0');
+    for (size_t i = 0; i < pending; i++) {
+        input[i] = (char) typeahead->buffer[(typeahead->head + i) & (typeahead->size - 1)];
+    }
+
+    uint64_t page_bytes = 0;
+    for (size_t i = 0; i < page->length; i++) {
+        page_bytes += page->lines[i].length;
+    }
+
+    SnapshotEntry table[SNAPSHOT_SECTION_COUNT];
+    uint64_t      offset = align8(sizeof(SnapshotHeader) + sizeof(table));
+
+    uint64_t lengths[SNAPSHOT_SECTION_COUNT] = {
+        sizeof(SnapshotState),
+        stream->line->length,
+        page->length * sizeof(uint64_t) + page_bytes,
+        pending,
+    };
+    uint64_t counts[SNAPSHOT_SECTION_COUNT] = {1, 1, page->length, 1};
+    for (uint32_t kind = 0; kind < SNAPSHOT_SECTION_COUNT; kind++) {
+        table[kind].kind    = kind;
+        table[kind].unused  = 0;
+        table[kind].offset  = offset;
+        table[kind].length  = lengths[kind];
+        table[kind].count   = counts[kind];
+        offset             += align8(lengths[kind]);
+    }
+
+    std::string temporary = std::string(path) + ".tmp";
+    FILE*       file      = fopen(temporary.c_str(), "wb");
+    if (NULL == file) {
+        fprintf(stderr, "debug: console_save_snapshot: cannot create %s\n", temporary.c_str());
+        return false;
+    }
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = CONSOLE_SNAPSHOT_VERSION;
+    header.count   = SNAPSHOT_SECTION_COUNT;
+
+    SnapshotState state;
+    state.input   = console->state->input;
+    state.display = console->state->display;
+    state.row     = stream->cursor->row;
+    state.col     = stream->cursor->col;
+
+    bool ok = 1 == fwrite(&header, sizeof(header), 1, file)
+              && write_padded(file, table, sizeof(table))
+              && write_padded(file, &state, sizeof(state))
+              && write_padded(file, stream->line->buffer, stream->line->length);
+
+    // page: the offset table comes first so a restore never scans the text for newlines
+    uint64_t end = 0;
+    for (size_t i = 0; ok && i < page->length; i++) {
+        end += page->lines[i].length;
+        ok   = 1 == fwrite(&end, sizeof(end), 1, file);
+    }
+    for (size_t i = 0; ok && i < page->length; i++) {
+        ConsoleLine* line = &page->lines[i];
+        ok                = 0 == line->length || 1 == fwrite(line->buffer, line->length, 1, file);
+    }
+    ok = ok && write_padding(file, page_bytes) && write_padded(file, input.data(), input.size());
+
+    ok = 0 == fflush(file) && 0 == fsync(fileno(file)) && ok;
+    ok = 0 == fclose(file) && ok;
+    if (!ok || 0 != rename(temporary.c_str(), path)) {
+        fprintf(stderr, "debug: console_save_snapshot: failed to write %s\n", path);
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Point the page's lines into the mapped section: the page takes over the mapping, and
+// no line is copied. The offset table is checked whole first, so a corrupt one leaves the
+// page as it was.
+static bool restore_page(ConsolePage* page, void* data, size_t size, const SnapshotEntry* entry) {
+    const char*     bytes = (const char*) data;
+    const uint64_t* ends  = (const uint64_t*) (bytes + entry->offset);
+    const char*     text  = bytes + entry->offset + entry->count * sizeof(uint64_t);
+    size_t          count = (size_t) entry->count;
+
+    uint64_t start = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (ends[i] < start || ends[i] > entry->length - count * sizeof(uint64_t)) {
+            return false;
+        }
+        start = ends[i];
+    }
+    if (count > page->size) {
+        ConsoleLine* lines = (ConsoleLine*) realloc(page->lines, count * sizeof(ConsoleLine));
+        if (NULL == lines) {
+            return false;
+        }
+        page->lines = lines;
+        page->size  = count;
+    }
+
+    console_page_clear(page);
+    start = 0;
+    for (size_t i = 0; i < count; i++) {
+        ConsoleLine* line = &page->lines[i];
+        line->buffer      = (char*) text + start; // read-only, see ConsolePage::mapped
+        line->length      = (size_t) (ends[i] - start);
+        line->size        = line->length;
+        start             = ends[i];
+    }
+    page->length   = count;
+    page->mapped   = count;
+    page->map      = data;
+    page->map_size = size;
+    return true;
+}
+
+// Put the saved line back as it was; the next console_readline() edits it
+static bool restore_line(Console* console, const char* text, size_t length) {
+    ConsoleLine* line = console->stream->line;
+    line->length      = 0;
+    line->buffer[0]   = '\0';
+    if (length > 0 && !console_line_insert(line, 0, text, length)) {
+        return false;
+    }
+    console->stream->status = STREAM_STATUS_RESTORED;
+    return true;
+}
+
+bool console_restore_snapshot(Console* console, const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+        fprintf(stderr, "debug: console_restore_snapshot: cannot open %s\n", path);
+        return false;
+    }
+
+    struct stat info;
+    if (-1 == fstat(fd, &info) || (size_t) info.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t) info.st_size;
+    void*  data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data) {
+        return false;
+    }
+    madvise(data, size, MADV_WILLNEED);
+
+    const char*           bytes  = (const char*) data;
+    const SnapshotHeader* header = (const SnapshotHeader*) bytes;
+    const SnapshotEntry*  table  = (const SnapshotEntry*) (bytes + sizeof(SnapshotHeader));
+
+    bool ok = 0 == memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic))
+              && CONSOLE_SNAPSHOT_VERSION == header->version
+              && sizeof(SnapshotHeader) + header->count * sizeof(SnapshotEntry) <= size;
+
+    // bounds-check the whole table before touching anything
+    for (uint32_t i = 0; ok && i < header->count; i++) {
+        ok = table[i].offset <= size && table[i].length <= size - table[i].offset;
+        if (ok && SNAPSHOT_SECTION_PAGE == table[i].kind) {
+            ok = table[i].count <= table[i].length / sizeof(uint64_t);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "debug: console_restore_snapshot: %s is not a valid snapshot\n", path);
+        munmap(data, size);
+        return false;
+    }
+
+    bool adopted = false; // the page points into the mapping from now on
+    for (uint32_t i = 0; ok && i < header->count; i++) {
+        const SnapshotEntry* entry   = &table[i];
+        const char*          section = bytes + entry->offset;
+        switch (entry->kind) {
+            case SNAPSHOT_SECTION_STATE:
+                {
+                    if (entry->length < sizeof(SnapshotState)) {
+                        ok = false;
+                        break;
+                    }
+                    SnapshotState state;
+                    memcpy(&state, section, sizeof(state));
+                    console->state->input        = (StateInput) state.input;
+                    console->stream->cursor->row = state.row;
+                    console->stream->cursor->col = state.col;
+                    // force the saved display mode to be emitted again
+                    console->state->display = STATE_DISPLAY_RESET;
+                    console_set_display_mode(console, (StateDisplay) state.display);
+                    break;
+                }
+            case SNAPSHOT_SECTION_LINE:
+                ok = restore_line(console, section, entry->length);
+                break;
+            case SNAPSHOT_SECTION_PAGE:
+                ok      = restore_page(console->stream->page, data, size, entry);
+                adopted = ok;
+                break;
+            case SNAPSHOT_SECTION_TYPEAHEAD:
+                ok = console_typeahead_insert(console, section, entry->length);
+                break;
+            default:
+                break; // unknown sections from newer writers are skipped
+        }
+    }
+
+    if (!adopted) {
+        munmap(data, size);
+    }
+    return ok;
+}
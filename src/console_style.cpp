@@ -0,0 +1,243 @@
+/**
+ * @file console_style.cpp
+ *
+ * @brief SGR state tracking: text attributes and colors as values, and the shortest
+ * escape sequence that takes the terminal from one to another.
+ *
+ */
+
+#include <console_style.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// SGR parameters that set or clear each attribute, in CONSOLE_STYLE_* bit order
+static const int attribute_on[]  = {1, 2, 3, 4, 7};
+static const int attribute_off[] = {22, 22, 23, 24, 27}; // 22 clears bold and dim
+
+static const unsigned attribute_all = 0x1F;
+
+// Parameters are collected without the leading separator of the first
+static size_t append_number(char* out, size_t length, int number) {
+    char   digits[4];
+    size_t count = 0;
+    do {
+        digits[count++] = (char) ('0' + number % 10);
+        number         /= 10;
+    } while (number > 0);
+    if (length > 0) {
+        out[length++] = ';';
+    }
+    while (count > 0) {
+        out[length++] = digits[--count];
+    }
+    return length;
+}
+
+// The parameters of the color's own sequence, between CSI and 'm'
+static size_t append_color(char* out, size_t length, int color, bool background) {
+    size_t      sequence_length;
+    const char* sequence = console_color_sgr(color, background, &sequence_length);
+    if (length > 0) {
+        out[length++] = ';';
+    }
+    memcpy(out + length, sequence + 2, sequence_length - 3);
+    return length + sequence_length - 3;
+}
+
+// Everything `to` sets, starting from a reset
+static size_t append_style(char* out, size_t length, const ConsoleStyle* to) {
+    for (size_t bit = 0; bit < 5; bit++) {
+        if (to->attributes & 1u << bit) {
+            length = append_number(out, length, attribute_on[bit]);
+        }
+    }
+    if (CONSOLE_COLOR_DEFAULT != to->foreground) {
+        length = append_color(out, length, to->foreground, false);
+    }
+    if (CONSOLE_COLOR_DEFAULT != to->background) {
+        length = append_color(out, length, to->background, true);
+    }
+    return length;
+}
+
+ConsoleStyle console_style_default(void) {
+    ConsoleStyle style;
+    style.attributes = 0;
+    style.foreground = CONSOLE_COLOR_DEFAULT;
+    style.background = CONSOLE_COLOR_DEFAULT;
+    return style;
+}
+
+void console_style_apply(ConsoleStyle* style, const char* parameters, size_t length) {
+    int    values[32];
+    size_t count = 0;
+    int    value = 0;
+    for (size_t i = 0; i <= length && count < 32; i++) {
+        if (i == length || ';' == parameters[i] || ':' == parameters[i]) {
+            values[count++] = value;
+            value           = 0;
+        } else if (parameters[i] >= '0' && parameters[i] <= '9') {
+            value = value < 100000 ? value * 10 + parameters[i] - '0' : value;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int  parameter = values[i];
+        int* color     = parameter / 10 % 2 ? &style->foreground : &style->background;
+        if (0 == parameter) {
+            *style = console_style_default();
+        } else if (parameter >= 1 && parameter <= 7) {
+            for (size_t bit = 0; bit < 5; bit++) {
+                style->attributes |= attribute_on[bit] == parameter ? 1u << bit : 0;
+            }
+        } else if (22 == parameter) {
+            style->attributes &= ~(CONSOLE_STYLE_BOLD | CONSOLE_STYLE_DIM);
+        } else if (parameter >= 23 && parameter <= 27) {
+            for (size_t bit = 2; bit < 5; bit++) {
+                style->attributes &= attribute_off[bit] == parameter ? ~(1u << bit) : ~0u;
+            }
+        } else if ((parameter >= 30 && parameter <= 37) || (parameter >= 40 && parameter <= 47)) {
+            *color = parameter % 10;
+        } else if ((parameter >= 90 && parameter <= 97) || (parameter >= 100 && parameter <= 107)) {
+            *color = parameter % 10 + 8;
+        } else if (39 == parameter || 49 == parameter) {
+            *color = CONSOLE_COLOR_DEFAULT;
+        } else if ((38 == parameter || 48 == parameter) && i + 2 < count && 5 == values[i + 1]) {
+            *color  = values[i + 2] & 0xFF;
+            i      += 2;
+        } else if ((38 == parameter || 48 == parameter) && i + 4 < count && 2 == values[i + 1]) {
+            *color  = CONSOLE_COLOR_RGB(values[i + 2], values[i + 3], values[i + 4]);
+            i      += 4;
+        }
+    }
+}
+
+bool console_style_equal(const ConsoleStyle* a, const ConsoleStyle* b) {
+    return a->attributes == b->attributes && a->foreground == b->foreground
+           && a->background == b->background;
+}
+
+size_t console_style_transition(const ConsoleStyle* from, const ConsoleStyle* to, char* out) {
+    char   reset[CONSOLE_STYLE_MAX];
+    size_t reset_length = append_number(reset, 0, 0);
+    reset_length        = append_style(reset, reset_length, to);
+
+    char   change[CONSOLE_STYLE_MAX];
+    size_t change_length = 0;
+    if (NULL != from) {
+        if (console_style_equal(from, to)) {
+            return 0;
+        }
+        unsigned removed = from->attributes & ~to->attributes & attribute_all;
+        unsigned added   = to->attributes & ~from->attributes & attribute_all;
+        if (removed & (CONSOLE_STYLE_BOLD | CONSOLE_STYLE_DIM)) {
+            // one parameter clears both, the one that stays is set again
+            change_length  = append_number(change, change_length, 22);
+            added         |= to->attributes & (CONSOLE_STYLE_BOLD | CONSOLE_STYLE_DIM);
+            removed       &= ~(CONSOLE_STYLE_BOLD | CONSOLE_STYLE_DIM);
+        }
+        for (size_t bit = 0; bit < 5; bit++) {
+            if (removed & 1u << bit) {
+                change_length = append_number(change, change_length, attribute_off[bit]);
+            }
+        }
+        for (size_t bit = 0; bit < 5; bit++) {
+            if (added & 1u << bit) {
+                change_length = append_number(change, change_length, attribute_on[bit]);
+            }
+        }
+        if (from->foreground != to->foreground) {
+            change_length = append_color(change, change_length, to->foreground, false);
+        }
+        if (from->background != to->background) {
+            change_length = append_color(change, change_length, to->background, true);
+        }
+    }
+
+    const char* parameters = reset;
+    size_t      length     = reset_length;
+    if (NULL != from && change_length < reset_length) {
+        parameters = change;
+        length     = change_length;
+    }
+    out[0] = '\x1b';
+    out[1] = '[';
+    memcpy(out + 2, parameters, length);
+    out[2 + length] = 'm';
+    return length + 3;
+}
+
+ConsoleStyleTracker* console_create_style_tracker(void) {
+    ConsoleStyleTracker* tracker = (ConsoleStyleTracker*) malloc(sizeof(ConsoleStyleTracker));
+    if (NULL == tracker) {
+        fprintf(stderr, "debug: console_create_style_tracker: failed to allocate tracker\n");
+        return NULL;
+    }
+    console_style_track(tracker);
+    return tracker;
+}
+
+void console_destroy_style_tracker(ConsoleStyleTracker* tracker) {
+    free(tracker);
+}
+
+void console_style_track(ConsoleStyleTracker* tracker) {
+    tracker->current = console_style_default();
+    tracker->exact   = true;
+    tracker->known   = true;
+}
+
+void console_style_forget(ConsoleStyleTracker* tracker) {
+    tracker->known = false;
+}
+
+size_t console_style_update(ConsoleStyleTracker* tracker, const ConsoleStyle* to, char* out) {
+    if (tracker->known && console_style_equal(&tracker->current, to)) {
+        return 0;
+    }
+    bool   exact     = tracker->known && tracker->exact;
+    size_t length    = console_style_transition(exact ? &tracker->current : NULL, to, out);
+    tracker->current = *to;
+    tracker->exact   = true;
+    tracker->known   = true;
+    return length;
+}
+
+size_t console_style_reset(ConsoleStyleTracker* tracker, char* out) {
+    ConsoleStyle plain = console_style_default();
+    if (!tracker->exact) {
+        tracker->known = false; // assumed to be plain is not good enough
+    }
+    return console_style_update(tracker, &plain, out);
+}
+
+ConsoleStyle console_style_downsample(const ConsoleStyle* style, int colors) {
+    ConsoleStyle result = *style;
+    result.foreground   = console_color_map(style->foreground, colors);
+    result.background   = console_color_map(style->background, colors);
+    return result;
+}
+
+void console_write_styled(
+    Console* console, const char* text, size_t length, const ConsoleStyle* style
+) {
+    if (NULL == console->capabilities || NULL == console->style || NULL == style) {
+        console_write_output(console, text, length); // nothing to style with: the text alone
+        return;
+    }
+    ConsoleStyle shown = console_style_downsample(style, console->capabilities->colors);
+
+    // one write for the escape and a token, the usual case
+    char   buffer[CONSOLE_STYLE_MAX + 256];
+    size_t count = console_style_update(console->style, &shown, buffer);
+    if (count + length <= sizeof(buffer)) {
+        memcpy(buffer + count, text, length);
+        console_write_output(console, buffer, count + length);
+        return;
+    }
+    if (count > 0) {
+        console_write_output(console, buffer, count);
+    }
+    console_write_output(console, text, length);
+}
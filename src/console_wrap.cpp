@@ -0,0 +1,496 @@
+/**
+ * @file console_wrap.cpp
+ *
+ * @brief Output stage that word-wraps streamed text at line break opportunities, after
+ * the pair rules of UAX #14, instead of letting the terminal cut words in half.
+ *
+ */
+
+#include <console_layout.h>
+#include <console_wrap.h>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/ioctl.h>
+
+// The line breaking classes of UAX #14 that matter for text a model writes. Classes
+// the subset leaves out are folded into their nearest neighbour, mostly AL.
+enum BreakClass {
+    BREAK_BK, // mandatory break, the newline
+    BREAK_SP, // space, and the tab here
+    BREAK_ZW, // zero width space
+    BREAK_GL, // non-breaking glue, e.g. NO-BREAK SPACE
+    BREAK_CM, // combining mark, takes the class of its base
+    BREAK_WJ, // word joiner
+    BREAK_OP, // opening punctuation
+    BREAK_CL, // closing punctuation
+    BREAK_CP, // closing parenthesis
+    BREAK_QU, // ambiguous quotation
+    BREAK_EX, // exclamation or interrogation
+    BREAK_IS, // infix numeric separator
+    BREAK_SY, // symbol allowing a break after, the slash
+    BREAK_HY, // hyphen-minus
+    BREAK_BA, // break after, e.g. the vertical bar or EN DASH
+    BREAK_BB, // break before
+    BREAK_B2, // break on either side but not between, EM DASH
+    BREAK_NS, // nonstarter
+    BREAK_IN, // inseparable, the ellipsis
+    BREAK_AL, // alphabetic and everything else
+    BREAK_NU, // numeric
+    BREAK_PR, // prefix numeric, e.g. currency signs
+    BREAK_PO, // postfix numeric, e.g. the percent sign
+    BREAK_ID, // ideographic, breaks on both sides
+    BREAK_CLASSES
+};
+
+// What the pair table says about the boundary between two classes
+enum BreakAction {
+    BREAK_DIRECT,     // a break is allowed here
+    BREAK_INDIRECT,   // only if spaces come between
+    BREAK_PROHIBITED  // not even with spaces between
+};
+
+struct BreakRange {
+    uint32_t        first;
+    uint32_t        last;
+    enum BreakClass type;
+};
+
+// Classes outside ASCII, sorted for a binary search
+static const BreakRange ranges[] = {
+    {0x00A0,  0x00A0,  BREAK_GL}, // NO-BREAK SPACE
+    {0x00AB,  0x00AB,  BREAK_QU},
+    {0x00AD,  0x00AD,  BREAK_BA}, // SOFT HYPHEN
+    {0x00B4,  0x00B4,  BREAK_BB},
+    {0x00BB,  0x00BB,  BREAK_QU},
+    {0x0300,  0x036F,  BREAK_CM},
+    {0x0483,  0x0489,  BREAK_CM},
+    {0x0591,  0x05BD,  BREAK_CM},
+    {0x0610,  0x061A,  BREAK_CM},
+    {0x064B,  0x065F,  BREAK_CM},
+    {0x2000,  0x2006,  BREAK_BA}, // spaces of various widths
+    {0x2007,  0x2007,  BREAK_GL}, // FIGURE SPACE
+    {0x2008,  0x200A,  BREAK_BA},
+    {0x200B,  0x200B,  BREAK_ZW},
+    {0x200C,  0x200D,  BREAK_CM},
+    {0x2010,  0x2010,  BREAK_BA},
+    {0x2011,  0x2011,  BREAK_GL}, // NON-BREAKING HYPHEN
+    {0x2012,  0x2013,  BREAK_BA},
+    {0x2014,  0x2014,  BREAK_B2},
+    {0x2018,  0x2019,  BREAK_QU},
+    {0x201C,  0x201D,  BREAK_QU},
+    {0x2024,  0x2026,  BREAK_IN},
+    {0x202F,  0x202F,  BREAK_GL},
+    {0x2030,  0x2037,  BREAK_PO},
+    {0x2060,  0x2060,  BREAK_WJ},
+    {0x20A0,  0x20CF,  BREAK_PR}, // currency signs
+    {0x20D0,  0x20FF,  BREAK_CM},
+    {0x2E80,  0x2FFF,  BREAK_ID},
+    {0x3000,  0x3000,  BREAK_BA}, // IDEOGRAPHIC SPACE
+    {0x3001,  0x3002,  BREAK_CL},
+    {0x3003,  0x3007,  BREAK_ID},
+    {0x3008,  0x3008,  BREAK_OP},
+    {0x3009,  0x3009,  BREAK_CL},
+    {0x300A,  0x300A,  BREAK_OP},
+    {0x300B,  0x300B,  BREAK_CL},
+    {0x300C,  0x300C,  BREAK_OP},
+    {0x300D,  0x300D,  BREAK_CL},
+    {0x3041,  0x309F,  BREAK_ID}, // Hiragana
+    {0x30A0,  0x30FF,  BREAK_ID}, // Katakana
+    {0x3400,  0x4DBF,  BREAK_ID},
+    {0x4E00,  0x9FFF,  BREAK_ID}, // CJK Unified Ideographs
+    {0xAC00,  0xD7A3,  BREAK_ID}, // Hangul syllables
+    {0xF900,  0xFAFF,  BREAK_ID},
+    {0xFE00,  0xFE0F,  BREAK_CM}, // variation selectors
+    {0xFEFF,  0xFEFF,  BREAK_WJ},
+    {0xFF01,  0xFF01,  BREAK_EX},
+    {0xFF08,  0xFF08,  BREAK_OP},
+    {0xFF09,  0xFF09,  BREAK_CL},
+    {0xFF0C,  0xFF0C,  BREAK_CL},
+    {0xFF0E,  0xFF0E,  BREAK_CL},
+    {0xFF1A,  0xFF1B,  BREAK_NS},
+    {0xFF1F,  0xFF1F,  BREAK_EX},
+    {0x1F000, 0x1FAFF, BREAK_ID}, // emoji and pictographs
+    {0x20000, 0x3FFFD, BREAK_ID},
+};
+
+// The pair table and the ASCII classes, compiled once from the rules of UAX #14
+struct BreakTables {
+    unsigned char ascii[128];
+    unsigned char pairs[BREAK_CLASSES][BREAK_CLASSES];
+};
+
+static void pair(BreakTables* tables, int before, int after, enum BreakAction action) {
+    if (BREAK_PROHIBITED == action || BREAK_DIRECT == tables->pairs[before][after]) {
+        tables->pairs[before][after] = action;
+    }
+}
+
+static BreakTables compile_tables(void) {
+    BreakTables tables;
+
+    for (int c = 0; c < 128; c++) {
+        tables.ascii[c] = c < 0x20 ? BREAK_CM : BREAK_AL;
+    }
+    for (int c = '0'; c <= '9'; c++) {
+        tables.ascii[c] = BREAK_NU;
+    }
+    static const struct {
+        const char*     characters;
+        enum BreakClass type;
+    } classes[] = {
+        {"\n", BREAK_BK},  {" \t", BREAK_SP}, {"([{", BREAK_OP}, {"}", BREAK_CL},
+        {")]", BREAK_CP},  {"\"'", BREAK_QU}, {"!?", BREAK_EX},  {",.:;", BREAK_IS},
+        {"/", BREAK_SY},   {"-", BREAK_HY},   {"|", BREAK_BA},   {"$+\\", BREAK_PR},
+        {"%", BREAK_PO},
+    };
+    for (const auto &entry : classes) {
+        for (const char* c = entry.characters; '\0' != *c; c++) {
+            tables.ascii[(unsigned char) *c] = (unsigned char) entry.type;
+        }
+    }
+
+    for (int b = 0; b < BREAK_CLASSES; b++) {
+        for (int a = 0; a < BREAK_CLASSES; a++) {
+            tables.pairs[b][a] = BREAK_DIRECT; // LB31: break everywhere else
+        }
+    }
+    for (int x = 0; x < BREAK_CLASSES; x++) {
+        pair(&tables, x, BREAK_ZW, BREAK_PROHIBITED); // LB7
+        pair(&tables, x, BREAK_WJ, BREAK_PROHIBITED); // LB11
+        pair(&tables, BREAK_WJ, x, BREAK_PROHIBITED);
+        pair(&tables, x, BREAK_CL, BREAK_PROHIBITED); // LB13
+        pair(&tables, x, BREAK_CP, BREAK_PROHIBITED);
+        pair(&tables, x, BREAK_EX, BREAK_PROHIBITED);
+        pair(&tables, x, BREAK_IS, BREAK_PROHIBITED);
+        pair(&tables, x, BREAK_SY, BREAK_PROHIBITED);
+        pair(&tables, BREAK_OP, x, BREAK_PROHIBITED); // LB14
+    }
+    pair(&tables, BREAK_QU, BREAK_OP, BREAK_PROHIBITED); // LB15
+    pair(&tables, BREAK_CL, BREAK_NS, BREAK_PROHIBITED); // LB16
+    pair(&tables, BREAK_CP, BREAK_NS, BREAK_PROHIBITED);
+    pair(&tables, BREAK_B2, BREAK_B2, BREAK_PROHIBITED); // LB17
+
+    for (int x = 0; x < BREAK_CLASSES; x++) {
+        pair(&tables, BREAK_GL, x, BREAK_INDIRECT); // LB12
+        if (BREAK_BA != x && BREAK_HY != x) {
+            pair(&tables, x, BREAK_GL, BREAK_INDIRECT); // LB12a
+        }
+        pair(&tables, x, BREAK_QU, BREAK_INDIRECT); // LB19
+        pair(&tables, BREAK_QU, x, BREAK_INDIRECT);
+        pair(&tables, x, BREAK_BA, BREAK_INDIRECT); // LB21
+        pair(&tables, x, BREAK_HY, BREAK_INDIRECT);
+        pair(&tables, x, BREAK_NS, BREAK_INDIRECT);
+        pair(&tables, BREAK_BB, x, BREAK_INDIRECT);
+        pair(&tables, x, BREAK_IN, BREAK_INDIRECT); // LB22
+    }
+    static const int joined[][2] = {
+        {BREAK_AL, BREAK_NU}, {BREAK_NU, BREAK_AL},                       // LB23
+        {BREAK_PR, BREAK_ID}, {BREAK_ID, BREAK_PO},                       // LB23a
+        {BREAK_PR, BREAK_AL}, {BREAK_PO, BREAK_AL}, {BREAK_AL, BREAK_PR}, // LB24
+        {BREAK_AL, BREAK_PO}, {BREAK_CL, BREAK_PO}, {BREAK_CL, BREAK_PR}, // LB25
+        {BREAK_CP, BREAK_PO}, {BREAK_CP, BREAK_PR}, {BREAK_NU, BREAK_PO},
+        {BREAK_NU, BREAK_PR}, {BREAK_PO, BREAK_OP}, {BREAK_PR, BREAK_OP},
+        {BREAK_PO, BREAK_NU}, {BREAK_PR, BREAK_NU}, {BREAK_HY, BREAK_NU},
+        {BREAK_IS, BREAK_NU}, {BREAK_NU, BREAK_NU}, {BREAK_SY, BREAK_NU},
+        {BREAK_AL, BREAK_AL},                                             // LB28
+        {BREAK_IS, BREAK_AL},                                             // LB29
+        {BREAK_AL, BREAK_OP}, {BREAK_NU, BREAK_OP}, {BREAK_CP, BREAK_AL}, // LB30
+        {BREAK_CP, BREAK_NU},
+    };
+    for (const auto &entry : joined) {
+        pair(&tables, entry[0], entry[1], BREAK_INDIRECT);
+    }
+
+    for (int x = 0; x < BREAK_CLASSES; x++) {
+        tables.pairs[BREAK_ZW][x] = BREAK_DIRECT; // LB8: ZW SP* ÷
+    }
+    return tables;
+}
+
+static const BreakTables &break_tables(void) {
+    static const BreakTables tables = compile_tables();
+    return tables;
+}
+
+static enum BreakClass break_class(uint32_t codepoint) {
+    size_t low  = 0;
+    size_t high = sizeof(ranges) / sizeof(ranges[0]);
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (codepoint < ranges[middle].first) {
+            high = middle;
+        } else if (codepoint > ranges[middle].last) {
+            low = middle + 1;
+        } else {
+            return ranges[middle].type;
+        }
+    }
+    return BREAK_AL;
+}
+
+static uint32_t decode(const unsigned char* bytes, size_t count) {
+    uint32_t codepoint = count > 1 ? bytes[0] & (0xFF >> (count + 1)) : bytes[0];
+    for (size_t i = 1; i < count; i++) {
+        codepoint = codepoint << 6 | (bytes[i] & 0x3F);
+    }
+    return codepoint;
+}
+
+// The row being written is `line`. Text since the last break opportunity waits in
+// `segment` until the next opportunity shows whether it fits after `gap`, the spaces
+// that ended the segment before it, or starts the next row.
+struct ConsoleWrapper {
+    ConsoleSink     sink;          // the wrapper as an output stage
+    size_t          width;         // columns to wrap at, 0 to follow the terminal
+    ConsoleLayout   line;          // the cursor as written so far
+    enum BreakClass before;        // last class that is not a space, BK at a row start
+    bool            spaced;        // spaces came after `before`
+    bool            direct;        // in a word wider than a row, written as it arrives
+    std::string     segment;       // since the last break opportunity
+    size_t          segment_width;
+    std::string     space;         // spaces after the segment
+    size_t          space_width;
+    std::string     gap;           // spaces after the last placed segment, not written yet
+    size_t          gap_width;
+    std::string     lead;          // styles after the spaces, for the text that follows
+    std::string     partial;       // a character or sequence cut off by the last write
+    std::string     out;           // output of the write in progress
+};
+
+static void emit(ConsoleWrapper* wrapper, const char* data, size_t length) {
+    wrapper->out.append(data, length);
+    console_layout_advance(&wrapper->line, data, length);
+}
+
+// A break opportunity ended the segment: place it after the gap if it fits, else on
+// the next row. A row that is still empty takes it either way and lets it wrap hard.
+static void place(ConsoleWrapper* wrapper) {
+    ConsoleLayout &line = wrapper->line;
+    if (wrapper->segment.empty()) {
+        wrapper->gap         += wrapper->space; // nothing to place, the spaces add up
+        wrapper->gap_width   += wrapper->space_width;
+        wrapper->space.clear();
+        wrapper->space_width  = 0;
+        return;
+    }
+    if (line.col > 0
+        && line.col + wrapper->gap_width + wrapper->segment_width > line.columns) {
+        emit(wrapper, "\n", 1);
+    } else {
+        emit(wrapper, wrapper->gap.data(), wrapper->gap.size());
+    }
+    emit(wrapper, wrapper->segment.data(), wrapper->segment.size());
+
+    wrapper->segment.clear();
+    wrapper->segment_width = 0;
+    wrapper->gap.swap(wrapper->space);
+    wrapper->gap_width = wrapper->space_width;
+    wrapper->space.clear();
+    wrapper->space_width = 0;
+}
+
+static void newline(ConsoleWrapper* wrapper) {
+    place(wrapper);
+    // trailing spaces are written when they fit; they are not worth a row of their own
+    if (wrapper->line.col + wrapper->gap_width <= wrapper->line.columns) {
+        emit(wrapper, wrapper->gap.data(), wrapper->gap.size());
+    }
+    emit(wrapper, wrapper->lead.data(), wrapper->lead.size());
+    wrapper->lead.clear();
+    wrapper->gap.clear();
+    wrapper->gap_width = 0;
+    emit(wrapper, "\n", 1);
+    wrapper->before = BREAK_BK;
+    wrapper->spaced = false;
+    wrapper->direct = false;
+}
+
+// One character of class `type`, `width` columns wide.
+static void take(
+    ConsoleWrapper* wrapper, const char* bytes, size_t count, enum BreakClass type, size_t width
+) {
+    if (BREAK_BK == type) {
+        newline(wrapper);
+        return;
+    }
+    if (BREAK_SP == type) {
+        if ('\t' == bytes[0]) {
+            size_t at = wrapper->line.col + wrapper->gap_width + wrapper->segment_width
+                        + wrapper->space_width;
+            width     = 8 - at % 8;
+        }
+        wrapper->space.append(bytes, count);
+        wrapper->space_width += width;
+        wrapper->spaced       = true;
+        return;
+    }
+    if (BREAK_CM == type) {
+        if (BREAK_BK != wrapper->before && !wrapper->spaced) {
+            type = wrapper->before; // LB9: a mark belongs to the character before it
+        } else {
+            type = BREAK_AL; // LB10
+        }
+    }
+
+    int  action = break_tables().pairs[wrapper->before][type];
+    bool split  = BREAK_BK != wrapper->before
+                 && (BREAK_DIRECT == action || (BREAK_INDIRECT == action && wrapper->spaced));
+    if (split) {
+        place(wrapper);
+        wrapper->direct = false;
+    } else if (wrapper->spaced) {
+        // spaces inside an unbreakable run belong to it, e.g. "word )"
+        wrapper->segment       += wrapper->space;
+        wrapper->segment_width += wrapper->space_width;
+        wrapper->space.clear();
+        wrapper->space_width    = 0;
+    }
+    wrapper->segment += wrapper->lead;
+    wrapper->lead.clear();
+
+    if (wrapper->direct) {
+        emit(wrapper, wrapper->segment.data(), wrapper->segment.size());
+        emit(wrapper, bytes, count);
+        wrapper->segment.clear();
+        wrapper->segment_width = 0;
+    } else {
+        wrapper->segment.append(bytes, count);
+        wrapper->segment_width += width;
+        if (wrapper->segment_width > wrapper->line.columns) {
+            // no row is wide enough: write it now and let the terminal wrap it hard
+            place(wrapper);
+            wrapper->direct = true;
+        }
+    }
+    wrapper->before = type;
+    wrapper->spaced = false;
+}
+
+static void wrap(ConsoleWrapper* wrapper, const char* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t               i     = 0;
+
+    while (i < length) {
+        unsigned char byte = bytes[i];
+        if (0x1B == byte) {
+            size_t count = console_sequence_length(data + i, length - i);
+            if (0 == count) {
+                break;
+            }
+            // styles take no room; they stay with the text they come before
+            if (wrapper->spaced) {
+                wrapper->lead.append(data + i, count);
+            } else if (wrapper->direct) {
+                emit(wrapper, data + i, count);
+            } else {
+                wrapper->segment.append(data + i, count);
+            }
+            i += count;
+        } else if (byte < 0x80) {
+            take(wrapper, data + i, 1, (enum BreakClass) break_tables().ascii[byte],
+                 byte >= 0x20 && 0x7F != byte ? 1 : 0);
+            i++;
+        } else {
+            size_t count = console_utf8_length(byte);
+            if (i + count > length) {
+                break;
+            }
+            int width = console_utf8_width(data + i, count);
+            take(wrapper, data + i, count, break_class(decode(bytes + i, count)),
+                 width > 0 ? (size_t) width : 0);
+            i += count;
+        }
+    }
+    wrapper->partial.assign(data + i, length - i);
+}
+
+static void measure(Console* console, ConsoleWrapper* wrapper) {
+    struct winsize window_size;
+    size_t         columns = wrapper->width;
+    if (0 == columns) {
+        columns = 80;
+        if (0 == ioctl(fileno(console->io->teletype), TIOCGWINSZ, &window_size)
+            && window_size.ws_col > 0) {
+            columns = window_size.ws_col;
+        }
+    }
+    wrapper->line.columns = columns;
+    if (wrapper->line.col > columns) {
+        wrapper->line.col = columns;
+    }
+}
+
+static void wrapper_write(Console* console, ConsoleSink* sink, const char* data, size_t length) {
+    ConsoleWrapper* wrapper = (ConsoleWrapper*) sink->context;
+
+    measure(console, wrapper);
+    wrapper->out.clear();
+    if (wrapper->partial.empty()) {
+        wrap(wrapper, data, length);
+    } else {
+        std::string text = std::move(wrapper->partial);
+        text.append(data, length);
+        wrap(wrapper, text.data(), text.size());
+    }
+    if (!wrapper->out.empty()) {
+        console_sink_pass(console, sink, wrapper->out.data(), wrapper->out.size());
+    }
+}
+
+static void wrapper_flush(Console* console, ConsoleSink* sink) {
+    ConsoleWrapper* wrapper = (ConsoleWrapper*) sink->context;
+
+    measure(console, wrapper);
+    wrapper->out.clear();
+    place(wrapper);
+    emit(wrapper, wrapper->lead.data(), wrapper->lead.size());
+    emit(wrapper, wrapper->partial.data(), wrapper->partial.size());
+    wrapper->lead.clear();
+    wrapper->partial.clear();
+    if (!wrapper->out.empty()) {
+        console_sink_pass(console, sink, wrapper->out.data(), wrapper->out.size());
+    }
+    console_sink_flush(console, sink);
+}
+
+ConsoleWrapper* console_create_wrapper(size_t columns) {
+    ConsoleWrapper* wrapper = new (std::nothrow) ConsoleWrapper();
+    if (NULL == wrapper) {
+        fprintf(stderr, "debug: console_create_wrapper: failed to allocate wrapper\n");
+        return NULL;
+    }
+
+    wrapper->width        = columns;
+    wrapper->line.columns = columns > 0 ? columns : 80;
+    wrapper->before       = BREAK_BK;
+    wrapper->sink.write   = wrapper_write;
+    wrapper->sink.flush   = wrapper_flush;
+    wrapper->sink.context = wrapper;
+    wrapper->sink.next    = NULL;
+    return wrapper;
+}
+
+void console_destroy_wrapper(ConsoleWrapper* wrapper) {
+    delete wrapper;
+}
+
+void console_reset_wrapper(ConsoleWrapper* wrapper) {
+    wrapper->line.col = 0;
+    wrapper->before   = BREAK_BK;
+    wrapper->spaced   = false;
+    wrapper->direct   = false;
+    wrapper->segment.clear();
+    wrapper->segment_width = 0;
+    wrapper->space.clear();
+    wrapper->space_width = 0;
+    wrapper->gap.clear();
+    wrapper->gap_width = 0;
+    wrapper->lead.clear();
+    wrapper->partial.clear();
+}
+
+ConsoleSink* console_wrapper_sink(ConsoleWrapper* wrapper) {
+    return &wrapper->sink;
+}
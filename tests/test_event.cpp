@@ -0,0 +1,120 @@
+/**
+ * @file test_event.cpp
+ *
+ * @brief Checks the decoding of terminal input into events: keys, chords, escape sequences
+ * cut short or malformed, and UTF-8.
+ *
+ */
+
+#include <console_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+static Console* console = NULL;
+static int      input   = -1; // write end of the pipe the console reads from
+
+// Deliver `data` at once, as a terminal would, and decode everything it holds
+static size_t decode(const char* data, ConsoleEvent* events, size_t max) {
+    if ((ssize_t) strlen(data) != write(input, data, strlen(data))) {
+        return 0;
+    }
+    return console_read_events(console, events, max);
+}
+
+static bool is_key(const ConsoleEvent* event, StreamEvent key, unsigned modifiers) {
+    return CONSOLE_EVENT_KEY == event->type && key == event->key
+           && modifiers == event->modifiers;
+}
+
+static bool is_char(const ConsoleEvent* event, uint32_t codepoint, unsigned modifiers) {
+    return CONSOLE_EVENT_CODEPOINT == event->type && codepoint == event->codepoint
+           && modifiers == event->modifiers;
+}
+
+static void test_keys(void) {
+    ConsoleEvent events[8];
+    CHECK(3 == decode("a\xc3\xa9\x01", events, 8));
+    CHECK(is_char(&events[0], 'a', 0));
+    CHECK(is_char(&events[1], 0xE9, 0));
+    CHECK(is_char(&events[2], 'a', CONSOLE_MOD_CTRL));
+
+    CHECK(3 == decode("\r\t\x7f", events, 8));
+    CHECK(is_key(&events[0], STREAM_EVENT_ENTER, 0));
+    CHECK(is_key(&events[1], STREAM_EVENT_TAB, 0));
+    CHECK(is_key(&events[2], STREAM_EVENT_BACKSPACE, 0));
+
+    CHECK(1 == decode("\x1b", events, 8)); // nothing after it: the Escape key
+    CHECK(is_key(&events[0], STREAM_EVENT_ESC, 0));
+
+    CHECK(1 == decode("\x1bx", events, 8));
+    CHECK(is_char(&events[0], 'x', CONSOLE_MOD_ALT));
+}
+
+static void test_csi(void) {
+    ConsoleEvent events[8];
+    CHECK(3 == decode("\x1b[A\x1b[1;5C\x1b[3~", events, 8));
+    CHECK(is_key(&events[0], STREAM_EVENT_UP, 0));
+    CHECK(is_key(&events[1], STREAM_EVENT_RIGHT, CONSOLE_MOD_CTRL));
+    CHECK(is_key(&events[2], STREAM_EVENT_DEL, 0));
+
+    // Alt+[ then Enter: the Enter is not taken as the end of the sequence
+    CHECK(1 == decode("\x1b[\r", events, 8));
+    CHECK(is_key(&events[0], STREAM_EVENT_ENTER, 0));
+}
+
+static void test_ss3(void) {
+    ConsoleEvent events[8];
+    CHECK(2 == decode("\x1bOA\x1bOP", events, 8));
+    CHECK(is_key(&events[0], STREAM_EVENT_UP, 0));
+    CHECK(is_key(&events[1], STREAM_EVENT_FUNCTION, 0) && 1 == events[1].codepoint);
+
+    // Alt+Shift+O alone is a key of its own, not the start of a sequence to wait for
+    CHECK(1 == decode("\x1bO", events, 8));
+    CHECK(is_char(&events[0], 'O', CONSOLE_MOD_ALT));
+
+    // and what follows it, when it is no SS3 final byte, is not lost
+    CHECK(3 == decode("\x1bOx\r", events, 8));
+    CHECK(is_char(&events[0], 'O', CONSOLE_MOD_ALT));
+    CHECK(is_char(&events[1], 'x', 0));
+    CHECK(is_key(&events[2], STREAM_EVENT_ENTER, 0));
+}
+
+int main(void) {
+    // the console reads a pipe standing in for the terminal
+    int descriptors[2];
+    if (0 != pipe(descriptors) || -1 == dup2(descriptors[0], STDIN_FILENO)) {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+    input   = descriptors[1];
+    console = console_create();
+    if (NULL == console) {
+        return EXIT_FAILURE;
+    }
+    if (NULL != console->terminal) {
+        console->terminal->c_cc[VINTR] = 0x03; // a pipe has no settings to start from
+    }
+
+    test_keys();
+    test_csi();
+    test_ss3();
+
+    console_destroy(console);
+    if (0 != failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
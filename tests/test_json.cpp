@@ -0,0 +1,186 @@
+/**
+ * @file test_json.cpp
+ *
+ * @brief Checks the streaming JSON stage: where a document completes or goes wrong, its
+ * indented layout, and that how the stream is cut into writes changes nothing.
+ *
+ */
+
+#include <console_json.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+// Last stage: collects what the JSON stage passes on
+static void collect(Console* console, ConsoleSink* sink, const char* data, size_t length) {
+    (void) console;
+    ((std::string*) sink->context)->append(data, length);
+}
+
+static void ignore_flush(Console* console, ConsoleSink* sink) {
+    (void) console;
+    (void) sink;
+}
+
+// Everything the stage writes for `input` given in writes of `step` bytes, or of random
+// sizes seeded by `seed` when `step` is 0, followed by a flush
+static std::string print(
+    const std::string &input, size_t indent, size_t step, unsigned seed,
+    ConsoleJsonStatus* status, size_t* offset
+) {
+    std::string  output;
+    ConsoleSink  terminal = {collect, ignore_flush, &output, NULL};
+    ConsoleJson* json     = console_create_json(indent);
+    ConsoleSink* sink     = console_json_sink(json);
+    sink->next            = &terminal;
+
+    srand(seed);
+    for (size_t i = 0; i < input.size();) {
+        size_t count = 0 != step ? step : 1 + (size_t) (rand() % 7);
+        count        = count < input.size() - i ? count : input.size() - i;
+        sink->write(NULL, sink, input.data() + i, count);
+        i += count;
+    }
+    sink->flush(NULL, sink);
+
+    *status = console_json_status(json, offset);
+    console_destroy_json(json);
+    return output;
+}
+
+// The text without its SGR sequences
+static std::string plain(const std::string &text) {
+    std::string result;
+    for (size_t i = 0; i < text.size(); i++) {
+        if ('\x1b' == text[i]) {
+            while (i < text.size() && 'm' != text[i]) {
+                i++;
+            }
+            continue;
+        }
+        result += text[i];
+    }
+    return result;
+}
+
+struct StatusCase {
+    const char*       input;
+    ConsoleJsonStatus status;
+    size_t            offset; // only for COMPLETE and INVALID
+};
+
+static void test_status(void) {
+    static const StatusCase cases[] = {
+        {"{\"a\": [1, 2.5e-3, -0, true, null], \"b\": {}}", CONSOLE_JSON_COMPLETE, 43},
+        {"42", CONSOLE_JSON_COMPLETE, 2}, // the flush ends the number
+        {"\"ok\"  trailing", CONSOLE_JSON_COMPLETE, 4},
+        {"{\"a\":1}}", CONSOLE_JSON_COMPLETE, 7},
+        {"[1, 2", CONSOLE_JSON_PENDING, 0},
+        {"tru", CONSOLE_JSON_PENDING, 0},
+        {"[1,]", CONSOLE_JSON_INVALID, 3},
+        {"{\"a\" 1}", CONSOLE_JSON_INVALID, 5},
+        {"\"ab\ncd\"", CONSOLE_JSON_INVALID, 3},
+        {"[01]", CONSOLE_JSON_INVALID, 2},
+        {"trux", CONSOLE_JSON_INVALID, 3},
+        {"1.e5", CONSOLE_JSON_INVALID, 2},
+        {"[1e+]", CONSOLE_JSON_INVALID, 4},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+        const StatusCase* test   = &cases[i];
+        ConsoleJsonStatus status = CONSOLE_JSON_PENDING;
+        size_t            offset = 0;
+        std::string       whole  = print(test->input, 2, strlen(test->input), 0, &status, &offset);
+        if (test->status != status
+            || (CONSOLE_JSON_PENDING != status && test->offset != offset)) {
+            fprintf(stderr, "debug: \"%s\": status %d at %zu\n", test->input, status, offset);
+            failures++;
+        }
+
+        for (unsigned seed = 0; seed < 50; seed++) {
+            ConsoleJsonStatus split_status = CONSOLE_JSON_PENDING;
+            size_t            split_offset = 0;
+            std::string split = print(test->input, 2, 0, seed, &split_status, &split_offset);
+            CHECK(whole == split && status == split_status && offset == split_offset);
+        }
+    }
+}
+
+static void test_layout(void) {
+    const char*       input  = "{ \"a\" :[1,\"x\"],\"b\":{},\"c\":{\"d\":[[]]}}";
+    ConsoleJsonStatus status = CONSOLE_JSON_PENDING;
+    size_t            offset = 0;
+
+    std::string indented = plain(print(input, 2, 1, 0, &status, &offset));
+    CHECK(CONSOLE_JSON_COMPLETE == status && strlen(input) == offset);
+    CHECK("{\n"
+          "  \"a\": [\n"
+          "    1,\n"
+          "    \"x\"\n"
+          "  ],\n"
+          "  \"b\": {},\n"
+          "  \"c\": {\n"
+          "    \"d\": [\n"
+          "      []\n"
+          "    ]\n"
+          "  }\n"
+          "}"
+          == indented);
+
+    std::string flat = plain(print(input, 0, 1, 0, &status, &offset));
+    CHECK("{\"a\": [1, \"x\"], \"b\": {}, \"c\": {\"d\": [[]]}}" == flat);
+}
+
+static void test_depth(void) {
+    ConsoleJsonStatus status = CONSOLE_JSON_PENDING;
+    size_t            offset = 0;
+
+    std::string deep(CONSOLE_JSON_DEPTH_MAX, '[');
+    print(deep, 0, 64, 0, &status, &offset);
+    CHECK(CONSOLE_JSON_PENDING == status);
+
+    deep += '[';
+    print(deep, 0, 64, 0, &status, &offset);
+    CHECK(CONSOLE_JSON_INVALID == status && CONSOLE_JSON_DEPTH_MAX == offset);
+}
+
+static void test_reset(void) {
+    std::string  output;
+    ConsoleSink  terminal = {collect, ignore_flush, &output, NULL};
+    ConsoleJson* json     = console_create_json(0);
+    ConsoleSink* sink     = console_json_sink(json);
+    sink->next            = &terminal;
+
+    size_t offset = 0;
+    sink->write(NULL, sink, "[1,]", 4);
+    CHECK(CONSOLE_JSON_INVALID == console_json_status(json, &offset));
+
+    console_reset_json(json);
+    CHECK(CONSOLE_JSON_PENDING == console_json_status(json, &offset));
+    sink->write(NULL, sink, "[true]", 6);
+    CHECK(CONSOLE_JSON_COMPLETE == console_json_status(json, &offset) && 6 == offset);
+    console_destroy_json(json);
+}
+
+int main(void) {
+    test_status();
+    test_layout();
+    test_depth();
+    test_reset();
+
+    if (0 != failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file test_markdown.cpp
+ *
+ * @brief Checks the streaming Markdown stage: the styles blocks and spans come out in, and
+ * that how the stream is cut into writes changes nothing.
+ *
+ */
+
+#include <console_markdown.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+// Last stage: collects what the Markdown stage passes on
+static void collect(Console* console, ConsoleSink* sink, const char* data, size_t length) {
+    (void) console;
+    ((std::string*) sink->context)->append(data, length);
+}
+
+static void ignore_flush(Console* console, ConsoleSink* sink) {
+    (void) console;
+    (void) sink;
+}
+
+// Everything the stage writes for `input` given in writes of `step` bytes, or of random
+// sizes seeded by `seed` when `step` is 0, followed by a flush
+static std::string render(const std::string &input, size_t step, unsigned seed) {
+    std::string      output;
+    ConsoleSink      terminal = {collect, ignore_flush, &output, NULL};
+    ConsoleMarkdown* markdown = console_create_markdown();
+    ConsoleSink*     sink     = console_markdown_sink(markdown);
+    sink->next                = &terminal;
+
+    srand(seed);
+    for (size_t i = 0; i < input.size();) {
+        size_t count = 0 != step ? step : 1 + (size_t) (rand() % 7);
+        count        = count < input.size() - i ? count : input.size() - i;
+        sink->write(NULL, sink, input.data() + i, count);
+        i += count;
+    }
+    sink->flush(NULL, sink);
+
+    console_destroy_markdown(markdown);
+    return output;
+}
+
+static bool renders(const char* input, const char* expected) {
+    std::string output = render(input, strlen(input), 0);
+    if (expected != output) {
+        fprintf(stderr, "debug: \"%s\" rendered as \"%s\"\n", input, output.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void test_styles(void) {
+    CHECK(renders("# Title\n", "\x1b[1;4mTitle\x1b[0m\n"));
+    CHECK(renders("a **b** *c* `d`\n",
+                  "a \x1b[1mb\x1b[0m \x1b[3mc\x1b[0m \x1b[36md\x1b[0m\n"));
+    CHECK(renders("2*3*4\n", "2\x1b[3m3\x1b[0m4\n"));
+    CHECK(renders("\\*x\\*\n", "*x*\n"));
+    CHECK(renders("- one\n", "\x1b[33m\xe2\x80\xa2 \x1b[0mone\n"));
+    CHECK(renders("```c\nint x; // y\n```\n",
+                  "\x1b[90m```c\x1b[0m\n"
+                  "\x1b[35mint\x1b[0m x; \x1b[90m// y\x1b[0m\n"
+                  "\x1b[90m```\x1b[0m\n"));
+    CHECK(renders("**open", "\x1b[1mopen\x1b[0m")); // the flush closes what is still open
+}
+
+// A document touching every construct, fed whole, byte by byte and in random pieces
+static void test_splits(void) {
+    static const char* const document
+        = "# Title here\n"
+          "Some **bold** and *italic* and `code` text, snake_case_name, 2*3*4, a * b.\n"
+          "## Sub *heading*\n"
+          "- item one with **bold\n"
+          "- item two `x**y`\n"
+          "  1. nested \\*literal\\* and __strong__\n"
+          "> quote with **b**\n"
+          "> > nested\n"
+          "---\n"
+          "```python\n"
+          "def f(x):  # comment\n"
+          "    return \"str\\\"ing\" + 42 if x else None\n"
+          "```\n"
+          "```c\n"
+          "/* block\n"
+          "   comment */ int main() { return 0; } // done\n"
+          "```\n"
+          "~~~\n"
+          "plain ``` inside\n"
+          "~~~\n"
+          "Trailing **bo";
+
+    std::string whole = render(document, strlen(document), 0);
+    CHECK(whole == render(document, 1, 0));
+    for (unsigned seed = 0; seed < 200; seed++) {
+        if (whole != render(document, 0, seed)) {
+            fprintf(stderr, "debug: split with seed %u renders differently\n", seed);
+            failures++;
+            break;
+        }
+    }
+}
+
+int main(void) {
+    test_styles();
+    test_splits();
+
+    if (0 != failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,214 @@
+/**
+ * @file test_search.cpp
+ *
+ * @brief Checks regex compilation and matching, and the page and text searches built on
+ * them: leftmost-longest semantics, anchors, UTF-8 classes and the DFA cache reset.
+ *
+ */
+
+#include <console_search.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+static ConsoleRegex* compile(const char* pattern, bool ignore_case) {
+    const char*   error = NULL;
+    ConsoleRegex* regex = console_compile_regex(pattern, strlen(pattern), ignore_case, &error);
+    if (NULL == regex) {
+        fprintf(stderr, "debug: compile: /%s/: %s\n", pattern, NULL != error ? error : "?");
+    }
+    return regex;
+}
+
+// Whether `pattern` matches `text` exactly at [start, end), or does not match when start is -1
+static bool matches(const char* pattern, const char* text, long start, long end) {
+    ConsoleRegex* regex = compile(pattern, false);
+    if (NULL == regex) {
+        return false;
+    }
+    size_t found_start = 0;
+    size_t found_end   = 0;
+    bool   found       = console_regex_match(regex, text, strlen(text), &found_start, &found_end);
+    console_destroy_regex(regex);
+
+    bool ok = -1 == start ? !found
+                          : found && (size_t) start == found_start && (size_t) end == found_end;
+    if (!ok) {
+        fprintf(stderr, "debug: /%s/ on \"%s\": %s [%zu, %zu)\n", pattern, text,
+                found ? "matched" : "no match", found_start, found_end);
+    }
+    return ok;
+}
+
+static bool rejects(const char* pattern) {
+    const char*   error = NULL;
+    ConsoleRegex* regex = console_compile_regex(pattern, strlen(pattern), false, &error);
+    console_destroy_regex(regex);
+    return NULL == regex && NULL != error;
+}
+
+static void test_leftmost_longest(void) {
+    CHECK(matches("a|ab", "xabc", 1, 3));
+    CHECK(matches("ab|a", "xabc", 1, 3));
+    CHECK(matches("(a|ab)(c|bcd)", "abcd", 0, 4));
+    CHECK(matches("a+", "baaab", 1, 4));
+    CHECK(matches("b|aaa", "aaab", 0, 3)); // leftmost wins over the shorter later match
+    CHECK(matches("x*", "abc", 0, 0));
+    CHECK(matches("[0-9]{2,3}", "a12345", 1, 4));
+    CHECK(matches("(ab)?c", "xabc", 1, 4));
+    CHECK(matches("\\d+\\s\\w+", "id 42 words", 3, 11));
+    CHECK(matches("a{2", "aa{2", 1, 4)); // not a bound, so literal
+    CHECK(matches("z", "abc", -1, -1));
+    CHECK(matches("b", "a\nb", -1, -1)); // only the first line is matched
+}
+
+static void test_anchors(void) {
+    CHECK(matches("^ab", "ab c", 0, 2));
+    CHECK(matches("^ab", "cab", -1, -1));
+    CHECK(matches("b$", "ab", 1, 2));
+    CHECK(matches("b$", "ba", -1, -1));
+    CHECK(matches("^$", "", 0, 0));
+    CHECK(matches("^a*$", "aaa", 0, 3));
+    CHECK(matches("^a*$", "aab", -1, -1));
+    CHECK(matches("a|^b", "cba", 2, 3));
+}
+
+static void test_utf8(void) {
+    CHECK(matches(".", "\xc3\xa9", 0, 2));
+    CHECK(matches("^.$", "\xc3\xa9", 0, 2));
+    CHECK(matches("^...$", "a\xe2\x82\xac\xf0\x9f\x99\x82", 0, 8));
+    CHECK(matches("[\xc3\xa9x]+", "a\xc3\xa9x\xc3\xa9", 1, 6));
+    CHECK(matches("[^a]", "a\xc3\xa9", 1, 3));
+    CHECK(matches("\\W", "a\xe2\x82\xac", 1, 4));
+    CHECK(matches("caf\xc3\xa9", "un caf\xc3\xa9", 3, 8));
+
+    ConsoleRegex* regex = compile("CAF\xc3\xa9", true);
+    size_t        start = 0;
+    size_t        end   = 0;
+    CHECK(NULL != regex && console_regex_match(regex, "Caf\xc3\xa9", 5, &start, &end));
+    CHECK(0 == start && 5 == end);
+    console_destroy_regex(regex);
+}
+
+static void test_errors(void) {
+    CHECK(rejects("("));
+    CHECK(rejects("a)"));
+    CHECK(rejects("[a"));
+    CHECK(rejects("[z-a]"));
+    CHECK(rejects("a{3,2}"));
+    CHECK(rejects("(a)\\1"));
+}
+
+// `[ab]*a[ab]{12}` needs one state per combination of the last 13 bytes, twice what the
+// cache holds, so random text keeps resetting it. The expected match is easy to find by
+// hand: from 0 to 13 past the last 'a' that still has 12 bytes after it.
+static void test_cache_reset(void) {
+    static const size_t LENGTH = 1 << 16;
+    std::string         text(LENGTH, 'b');
+    srand(1);
+    for (size_t i = 0; i < LENGTH; i++) {
+        text[i] = rand() % 2 ? 'a' : 'b';
+    }
+
+    long last = -1;
+    for (size_t i = 0; i + 13 <= LENGTH; i++) {
+        if ('a' == text[i]) {
+            last = (long) i;
+        }
+    }
+    CHECK(last >= 0);
+
+    ConsoleRegex* regex = compile("[ab]*a[ab]{12}", false);
+    size_t        start = 0;
+    size_t        end   = 0;
+    CHECK(NULL != regex && console_regex_match(regex, text.data(), text.size(), &start, &end));
+    CHECK(0 == start && (size_t) last + 13 == end);
+
+    // matched again with the states the first match left, the answer is the same
+    size_t again_start = 0;
+    size_t again_end   = 0;
+    CHECK(console_regex_match(regex, text.data(), text.size(), &again_start, &again_end));
+    CHECK(start == again_start && end == again_end);
+    console_destroy_regex(regex);
+}
+
+static void test_search_page(void) {
+    ConsolePage* page = console_create_page();
+    CHECK(NULL != page);
+    for (size_t i = 0; i < 3 * CONSOLE_SEARCH_LINES; i++) {
+        char line[32];
+        int  length = snprintf(line, sizeof(line), "line %zu%s", i, 0 == i % 1000 ? " mark" : "");
+        CHECK(console_page_append_line(page, line, (size_t) length));
+    }
+
+    ConsoleRegex* regex = compile("[0-9]+ mark$", false);
+    CHECK(NULL != regex);
+
+    ConsoleSearchMatch found[16];
+    size_t             count = console_search_page(regex, page, 1, found, 16);
+    CHECK(12 == count);
+    for (size_t i = 0; i < count; i++) {
+        CHECK(1000 * (i + 1) == found[i].line);
+        CHECK(5 == found[i].start);
+    }
+    CHECK(3 == console_search_page(regex, page, 0, found, 3)); // stops at `max`
+    CHECK(0 == found[0].line && 2000 == found[2].line);
+
+    console_destroy_regex(regex);
+    console_destroy_page(page);
+}
+
+// Enough text for several blocks, so the first match has to win over later ones found
+// in parallel
+static void test_search_text(void) {
+    std::string text;
+    while (text.size() < 3 * CONSOLE_SEARCH_BLOCK) {
+        text += "nothing to see here\n";
+    }
+    size_t first = text.size();
+    text        += "needle one\n";
+    while (text.size() < 4 * CONSOLE_SEARCH_BLOCK) {
+        text += "more hay\n";
+    }
+    size_t second = text.size();
+    text         += "needle two";
+
+    ConsoleRegex* regex = compile("^needle \\w+", false);
+    CHECK(NULL != regex);
+
+    ConsoleSearchMatch match;
+    CHECK(console_search_text(regex, text.data(), text.size(), 0, &match));
+    CHECK(first == match.line && 0 == match.start && 10 == match.end);
+    CHECK(console_search_text(regex, text.data(), text.size(), first + 1, &match));
+    CHECK(second == match.line);
+    CHECK(!console_search_text(regex, text.data(), text.size(), second + 1, &match));
+
+    console_destroy_regex(regex);
+}
+
+int main(void) {
+    test_leftmost_longest();
+    test_anchors();
+    test_utf8();
+    test_errors();
+    test_cache_reset();
+    test_search_page();
+    test_search_text();
+
+    if (0 != failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}